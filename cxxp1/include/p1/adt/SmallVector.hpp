@@ -0,0 +1,207 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_ADT_SMALLVECTOR_HPP
+#define P1_ADT_SMALLVECTOR_HPP
+
+#include "p1/util/compiler.h"
+#include <gc/gc_allocator.h>
+#include <boost/type_traits/aligned_storage.hpp>
+#include <boost/type_traits/alignment_of.hpp>
+#include <boost/static_assert.hpp>
+#include <cassert>
+#include <cstddef>
+#include <new>
+
+namespace p1 {
+
+/**
+ * A growable array which keeps up to N elements inside the object itself, so the common short
+ * sequences need no allocation of their own. Once it outgrows the inline space, the elements
+ * move to a block from Alloc, which doubles as needed.
+ *
+ * With the default allocator the elements may point to collected objects. An inline element is
+ * visible to the collector only if the vector itself is, e.g. as a member of a gc object.
+ */
+template <class T, unsigned N, class Alloc = gc_allocator<T> >
+class SmallVector
+{
+  BOOST_STATIC_ASSERT( N > 0 );
+public:
+  typedef T value_type;
+  typedef T * iterator;
+  typedef const T * const_iterator;
+  typedef T & reference;
+  typedef const T & const_reference;
+  typedef std::size_t size_type;
+
+  SmallVector ()
+  {
+    init();
+  }
+
+  SmallVector ( const SmallVector & v )
+  {
+    init();
+    append( v.begin(), v.end() );
+  }
+
+  template <class IT>
+  SmallVector ( IT first, IT last )
+  {
+    init();
+    append( first, last );
+  }
+
+  ~SmallVector ()
+  {
+    destroy( m_data, m_data + m_size );
+    release();
+  }
+
+  SmallVector & operator = ( const SmallVector & v )
+  {
+    if (this != &v)
+    {
+      clear();
+      append( v.begin(), v.end() );
+    }
+    return *this;
+  }
+
+  size_type size () const { return m_size; }
+  bool empty () const { return m_size == 0; }
+  size_type capacity () const { return m_capacity; }
+  /** Whether the elements are still in the inline space */
+  bool isSmall () const { return m_data == inlineData(); }
+
+  iterator begin () { return m_data; }
+  iterator end () { return m_data + m_size; }
+  const_iterator begin () const { return m_data; }
+  const_iterator end () const { return m_data + m_size; }
+
+  T & operator[] ( size_type i ) { assert( i < m_size ); return m_data[i]; }
+  const T & operator[] ( size_type i ) const { assert( i < m_size ); return m_data[i]; }
+
+  T & front () { assert( m_size ); return m_data[0]; }
+  T & back () { assert( m_size ); return m_data[m_size - 1]; }
+  const T & front () const { assert( m_size ); return m_data[0]; }
+  const T & back () const { assert( m_size ); return m_data[m_size - 1]; }
+
+  void push_back ( const T & x )
+  {
+    if (likely(m_size != m_capacity))
+    {
+      ::new (m_data + m_size) T( x );
+      ++m_size;
+    }
+    else
+      pushBackSlow( x );
+  }
+
+  SmallVector & operator += ( const T & x )
+  {
+    push_back( x );
+    return *this;
+  }
+
+  void pop_back ()
+  {
+    assert( m_size );
+    m_data[--m_size].~T();
+  }
+
+  /** Remove all elements, keeping the capacity */
+  void clear ()
+  {
+    destroy( m_data, m_data + m_size );
+    m_size = 0;
+  }
+
+  void reserve ( size_type n )
+  {
+    if (n > m_capacity)
+      grow( n );
+  }
+
+  template <class IT>
+  void append ( IT first, IT last )
+  {
+    for ( ; first != last; ++first )
+      push_back( *first );
+  }
+
+private:
+  T * m_data;
+  unsigned m_size, m_capacity;
+  typename boost::aligned_storage<sizeof(T) * N, boost::alignment_of<T>::value>::type m_inline;
+
+  T * inlineData () { return reinterpret_cast<T *>(&m_inline); }
+  const T * inlineData () const { return reinterpret_cast<const T *>(&m_inline); }
+
+  void init ()
+  {
+    m_data = inlineData();
+    m_size = 0;
+    m_capacity = N;
+  }
+
+  static void destroy ( T * from, T * to )
+  {
+    for ( ; from != to; ++from )
+      from->~T();
+  }
+
+  void release ()
+  {
+    if (!isSmall())
+      Alloc().deallocate( m_data, m_capacity );
+  }
+
+  void grow ( size_type minCapacity );
+  void pushBackSlow ( const T & x );
+};
+
+template <class T, unsigned N, class Alloc>
+void SmallVector<T,N,Alloc>::grow ( size_type minCapacity )
+{
+  size_type capacity = m_capacity * 2;
+  if (capacity < minCapacity)
+    capacity = minCapacity;
+
+  T * data = Alloc().allocate( capacity );
+  for ( unsigned i = 0; i != m_size; ++i )
+    ::new (data + i) T( m_data[i] );
+  destroy( m_data, m_data + m_size );
+  release();
+
+  m_data = data;
+  m_capacity = capacity;
+}
+
+template <class T, unsigned N, class Alloc>
+void SmallVector<T,N,Alloc>::pushBackSlow ( const T & x )
+{
+  // "x" may be one of our own elements
+  T copy( x );
+  grow( m_size + 1 );
+  ::new (m_data + m_size) T( copy );
+  ++m_size;
+}
+
+} // namespaces
+
+#endif /* P1_ADT_SMALLVECTOR_HPP */
@@ -21,7 +21,7 @@
 
 #include "p1/smalls/common/SourceCoords.hpp"
 #include "p1/util/gc-support.hpp"
-#include "p1/adt/CircularList.hpp"
+#include "p1/adt/SmallVector.hpp"
 
 namespace p1 {
 namespace smalls {
@@ -34,47 +34,68 @@ namespace smalls {
 class AstVariable;
 class AstFrame;
 
-class AstVariable : public p1::ListEntry, public gc
+class AstVariable : public gc
 {
 public:
   const gc_char * const name;
   AstFrame * const frame;
+  /** The position of the variable in its frame */
+  unsigned const index;
+  /**
+   * Dense within the module, including the system frame; see {@link AstFrame}. Passes keep
+   * their per-variable data in a {@link VarTable} indexed by it.
+   */
+  unsigned const id;
   SourceCoords defCoords;
-  void * data;
-
-  AstVariable ( const gc_char * name_, AstFrame * frame_, const SourceCoords & defCoords_ )
-    : name(name_), frame(frame_), defCoords(defCoords_)
-  {
-    ListEntry::debugClear();
-    this->data = NULL;
-  }
+  /** Defined by an identifier introduced by a macro, so other variables of the frame may have its name */
+  bool introduced;
+
+  AstVariable ( const gc_char * name_, AstFrame * frame_, unsigned index_, unsigned id_,
+                const SourceCoords & defCoords_ )
+    : name(name_), frame(frame_), index(index_), id(id_), defCoords(defCoords_), introduced(false)
+  {}
 };
 
 std::ostream & operator << ( std::ostream & os, const AstVariable & var );
 
+/**
+ * The variables of a scope.
+ *
+ * A frame without a parent (the system frame) and each of its children (the top-level frame of a
+ * module) start a space of variable ids, which the frames nested in them share. A module's ids
+ * continue after those of the system frame, so the variables of both can share a table.
+ */
 class AstFrame : public gc
 {
 public:
   AstFrame * const parent;
   int const level;
 
-  AstFrame ( AstFrame * parent_ )
-    : parent( parent_ ), level( parent_?parent_->level + 1 : -1)
-  {
-    m_varCount = 0;
-  }
+  AstFrame ( AstFrame * parent_ );
 
   AstVariable * newVariable ( const gc_char * name, const SourceCoords & defCoords );
   AstVariable * newAnonymous ( const gc_char * infoPrefix, const SourceCoords & defCoords );
 
-  unsigned length () const { return m_varCount; };
+  unsigned length () const { return m_vars.size(); };
+
+  /** The variables in order of creation, i.e. by {@link AstVariable#index} */
+  typedef p1::SmallVector<AstVariable *, 4> VariableList;
+  const VariableList & vars () const { return m_vars; }
+  AstVariable * var ( unsigned index ) const { return m_vars[index]; }
 
-  typedef p1::CircularList<AstVariable> VariableList;
-  VariableList & vars () { return m_vars; }
+  /** One past the largest variable id allocated so far in the id space of the frame */
+  unsigned idLimit () const { return m_idFrame->m_nextId; }
 
 private:
   VariableList m_vars;
-  unsigned m_varCount;
+  /** The frame which allocates the ids */
+  AstFrame * const m_idFrame;
+  /** Only in m_idFrame */
+  unsigned m_nextId;
+  /** Only in a root: whether modules have continued its id space */
+  bool m_idsShared;
+
+  unsigned newId ();
 };
 
 }} // namespaces
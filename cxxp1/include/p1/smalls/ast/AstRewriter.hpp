@@ -0,0 +1,80 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_AST_ASTREWRITER_HPP
+#define	P1_SMALLS_AST_ASTREWRITER_HPP
+
+#include "SchemeAST.hpp"
+
+namespace p1 {
+namespace smalls {
+
+/**
+ * Walks an AST depth first, replacing every expression with the result of its visit method.
+ *
+ * The default visit methods rewrite the children of a node in place and return the node itself,
+ * so a rewriter only overrides the kinds it is interested in, calling the base method when it
+ * wants to descend. Replacing a node costs a single store into its parent; nothing is copied.
+ *
+ * Bodies are rewritten in place but never replaced, since closures and lets refer to them
+ * directly.
+ */
+class AstRewriter
+{
+public:
+  /**
+   * @param enterClosures descend into the bodies of closures. A rewriter which handles one
+   *   function at a time sees the closures nested in it, but not their contents
+   */
+  explicit AstRewriter ( bool enterClosures = true )
+    : m_enterClosures( enterClosures ), m_visited( 0 ), m_replaced( 0 )
+  {}
+  virtual ~AstRewriter () {}
+
+  /** @return the replacement of ast, or ast itself. NULL is returned unchanged */
+  Ast * rewrite ( Ast * ast );
+  void rewriteBody ( AstBody * body );
+
+  /** The number of nodes visited so far */
+  unsigned visited () const { return m_visited; }
+  /** The number of nodes replaced so far */
+  unsigned replaced () const { return m_replaced; }
+
+protected:
+  bool const m_enterClosures;
+
+  virtual Ast * visitUnspecified ( AstUnspecified * ast );
+  virtual Ast * visitVar ( AstVar * ast );
+  virtual Ast * visitDatum ( AstDatum * ast );
+  virtual Ast * visitSet ( AstSet * ast );
+  virtual Ast * visitApply ( AstApply * ast );
+  virtual Ast * visitIf ( AstIf * ast );
+  virtual Ast * visitBegin ( AstBegin * ast );
+  virtual void visitBody ( AstBody * body );
+  virtual Ast * visitClosure ( AstClosure * ast );
+  /** Also called for AstFix */
+  virtual Ast * visitLet ( AstLet * ast );
+
+  void rewriteList ( ListOfAst & lst );
+
+private:
+  unsigned m_visited;
+  unsigned m_replaced;
+};
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_AST_ASTREWRITER_HPP */
@@ -0,0 +1,63 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_AST_FREEVARIABLES_HPP
+#define	P1_SMALLS_AST_FREEVARIABLES_HPP
+
+#include "SchemeAST.hpp"
+#include "VarTable.hpp"
+
+namespace p1 {
+namespace smalls {
+
+/** What analyseClosures() found out about a variable */
+struct VarFlags
+{
+  enum Enum
+  {
+    CAPTURED = 1, //< free in a closure
+    ASSIGNED = 2, //< the target of a set!
+    EARLY = 4,    //< may be captured before its definition has been evaluated
+    PENDING = 8   //< used during the analysis
+  };
+
+  /**
+   * A captured variable must be shared by its function and the closures, rather than copied,
+   * if it may change after it has been captured
+   */
+  static bool boxed ( unsigned char flags )
+  {
+    return (flags & EARLY) || (flags & (CAPTURED | ASSIGNED)) == (CAPTURED | ASSIGNED);
+  }
+};
+
+typedef VarTable<unsigned char> VarFlagTable;
+
+/**
+ * Free-variable analysis for closure conversion. Sets AstClosure::freeVars of every closure in
+ * a top-level body (a module body or a stream form) and the flags of the variables which are
+ * captured or assigned.
+ *
+ * The variables of the system frame and of the top-level frame are global, so they are never
+ * free. A definition whose value is a closure is available to the closures defined next to it
+ * (a group of consecutive such definitions is created before any of them captures anything), so
+ * recursive and mutually recursive local functions don't need to be boxed.
+ */
+void analyseClosures ( AstBody * root, VarFlagTable & flags );
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_AST_FREEVARIABLES_HPP */
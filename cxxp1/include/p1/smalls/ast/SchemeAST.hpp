@@ -21,10 +21,11 @@
 
 #include "AstFrame.hpp"
 #include "p1/smalls/common/SourceCoords.hpp"
-#include "p1/adt/LinkedList.hpp"
+#include "p1/adt/SmallVector.hpp"
 #include "p1/util/casting.hpp"
+#include <boost/range/iterator_range.hpp>
 #include <vector>
-#include <list>
+#include <algorithm>
 
 namespace p1 {
 namespace smalls {
@@ -63,6 +64,10 @@ private:
   static const char * s_names[];
 };
 
+/**
+ * The child expressions of a node may be replaced in place by the passes of the middle end (see
+ * AstRewriter). The kind, the variables and the frames of a node never change.
+ */
 class Ast : public gc
 {
 public:
@@ -70,24 +75,33 @@ public:
   SourceCoords const coords;
 
   Ast ( AstKind::Enum kind_, const SourceCoords & coords_ ) : kind(kind_), coords(coords_)
-  {
-    this->m_prev = this->m_next = NULL;
-  };
+  {}
 
   static bool classof ( const Ast * ) { return true; }
 
   virtual void toStream ( std::ostream & os ) const;
 
-  struct LinkAccessor
+  using gc::operator new;
+  using gc::operator delete;
+
+protected:
+  /** Allocate a node followed by "extra" bytes, for an array stored inline after it */
+  static void * operator new ( size_t size, GCPlacement gcp, size_t extra )
   {
-    static Ast * & prev ( Ast * item ) { return item->m_prev; }
-    static Ast * & next ( Ast * item ) { return item->m_next; }
-    static Ast * prev ( const Ast * item ) { return item->m_prev; }
-    static Ast * next ( const Ast * item ) { return item->m_next; }
-  };
+    return gc::operator new( size + extra, gcp );
+  }
+  /** Called only if the constructor throws */
+  static void operator delete ( void * p, GCPlacement, size_t )
+  {
+    gc::operator delete( p );
+  }
 
-private:
-  Ast * m_prev, * m_next;
+  /** The inline array after a node of type T, allocated with the operator above */
+  template <class E, class T>
+  static E * trailing ( const T * node )
+  {
+    return reinterpret_cast<E *>(const_cast<T *>(node) + 1);
+  }
 };
 
 inline std::ostream & operator << ( std::ostream & os, const Ast & ast )
@@ -96,7 +110,8 @@ inline std::ostream & operator << ( std::ostream & os, const Ast & ast )
   return os;
 }
 
-typedef p1::LinkedList<Ast,Ast::LinkAccessor> ListOfAst;
+/** Most bodies consist of one or two expressions */
+typedef p1::SmallVector<Ast *, 2> ListOfAst;
 
 std::ostream & printListOfAst ( std::ostream & os, const ListOfAst & lst, const char * tag );
 std::ostream & operator<< ( std::ostream & os, const ListOfAst & lst );
@@ -148,7 +163,7 @@ class AstSet : public Ast
 {
 public:
   AstVariable * const target;
-  Ast * const rvalue;
+  Ast * rvalue;
 
   AstSet ( const SourceCoords & coords_, AstVariable * target_, Ast * rvalue_ )
     : Ast( AstKind::SET, coords_ ), target(target_), rvalue(rvalue_)
@@ -160,30 +175,53 @@ public:
   virtual void toStream ( std::ostream & os ) const;
 };
 
+/**
+ * A call. The parameters are stored inline, after the node.
+ */
 class AstApply : public Ast
 {
 public:
-  Ast * const target;
-  VectorOfAst * const params;
-  Ast * const listParam;
+  Ast * target;
+  Ast * listParam;
+  unsigned const paramCount;
+  /** In tail position in the body of its closure; see markTailCalls() */
+  bool tail;
+
+  static AstApply * create ( const SourceCoords & coords_, Ast * target_,
+                             Ast * const * params_, unsigned paramCount_, Ast * listParam_ )
+  {
+    return new (GC, paramCount_ * sizeof(Ast *))
+      AstApply( coords_, target_, params_, paramCount_, listParam_ );
+  }
 
-  AstApply ( const SourceCoords & coords_,
-             Ast * target_, VectorOfAst * params_, Ast * listParam_ )
-    : Ast( AstKind::APPLY, coords_ ), target(target_), params(params_), listParam(listParam_)
-  {}
+  typedef boost::iterator_range<Ast **> ParamRange;
+  ParamRange params () const
+  {
+    Ast ** first = trailing<Ast *>( this );
+    return ParamRange( first, first + paramCount );
+  }
 
   static bool classof ( const AstApply * ) { return true; }
   static bool classof ( const Ast * t ) { return t->kind == AstKind::APPLY; }
 
   virtual void toStream ( std::ostream & os ) const;
+
+private:
+  AstApply ( const SourceCoords & coords_, Ast * target_,
+             Ast * const * params_, unsigned paramCount_, Ast * listParam_ )
+    : Ast( AstKind::APPLY, coords_ ), target(target_), listParam(listParam_),
+      paramCount(paramCount_), tail(false)
+  {
+    std::copy( params_, params_ + paramCount_, trailing<Ast *>( this ) );
+  }
 };
 
 class AstIf : public Ast
 {
 public:
-  Ast * const cond;
-  Ast * const thenAst;
-  Ast * const elseAst;
+  Ast * cond;
+  Ast * thenAst;
+  Ast * elseAst;
 
   AstIf ( const SourceCoords & coords_,
           Ast * cond_, Ast * thenAst_, Ast * elseAst_ )
@@ -223,7 +261,7 @@ class AstBody : public AstBegin
 {
 public:
   typedef std::pair<AstVariable *, Ast *> Definition;
-  typedef std::list<Definition,gc_allocator<Definition> > DefinitionList;
+  typedef p1::SmallVector<Definition, 1> DefinitionList;
 
   AstBody ( const SourceCoords & coords_, AstFrame * frame )
     : AstBegin( AstKind::BODY, coords_ ), m_frame(frame)
@@ -246,32 +284,75 @@ private:
 
 typedef std::vector<AstVariable *, gc_allocator<AstVariable *> > VectorOfVariable;
 
+/**
+ * A lambda. The parameters are stored inline, after the node.
+ */
 class AstClosure : public Ast
 {
 public:
   AstFrame * const paramFrame;
-  VectorOfVariable * const params;
   AstVariable * const listParam;
   AstBody * const body;
+  unsigned const paramCount;
+  /**
+   * The variables of the enclosing functions which the closure refers to, directly or through
+   * the closures nested in it, in order of the first reference. Set by analyseClosures()
+   */
+  VectorOfVariable * freeVars;
+
+  static AstClosure * create (
+    const SourceCoords & coords_,
+    AstFrame * paramFrame_,
+    AstVariable * const * params_,
+    unsigned paramCount_,
+    AstVariable * listParam_,
+    AstBody * body_
+  )
+  {
+    return new (GC, paramCount_ * sizeof(AstVariable *))
+      AstClosure( coords_, paramFrame_, params_, paramCount_, listParam_, body_ );
+  }
+
+  typedef boost::iterator_range<AstVariable **> ParamRange;
+  ParamRange params () const
+  {
+    AstVariable ** first = trailing<AstVariable *>( this );
+    return ParamRange( first, first + paramCount );
+  }
+
+  static bool classof ( const AstClosure * ) { return true; }
+  static bool classof ( const Ast * t ) { return t->kind == AstKind::CLOSURE; }
+
+  virtual void toStream ( std::ostream & os ) const;
 
+private:
   AstClosure (
     const SourceCoords & coords_,
     AstFrame * paramFrame_,
-    VectorOfVariable * params_,
+    AstVariable * const * params_,
+    unsigned paramCount_,
     AstVariable * listParam_,
     AstBody * body_
   ) : Ast( AstKind::CLOSURE, coords_ ),
       paramFrame( paramFrame_ ),
-      params( params_ ),
       listParam( listParam_ ),
-      body( body_ )
-  {}
+      body( body_ ),
+      paramCount( paramCount_ ),
+      freeVars( NULL )
+  {
+    std::copy( params_, params_ + paramCount_, trailing<AstVariable *>( this ) );
+  }
+};
 
-  static bool classof ( const AstClosure * ) { return true; }
-  static bool classof ( const Ast * t ) { return t->kind == AstKind::CLOSURE; }
+typedef p1::SmallVector<AstApply *, 4> ListOfApply;
 
-  virtual void toStream ( std::ostream & os ) const;
-};
+/**
+ * Set AstApply::tail of every call in the body of a closure, without entering the closures nested
+ * in it. The top-level body of a module has no tail calls, since nothing returns to the caller of
+ * the module.
+ * @param calls if not NULL, the calls in tail position are appended to it
+ */
+void markTailCalls ( AstBody * body, ListOfApply * calls = NULL );
 
 class AstLet : public Ast
 {
@@ -0,0 +1,70 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_AST_VARTABLE_HPP
+#define	P1_SMALLS_AST_VARTABLE_HPP
+
+#include "AstFrame.hpp"
+#include "p1/util/compiler.h"
+#include <vector>
+
+namespace p1 {
+namespace smalls {
+
+/**
+ * Per-variable data of type T, stored densely by {@link AstVariable#id}, for the variables of a
+ * single module. A variable which hasn't been set reads as the default value.
+ *
+ * Concurrent get() calls are safe while nothing modifies the table.
+ */
+template <class T, class Alloc = gc_allocator<T> >
+class VarTable
+{
+public:
+  explicit VarTable ( const T & def = T() ) : m_default( def ) {}
+
+  /** Make room for all variables allocated so far in the id space of a frame */
+  void reserve ( const AstFrame * frame )
+  {
+    if (frame->idLimit() > m_data.size())
+      m_data.resize( frame->idLimit(), m_default );
+  }
+
+  /** The value for a variable, which may be modified. Grows the table as needed */
+  T & operator[] ( const AstVariable * var )
+  {
+    if (unlikely(var->id >= m_data.size()))
+      m_data.resize( var->id + 1, m_default );
+    return m_data[var->id];
+  }
+
+  /** The value for a variable, or the default if it has not been set */
+  const T & get ( const AstVariable * var ) const
+  {
+    return var->id < m_data.size() ? m_data[var->id] : m_default;
+  }
+
+  /** Reset all variables to the default */
+  void clear () { m_data.clear(); }
+
+private:
+  std::vector<T, Alloc> m_data;
+  T const m_default;
+};
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_AST_VARTABLE_HPP */
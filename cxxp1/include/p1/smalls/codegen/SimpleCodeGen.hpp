@@ -18,15 +18,35 @@
 #define	PS_SMALLS_CODEGEN_SIMPLECODEGEN_HPP
 
 #include "p1/util/gc-support.hpp"
-#include "p1/util/format-str.hpp"
+#include "p1/util/CodeBuffer.hpp"
+#include "p1/util/FastOutput.hpp"
 #include "p1/smalls/ast/SchemeAST.hpp"
+#include "p1/smalls/ast/VarTable.hpp"
+#include "p1/smalls/ast/FreeVariables.hpp"
+#include <boost/unordered_map.hpp>
+#include <pthread.h>
 #include <iostream>
-#include <sstream>
-#include <list>
+#include <vector>
+#include <deque>
+
+namespace p1 {
+  class ThreadPool;
+}
 
 namespace p1 {
 namespace smalls {
 
+/**
+ * Closures are flat: each carries copies of the variables of the enclosing functions which it
+ * uses, after its closure_t, so every variable is a single load away. Only a captured variable
+ * which may change after it has been captured is kept in a box shared by the copies. The
+ * variables of the system frame and of the top-level frame are global; all others are C locals,
+ * so a function allocates nothing for its frames apart from the boxes.
+ *
+ * Each generated function is written out as soon as it is complete. Its text and the names of its
+ * temporaries are kept in an arena of its own, which is released right after that, so the memory
+ * used doesn't grow with the size of the module.
+ */
 class SimpleCodeGen : public gc
 {
 public:
@@ -34,43 +54,107 @@ public:
 
   void setLineInfo ( bool on ) { m_optLineInfo = on; }
 
+  /**
+   * Generate the bodies of the closures on the workers of a pool, or on the calling thread if
+   * NULL (the default). The output is the same either way. The pool must not be the one running
+   * the caller, since it is waited on.
+   */
+  void setThreadPool ( ThreadPool * pool ) { m_pool = pool; }
+
+  /**
+   * The output can be any FastOutput; the std::ostream overloads buffer it through an
+   * OStreamOutput. A FastOutput which gathers references to the generated text, rather than
+   * copying it, is flushed at the end of each module or stream form.
+   */
+  void generate ( FastOutput & os, AstModule * module );
   void generate ( std::ostream & os, AstModule * module );
 
+  /**
+   * Generate a module returned by SchemeParser::beginStream(), one top-level form at a time.
+   * The code of each form is written out as soon as it's generated. The top-level frame is
+   * global, because its size isn't known until the end.
+   */
+  void beginStream ( FastOutput & os, AstModule * module );
+  void genStreamForm ( FastOutput & os, AstBody * form );
+  void endStream ( FastOutput & os );
+  void beginStream ( std::ostream & os, AstModule * module );
+  void genStreamForm ( std::ostream & os, AstBody * form );
+  void endStream ( std::ostream & os );
+
+  /**
+   * Generate a form so its code can be reused by a later stream of the same module: the names
+   * of its functions are derived from id, which must be unique in the stream, instead of from
+   * the order of generation. Top-level variables always get the same address by name (and id, if
+   * introduced by a macro), as long as the same SimpleCodeGen is used.
+   */
+  void genStreamForm ( FastOutput & os, AstBody * form, unsigned id );
+  void genStreamForm ( std::ostream & os, AstBody * form, unsigned id );
+  /**
+   * Emit the code of an unchanged form, generated by genStreamForm( os, form, id ) for an earlier
+   * stream. The top-level variables the form defines must have been created already.
+   */
+  void reuseStreamForm ( FastOutput & os, const gc_string & code, unsigned id );
+  void reuseStreamForm ( std::ostream & os, const gc_string & code, unsigned id );
+
+  /**
+   * For a generator running behind the parser on another thread, while variables are still
+   * being added to the top-level frame, whose storage may move as it grows: "added" are the
+   * variables created since the previous form, as copied by the parser's thread (NULL if there
+   * were none). The frame itself isn't touched until endStream(). Must be set before each form;
+   * endStream() may only be called after the parser is done.
+   */
+  void setStreamVarsAdded ( const VectorOfVariable * added )
+  {
+    m_streamVarsAdded = added;
+    m_streamVarsBounded = true;
+  }
+
 private:
   unsigned m_tmpIndex;
   bool m_optLineInfo;
 
-  typedef std::list<const gc_char *,gc_allocator<const gc_char *> > LineList;
-
   class Func : public gc
   {
   public:
     SourceCoords const coords;
-    const gc_char * const name;
-    const gc_char * const decl;
-    gc_string locals;
-    gc_string contents;
-
-    Func ( const SourceCoords & coords_, const gc_char * name_ )
-      : coords(coords_), name(name_),
-        decl( formatGCStr("static reg_t %s ( void )", name_) )
+    const char * const name; //< in SimpleCodeGen::m_names
+    /** Holds everything below; released once the function has been written out */
+    Arena arena;
+    CodeBuffer locals;
+    CodeBuffer contents;
+    bool done; //< complete, waiting to be written out. Protected by m_flushLock
+    /**
+     * The variable defined to the closure of the function, if the function calls itself through
+     * it in tail position. Such calls jump back to the entry of the function.
+     */
+    const AstVariable * selfVar;
+    /** The variables copied into the environment of the closure, if any */
+    const VectorOfVariable * freeVars;
+    /** The environment, copied from g_param0 on entry */
+    const char * envtmp;
+    /** The number of variables kept in C locals */
+    unsigned localCount;
+    /**
+     * The variables at this frame level and deeper are locals; the ones between it and the
+     * top-level frame are in the environment
+     */
+    int baseLevel;
+
+    Func ( const SourceCoords & coords_, const char * name_ )
+      : coords(coords_), name(name_), arena( 4096 ), locals( arena ), contents( arena ), done( false ),
+        selfVar( NULL ), freeVars( NULL ), envtmp( NULL ), localCount( 0 ), baseLevel( 1 )
     {
       m_tmpIndex = 0;
     }
 
-    const gc_char * nextTmp ( const char * type, const char * prefix )
+    const char * nextTmp ( const char * type, const char * prefix )
     {
-      const gc_char * name = formatGCStr( "%s%u", prefix, m_tmpIndex++ );
+      const char * name = concatDecimal( arena, prefix, m_tmpIndex++ );
       if (type)
-        locals += formatGCStr( "  %s %s;\n", type, name );
+        locals << "  " << type << ' ' << name << ";\n";
       return name;
     }
 
-    void setContents ( const std::string & s )
-    {
-      this->contents.replace( this->contents.begin(), this->contents.end(), s.begin(), s.end() );
-    }
-
   private:
     unsigned m_tmpIndex;
   };
@@ -80,51 +164,192 @@ private:
   public:
     Context * const parent;
     Func * const func;
-    const gc_char * const frametmp;
+    const char * const frametmp; //< in the arena of func; NULL if the variables are C locals
     AstFrame * const frame;
 
-    Context ( Context * parent_, Func * func_, const gc_char * frametmp_, AstFrame * frame_)
+    Context ( Context * parent_, Func * func_, const char * frametmp_, AstFrame * frame_)
       : parent(parent_), func(func_), frametmp(frametmp_), frame(frame_)
     {}
   };
 
-  typedef std::list<Func, gc_allocator<Func> > FuncList;
+  /** The functions of the current unit (a module or a stream form), in output order */
+  typedef std::vector<Func *, gc_allocator<Func *> > FuncList;
   FuncList m_funcs;
+  /** The names of the functions of the current unit */
+  Arena m_names;
+  FastOutput * m_out;
+  /**
+   * Functions written out by reference, waiting for the output to flush, each with the
+   * flushCount() of the output after it was written
+   */
+  typedef std::deque<std::pair<Func *, unsigned long>,
+                     gc_allocator<std::pair<Func *, unsigned long> > > WrittenList;
+  WrittenList m_written;
+  /** The next function to write out */
+  unsigned m_flushNext;
+  pthread_mutex_t m_flushLock;
+
+  /**
+   * A closure whose function and contexts have been created, in source order, but whose body
+   * hasn't been generated yet. The bodies don't depend on each other, so they can be generated
+   * in any order, or in parallel.
+   */
+  struct ClosureJob : public gc
+  {
+    AstClosure * const cl;
+    Func * const func;
+    Context * paramCtx;
+    Context * bodyCtx;
+
+    ClosureJob ( AstClosure * cl_, Func * func_ )
+      : cl(cl_), func(func_), paramCtx(NULL), bodyCtx(NULL)
+    {}
+  };
+  class JobTask;
 
-  const gc_char * nextTmp ( const char * prefix )
+  typedef std::vector<ClosureJob *, gc_allocator<ClosureJob *> > JobList;
+  typedef boost::unordered_map<AstClosure *,
+                               ClosureJob *,
+                               boost::hash<AstClosure *>,
+                               std::equal_to<AstClosure *>,
+                               gc_allocator<std::pair<AstClosure * const, ClosureJob *> > > JobMap;
+  JobList m_jobs;
+  JobMap m_jobMap;
+
+  ThreadPool * m_pool;
+  /** The next job to be claimed by a JobTask */
+  volatile unsigned m_nextJob;
+  /** Set by the first failing JobTask */
+  int m_jobFailed;
+  std::string m_jobFailure;
+
+  Context * m_sysCtx; //< used while streaming
+  AstFrame * m_streamFrame;
+  unsigned m_streamVarsDone; //< the number of variables in m_streamFrame with an address
+  const VectorOfVariable * m_streamVarsAdded; //< see setStreamVarsAdded()
+  bool m_streamVarsBounded;
+  std::vector<unsigned, gc_allocator<unsigned> > m_streamIds; //< of the toplevel_N functions, in order
+  const char * m_funcPrefix;
+
+  /** The addresses of top-level variables by name, kept across streams */
+  typedef boost::unordered_map<gc_string,
+                               unsigned,
+                               boost::hash<gc_string>,
+                               std::equal_to<gc_string>,
+                               gc_allocator<std::pair<const gc_string, unsigned> > > TopAddrMap;
+  TopAddrMap m_topAddrs;
+  /**
+   * The addresses of the variables introduced by macros, which may share a name with other
+   * top-level variables, by name and form id, in order of definition
+   */
+  struct FormAddrs
+  {
+    std::vector<unsigned, gc_allocator<unsigned> > addrs;
+    unsigned stream; //< the last stream which used them
+    unsigned used;   //< the number of addrs used in that stream
+  };
+  typedef std::pair<gc_string, unsigned> FormAddrKey;
+  typedef boost::unordered_map<FormAddrKey,
+                               FormAddrs,
+                               boost::hash<FormAddrKey>,
+                               std::equal_to<FormAddrKey>,
+                               gc_allocator<std::pair<const FormAddrKey, FormAddrs> > > FormAddrMap;
+  FormAddrMap m_formAddrs;
+  unsigned m_topCount; //< addresses used in the top-level frame, except 0
+  unsigned m_streamCount;
+
+  const char * nextTmp ( const char * prefix )
   {
-    return formatGCStr( "%s%u", prefix, m_tmpIndex++ );
+    return concatDecimal( m_names, prefix, m_tmpIndex++ );
   }
 
-  Func * newFunc ( const SourceCoords & coords, const gc_char * name = 0 )
+  Func * newFunc ( const SourceCoords & coords, const char * name = 0 )
   {
-    m_funcs.push_back( Func( coords, !name?nextTmp("func_"):name) );
-    return &m_funcs.back();
+    Func * f = new Func( coords, !name?nextTmp(m_funcPrefix):name );
+    m_funcs.push_back( f );
+    return f;
   }
 
-  void genTopLevel ( std::ostream & os, AstModule * module );
-  Context * genSystem ( std::ostream & os, AstModule * module );
+  void genPrologue ( FastOutput & os );
+  void assignStreamAddresses ( unsigned id );
+  void assignStreamAddress ( AstVariable * var, unsigned id );
+  void genStreamFunc ( FastOutput & os, AstBody * form, unsigned id );
+  void beginFuncs ( FastOutput & os );
+  void funcDone ( Func * f );
+  void writeFunc ( FastOutput & os, Func * f );
+  void releaseWritten ( unsigned long flushCount );
+  void endFuncs ();
+  void genTopLevel ( FastOutput & os, AstModule * module );
+  Context * genSystem ( FastOutput & os, AstModule * module );
+
+  Context * newFrameContext ( Context * parentCtx, Func * func, AstFrame * frame );
+  void prepare ( Context * ctx, Ast * ast, const AstVariable * defVar = NULL );
+  void prepareBody ( Context * ctx, AstBody * body );
+  void genClosureBodies ();
+  void genClosureBody ( ClosureJob * job );
+  void jobFailed ( const char * what );
+
+  const char * genBody ( CodeBuffer & os, Context * ctx, AstBody * body );
+  const char * genBodyContents ( CodeBuffer & os, Context * ctx, AstBody * body );
+  const char * gen ( CodeBuffer & os, Context * ctx, Ast * ast );
+  const char * genDatum ( CodeBuffer & os, Context * ctx, AstDatum * ast );
+  const char * genClosure ( CodeBuffer & os, Context * ctx, AstClosure * cl );
+  void genFrameBoxes ( CodeBuffer & os, Context * ctx, AstFrame * frame );
+  const char * genClosureAlloc ( CodeBuffer & os, Context * ctx, AstClosure * cl );
+  void genClosureGroup ( CodeBuffer & os, Context * ctx, unsigned count,
+                         AstVariable * const * vars, Ast * const * values );
+  void genClosureEnv ( CodeBuffer & os, Context * ctx, AstClosure * cl, const char * cltmp );
+  const char * genLet ( CodeBuffer & os, Context * ctx, AstLet * let );
+  const char * genSet ( CodeBuffer & os, Context * ctx, AstSet * set );
+  const char * genApply ( CodeBuffer & os, Context * ctx, AstApply * ap );
+  const char * genIf ( CodeBuffer & os, Context * ctx, AstIf * ia );
 
-  const gc_char * genBody ( std::ostream & os, Context * parentCtx, Func * func, AstBody * body );
-  const gc_char * gen ( std::ostream & os, Context * ctx, Ast * ast );
-  const gc_char * genDatum ( std::ostream & os, Context * ctx, AstDatum * ast );
-  const gc_char * genClosure ( std::ostream & os, Context * ctx, AstClosure * cl );
-  const gc_char * genApply ( std::ostream & os, Context * ctx, AstApply * ap );
-  const gc_char * genIf ( std::ostream & os, Context * ctx, AstIf * ia );
+  static const unsigned NO_ADDR = ~0u;
+  /**
+   * The address of each variable in its frame. Only grows in the single-threaded parts, so the
+   * closures generated in parallel can read it.
+   */
+  VarTable<unsigned> m_addrs;
 
-  struct VarData : public gc
+  unsigned varAddr ( const AstVariable * var ) const
   {
-    unsigned addr;
-    VarData ( unsigned addr_ ) : addr(addr_) {};
-  };
+    unsigned addr = m_addrs.get( var );
+    assert( addr != NO_ADDR && "Variable without an address" );
+    return addr;
+  }
 
-  static VarData * varData ( AstVariable * var )
+  /** Set by analyseClosures() for each top-level body, before its closures are prepared */
+  VarFlagTable m_varFlags;
+
+  bool isBoxed ( const AstVariable * var ) const
   {
-    return static_cast<VarData*>(var->data);
+    return VarFlags::boxed( m_varFlags.get( var ) );
   }
 
-  std::string coords ( const SourceCoords & coords );
-  std::string coords ( Ast * ast )
+  /**
+   * The closure which each variable always holds, if known. Set while preparing, so the
+   * closures generated in parallel can read it.
+   */
+  VarTable<ClosureJob *> m_knownCalls;
+
+  bool alwaysHolds ( const AstVariable * var ) const;
+
+  const char * varSlot ( Context * ctx, const AstVariable * var );
+  const char * varValue ( Context * ctx, const AstVariable * var );
+
+  /** A #line directive, written only if enabled */
+  struct LineInfo
+  {
+    const SourceCoords * coords; //< NULL if disabled
+  };
+  friend CodeBuffer & operator<< ( CodeBuffer & os, const LineInfo & li );
+
+  LineInfo coords ( const SourceCoords & coords ) const
+  {
+    LineInfo li = { m_optLineInfo && coords.full() ? &coords : NULL };
+    return li;
+  }
+  LineInfo coords ( Ast * ast ) const
   {
     return coords( ast->coords );
   }
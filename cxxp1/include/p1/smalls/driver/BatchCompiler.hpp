@@ -0,0 +1,107 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_DRIVER_BATCHCOMPILER_HPP
+#define	P1_SMALLS_DRIVER_BATCHCOMPILER_HPP
+
+#include "p1/util/ThreadPool.hpp"
+#include <boost/noncopyable.hpp>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <iostream>
+
+namespace p1 {
+namespace smalls {
+
+/**
+ * Compiles many files in parallel on a {@link ThreadPool}.
+ *
+ * Every file is an independent task with its own symbol table, reader, parser and code
+ * generator, so the tasks share nothing but the collector. The results are delivered to the
+ * caller in the order of the input, as soon as all files before them are done, so the output
+ * doesn't depend on the scheduling.
+ */
+class BatchCompiler : public boost::noncopyable
+{
+public:
+  struct Options
+  {
+    unsigned threads; //< 0 means one per processor
+    bool stream;
+    bool expansionCache;
+
+    Options () : threads( 0 ), stream( false ), expansionCache( false ) {}
+  };
+
+  struct FileResult
+  {
+    std::string fileName;
+    int status; //< 0 for success
+    std::string code;
+    std::string diagnostics;
+    uint64_t sourceBytes;
+    uint64_t nanos; //< the time taken to compile the file, not counting the time in the queue
+  };
+
+  class Sink
+  {
+  public:
+    virtual ~Sink () {}
+    /** Called on the thread running {@link BatchCompiler#run}, in input order */
+    virtual void done ( const FileResult & result ) = 0;
+  };
+
+  struct Summary
+  {
+    unsigned files;
+    unsigned failed;
+    uint64_t sourceBytes;
+    uint64_t wallNanos;
+    std::vector<uint64_t> nanos; //< of each file, sorted
+    ThreadPool::Stats pool;
+
+    Summary () : files( 0 ), failed( 0 ), sourceBytes( 0 ), wallNanos( 0 ) {}
+
+    /** Throughput and the distribution of the per-file latency */
+    void print ( std::ostream & os, unsigned threads ) const;
+  };
+
+  explicit BatchCompiler ( const Options & options );
+  ~BatchCompiler ();
+
+  unsigned threads () const { return m_pool.size(); }
+
+  Summary run ( const std::vector<std::string> & fileNames, Sink & sink );
+
+private:
+  class CompileTask;
+
+  Options const m_options;
+  ThreadPool m_pool;
+
+  pthread_mutex_t m_lock;
+  /** Broadcast whenever a task is done */
+  pthread_cond_t m_taskDone;
+
+  void compileFile ( FileResult & res ) const;
+  void taskDone ( CompileTask * task );
+};
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_DRIVER_BATCHCOMPILER_HPP */
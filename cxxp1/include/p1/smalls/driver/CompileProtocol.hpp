@@ -0,0 +1,87 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_DRIVER_COMPILEPROTOCOL_HPP
+#define	P1_SMALLS_DRIVER_COMPILEPROTOCOL_HPP
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+
+namespace p1 {
+namespace smalls {
+
+/**
+ * The messages exchanged by the compile server and its clients (see {@link UnixSocket}).
+ *
+ * A request is one message of NUL-separated fields: the command, followed by its arguments.
+ * "compile" takes the flags (decimal), the working directory of the client and the file name as
+ * the client got it. "shutdown" takes nothing.
+ *
+ * The response to "compile" is three messages: the exit status (decimal), the generated code and
+ * the diagnostics.
+ *
+ * This header doesn't depend on the compiler, so clients can stay thin.
+ */
+namespace protocol
+{
+  const char CMD_COMPILE[] = "compile";
+  const char CMD_SHUTDOWN[] = "shutdown";
+
+  /** Emit each top-level form as soon as it is compiled (like "scheme-play -stream") */
+  const unsigned F_STREAM = 1;
+
+  inline std::string encode ( const std::vector<std::string> & fields )
+  {
+    std::string res;
+    for ( size_t i = 0; i != fields.size(); ++i )
+    {
+      if (i)
+        res += '\0';
+      res += fields[i];
+    }
+    return res;
+  }
+
+  inline std::vector<std::string> decode ( const std::string & msg )
+  {
+    std::vector<std::string> res;
+    size_t start = 0, pos;
+    while ((pos = msg.find( '\0', start )) != std::string::npos)
+    {
+      res.push_back( msg.substr( start, pos - start ) );
+      start = pos + 1;
+    }
+    res.push_back( msg.substr( start ) );
+    return res;
+  }
+
+  /** The socket used when none is specified: $SMALLS_SOCKET or one per user in /tmp */
+  inline std::string defaultSocketPath ()
+  {
+    if (const char * env = std::getenv( "SMALLS_SOCKET" ))
+      return env;
+    char buf[32];
+    std::sprintf( buf, "%u", (unsigned)::getuid() );
+    return std::string( "/tmp/smalls-" ) + buf + ".sock";
+  }
+}
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_DRIVER_COMPILEPROTOCOL_HPP */
@@ -0,0 +1,122 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_DRIVER_COMPILESERVER_HPP
+#define	P1_SMALLS_DRIVER_COMPILESERVER_HPP
+
+#include "CompileProtocol.hpp"
+#include "ModuleCompiler.hpp"
+#include <boost/unordered_map.hpp>
+#include <sys/types.h>
+#include <iostream>
+
+namespace p1 {
+namespace smalls {
+
+/**
+ * A long-running compiler, which pays for the system environment and the heap warm-up once,
+ * instead of once per file.
+ *
+ * The parser, with its system bindings, keywords and resolution caches, is shared by all
+ * requests. Everything a request creates is scoped to it: the module scope is popped and the
+ * mark generation released by the parser, and every request has its own code generator and
+ * diagnostics. Macros and definitions never leak from one file into the next.
+ *
+ * The syntax read from each file is cached, keyed by device and inode, and reused while the
+ * modification time and size of the file stay the same.
+ */
+class CompileServer : public gc
+{
+public:
+  struct Stats
+  {
+    unsigned long requests;
+    unsigned long sourceHits; //< files whose syntax was reused
+
+    Stats () : requests(0), sourceHits(0) {}
+  };
+
+  CompileServer ();
+
+  /** Reuse the expansions of pure macros (see {@link SchemeParser#setExpansionCache}) */
+  void setExpansionCache ( bool enable ) { m_parser.setExpansionCache( enable ); }
+
+  /**
+   * Compile a file to C. The output is the same as that of "scheme-play".
+   * @param fileName the name used in diagnostics
+   * @param path where to read it from; usually the same as the name
+   * @param flags protocol::F_xxx
+   * @return the exit status: 0 for success
+   */
+  int compile ( const char * fileName, const char * path, unsigned flags,
+                std::ostream & out, std::ostream & diag );
+
+  /** Serve requests on the socket until a "shutdown" request. Clients are served one at a time */
+  void serve ( const char * socketPath );
+
+  const Stats & stats () const { return m_stats; }
+
+private:
+  struct SourceFile : public gc
+  {
+    dev_t dev;
+    ino_t ino;
+    time_t mtime;
+    long mtimeNsec;
+    off_t size;
+    gc_string name; //< the lexer and the syntax refer to it
+    SyntaxList datums;
+    gc_string diagnostics; //< reported while reading
+    unsigned errorCount;
+  };
+
+  struct FileId
+  {
+    dev_t dev;
+    ino_t ino;
+
+    FileId ( dev_t dev_, ino_t ino_ ) : dev( dev_ ), ino( ino_ ) {}
+    bool operator == ( const FileId & x ) const { return dev == x.dev && ino == x.ino; }
+  };
+  struct FileIdHash : public std::unary_function<FileId, std::size_t>
+  {
+    std::size_t operator () ( const FileId & x ) const
+    {
+      std::size_t seed = 0;
+      boost::hash_combine( seed, x.dev );
+      boost::hash_combine( seed, x.ino );
+      return seed;
+    }
+  };
+  typedef boost::unordered_map<FileId,
+                               SourceFile *,
+                               FileIdHash,
+                               std::equal_to<FileId>,
+                               gc_allocator<std::pair<const FileId, SourceFile *> > > SourceMap;
+
+  SymbolTable m_symbolTable;
+  Keywords m_kw;
+  StreamErrorReporter m_errors;
+  SchemeParser m_parser;
+  SourceMap m_sources;
+  Stats m_stats;
+
+  SourceFile * readSource ( const char * fileName, const char * path );
+};
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_DRIVER_COMPILESERVER_HPP */
@@ -0,0 +1,101 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_DRIVER_INCREMENTALCOMPILER_HPP
+#define	P1_SMALLS_DRIVER_INCREMENTALCOMPILER_HPP
+
+#include "p1/smalls/parser/SchemeParser.hpp"
+#include "p1/smalls/parser/AstCache.hpp"
+#include "p1/smalls/codegen/SimpleCodeGen.hpp"
+#include <boost/unordered_map.hpp>
+#include <vector>
+#include <iostream>
+
+namespace p1 {
+namespace smalls {
+
+/**
+ * Recompiles successive versions of a module, regenerating only the top-level forms which
+ * changed and the forms which depend on them.
+ *
+ * Every form is fingerprinted (see {@link fingerprintSyntax}). The AST cache records the
+ * bindings each form uses and defines; that is the dependency graph between the top-level
+ * definitions. A form is reused if its fingerprint is unchanged and its dependencies still
+ * resolve the same way; then only its definitions are bound, and its C code from the previous
+ * version is emitted as it was. Everything else is expanded, compiled and generated again.
+ *
+ * The generated code of a form doesn't depend on the other forms: function names are derived
+ * from a per-form id and top-level variables are addressed by name.
+ */
+class IncrementalCompiler : public gc
+{
+public:
+  typedef std::vector<Syntax *, gc_allocator<Syntax *> > SyntaxList;
+
+  struct Stats
+  {
+    unsigned forms;
+    unsigned reused;   //< forms whose code was reused
+    unsigned compiled; //< forms which were compiled and generated
+
+    Stats () : forms(0), reused(0), compiled(0) {}
+  };
+
+  IncrementalCompiler ( SymbolTable & symbolTable, const Keywords & kw, AbstractErrorReporter & errors );
+
+  /**
+   * With line information, the code of a form depends on its position, so moved forms are
+   * generated again.
+   */
+  void setLineInfo ( bool on );
+
+  /** Compile the top-level forms of the new version of the module and write the complete C file */
+  void compile ( std::ostream & os, const SyntaxList & datums );
+
+  /** Of the last compilation */
+  const Stats & stats () const { return m_stats; }
+
+  SchemeParser & parser () { return m_parser; }
+  AstCache & astCache () { return m_astCache; }
+
+private:
+  SchemeParser m_parser;
+  SimpleCodeGen m_codeGen;
+  AstCache m_astCache;
+  bool m_lineInfo;
+  Stats m_stats;
+
+  struct FormCode : public gc
+  {
+    unsigned const id;
+    gc_string const code;
+
+    FormCode ( unsigned id_, const std::string & code_ ) : id( id_ ), code( code_.begin(), code_.end() ) {}
+  };
+  /** Identical forms may appear more than once */
+  typedef boost::unordered_multimap<uint64_t,
+                                    FormCode *,
+                                    boost::hash<uint64_t>,
+                                    std::equal_to<uint64_t>,
+                                    gc_allocator<std::pair<const uint64_t, FormCode *> > > CodeMap;
+  /** The code of the forms of the last version, by fingerprint */
+  CodeMap m_code;
+  unsigned m_nextId;
+};
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_DRIVER_INCREMENTALCOMPILER_HPP */
@@ -0,0 +1,51 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_DRIVER_MODULECOMPILER_HPP
+#define	P1_SMALLS_DRIVER_MODULECOMPILER_HPP
+
+#include "p1/smalls/parser/SchemeParser.hpp"
+#include <vector>
+#include <iostream>
+
+namespace p1 {
+namespace smalls {
+
+/**
+ * Writes the messages to a stream, if there is one, and counts them.
+ */
+class StreamErrorReporter : public AbstractErrorReporter
+{
+public:
+  std::ostream * os;
+  unsigned count;
+
+  explicit StreamErrorReporter ( std::ostream * os_ = NULL ) : os( os_ ), count( 0 ) {}
+  virtual void error ( const ErrorInfo & ei );
+};
+
+typedef std::vector<Syntax *, gc_allocator<Syntax *> > SyntaxList;
+
+/**
+ * Compile the top-level forms of a file and write the C code, in the same format as
+ * "scheme-play". The parser is left ready for the next module.
+ * @param stream compile and emit one top-level form at a time
+ */
+void compileModule ( SchemeParser & parser, const SyntaxList & datums, bool stream, std::ostream & out );
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_DRIVER_MODULECOMPILER_HPP */
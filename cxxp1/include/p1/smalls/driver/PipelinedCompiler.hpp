@@ -0,0 +1,117 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_DRIVER_PIPELINEDCOMPILER_HPP
+#define	P1_SMALLS_DRIVER_PIPELINEDCOMPILER_HPP
+
+#include "p1/smalls/parser/SchemeParser.hpp"
+#include "p1/smalls/codegen/SimpleCodeGen.hpp"
+#include "p1/util/SpscQueue.hpp"
+#include <stdint.h>
+#include <iostream>
+
+namespace p1 {
+namespace smalls {
+
+/**
+ * Compiles one file in stream mode with the stages on separate threads: one thread reads
+ * datums, another expands and compiles them to AST, and the calling thread generates and writes
+ * the code. The stages are connected by bounded {@link SpscQueue}s, so a large file takes about
+ * as long as its slowest stage.
+ *
+ * The output and the diagnostics are the same as those of the sequential stream mode. The
+ * errors of the reader are passed along with the datums and reported by the parser thread, in
+ * the order a single thread would have reported them.
+ */
+class PipelinedCompiler : public gc
+{
+public:
+  struct Stats
+  {
+    unsigned forms;
+    /** The time each stage spent working, not waiting for the others */
+    uint64_t readNanos, compileNanos, emitNanos;
+    uint64_t wallNanos;
+
+    Stats () : forms( 0 ), readNanos( 0 ), compileNanos( 0 ), emitNanos( 0 ), wallNanos( 0 ) {}
+  };
+
+  /**
+   * @param lex the lexer of the reader. Its error reporter is replaced while running
+   * @param printForms write each form as a comment before its code, like "scheme-play -stream"
+   */
+  PipelinedCompiler ( Lexer & lex, SyntaxReader & reader, SchemeParser & parser,
+                      AbstractErrorReporter & errors, bool printForms, unsigned queueSize = 64 );
+
+  /**
+   * @throws std::exception thrown by any of the stages, after all of them have stopped
+   */
+  void run ( std::ostream & out );
+
+  const Stats & stats () const { return m_stats; }
+
+private:
+  class ReaderErrors;
+  typedef std::vector<ErrorInfo *, gc_allocator<ErrorInfo *> > ErrorList;
+
+  struct ReadItem
+  {
+    Syntax * datum; //< NULL at the end
+    ErrorList * errors; //< reported before the datum, if any
+
+    ReadItem () : datum( NULL ), errors( NULL ) {}
+  };
+  struct FormItem
+  {
+    AstBody * form; //< NULL at the end
+    VectorOfVariable * addedVars; //< see SimpleCodeGen::setStreamVarsAdded()
+
+    FormItem () : form( NULL ), addedVars( NULL ) {}
+  };
+
+  Lexer & m_lex;
+  SyntaxReader & m_reader;
+  SchemeParser & m_parser;
+  AbstractErrorReporter & m_errors;
+  bool const m_printForms;
+
+  SpscQueue<ReadItem> m_readQueue;
+  SpscQueue<FormItem> m_formQueue;
+  AstFrame * m_frame;
+
+  /** Set when a stage fails, so the others stop waiting for it */
+  int m_abort;
+  /** The first failure. Read only after all threads have stopped */
+  std::string m_failure;
+
+  Stats m_stats;
+
+  static void * readerMain ( void * arg );
+  static void * parserMain ( void * arg );
+  void readStage ();
+  void compileStage ();
+  void emitStage ( std::ostream & out, SimpleCodeGen & cg );
+  void fail ( const char * what );
+
+  template <typename Q, typename T>
+  bool push ( Q & q, const T & x );
+  template <typename Q, typename T>
+  bool pop ( Q & q, T & x );
+};
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_DRIVER_PIPELINEDCOMPILER_HPP */
@@ -0,0 +1,141 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_PARSER_ASTCACHE_HPP
+#define	P1_SMALLS_PARSER_ASTCACHE_HPP
+
+#include "SymbolTable.hpp"
+#include "p1/smalls/ast/SchemeAST.hpp"
+#include <boost/unordered_map.hpp>
+#include <vector>
+
+namespace p1 {
+namespace smalls {
+
+#define _DEF_AST_DEPENDENCY_KINDS \
+  _MK_ENUM(RESWORD) \
+  _MK_ENUM(MACRO) \
+  _MK_ENUM(VAR) \
+  _MK_ENUM(DEFINE) \
+  _MK_ENUM(FORWARD)
+
+struct AstDependencyKind
+{
+  #define _MK_ENUM(x)  x,
+  enum Enum
+  {
+    _DEF_AST_DEPENDENCY_KINDS
+  };
+  #undef _MK_ENUM
+
+  static const char * name ( Enum x )  { return s_names[x]; }
+private:
+  static const char * s_names[];
+};
+
+/**
+ * A top-level binding used by a cached form (RESWORD, MACRO, VAR), or created by it: a definition
+ * (DEFINE) or a placeholder for a variable which hadn't been defined yet (FORWARD).
+ */
+struct AstDependency
+{
+  AstDependencyKind::Enum kind;
+  bool system;         //< resolved in the system scope instead of the top-level one
+  const gc_char * name;
+  uint64_t detail;     //< RESWORD: the reserved word; MACRO: its fingerprint
+  SourceCoords coords; //< DEFINE: the definition; FORWARD: the first reference
+  AstVariable * var;   //< VAR, DEFINE, FORWARD: the variable. Not stored.
+
+  AstDependency ( AstDependencyKind::Enum kind_, bool system_, const gc_char * name_, uint64_t detail_,
+                  const SourceCoords & coords_, AstVariable * var_ )
+    : kind( kind_ ), system( system_ ), name( name_ ), detail( detail_ ), coords( coords_ ), var( var_ )
+  {}
+};
+
+/**
+ * Compiled top-level forms, so unchanged forms don't have to be expanded and compiled again when
+ * a module is rebuilt.
+ *
+ * A form is keyed by {@link fingerprintSyntax} of its source, including the coordinates relative
+ * to its start, so it can move within the file. The AST is serialized together with the
+ * frames and variables it creates; references to top-level and system variables are stored by
+ * name in the dependency list. Whoever reuses a form must check that every dependency still
+ * resolves to an equivalent binding, create the DEFINE and FORWARD variables and then
+ * {@link #instantiate} the AST with them. Coordinates inside the form are rebased to its new
+ * location; coordinates elsewhere (e.g. in macro templates) are stored as they were.
+ */
+class AstCache : public gc
+{
+public:
+  typedef std::vector<AstDependency, gc_allocator<AstDependency> > DependencyList;
+  typedef std::vector<unsigned char, gc_allocator<unsigned char> > Bytes;
+
+  struct Form : public gc
+  {
+    uint64_t key;
+    unsigned astOffset; //< where the AST starts in data, after the dependencies
+    Bytes data;
+  };
+
+  AstCache ();
+
+  const Form * find ( uint64_t key ) const;
+
+  /**
+   * Serialize a form compiled in topFrame and replace the previous form with the same key. Every
+   * variable in topFrame or outside of it which the AST refers to must be in deps.
+   * @return false if the AST can't be serialized
+   */
+  bool store ( uint64_t key, const DependencyList & deps, AstBody * body, AstFrame * topFrame,
+               const SourceCoords & base );
+
+  /** Decode the dependencies of a form, whose source is now at base. The variables are NULL */
+  bool readDependencies ( const Form * form, const SourceCoords & base, DependencyList & deps ) const;
+
+  /**
+   * Re-create the AST of the form in topFrame, with the variables of the dependencies.
+   * @return NULL if the form is invalid
+   */
+  AstBody * instantiate ( const Form * form, const DependencyList & deps, AstFrame * topFrame,
+                          const SourceCoords & base ) const;
+
+  unsigned size () const { return m_forms.size(); }
+  void clear () { m_forms.clear(); }
+
+  /**
+   * Write all forms to a file atomically.
+   * @throws io_error
+   */
+  void save ( const char * path ) const;
+
+  /**
+   * Add the forms in a file saved by {@link #save}.
+   * @return false if the file doesn't exist or is invalid. The cache is not modified then.
+   */
+  bool load ( const char * path );
+
+private:
+  typedef boost::unordered_map<uint64_t,
+                               Form *,
+                               boost::hash<uint64_t>,
+                               std::equal_to<uint64_t>,
+                               gc_allocator<std::pair<const uint64_t, Form *> > > FormMap;
+  FormMap m_forms;
+};
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_PARSER_ASTCACHE_HPP */
@@ -0,0 +1,132 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_PARSER_DATUM_HPP
+#define	P1_SMALLS_PARSER_DATUM_HPP
+
+#include "p1/util/gc-support.hpp"
+#include <iostream>
+#include <cassert>
+#include <stdint.h>
+
+namespace p1 {
+namespace smalls {
+  class Symbol;
+}}
+
+namespace p1 {
+namespace smalls {
+
+#define _DEF_DATUM_KINDS \
+   _MK_ENUM(DEOF) \
+   _MK_ENUM(COMMENT) \
+   _MK_ENUM(NIL) \
+   _MK_ENUM(BOOL) \
+   _MK_ENUM(INTEGER) \
+   _MK_ENUM(REAL) \
+   _MK_ENUM(STR) \
+   _MK_ENUM(SYMBOL) \
+   _MK_ENUM(NAME) \
+   _MK_ENUM(PAIR) \
+   _MK_ENUM(VECTOR) \
+
+
+struct DatumKind
+{
+  #define _MK_ENUM(name)  name,
+  enum Enum
+  {
+    _DEF_DATUM_KINDS
+  };
+  #undef _MK_ENUM
+
+  static const char * name ( Enum x ) { return s_names[x]; }
+
+private:
+  static const char * s_names[];
+};
+
+/**
+ * A plain S-expression datum, as produced by {@link DatumReader}. Unlike {@link Syntax} it has
+ * no source coordinates, no marks and no virtual methods, so every node is three words.
+ *
+ * Symbols are either interned (SYMBOL) or just names (NAME), depending on how the Lexer was
+ * configured. Atoms which contain no pointers are allocated as pointer-free.
+ */
+struct Datum : public gc
+{
+  DatumKind::Enum const kind;
+
+  union
+  {
+    bool vbool;
+    int64_t integer;
+    double real;
+    const gc_char * str;
+    Symbol * symbol;
+    const gc_char * name;
+    struct
+    {
+      Datum * car;
+      Datum * cdr;
+    } pair;
+    struct
+    {
+      Datum ** elems;
+      unsigned len;
+    } vec;
+  } u;
+
+  explicit Datum ( DatumKind::Enum kind_ ) : kind( kind_ ) {}
+
+  bool isNil () const { return kind == DatumKind::NIL; }
+  bool isPair () const { return kind == DatumKind::PAIR; }
+  bool isSymbol () const { return kind == DatumKind::SYMBOL || kind == DatumKind::NAME; }
+
+  Datum * car () const
+  {
+    assert( kind == DatumKind::PAIR );
+    return u.pair.car;
+  }
+  Datum * cdr () const
+  {
+    assert( kind == DatumKind::PAIR );
+    return u.pair.cdr;
+  }
+
+  /** The name of a SYMBOL or NAME */
+  const gc_char * symbolName () const;
+
+  /** Symbols are equal if their names are, regardless of how they were read */
+  bool equal ( const Datum * x ) const;
+  void toStream ( std::ostream & os ) const;
+
+  /** The empty list. There is only one */
+  static Datum * nil () { return &s_nil; }
+
+private:
+  static Datum s_nil;
+};
+
+inline std::ostream & operator << ( std::ostream & os, const Datum & dat )
+{
+  dat.toStream( os );
+  return os;
+}
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_PARSER_DATUM_HPP */
@@ -0,0 +1,82 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_PARSER_DATUMREADER_HPP
+#define	P1_SMALLS_PARSER_DATUMREADER_HPP
+
+#include "Lexer.hpp"
+#include "Datum.hpp"
+#include <vector>
+
+namespace p1 {
+namespace smalls {
+
+/**
+ * Reads S-expression data files into a compact {@link Datum} tree, using the same Lexer as
+ * {@link SyntaxReader}, but without source coordinates or hygiene support.
+ *
+ * Symbols are interned into the Lexer's symbol table, unless that was disabled with
+ * {@link Lexer#setInternSymbols()}, in which case they are just names. To keep the data symbols
+ * out of the compiler's table, give the Lexer a separate SymbolTable.
+ */
+class DatumReader : public gc
+{
+public:
+  DatumReader ( Lexer & lex );
+
+  /** @return the next datum or DAT_EOF */
+  Datum * parseDatum ();
+
+  Datum * const DAT_EOF;
+private:
+  Datum * const DAT_COM;
+
+  Lexer & m_lex;
+  Token m_tok;
+
+  /** quote, quasiquote, etc. Abbreviations share them */
+  Datum * m_abbrevQuote, * m_abbrevQuasiquote, * m_abbrevUnquote, * m_abbrevUnquoteSplicing;
+  Datum * m_abbrevSyntax, * m_abbrevQuasisyntax, * m_abbrevUnsyntax, * m_abbrevUnsyntaxSplicing;
+
+  /** Elements of the vectors being read. Nested vectors share it */
+  std::vector<Datum *, gc_allocator<Datum *> > m_vecStack;
+
+  TokenKind::Enum next ()
+  {
+    return m_lex.nextToken( m_tok );
+  }
+
+  Datum * newSymbol ( const char * name );
+  Datum * newPair ( Datum * car, Datum * cdr )
+  {
+    Datum * res = new Datum( DatumKind::PAIR );
+    res->u.pair.car = car;
+    res->u.pair.cdr = cdr;
+    return res;
+  }
+
+  Datum * readSkipDatCom ( unsigned termSet );
+  Datum * read ( unsigned termSet );
+  Datum * list ( TokenKind::Enum terminator, unsigned termSet );
+  Datum * vector ( TokenKind::Enum terminator, unsigned termSet );
+  Datum * abbrev ( Datum * sym, unsigned termSet );
+
+  void error ( const gc_char * msg, ... );
+};
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_PARSER_DATUMREADER_HPP */
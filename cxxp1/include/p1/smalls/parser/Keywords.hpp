@@ -56,6 +56,9 @@ public:
   Symbol * const sym_define_identifier_macro;
   Symbol * const sym_define_set_macro;
   Symbol * const sym_macro_env;
+  Symbol * const sym_syntax_rules;
+  Symbol * const sym_ellipsis;
+  Symbol * const sym_underscore;
 
   Keywords ( SymbolTable & symbolTable_ );
 };
@@ -57,6 +57,7 @@ class Lexer : public gc
 
   int32_t m_curChar;
 
+  bool m_internSymbols;
   bool m_inNestedComment;
   detail::StringCollector m_strBuf;
 
@@ -74,6 +75,14 @@ public:
 
   SymbolTable & symbolTable () { return m_symbolTable; }
   AbstractErrorReporter & errorReporter () { return *m_errors; }
+  void setErrorReporter ( AbstractErrorReporter & errors ) { m_errors = &errors; }
+
+  /**
+   * When disabled, identifiers are returned as NAME tokens containing just the name, instead of
+   * SYMBOL tokens interned in the symbol table. Only useful for reading data.
+   */
+  void setInternSymbols ( bool on ) { m_internSymbols = on; }
+  bool internSymbols () const { return m_internSymbols; }
 
   TokenKind::Enum nextToken ( Token & tok )
   {
@@ -21,8 +21,10 @@
 
 #include "SyntaxReader.hpp"
 #include "SymbolTable.hpp"
+#include "AstCache.hpp"
 #include "p1/smalls/ast/SchemeAST.hpp"
 #include "p1/smalls/common/AbstractErrorReporter.hpp"
+#include <boost/unordered_map.hpp>
 
 namespace p1 {
 namespace smalls {
@@ -40,11 +42,59 @@ public:
 
   AstModule * compileLibraryBody ( Syntax * datum );
 
+  /**
+   * Compile a library body one top-level form at a time, so the forms don't have to be buffered.
+   * All forms share the frame of the returned module, whose body is empty. References to
+   * variables which haven't been defined yet create placeholders, which are resolved by the
+   * following definitions; {@link #endStream()} reports the ones which never were.
+   */
+  AstModule * beginStream ();
+  /** @return the definitions and expressions of the form, in the frame of the stream */
+  AstBody * compileTopLevelForm ( Syntax * datum );
+  void endStream ();
+
+  /**
+   * While streaming, reuse the top-level forms compiled before, if their source is unchanged and
+   * the bindings they use still resolve the same way, and add the newly compiled forms to the
+   * cache. Forms which define macros, contain errors or depend on macros without a fingerprint
+   * are not cached.
+   */
+  void setAstCache ( AstCache * cache ) { m_astCache = cache; }
+  unsigned long astCacheHits () const { return m_astCacheHits; }
+
+  /**
+   * If the form can be reused from the AST cache, only create the top-level bindings it defines,
+   * without re-creating the AST. For callers which keep the code generated from the form as well.
+   * @return false if the form has to be compiled with {@link #compileTopLevelForm}
+   */
+  bool bindCachedForm ( Syntax * datum );
+
+  /**
+   * Reuse the expansions of pure macros when they are invoked on identical inputs (same structure,
+   * identifiers and marks). Each reuse is wrapped with a fresh mark, so hygiene is unaffected,
+   * but source coordinates inside a reused expansion refer to the first use.
+   */
+  void setExpansionCache ( bool enable );
+  unsigned long expansionCacheHits () const { return m_expansionCacheHits; }
+
+  typedef std::vector<Macro *, gc_allocator<Macro *> > MacroList;
+
+  /** Collect Macro::stats for every expansion. Cheap enough to be left on */
+  void setMacroProfiling ( bool enable ) { m_macroProfiling = enable; }
+  bool macroProfiling () const { return m_macroProfiling; }
+  /**
+   * The system macros, followed by the macros defined while profiling in the current (or last)
+   * module or stream, in order of definition
+   */
+  const MacroList & macros () const { return m_macros; }
+  /** Print the statistics of all macros which have been expanded, the slowest first */
+  void printMacroProfile ( std::ostream & os ) const;
+
 private:
-  typedef std::list<Syntax *,gc_allocator<SyntaxPair *> > DatumList;
+  typedef p1::SmallVector<Syntax *, 4> DatumList;
 
   typedef std::pair<Binding *, Syntax *> DeferredDefine;
-  typedef std::list<DeferredDefine,gc_allocator<DeferredDefine> > DeferredDefineList;
+  typedef p1::SmallVector<DeferredDefine, 2> DeferredDefineList;
 
   struct Context : public gc
   {
@@ -59,6 +109,7 @@ private:
   };
 
   SymbolTable & m_symbolTable;
+  const Keywords & m_kw;
   Scope * m_systemScope;
   AbstractErrorReporter & m_errors;
 
@@ -67,15 +118,90 @@ private:
   Binding * m_bindBegin; // the "begin" system binding. We need it occasionally
   Binding * m_unspec;
 
+  /**
+   * Direct-mapped cache of resolved (symbol, mark) pairs. Marks are interned, so the pointers
+   * identify the whole chain. An entry is valid only while {@link SymbolTable#epoch()} hasn't
+   * changed. Keeping the keys here also keeps them alive, so a pointer can't be reused.
+   */
+  struct ResolveCacheEntry
+  {
+    Symbol * symbol;
+    Mark * mark;
+    Binding * bnd;
+    uint64_t epoch;
+  };
+  static const unsigned RESOLVE_CACHE_SIZE = 1024; // must be power of 2
+  ResolveCacheEntry m_resolveCache[RESOLVE_CACHE_SIZE];
+
+  struct ExpansionCacheEntry
+  {
+    Macro * macro;
+    std::size_t hash;
+    SyntaxPair * input;
+    Syntax * expanded; //< the output of Macro::expand() before marking
+
+    ExpansionCacheEntry () : macro(NULL), hash(0), input(NULL), expanded(NULL) {}
+  };
+  static const unsigned EXPANSION_CACHE_SIZE = 1024; // must be power of 2
+  /** Larger inputs are not worth hashing */
+  static const unsigned MAX_CACHED_EXPANSION_NODES = 256;
+  /** Direct-mapped by hash. Empty when disabled */
+  std::vector<ExpansionCacheEntry, gc_allocator<ExpansionCacheEntry> > m_expansionCache;
+  unsigned long m_expansionCacheHits;
+
+  bool m_macroProfiling;
+  MacroList m_macros;
+  /** The system macros at the start of m_macros, which are kept across compilation units */
+  std::size_t m_systemMacroCount;
+
+  /** The top-level context while streaming, otherwise NULL */
+  Context * m_streamCtx;
+  struct ForwardRef
+  {
+    unsigned seq; //< for reporting in order of appearance
+    SyntaxSymbol * ref; //< the first reference
+  };
+  /** Placeholder bindings which haven't been defined yet */
+  typedef boost::unordered_map<Binding *,
+                               ForwardRef,
+                               boost::hash<Binding *>,
+                               std::equal_to<Binding *>,
+                               gc_allocator<std::pair<Binding * const, ForwardRef> > > ForwardRefMap;
+  ForwardRefMap m_forwardRefs;
+  unsigned m_forwardRefSeq;
+
+  AstCache * m_astCache;
+  unsigned long m_astCacheHits;
+  unsigned long m_errorCount;
+  /** The dependencies of the top-level form being compiled for the AST cache, otherwise NULL */
+  AstCache::DependencyList * m_formDeps;
+  typedef boost::unordered_map<Binding *,
+                               unsigned,
+                               boost::hash<Binding *>,
+                               std::equal_to<Binding *>,
+                               gc_allocator<std::pair<Binding * const, unsigned> > > DependencyIndexMap;
+  /** The index of each binding in m_formDeps */
+  DependencyIndexMap m_formDepIndex;
+  bool m_formCacheable;
+
+  AstBody * reuseCachedForm ( uint64_t key, const SourceCoords & coords );
+  const AstCache::Form * bindCachedForm ( uint64_t key, const SourceCoords & coords, AstCache::DependencyList & deps );
+  void recordDependency ( Binding * bnd );
+  void recordDefinition ( Binding * bnd, const SourceCoords & coords );
+
   AstBody * compileBody ( Context * ctx, Syntax * datum );
+  AstBody * compileDeferred ( Context * ctx, const SourceCoords & coords );
   void parseBody ( Context * ctx, Syntax * datum);
   void processBodyForm ( Context * ctx, Syntax * datum );
   void recordDefine ( Context * ctx, SyntaxPair * form );
+  void defineMacro ( Context * ctx, SyntaxPair * form );
 
-  Syntax * expandMacro ( Context * ctx, Macro * macro, SyntaxPair * pair );
+  Syntax * expandMacro ( Context * ctx, Macro * macro, SyntaxPair * pair, unsigned depth );
+  Syntax * doExpandMacro ( Context * ctx, Macro * macro, SyntaxPair * pair );
 
   Ast * compileExpression ( Context * ctx, Syntax * expr );
   Ast * compileBinding ( Context * ctx, Binding * bnd, Syntax * exprForCoords );
+  Binding * forwardReference ( SyntaxSymbol * ss );
   Ast * compileCall ( Context * ctx, SyntaxPair * call );
   Ast * compileResForm ( Context * ctx, SyntaxPair * pair, Binding * bndCar );
   Ast * compileBegin ( Context * ctx, SyntaxPair * beginPair );
@@ -85,6 +211,7 @@ private:
   Ast * compileLet ( Context * ctx, SyntaxPair * letPair );
   Ast * compileBasicLet ( Context * ctx, SyntaxPair * letPair );
   Ast * compileNamedLet ( Context * ctx, SyntaxPair * letPair );
+  Ast * compileLetRec ( Context * ctx, SyntaxPair * letPair );
   bool splitLetParams ( Syntax * p0, DatumList & varDatums, DatumList & valueDatums );
 
   static Ast * makeUnspecified ( const SourceCoords & coords );
@@ -97,6 +224,8 @@ private:
 
   bool bindSyntaxSymbol ( Binding * & res, Scope * scope, SyntaxSymbol * ss );
   Binding * lookupSyntaxSymbol ( SyntaxSymbol * ss );
+  Binding * resolveSyntaxSymbol ( SyntaxSymbol * ss );
+  Binding * resolveMarkedSymbol ( Symbol * symbol, Mark * mark );
 
   SyntaxPair * needPair ( const char * formName, Syntax * datum );
   bool needNil ( const char * formName, Syntax * datum );
@@ -23,12 +23,15 @@
 #include "p1/util/gc-support.hpp"
 #include <boost/unordered_map.hpp>
 #include <boost/noncopyable.hpp>
+#include <pthread.h>
 #include <list>
+#include <vector>
 #include <cstring>
 
 namespace p1 {
 namespace smalls {
   class Syntax;
+  struct Mark;
   class AstVariable;
 }}
 
@@ -67,6 +70,7 @@ class SymbolTable;
   _MK_ENUM(DEFINE_IDENTIFIER_MACRO) \
   _MK_ENUM(DEFINE_SET_MACRO) \
   _MK_ENUM(MACRO_ENV) \
+  _MK_ENUM(SYNTAX_RULES) \
   \
   _MK_ENUM(UNSPECIFIED)
 
@@ -141,12 +145,46 @@ private:
   friend class SymbolTable;
 };
 
+/** Collected by SchemeParser when macro profiling is enabled */
+struct MacroStats
+{
+  unsigned long count;     //< number of expansions
+  unsigned long cacheHits; //< expansions reused from the expansion cache
+  uint64_t nanos;          //< total time spent expanding
+  uint64_t inNodes;        //< total size of the inputs (each saturated at MAX_COUNTED_NODES)
+  uint64_t outNodes;       //< total size of the outputs (each saturated at MAX_COUNTED_NODES)
+  uint64_t allocBytes;     //< GC bytes allocated while expanding
+  unsigned maxDepth;       //< longest chain of expansions of a single form ending with this macro
+
+  static const unsigned MAX_COUNTED_NODES = 1024;
+
+  MacroStats ()
+    : count(0), cacheHits(0), nanos(0), inNodes(0), outNodes(0), allocBytes(0), maxDepth(0)
+  {}
+};
+
 class Macro : public gc
 {
 public:
   Scope * const scope;
-  Macro ( Scope * scope_ ) : scope(scope_) {}
+  Symbol * const name;
+  MacroStats stats;
+
+  Macro ( Scope * scope_, Symbol * name_ ) : scope(scope_), name(name_) {}
   virtual Syntax * expand ( Syntax * datum ) = 0;
+
+  /**
+   * A pure macro has no side effects, and its expansion depends only on the structure of its
+   * input, so expansions of identical inputs can be shared.
+   */
+  virtual bool isPure () const { return false; }
+
+  /**
+   * Identifies the behaviour of the macro across compilations: macros with equal non-0
+   * fingerprints produce the same expansions. Forms expanded by a macro with a fingerprint of 0
+   * can't be cached.
+   */
+  virtual uint64_t fingerprint () const { return 0; }
 };
 
 class Binding : public gc
@@ -167,6 +205,7 @@ public:
 
   BindingKind::Enum kind () const { return m_kind; }
   const SourceCoords & defCoords () const { return m_defCoords; }
+  void setDefCoords ( const SourceCoords & defCoords ) { m_defCoords = defCoords; }
 
   ResWord::Enum resWord () const
   {
@@ -233,7 +272,7 @@ class Symbol : public gc, public boost::noncopyable
 {
 public:
   const gc_char * const name;
-  uint32_t const uid; //< different value for each symbol
+  uint32_t const uid; //< different value for each live symbol
   /**
    * If not NULL, links to the parent in the family of symbols with the same name but different
    * marks generated by a macro.
@@ -278,6 +317,13 @@ public:
   Symbol * newSymbol ( const gc_char * name );
   Symbol * newSymbol ( Symbol * parentSymbol, uint32_t markStamp );
 
+  /**
+   * Allow {@link #newSymbol(const gc_char *)} to be called concurrently with everything else, so
+   * that a reader on another thread can intern symbols while the parser is running. The rest of
+   * the table is still used by one thread only.
+   */
+  void setConcurrentInterning ( bool on ) { m_concurrentInterning = on; }
+
   Binding * lookup ( const Symbol * sym )
   {
     return sym->m_top;
@@ -295,9 +341,32 @@ public:
 
   Scope * topScope () const { return m_topScope; }
 
-  uint32_t nextMarkStamp () { return ++m_markStamp; };
+  uint32_t nextMarkStamp ();
+
+  /** Return the unique mark with these contents, creating it if necessary */
+  Mark * newMark ( int32_t value, Scope * scope, Mark * next );
+
+  /**
+   * Incremented whenever the result of resolving a symbol could change: when a scope is pushed or
+   * popped, when a binding is added, or when marked symbols are released.
+   */
+  uint64_t epoch () const { return m_epoch; }
+
+  /**
+   * Start a new generation of macro-marked symbols. All marked symbols created after this point
+   * are released by the matching {@link #endMarkGeneration()}, and the mark stamps and uids they
+   * used are recycled. Generations nest; they must be closed only when nothing refers to the
+   * released symbols any more (e.g. when a compilation unit or a lambda body has been compiled).
+   */
+  void beginMarkGeneration ();
+  void endMarkGeneration ();
+
+  /** Uids of marked symbols have this bit set. The rest of the bits can be recycled. */
+  static const uint32_t MARKED_UID = 0x80000000u;
 
 private:
+  Symbol * internSymbol ( const gc_char * name );
+
   struct gc_charstr_equal : public std::binary_function<const gc_char *,const gc_char *,bool>
   {
     bool operator () ( const gc_char * a, const gc_char * b ) const
@@ -361,12 +430,71 @@ private:
                                std::equal_to<const MarkKey &>,
                                gc_allocator<MarkKey> > MarkMap;
 
+  struct InternKey
+  {
+    int32_t const value;
+    Scope * const scope;
+    Mark * const next;
+
+    InternKey ( int32_t value_, Scope * scope_, Mark * next_ )
+      : value( value_ ), scope( scope_ ), next( next_ )
+    {}
+
+    bool operator== ( const InternKey & x ) const
+    {
+      return this->value == x.value && this->scope == x.scope && this->next == x.next;
+    }
+  };
+
+  struct InternKey_hash : std::unary_function<const InternKey &, std::size_t>
+  {
+    std::size_t operator () ( const InternKey & a ) const
+    {
+      std::size_t seed = 0;
+      boost::hash_combine( seed, a.value );
+      boost::hash_combine( seed, a.scope );
+      boost::hash_combine( seed, a.next );
+      return seed;
+    }
+  };
+
+  /** Map from <value,scope,next> to the interned <Mark *> */
+  typedef boost::unordered_map<InternKey,
+                               Mark *,
+                               InternKey_hash,
+                               std::equal_to<const InternKey &>,
+                               gc_allocator<InternKey> > InternMap;
+
+  struct MarkGeneration
+  {
+    uint32_t markStamp; //< m_markStamp when the generation started
+    size_t logSize;     //< m_markLog.size() when the generation started
+    size_t internLogSize; //< m_internLog.size() when the generation started
+
+    MarkGeneration ( uint32_t markStamp_, size_t logSize_, size_t internLogSize_ )
+      : markStamp( markStamp_ ), logSize( logSize_ ), internLogSize( internLogSize_ )
+    {}
+  };
+
   Map m_map;
   MarkMap m_markMap;
   uint32_t m_uid;
+  bool m_concurrentInterning;
+  /** Protects m_map and m_uid when m_concurrentInterning */
+  pthread_mutex_t m_internLock;
   Scope * m_topScope;
   /** Used for marking macro-expanded symbols */
   uint32_t m_markStamp;
+  uint64_t m_epoch;
+  InternMap m_internMap;
+
+  /** All live marked symbols in order of creation. The index of a symbol is also its uid. */
+  std::vector<Symbol *, gc_allocator<Symbol *> > m_markLog;
+  /** All interned marks in order of creation */
+  std::vector<Mark *, gc_allocator<Mark *> > m_internLog;
+  std::vector<MarkGeneration, gc_allocator<MarkGeneration> > m_markGenerations;
+
+  friend class Scope;
 };
 
 class ScopePopper
@@ -383,6 +511,22 @@ private:
   Scope * m_scope;
 };
 
+class MarkGenerationScope
+{
+public:
+  MarkGenerationScope ( SymbolTable & symbolTable ) : m_symbolTable(symbolTable)
+  {
+    m_symbolTable.beginMarkGeneration();
+  }
+
+  ~MarkGenerationScope ()
+  {
+    m_symbolTable.endMarkGeneration();
+  }
+private:
+  SymbolTable & m_symbolTable;
+};
+
 }} // namespaces
 
 #endif	/* P1_SMALLS_PARSER_SYMBOLTABLE_HPP */
@@ -32,23 +32,31 @@ namespace smalls {
   class Scope;
   class Symbol;
   class Binding;
+  class SymbolTable;
 }}
 
 namespace p1 {
 namespace smalls {
 
-struct Mark
+/**
+ * Marks are interned by {@link SymbolTable#newMark()}, so two mark chains are equal if and only if
+ * they are the same object.
+ */
+struct Mark : public gc
 {
   int32_t const value; // -1 means anti-mark
   Scope * const scope;
   Mark * const next;
 
+private:
   Mark ( int32_t value_, Scope * scope_, Mark * next_ )
     : value(value_), scope(scope_), next( next_ )
   {
-    assert( value < 0 || scope != NULL );
+    assert( scope != NULL );
   }
+  friend class SymbolTable;
 
+public:
   bool isAntiMark () const { return value < 0; };
   bool isMark () const { return value > 0; };
 
@@ -114,6 +122,27 @@ public:
 
 Syntax * unwrapCompletely ( Syntax * syntax, Mark * mark = NULL );
 
+/**
+ * Compute a structural hash of the syntax as it would look after all pending marks were applied,
+ * without actually applying them.
+ * @return false if the syntax has more than maxNodes nodes
+ */
+bool hashSyntax ( const Syntax * syntax, std::size_t & hash, unsigned maxNodes );
+/**
+ * Compare the syntax as it would look after all pending marks were applied. Since marks are
+ * interned, identifiers are equal only if they would resolve the same way.
+ */
+bool equalSyntax ( const Syntax * a, const Syntax * b );
+/**
+ * A hash of the structure, symbol names and values of unmarked syntax. Unlike {@link hashSyntax}
+ * it doesn't depend on pointers, so it is stable across compilations. If base isn't NULL, the
+ * coordinates of the nodes relative to base are hashed as well.
+ * @return false if the syntax contains marks or bindings
+ */
+bool fingerprintSyntax ( const Syntax * syntax, const SourceCoords * base, uint64_t & hash );
+/** Count the nodes of the syntax, stopping at the limit */
+unsigned syntaxSize ( const Syntax * syntax, unsigned limit );
+
 inline std::ostream & operator << ( std::ostream & os, const Syntax & dat )
 {
   dat.toStream(os);
@@ -260,7 +289,10 @@ public:
   Mark * const mark;
 
   SyntaxVector ( const SourceCoords & coords_, Syntax ** data_, unsigned len_, Mark * mark_ = NULL )
-    : Syntax( SyntaxKind::VECTOR, coords ), m_data( data_ ), len( len_ ), mark(mark_) {}
+    : Syntax( SyntaxKind::VECTOR, coords_ ), m_data( data_ ), len( len_ ), mark(mark_)
+  {
+    m_wrappedData = NULL;
+  }
 
   static bool classof ( const SyntaxVector * ) { return true; }
   static bool classof ( const Syntax * t ) { return t->skind == SyntaxKind::VECTOR; }
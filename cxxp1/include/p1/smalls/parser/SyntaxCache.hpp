@@ -0,0 +1,81 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_PARSER_SYNTAXCACHE_HPP
+#define	P1_SMALLS_PARSER_SYNTAXCACHE_HPP
+
+#include "Syntax.hpp"
+#include "p1/util/gc-support.hpp"
+#include <vector>
+#include <string>
+
+namespace p1 {
+namespace smalls {
+  class SymbolTable;
+  class Keywords;
+  class AbstractErrorReporter;
+}}
+
+namespace p1 {
+namespace smalls {
+
+/**
+ * A binary image of the Syntax read from a source file, so an unchanged file doesn't have to be
+ * lexed and parsed again. The cache lives next to the source and is keyed by the hash of its
+ * contents.
+ *
+ * The image is a header, a string table containing the symbol names and string values, and the
+ * nodes in postorder, each referring to its children by index. Loading maps the file, copies the
+ * string table into the heap in one block and creates the nodes in a single pass; there is no
+ * tokenizing. Only the unmarked Syntax produced by {@link SyntaxReader} can be saved.
+ */
+class SyntaxCache
+{
+public:
+  typedef std::vector<Syntax *, gc_allocator<Syntax *> > SyntaxList;
+
+  /** The cache of a source file has the same name with ".sxc" appended */
+  static std::string cachePath ( const char * sourcePath );
+
+  /** FNV-1a hash of the source contents */
+  static uint64_t hashSource ( const unsigned char * data, size_t len );
+
+  /**
+   * Write the cache atomically.
+   * @throws io_error
+   */
+  static void save ( const char * cachePath, uint64_t sourceHash, const SyntaxList & datums );
+
+  /**
+   * Append the datums of the cache to the list, with coordinates in fileName.
+   * @return false if the cache doesn't exist, is invalid or was made from a different source
+   */
+  static bool load ( const char * cachePath, uint64_t sourceHash, SymbolTable & symbolTable,
+                     const gc_char * fileName, SyntaxList & datums );
+
+  /**
+   * Read all datums of a source file from its cache if it is valid. Otherwise parse the file and,
+   * if there were no errors, update the cache.
+   * @return true if the cache was used
+   * @throws io_error if the source can't be read
+   */
+  static bool readFile ( const char * sourcePath, const Keywords & kw, AbstractErrorReporter & errors,
+                         SyntaxList & datums );
+};
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_PARSER_SYNTAXCACHE_HPP */
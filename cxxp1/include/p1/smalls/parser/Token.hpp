@@ -33,6 +33,7 @@ class Symbol;
    _MK_ENUM(NONE,"<NONE>") \
    _MK_ENUM(EOFTOK,"<EOF>") \
    _MK_ENUM(SYMBOL,"symbol") \
+   _MK_ENUM(NAME,"symbol") /* an uninterned symbol */ \
    _MK_ENUM(BOOL,"#t or #f") \
    _MK_ENUM(REAL,"real") \
    _MK_ENUM(INTEGER,"integer") \
@@ -119,6 +120,17 @@ public:
     return m_value.symbol;
   }
 
+  void name ( const gc_char * name )
+  {
+    m_kind = TokenKind::NAME;
+    m_value.string = name;
+  }
+  const gc_char * name () const
+  {
+    assert( m_kind == TokenKind::NAME );
+    return m_value.string;
+  }
+
   void integer ( int64_t integer )
   {
     m_kind = TokenKind::INTEGER;
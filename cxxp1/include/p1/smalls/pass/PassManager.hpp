@@ -0,0 +1,154 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_PASS_PASSMANAGER_HPP
+#define	P1_SMALLS_PASS_PASSMANAGER_HPP
+
+#include "p1/smalls/ast/SchemeAST.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <iostream>
+
+namespace p1 {
+  class ThreadPool;
+}
+
+namespace p1 {
+namespace smalls {
+
+class PassManager;
+
+/**
+ * A pass of the middle end, transforming a module between the parser and the code generator.
+ */
+class AstPass : public gc
+{
+public:
+  const char * const name;
+  /** The names of the passes which must run before this one, NULL-terminated. May be NULL */
+  const char * const * const requires;
+
+  AstPass ( const char * name_, const char * const * requires_ = NULL )
+    : name( name_ ), requires( requires_ )
+  {}
+  virtual ~AstPass () {}
+
+  /** @return the number of nodes replaced */
+  virtual unsigned run ( PassManager & pm, AstModule * module ) = 0;
+};
+
+/**
+ * A pass which works on one function at a time: the top-level body of the module, or the body
+ * of a closure, without the closures nested in it (see AstRewriter's enterClosures).
+ *
+ * The functions of a module are independent of each other, so runOnBody() may be called for
+ * several of them at the same time, on the threads of the manager's pool. It must only modify
+ * the nodes of its own function and must keep its working state in locals.
+ */
+class AstFunctionPass : public AstPass
+{
+public:
+  AstFunctionPass ( const char * name_, const char * const * requires_ = NULL )
+    : AstPass( name_, requires_ )
+  {}
+
+  /** @return the number of nodes replaced */
+  virtual unsigned runOnBody ( AstBody * body ) = 0;
+
+  virtual unsigned run ( PassManager & pm, AstModule * module );
+};
+
+/**
+ * Runs a sequence of passes over a module.
+ *
+ * The passes can be added in any order: each runs after the passes it requires, and otherwise
+ * in the order it was added. The time taken by every pass is recorded; with statistics enabled,
+ * the nodes of the module are also counted after every pass, which costs one more walk each.
+ */
+class PassManager : public gc
+{
+public:
+  struct PassStats
+  {
+    const char * name;
+    unsigned functions; //< the functions it ran on; 0 for a module pass
+    unsigned replaced;
+    unsigned nodes; //< in the module after the pass, if counted
+    uint64_t nanos;
+  };
+  typedef std::vector<PassStats> StatsList;
+
+  PassManager ();
+  ~PassManager ();
+
+  /** Run function passes on the workers of a pool, or on the calling thread if NULL */
+  void setThreadPool ( ThreadPool * pool ) { m_pool = pool; }
+  void setNodeCounting ( bool on ) { m_countNodes = on; }
+
+  void add ( AstPass * pass );
+
+  /**
+   * @throws std::runtime_error if a required pass hasn't been added, or the requirements are
+   *   circular. Nothing runs in that case
+   */
+  void run ( AstModule * module );
+
+  /** The statistics of the last run, one entry per pass in execution order */
+  const StatsList & stats () const { return m_stats; }
+  /** The nodes in the module before the last run, if counted */
+  unsigned inputNodes () const { return m_inputNodes; }
+  void printStats ( std::ostream & os ) const;
+
+  /**
+   * Run a function pass on every function of a module, in parallel if there is a pool.
+   * Called by AstFunctionPass::run().
+   * @return the number of nodes replaced
+   */
+  unsigned runOnFunctions ( AstFunctionPass * pass, AstModule * module );
+
+  /** The number of nodes in a module */
+  static unsigned countNodes ( AstModule * module );
+
+private:
+  class FunctionTask;
+  typedef std::vector<AstPass *, gc_allocator<AstPass *> > PassList;
+  typedef std::vector<AstBody *, gc_allocator<AstBody *> > BodyList;
+
+  PassList m_passes;
+  ThreadPool * m_pool;
+  bool m_countNodes;
+
+  StatsList m_stats;
+  unsigned m_inputNodes;
+  /** Of the function pass being run */
+  unsigned m_functions;
+
+  /** Shared by the FunctionTasks of a function pass */
+  AstFunctionPass * m_curPass;
+  BodyList m_bodies;
+  volatile unsigned m_nextBody;
+  volatile unsigned m_replaced;
+  int m_taskFailed;
+  std::string m_taskFailure;
+
+  PassList schedule () const;
+  void taskFailed ( const char * what );
+};
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_PASS_PASSMANAGER_HPP */
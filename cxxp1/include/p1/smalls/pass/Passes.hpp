@@ -0,0 +1,35 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_PASS_PASSES_HPP
+#define	P1_SMALLS_PASS_PASSES_HPP
+
+#include "PassManager.hpp"
+
+namespace p1 {
+namespace smalls {
+
+/**
+ * "fold-if": replace an "if" whose condition is a literal with the branch it selects.
+ */
+AstFunctionPass * createFoldIfPass ();
+
+/** Add the passes run by default, in order */
+void addStandardPasses ( PassManager & pm );
+
+}} // namespaces
+
+#endif	/* P1_SMALLS_PASS_PASSES_HPP */
@@ -0,0 +1,85 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_UTIL_ARENA_HPP
+#define P1_UTIL_ARENA_HPP
+
+#include "compiler.h"
+#include <boost/noncopyable.hpp>
+#include <cstddef>
+#include <cstring>
+
+namespace p1 {
+
+/**
+ * A bump allocator: memory is carved out of large blocks and released all at once.
+ *
+ * The blocks are not scanned by the collector, so they must not hold the only references to
+ * collectable objects.
+ */
+class Arena : public boost::noncopyable
+{
+public:
+  explicit Arena ( size_t blockSize = 8192 );
+  ~Arena () { clear(); }
+
+  /** Aligned for any scalar type */
+  __forceinline void * alloc ( size_t size )
+  {
+    size = (size + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+    if (likely(size <= (size_t)(m_end - m_cur)))
+    {
+      void * res = m_cur;
+      m_cur += size;
+      return res;
+    }
+    else
+      return allocSlow( size );
+  }
+
+  /** A NUL-terminated copy of s */
+  const char * copy ( const char * s, size_t len )
+  {
+    char * res = static_cast<char *>(alloc( len + 1 ));
+    std::memcpy( res, s, len );
+    res[len] = 0;
+    return res;
+  }
+
+  /** Release all blocks */
+  void clear ();
+
+  /** Bytes in blocks currently held */
+  size_t allocated () const { return m_allocated; }
+
+private:
+  struct Block
+  {
+    Block * next;
+  };
+  static const size_t ALIGN = sizeof(double) > sizeof(void *) ? sizeof(double) : sizeof(void *);
+
+  size_t const m_blockSize;
+  Block * m_blocks;
+  char * m_cur, * m_end;
+  size_t m_allocated;
+
+  void * allocSlow ( size_t size );
+};
+
+} // namespaces
+
+#endif /* P1_UTIL_ARENA_HPP */
@@ -0,0 +1,134 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_UTIL_CODEBUFFER_HPP
+#define P1_UTIL_CODEBUFFER_HPP
+
+#include "Arena.hpp"
+#include <string>
+#include <iosfwd>
+
+namespace p1 {
+
+/**
+ * Write the decimal digits of v backwards, ending just before "end".
+ * @return the first digit
+ */
+inline char * formatDecimal ( char * end, unsigned long long v )
+{
+  do
+    *--end = (char)('0' + v % 10);
+  while ((v /= 10) != 0);
+  return end;
+}
+
+/** "prefix" followed by the decimal digits of n, allocated in arena */
+const char * concatDecimal ( Arena & arena, const char * prefix, unsigned long long n );
+
+/**
+ * An append-only text buffer for generated code, kept as a chain of segments allocated from an
+ * Arena. Numbers are formatted without printf. The text is only made contiguous on request, so
+ * it can be written out segment by segment.
+ */
+class CodeBuffer
+{
+public:
+  struct Segment
+  {
+    Segment * next;
+    size_t size, capacity;
+
+    const char * data () const { return reinterpret_cast<const char *>(this + 1); }
+    char * data () { return reinterpret_cast<char *>(this + 1); }
+  };
+
+  explicit CodeBuffer ( Arena & arena )
+    : m_arena( arena ), m_first( NULL ), m_last( NULL ), m_size( 0 )
+  {}
+
+  bool empty () const { return m_size == 0; }
+  size_t size () const { return m_size; }
+  const Segment * segments () const { return m_first; }
+
+  /** Forget the text. The memory is released with the arena */
+  void clear ()
+  {
+    m_first = m_last = NULL;
+    m_size = 0;
+  }
+
+  __forceinline CodeBuffer & append ( const char * s, size_t len )
+  {
+    if (likely(m_last && m_last->capacity - m_last->size >= len))
+    {
+      std::memcpy( m_last->data() + m_last->size, s, len );
+      m_last->size += len;
+      m_size += len;
+      return *this;
+    }
+    else
+      return appendSlow( s, len );
+  }
+
+  CodeBuffer & operator<< ( const char * s ) { return append( s, std::strlen( s ) ); }
+  CodeBuffer & operator<< ( char c ) { return append( &c, 1 ); }
+  CodeBuffer & operator<< ( bool b ) { return *this << (b ? '1' : '0'); }
+  template <class A>
+  CodeBuffer & operator<< ( const std::basic_string<char, std::char_traits<char>, A> & s )
+  {
+    return append( s.data(), s.size() );
+  }
+  CodeBuffer & operator<< ( const CodeBuffer & buf );
+
+  CodeBuffer & operator<< ( unsigned long long v )
+  {
+    char buf[24];
+    char * const end = buf + sizeof(buf);
+    char * const p = formatDecimal( end, v );
+    return append( p, end - p );
+  }
+  CodeBuffer & operator<< ( long long v );
+  CodeBuffer & operator<< ( unsigned long v ) { return *this << (unsigned long long)v; }
+  CodeBuffer & operator<< ( unsigned v ) { return *this << (unsigned long long)v; }
+  CodeBuffer & operator<< ( unsigned short v ) { return *this << (unsigned long long)v; }
+  CodeBuffer & operator<< ( long v ) { return *this << (long long)v; }
+  CodeBuffer & operator<< ( int v ) { return *this << (long long)v; }
+
+  /** A NUL-terminated copy of the text, in the arena */
+  const char * str () const;
+
+  void writeTo ( std::ostream & os ) const;
+
+private:
+  /** The usual size of a segment */
+  static const size_t SEGMENT_SIZE = 1024 - sizeof(Segment);
+
+  Arena & m_arena;
+  Segment * m_first, * m_last;
+  size_t m_size;
+
+  CodeBuffer & appendSlow ( const char * s, size_t len );
+};
+
+inline std::ostream & operator<< ( std::ostream & os, const CodeBuffer & buf )
+{
+  buf.writeTo( os );
+  return os;
+}
+
+} // namespaces
+
+#endif /* P1_UTIL_CODEBUFFER_HPP */
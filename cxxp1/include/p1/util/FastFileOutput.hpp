@@ -0,0 +1,60 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_UTIL_FASTFILEOUTPUT_HPP
+#define P1_UTIL_FASTFILEOUTPUT_HPP
+
+#include "FastOutput.hpp"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+
+namespace p1 {
+
+/**
+ * Writes to a file descriptor through a large buffer. Blocks larger than the buffer are written
+ * directly.
+ */
+class FastFileOutput : public BufferedOutput<FastOutput>
+{
+  int m_handle;
+  bool m_own;
+
+public:
+  static const size_t DEFAULT_BUFSIZE = 1024*1024;
+
+  FastFileOutput ( const char * fileName, int oflags = O_WRONLY | O_CREAT | O_TRUNC,
+                   size_t bufSize = DEFAULT_BUFSIZE );
+  FastFileOutput ( int handle, size_t bufSize = DEFAULT_BUFSIZE );
+  /** Flushes, ignoring errors. Call {@link #close()} to see them */
+  virtual ~FastFileOutput ();
+
+  virtual void flush ();
+  /** Flush and close the file, if it is owned. Throw io_error on error */
+  virtual void close ();
+
+  /** Write all of a block to a descriptor, retrying after signals. Throw io_error on error */
+  static void writeAll ( int handle, const char * s, size_t len );
+
+protected:
+  virtual void drain ();
+  virtual void slowWrite ( const char * s, size_t len );
+};
+
+} // namespaces
+
+#endif /* P1_UTIL_FASTFILEOUTPUT_HPP */
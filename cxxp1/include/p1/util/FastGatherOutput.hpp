@@ -0,0 +1,69 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_UTIL_FASTGATHEROUTPUT_HPP
+#define P1_UTIL_FASTGATHEROUTPUT_HPP
+
+#include "FastOutput.hpp"
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <vector>
+
+namespace p1 {
+
+/**
+ * Writes to a file descriptor with writev(). Blocks passed to {@link #writeRef()} are not copied:
+ * they are gathered, in order, with the buffered small writes between them, and written out
+ * together when the buffer or the list of blocks fills up.
+ */
+class FastGatherOutput : public BufferedOutput<FastOutput>
+{
+  int m_handle;
+  bool m_own;
+  std::vector<struct iovec> m_iov;
+  /** The start of the buffered bytes which aren't in m_iov yet */
+  char * m_sliceStart;
+
+public:
+  /** Smaller blocks are copied into the buffer */
+  static const size_t MIN_REF = 128;
+
+  FastGatherOutput ( const char * fileName, int oflags = O_WRONLY | O_CREAT | O_TRUNC,
+                     size_t bufSize = DEFAULT_BUFSIZE );
+  FastGatherOutput ( int handle, size_t bufSize = DEFAULT_BUFSIZE );
+  /** Flushes, ignoring errors. Call {@link #close()} to see them */
+  virtual ~FastGatherOutput ();
+
+  virtual void writeRef ( const char * s, size_t len );
+  virtual bool keepsRefs () const { return true; }
+
+  virtual void flush ();
+  /** Flush and close the file, if it is owned. Throw io_error on error */
+  virtual void close ();
+
+protected:
+  virtual void drain ();
+
+private:
+  void init ();
+  void closeSlice ();
+};
+
+} // namespaces
+
+#endif /* P1_UTIL_FASTGATHEROUTPUT_HPP */
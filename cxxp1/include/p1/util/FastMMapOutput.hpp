@@ -0,0 +1,57 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_UTIL_FASTMMAPOUTPUT_HPP
+#define P1_UTIL_FASTMMAPOUTPUT_HPP
+
+#include "FastOutput.hpp"
+
+namespace p1 {
+
+/**
+ * Writes a file through a memory mapping. The file is extended with ftruncate() and mapped one
+ * window at a time, and cut to the length actually written when closed.
+ */
+class FastMMapOutput : public FastOutput
+{
+  int m_handle;
+  size_t const m_window;
+  void * m_map;
+
+public:
+  static const size_t DEFAULT_WINDOW = 64*1024*1024;
+
+  /** @param window the size of each mapping; rounded up to a multiple of the page size */
+  FastMMapOutput ( const char * fileName, size_t window = DEFAULT_WINDOW );
+  /** Closes, ignoring errors. Call {@link #close()} to see them */
+  virtual ~FastMMapOutput ();
+
+  /** The written data is already in the file; this does nothing */
+  virtual void flush ();
+  /** Unmap, cut the file to its length and close it. Throw io_error on error */
+  virtual void close ();
+
+protected:
+  virtual void drain ();
+
+private:
+  void map ( off_t offset );
+  void unmap ();
+};
+
+} // namespaces
+
+#endif /* P1_UTIL_FASTMMAPOUTPUT_HPP */
@@ -0,0 +1,169 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_UTIL_FASTOUTPUT_HPP
+#define P1_UTIL_FASTOUTPUT_HPP
+
+#include "FastInput.hpp"
+#include "CodeBuffer.hpp"
+
+#include <sys/types.h>
+#include <iosfwd>
+
+namespace p1 {
+
+/**
+ * A buffered output sink. Writing into the buffer is inline; the subclasses decide what
+ * happens when it fills up.
+ */
+class FastOutput
+{
+protected:
+  char * m_buf, * m_head, * m_end;
+  /** The offset in the output of everything which isn't in the buffer */
+  off_t m_bufOffset;
+  unsigned long m_flushCount;
+
+  FastOutput ( char * buf, size_t size )
+  {
+    m_buf = m_head = buf;
+    m_end = buf + size;
+    m_bufOffset = 0;
+    m_flushCount = 0;
+  }
+
+public:
+  virtual ~FastOutput () {};
+
+  __forceinline void put ( char c )
+  {
+    if (likely(m_head != m_end))
+      *m_head++ = c;
+    else
+      slowWrite( &c, 1 );
+  }
+
+  __forceinline void write ( const char * s, size_t len )
+  {
+    if (likely((size_t)(m_end - m_head) >= len))
+    {
+      std::memcpy( m_head, s, len );
+      m_head += len;
+    }
+    else
+      slowWrite( s, len );
+  }
+
+  /**
+   * Write a block which the caller leaves unchanged until {@link #flushCount()} changes. Sinks
+   * which can gather refer to it instead of copying it.
+   */
+  virtual void writeRef ( const char * s, size_t len ) { write( s, len ); }
+  /** Whether {@link #writeRef()} may keep references */
+  virtual bool keepsRefs () const { return false; }
+
+  /** Changes every time everything written so far, including references, has been passed on */
+  unsigned long flushCount () const { return m_flushCount; }
+
+  /** The number of bytes written so far */
+  off_t offset () const
+  {
+    return m_bufOffset + (m_head - m_buf);
+  }
+
+  /**
+   * Pass everything written so far on. Throw io_error on error.
+   */
+  virtual void flush () = 0;
+  /**
+   * Flush and release the destination. Throw io_error on error.
+   */
+  virtual void close () { flush(); }
+
+  FastOutput & operator<< ( const char * s ) { write( s, std::strlen( s ) ); return *this; }
+  FastOutput & operator<< ( char c ) { put( c ); return *this; }
+  template <class A>
+  FastOutput & operator<< ( const std::basic_string<char, std::char_traits<char>, A> & s )
+  {
+    write( s.data(), s.size() );
+    return *this;
+  }
+  FastOutput & operator<< ( const CodeBuffer & buf );
+
+  FastOutput & operator<< ( unsigned long long v )
+  {
+    char buf[24];
+    char * const end = buf + sizeof(buf);
+    char * const p = formatDecimal( end, v );
+    write( p, end - p );
+    return *this;
+  }
+  FastOutput & operator<< ( long long v );
+  FastOutput & operator<< ( unsigned long v ) { return *this << (unsigned long long)v; }
+  FastOutput & operator<< ( unsigned v ) { return *this << (unsigned long long)v; }
+  FastOutput & operator<< ( long v ) { return *this << (long long)v; }
+  FastOutput & operator<< ( int v ) { return *this << (long long)v; }
+
+  /** Write the segments of a buffer with {@link #writeRef()} */
+  void writeRefs ( const CodeBuffer & buf )
+  {
+    for ( const CodeBuffer::Segment * seg = buf.segments(); seg; seg = seg->next )
+      writeRef( seg->data(), seg->size );
+  }
+
+protected:
+  /**
+   * Called when the buffer is full: write out its contents, or move it, so there is room in it
+   * again. Throw io_error on error.
+   */
+  virtual void drain () = 0;
+  virtual void slowWrite ( const char * s, size_t len );
+};
+
+template<class BASE>
+class BufferedOutput : public BASE
+{
+  boost::scoped_array<char> m_bufCleaner;
+
+protected:
+  static const size_t DEFAULT_BUFSIZE = 64*1024;
+  size_t const m_bufSize;
+
+  BufferedOutput ( size_t bufSize )
+    : BASE( new char[bufSize], bufSize ), m_bufCleaner( BASE::m_buf ), m_bufSize( bufSize )
+  {}
+};
+
+/**
+ * Passes the output on to a std::ostream
+ */
+class OStreamOutput : public BufferedOutput<FastOutput>
+{
+  std::ostream & m_os;
+
+public:
+  explicit OStreamOutput ( std::ostream & os, size_t bufSize = 8192 );
+  /** Doesn't flush */
+  virtual ~OStreamOutput () {};
+  /** Writes the buffer to the stream, without flushing the stream */
+  virtual void flush ();
+protected:
+  virtual void drain ();
+};
+
+} // namespaces
+
+#endif /* P1_UTIL_FASTOUTPUT_HPP */
@@ -0,0 +1,106 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_UTIL_SPSCQUEUE_HPP
+#define P1_UTIL_SPSCQUEUE_HPP
+
+#include "gc-support.hpp"
+#include <boost/noncopyable.hpp>
+#include <vector>
+#include <cassert>
+
+namespace p1 {
+
+/**
+ * A bounded lock-free queue between exactly one producer thread and one consumer thread.
+ *
+ * The head and the tail are on separate cache lines, and each side keeps a private copy of the
+ * other side's index, which it refreshes only when the queue looks full (or empty), so in the
+ * steady state the two threads don't share any cache lines except for the slots themselves.
+ *
+ * The slots are visible to the collector, so the elements may point into the GC heap. A popped
+ * slot is cleared, so it doesn't keep its object alive.
+ */
+template <typename T>
+class SpscQueue : public boost::noncopyable
+{
+public:
+  /** @param capacity rounded up to a power of 2 */
+  explicit SpscQueue ( unsigned capacity )
+  {
+    unsigned size = 2;
+    while (size < capacity)
+      size <<= 1;
+    m_slots.resize( size );
+    m_mask = size - 1;
+    m_head = m_tail = 0;
+    m_headCache = m_tailCache = 0;
+  }
+
+  unsigned capacity () const { return m_mask + 1; }
+
+  /** Producer only. @return false if the queue is full */
+  bool tryPush ( const T & x )
+  {
+    unsigned const tail = m_tail;
+    if (tail - m_headCache > m_mask)
+    {
+      m_headCache = __atomic_load_n( &m_head, __ATOMIC_ACQUIRE );
+      if (tail - m_headCache > m_mask)
+        return false;
+    }
+    m_slots[tail & m_mask] = x;
+    __atomic_store_n( &m_tail, tail + 1, __ATOMIC_RELEASE );
+    return true;
+  }
+
+  /** Consumer only. @return false if the queue is empty */
+  bool tryPop ( T & x )
+  {
+    unsigned const head = m_head;
+    if (head == m_tailCache)
+    {
+      m_tailCache = __atomic_load_n( &m_tail, __ATOMIC_ACQUIRE );
+      if (head == m_tailCache)
+        return false;
+    }
+    T & slot = m_slots[head & m_mask];
+    x = slot;
+    slot = T();
+    __atomic_store_n( &m_head, head + 1, __ATOMIC_RELEASE );
+    return true;
+  }
+
+private:
+  std::vector<T, gc_allocator<T> > m_slots;
+  unsigned m_mask;
+
+  static const unsigned CACHE_LINE = 64;
+
+  char m_pad0[CACHE_LINE];
+  /** Consumer side */
+  unsigned m_head;
+  unsigned m_tailCache;
+  char m_pad1[CACHE_LINE];
+  /** Producer side */
+  unsigned m_tail;
+  unsigned m_headCache;
+  char m_pad2[CACHE_LINE];
+};
+
+} // namespaces
+
+#endif /* P1_UTIL_SPSCQUEUE_HPP */
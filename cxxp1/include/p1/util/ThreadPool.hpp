@@ -0,0 +1,110 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_UTIL_THREADPOOL_HPP
+#define P1_UTIL_THREADPOOL_HPP
+
+#include "gc-support.hpp"
+#include <boost/noncopyable.hpp>
+#include <pthread.h>
+#include <vector>
+
+namespace p1 {
+
+/**
+ * A fixed set of worker threads with work stealing.
+ *
+ * Every worker has its own deque of tasks. A task submitted by a worker goes to the back of its
+ * own deque, and workers take their own tasks from the back, so related work stays on the same
+ * thread while its data is still in the cache. An idle worker steals the oldest task from the
+ * front of another worker's deque. Tasks submitted from other threads are dealt round-robin.
+ *
+ * The workers are registered with the collector (the build defines GC_THREADS). The worker list
+ * and the workers are uncollectable but scanned, so the deques stay visible to the collector
+ * wherever the pool itself lives (e.g. on the malloc heap), and a queued task may be a
+ * collectable object. The pool never deletes tasks.
+ */
+class ThreadPool : public boost::noncopyable
+{
+public:
+  class Task
+  {
+  public:
+    virtual ~Task () {}
+    /** Called on one of the workers. Must not throw */
+    virtual void run () = 0;
+  };
+
+  struct Stats
+  {
+    unsigned long executed;
+    unsigned long stolen; //< tasks executed by a worker other than the one they were queued on
+  };
+
+  /** @param threads the number of workers; 0 means one per online processor */
+  explicit ThreadPool ( unsigned threads = 0 );
+  /** Waits for all tasks and stops the workers */
+  ~ThreadPool ();
+
+  unsigned size () const { return m_workers.size(); }
+
+  void submit ( Task * task );
+
+  /**
+   * Block until every submitted task, including the ones submitted by other tasks, has run.
+   * Must not be called from a worker.
+   */
+  void wait ();
+
+  /** @return the index of the calling worker of this pool, or -1 for other threads */
+  int currentWorker () const;
+
+  /** Valid after {@link #wait()} */
+  Stats stats () const;
+
+  static unsigned processorCount ();
+
+private:
+  struct Worker;
+  /** Uncollectable, so nothing is freed while the pool may be in unscanned memory */
+  typedef std::vector<Worker *, traceable_allocator<Worker *> > WorkerList;
+
+  WorkerList m_workers;
+  pthread_key_t m_self;
+
+  pthread_mutex_t m_lock;
+  /** Signalled when tasks are queued, or when stopping */
+  pthread_cond_t m_workAvailable;
+  /** Signalled when m_pending drops to 0 */
+  pthread_cond_t m_allDone;
+  bool m_stop;
+
+  /** Tasks waiting in the deques. Updated atomically; read under m_lock before sleeping */
+  volatile unsigned m_queued;
+  /** Tasks submitted but not finished yet. Updated atomically */
+  volatile unsigned m_pending;
+  /** The next deque for tasks submitted from outside */
+  volatile unsigned m_next;
+
+  void shutdown ();
+  static void * threadMain ( void * arg );
+  void workerLoop ( Worker * self );
+  Task * take ( Worker * self );
+};
+
+} // namespaces
+
+#endif /* P1_UTIL_THREADPOOL_HPP */
@@ -0,0 +1,64 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_UTIL_UNIXSOCKET_HPP
+#define P1_UTIL_UNIXSOCKET_HPP
+
+#include "FastInput.hpp"
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+
+namespace p1 {
+
+/**
+ * A blocking Unix domain stream socket exchanging length-prefixed messages. Owns the
+ * descriptor. All operations throw io_error on failure.
+ */
+class UnixSocket : public boost::noncopyable
+{
+  int m_fd;
+public:
+  explicit UnixSocket ( int fd ) : m_fd( fd ) {}
+  ~UnixSocket ();
+
+  /**
+   * Listen on a new socket at the path. A stale socket file left by a dead server is replaced,
+   * but a live one is not.
+   */
+  static int listen ( const char * path );
+  static int connect ( const char * path );
+
+  int fd () const { return m_fd; }
+
+  /** Wait for a connection on a listening socket */
+  int accept ();
+
+  /** The longest message accepted by {@link #readMessage} */
+  static const uint32_t MAX_MESSAGE = 256u << 20;
+
+  void writeMessage ( const std::string & msg );
+  /** @return false if the peer closed the connection before the start of the message */
+  bool readMessage ( std::string & msg );
+
+private:
+  void writeAll ( const void * buf, size_t len );
+  bool readAll ( void * buf, size_t len );
+};
+
+} // namespaces
+
+#endif /* P1_UTIL_UNIXSOCKET_HPP */
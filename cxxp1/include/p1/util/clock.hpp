@@ -0,0 +1,38 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+=============================================================================
+   High resolution time measurement
+*/
+
+#ifndef P1_UTIL_CLOCK_HPP
+#define P1_UTIL_CLOCK_HPP
+
+#include <time.h>
+#include <stdint.h>
+
+namespace p1 {
+
+/** Nanoseconds since an arbitrary point, unaffected by changes of the system time */
+inline uint64_t monotonicNanos ()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+} // namespaces
+
+#endif /* P1_UTIL_CLOCK_HPP */
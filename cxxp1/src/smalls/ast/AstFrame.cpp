@@ -17,6 +17,7 @@
 #include "AstFrame.hpp"
 #include "p1/util/format-str.hpp"
 #include <iostream>
+#include <cassert>
 
 using namespace p1;
 using namespace p1::smalls;
@@ -26,19 +27,38 @@ std::ostream & p1::smalls::operator<< ( std::ostream & os, const AstVariable & v
   return os << var.name << ':' << var.frame->level;
 }
 
+AstFrame::AstFrame ( AstFrame * parent_ )
+  : parent( parent_ ), level( parent_?parent_->level + 1 : -1),
+    m_idFrame( !parent_ || !parent_->parent ? this : parent_->m_idFrame )
+{
+  m_idsShared = false;
+  m_nextId = 0;
+  if (parent_ && m_idFrame == this)
+  {
+    m_nextId = parent_->m_nextId;
+    parent_->m_idsShared = true;
+  }
+}
+
+unsigned AstFrame::newId ()
+{
+  assert( !m_idFrame->m_idsShared && "Variable added to the system frame after a module" );
+  return m_idFrame->m_nextId++;
+}
+
 AstVariable * AstFrame::newVariable ( const gc_char * name, const SourceCoords & defCoords )
 {
-  AstVariable * var = new AstVariable( name, this, defCoords );
+  AstVariable * var = new AstVariable( name, this, m_vars.size(), newId(), defCoords );
   m_vars.push_back( var );
-  ++m_varCount;
   return var;
 }
 
 AstVariable * AstFrame::newAnonymous ( const gc_char * infoPrefix, const SourceCoords & defCoords )
 {
   // Note that variable names don't really need to be unique in a frame
-  AstVariable * var = new AstVariable( formatGCStr("tmp_%s_%u", infoPrefix, m_varCount), this, defCoords );
+  unsigned const index = m_vars.size();
+  AstVariable * var = new AstVariable( formatGCStr("tmp_%s_%u", infoPrefix, index), this, index, newId(),
+                                       defCoords );
   m_vars.push_back( var );
-  ++m_varCount;
   return var;
 }
@@ -0,0 +1,135 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "AstRewriter.hpp"
+#include <boost/foreach.hpp>
+
+namespace p1 {
+namespace smalls {
+
+Ast * AstRewriter::rewrite ( Ast * ast )
+{
+  if (!ast)
+    return NULL;
+
+  ++m_visited;
+  Ast * res;
+  switch (ast->kind)
+  {
+  case AstKind::UNSPECIFIED: res = visitUnspecified( static_cast<AstUnspecified *>(ast) ); break;
+  case AstKind::VAR: res = visitVar( static_cast<AstVar *>(ast) ); break;
+  case AstKind::DATUM: res = visitDatum( static_cast<AstDatum *>(ast) ); break;
+  case AstKind::SET: res = visitSet( static_cast<AstSet *>(ast) ); break;
+  case AstKind::APPLY: res = visitApply( static_cast<AstApply *>(ast) ); break;
+  case AstKind::IF: res = visitIf( static_cast<AstIf *>(ast) ); break;
+  case AstKind::BEGIN: res = visitBegin( static_cast<AstBegin *>(ast) ); break;
+  case AstKind::BODY:
+    visitBody( static_cast<AstBody *>(ast) );
+    return ast;
+  case AstKind::CLOSURE: res = visitClosure( static_cast<AstClosure *>(ast) ); break;
+  case AstKind::LET:
+  case AstKind::FIX:
+    res = visitLet( static_cast<AstLet *>(ast) );
+    break;
+  default:
+    assert( false && "Unknown AST kind" );
+    return ast;
+  }
+
+  if (res != ast)
+    ++m_replaced;
+  return res;
+}
+
+void AstRewriter::rewriteBody ( AstBody * body )
+{
+  ++m_visited;
+  visitBody( body );
+}
+
+void AstRewriter::rewriteList ( ListOfAst & lst )
+{
+  BOOST_FOREACH( Ast * & ast, lst )
+    ast = rewrite( ast );
+}
+
+Ast * AstRewriter::visitUnspecified ( AstUnspecified * ast )
+{
+  return ast;
+}
+
+Ast * AstRewriter::visitVar ( AstVar * ast )
+{
+  return ast;
+}
+
+Ast * AstRewriter::visitDatum ( AstDatum * ast )
+{
+  return ast;
+}
+
+Ast * AstRewriter::visitSet ( AstSet * ast )
+{
+  ast->rvalue = rewrite( ast->rvalue );
+  return ast;
+}
+
+Ast * AstRewriter::visitApply ( AstApply * ast )
+{
+  ast->target = rewrite( ast->target );
+  BOOST_FOREACH( Ast * & param, ast->params() )
+    param = rewrite( param );
+  ast->listParam = rewrite( ast->listParam );
+  return ast;
+}
+
+Ast * AstRewriter::visitIf ( AstIf * ast )
+{
+  ast->cond = rewrite( ast->cond );
+  ast->thenAst = rewrite( ast->thenAst );
+  ast->elseAst = rewrite( ast->elseAst );
+  return ast;
+}
+
+Ast * AstRewriter::visitBegin ( AstBegin * ast )
+{
+  rewriteList( ast->exprList() );
+  return ast;
+}
+
+void AstRewriter::visitBody ( AstBody * body )
+{
+  BOOST_FOREACH( AstBody::Definition & defn, body->defs() )
+    defn.second = rewrite( defn.second );
+  rewriteList( body->exprList() );
+}
+
+Ast * AstRewriter::visitClosure ( AstClosure * ast )
+{
+  if (m_enterClosures)
+    rewriteBody( ast->body );
+  return ast;
+}
+
+Ast * AstRewriter::visitLet ( AstLet * ast )
+{
+  BOOST_FOREACH( Ast * & value, *ast->values )
+    value = rewrite( value );
+  rewriteBody( ast->body );
+  return ast;
+}
+
+}} // namespaces
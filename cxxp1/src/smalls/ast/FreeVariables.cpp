@@ -0,0 +1,209 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "FreeVariables.hpp"
+#include <boost/foreach.hpp>
+#include <algorithm>
+
+namespace p1 {
+namespace smalls {
+
+namespace {
+
+class Analysis
+{
+public:
+  explicit Analysis ( VarFlagTable & flags )
+    : m_flags( flags ), m_baseLevel( 1 ), m_freeVars( NULL )
+  {}
+
+  void walkFunction ( AstBody * body, int baseLevel, VectorOfVariable * freeVars );
+
+private:
+  VarFlagTable & m_flags;
+  /** The frames at this level and deeper belong to the current function */
+  int m_baseLevel;
+  VectorOfVariable * m_freeVars;
+
+  void walk ( Ast * ast );
+  void walkBody ( AstBody * body );
+  void walkClosure ( AstClosure * cl );
+  void ref ( AstVariable * var );
+
+  static bool isLambdaDef ( const AstBody::Definition & defn )
+  {
+    return defn.first && defn.second->kind == AstKind::CLOSURE;
+  }
+};
+
+void Analysis::walkFunction ( AstBody * body, int baseLevel, VectorOfVariable * freeVars )
+{
+  int const saveBase = m_baseLevel;
+  VectorOfVariable * const saveFree = m_freeVars;
+  m_baseLevel = baseLevel;
+  m_freeVars = freeVars;
+
+  walkBody( body );
+
+  m_baseLevel = saveBase;
+  m_freeVars = saveFree;
+}
+
+void Analysis::ref ( AstVariable * var )
+{
+  int const level = var->frame->level;
+  if (level > 0 && level < m_baseLevel &&
+      std::find( m_freeVars->begin(), m_freeVars->end(), var ) == m_freeVars->end())
+  {
+    m_freeVars->push_back( var );
+  }
+}
+
+void Analysis::walkClosure ( AstClosure * cl )
+{
+  VectorOfVariable * freeVars = cl->freeVars;
+  if (freeVars)
+    freeVars->clear();
+  else
+    cl->freeVars = freeVars = new (GC) VectorOfVariable();
+
+  walkFunction( cl->body, cl->paramFrame->level, freeVars );
+
+  BOOST_FOREACH( AstVariable * var, *freeVars )
+  {
+    unsigned char & f = m_flags[var];
+    f |= VarFlags::CAPTURED;
+    // Created while the definition of the variable is still pending
+    if (f & VarFlags::PENDING)
+      f |= VarFlags::EARLY;
+    ref( var );
+  }
+}
+
+/**
+ * The definitions are evaluated in order, so until its own definition has been evaluated, a
+ * variable is pending. The variables of a group of consecutive closure definitions are filled in
+ * before the closures capture anything.
+ */
+void Analysis::walkBody ( AstBody * body )
+{
+  AstBody::DefinitionList & defs = body->defs();
+  BOOST_FOREACH( AstBody::Definition & defn, defs )
+    if (defn.first)
+      m_flags[defn.first] |= VarFlags::PENDING;
+
+  for ( AstBody::Definition * it = defs.begin(), * end = defs.end(); it != end; )
+  {
+    AstBody::Definition * groupEnd = it + 1;
+    if (isLambdaDef( *it ))
+    {
+      while (groupEnd != end && isLambdaDef( *groupEnd ))
+        ++groupEnd;
+      for ( AstBody::Definition * d = it; d != groupEnd; ++d )
+        m_flags[d->first] &= ~VarFlags::PENDING;
+    }
+
+    for ( ; it != groupEnd; ++it )
+    {
+      walk( it->second );
+      if (it->first)
+        m_flags[it->first] &= ~VarFlags::PENDING;
+    }
+  }
+
+  BOOST_FOREACH( Ast * ast, body->exprList() )
+    walk( ast );
+}
+
+void Analysis::walk ( Ast * ast )
+{
+  if (!ast)
+    return;
+
+  switch (ast->kind)
+  {
+  case AstKind::VAR:
+    ref( static_cast<AstVar *>(ast)->var );
+    break;
+
+  case AstKind::SET:
+    {
+      AstSet * set = static_cast<AstSet *>(ast);
+      m_flags[set->target] |= VarFlags::ASSIGNED;
+      ref( set->target );
+      walk( set->rvalue );
+    }
+    break;
+
+  case AstKind::APPLY:
+    {
+      AstApply * ap = static_cast<AstApply *>(ast);
+      walk( ap->target );
+      BOOST_FOREACH( Ast * param, ap->params() )
+        walk( param );
+      walk( ap->listParam );
+    }
+    break;
+
+  case AstKind::IF:
+    {
+      AstIf * aif = static_cast<AstIf *>(ast);
+      walk( aif->cond );
+      walk( aif->thenAst );
+      walk( aif->elseAst );
+    }
+    break;
+
+  case AstKind::BEGIN:
+    BOOST_FOREACH( Ast * expr, static_cast<AstBegin *>(ast)->exprList() )
+      walk( expr );
+    break;
+
+  case AstKind::BODY:
+    walkBody( static_cast<AstBody *>(ast) );
+    break;
+
+  case AstKind::CLOSURE:
+    walkClosure( static_cast<AstClosure *>(ast) );
+    break;
+
+  case AstKind::LET:
+  case AstKind::FIX:
+    {
+      // The closures of a FIX are created together, like a group of definitions
+      AstLet * let = static_cast<AstLet *>(ast);
+      BOOST_FOREACH( Ast * value, *let->values )
+        walk( value );
+      walkBody( let->body );
+    }
+    break;
+
+  default:
+    break;
+  }
+}
+
+} // anonymous namespace
+
+void analyseClosures ( AstBody * root, VarFlagTable & flags )
+{
+  // Everything below the top-level frame belongs to the function of the body
+  VectorOfVariable none;
+  Analysis( flags ).walkFunction( root, 1, &none );
+  assert( none.empty() );
+}
+
+}} // namespaces
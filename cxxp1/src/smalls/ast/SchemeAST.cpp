@@ -36,13 +36,13 @@ std::ostream & printListOfAst ( std::ostream & os, const ListOfAst & lst, const
   if (lst.empty())
     return os;
 
-  if (!lst.next(lst.first()))
-    return os << *lst.first();
+  if (lst.size() == 1)
+    return os << *lst.front();
 
   if (tag)
     os << "(" << tag << OStreamSetIndent(+4);
 
-  for ( ListOfAst::const_iterator ast = lst.begin(); ast != lst.end(); ++ast )
+  BOOST_FOREACH( const Ast * ast, lst )
     os << '\n' << OStreamIndent() << *ast;
 
   if (tag)
@@ -89,7 +89,7 @@ void AstApply::toStream ( std::ostream & os ) const
 {
   os << '(' << AstKind::name( this->kind ) << ' ' << *this->target << ' ';
 
-  BOOST_FOREACH( Ast * ast, *this->params )
+  BOOST_FOREACH( Ast * ast, this->params() )
     os << *ast << ' ';
 
   if (this->listParam)
@@ -165,7 +165,7 @@ void AstClosure::toStream ( std::ostream & os ) const
 
   os << '(';
   unsigned c = 0;
-  BOOST_FOREACH( AstVariable * var, *this->params )
+  BOOST_FOREACH( AstVariable * var, this->params() )
   {
     if (c++ > 0)
       os << ' ';
@@ -200,6 +200,75 @@ void AstLet::toStream ( std::ostream & os ) const
      << OStreamSetIndent(-4);
 }
 
+static void markTail ( Ast * ast, bool tail, ListOfApply * calls );
+
+static void markTailList ( ListOfAst & lst, bool tail, ListOfApply * calls )
+{
+  for ( ListOfAst::iterator it = lst.begin(), e = lst.end(); it != e; ++it )
+    markTail( *it, tail && it + 1 == e, calls );
+}
+
+static void markTail ( Ast * ast, bool tail, ListOfApply * calls )
+{
+  if (!ast)
+    return;
+
+  switch (ast->kind)
+  {
+  case AstKind::APPLY:
+    {
+      AstApply * ap = static_cast<AstApply *>(ast);
+      ap->tail = tail;
+      if (tail && calls)
+        calls->push_back( ap );
+      markTail( ap->target, false, calls );
+      BOOST_FOREACH( Ast * param, ap->params() )
+        markTail( param, false, calls );
+      markTail( ap->listParam, false, calls );
+    }
+    break;
+
+  case AstKind::IF:
+    {
+      AstIf * aif = static_cast<AstIf *>(ast);
+      markTail( aif->cond, false, calls );
+      markTail( aif->thenAst, tail, calls );
+      markTail( aif->elseAst, tail, calls );
+    }
+    break;
+
+  case AstKind::SET:
+    markTail( static_cast<AstSet *>(ast)->rvalue, false, calls );
+    break;
+
+  case AstKind::BODY:
+    BOOST_FOREACH( AstBody::Definition & defn, static_cast<AstBody *>(ast)->defs() )
+      markTail( defn.second, false, calls );
+    // fall through to the expressions
+  case AstKind::BEGIN:
+    markTailList( static_cast<AstBegin *>(ast)->exprList(), tail, calls );
+    break;
+
+  case AstKind::LET:
+  case AstKind::FIX:
+    {
+      AstLet * let = static_cast<AstLet *>(ast);
+      BOOST_FOREACH( Ast * value, *let->values )
+        markTail( value, false, calls );
+      markTail( let->body, tail, calls );
+    }
+    break;
+
+  default: // closures are marked on their own
+    break;
+  }
+}
+
+void markTailCalls ( AstBody * body, ListOfApply * calls )
+{
+  markTail( body, true, calls );
+}
+
 AstFix::AstFix (
   const SourceCoords & coords_,
   AstFrame * paramFrame,
@@ -0,0 +1,102 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestVarTable.hpp"
+#include "VarTable.hpp"
+
+using namespace p1;
+using namespace p1::smalls;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestVarTable );
+
+TestVarTable::TestVarTable ( )
+{
+}
+
+TestVarTable::~TestVarTable ( )
+{
+}
+
+void TestVarTable::setUp ( )
+{
+}
+
+void TestVarTable::tearDown ( )
+{
+}
+
+void TestVarTable::testIds ( )
+{
+  SourceCoords coords;
+  AstFrame * sys = new AstFrame( NULL );
+  AstVariable * s0 = sys->newVariable( "car", coords );
+  AstVariable * s1 = sys->newVariable( "cdr", coords );
+  CPPUNIT_ASSERT_EQUAL( 0u, s0->id );
+  CPPUNIT_ASSERT_EQUAL( 1u, s1->id );
+
+  // Modules continue after the system frame, independently of each other
+  AstFrame * mod1 = new AstFrame( sys );
+  AstFrame * mod2 = new AstFrame( sys );
+  AstVariable * a = mod1->newVariable( "a", coords );
+  AstFrame * inner = new AstFrame( mod1 );
+  AstVariable * x = inner->newVariable( "x", coords );
+  AstVariable * y = inner->newAnonymous( "y", coords );
+  AstVariable * b = mod1->newVariable( "b", coords );
+  AstVariable * c = mod2->newVariable( "c", coords );
+
+  CPPUNIT_ASSERT_EQUAL( 2u, a->id );
+  CPPUNIT_ASSERT_EQUAL( 3u, x->id );
+  CPPUNIT_ASSERT_EQUAL( 4u, y->id );
+  CPPUNIT_ASSERT_EQUAL( 5u, b->id );
+  CPPUNIT_ASSERT_EQUAL( 2u, c->id );
+  CPPUNIT_ASSERT_EQUAL( 6u, inner->idLimit() );
+  CPPUNIT_ASSERT_EQUAL( 3u, mod2->idLimit() );
+
+  CPPUNIT_ASSERT_EQUAL( 1u, b->index );
+  CPPUNIT_ASSERT_EQUAL( 1u, y->index );
+  CPPUNIT_ASSERT( inner->var( 0 ) == x );
+}
+
+void TestVarTable::testTable ( )
+{
+  SourceCoords coords;
+  AstFrame * sys = new AstFrame( NULL );
+  sys->newVariable( "car", coords );
+  AstFrame * mod = new AstFrame( sys );
+  AstVariable * a = mod->newVariable( "a", coords );
+  AstVariable * b = mod->newVariable( "b", coords );
+
+  VarTable<int> refs( -1 );
+  CPPUNIT_ASSERT_EQUAL( -1, refs.get( b ) );
+  ++refs[a];
+  ++refs[a];
+  CPPUNIT_ASSERT_EQUAL( 1, refs.get( a ) );
+  CPPUNIT_ASSERT_EQUAL( -1, refs.get( b ) );
+
+  // Variables created after the table was sized
+  AstFrame * inner = new AstFrame( mod );
+  AstVariable * x = inner->newVariable( "x", coords );
+  refs[x] = 7;
+  CPPUNIT_ASSERT_EQUAL( 7, refs.get( x ) );
+  CPPUNIT_ASSERT_EQUAL( 1, refs.get( a ) );
+
+  refs.reserve( inner );
+  CPPUNIT_ASSERT_EQUAL( -1, refs.get( sys->var( 0 ) ) );
+
+  refs.clear();
+  CPPUNIT_ASSERT_EQUAL( -1, refs.get( a ) );
+  CPPUNIT_ASSERT_EQUAL( -1, refs.get( x ) );
+}
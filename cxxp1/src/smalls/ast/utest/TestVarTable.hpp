@@ -0,0 +1,39 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef TESTVARTABLE_HPP
+#define	TESTVARTABLE_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class TestVarTable : public CPPUNIT_NS::TestFixture {
+  CPPUNIT_TEST_SUITE(TestVarTable);
+  CPPUNIT_TEST(testIds);
+  CPPUNIT_TEST(testTable);
+  CPPUNIT_TEST_SUITE_END();
+
+public:
+  TestVarTable();
+  virtual ~TestVarTable();
+  void setUp();
+  void tearDown();
+
+private:
+  void testIds();
+  void testTable();
+};
+
+#endif	/* TESTVARTABLE_HPP */
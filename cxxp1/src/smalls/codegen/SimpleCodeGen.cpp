@@ -16,21 +16,346 @@
 */
 #include "SimpleCodeGen.hpp"
 #include "p1/smalls/parser/Syntax.hpp"
+#include "p1/util/ThreadPool.hpp"
+#include "p1/util/scopeguard.hpp"
+#include "p1/util/compiler.h"
 #include <boost/foreach.hpp>
-#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdio>
 
 namespace p1 {
 namespace smalls {
 
 static const unsigned PARAM_COUNT = 32;
 
+/** Closures claimed by a JobTask at a time */
+static const unsigned JOB_CHUNK = 8;
+
+/**
+ * Generates closure bodies, claiming them in source order a few at a time, so the finished
+ * functions can be written out soon after they are generated.
+ */
+class SimpleCodeGen::JobTask : public ThreadPool::Task
+{
+public:
+  explicit JobTask ( SimpleCodeGen * cg )
+    : m_cg( cg )
+  {}
+
+  virtual void run ()
+  {
+    try
+    {
+      unsigned const count = m_cg->m_jobs.size();
+      unsigned i;
+      while ((i = __sync_fetch_and_add( &m_cg->m_nextJob, JOB_CHUNK )) < count)
+      {
+        for ( unsigned e = std::min( i + JOB_CHUNK, count ); i != e; ++i )
+          m_cg->genClosureBody( m_cg->m_jobs[i] );
+      }
+    }
+    catch (std::exception & e)
+    {
+      m_cg->jobFailed( e.what() );
+    }
+  }
+
+private:
+  SimpleCodeGen * m_cg;
+};
+
+static CodeBuffer & operator<< ( CodeBuffer & os, const AstVariable & var )
+{
+  return os << var.name << ':' << var.frame->level;
+}
+
+template <class OS>
+static void putLineInfo ( OS & os, const SourceCoords * coords )
+{
+  if (coords)
+    os << "#line " << coords->line << " \"" << coords->fileName << "\" " << " // column:" << coords->column << '\n';
+}
+
+CodeBuffer & operator<< ( CodeBuffer & os, const SimpleCodeGen::LineInfo & li )
+{
+  putLineInfo( os, li.coords );
+  return os;
+}
+
+/**
+ * The slot of a variable in a frame, or the C local if frametmp is NULL, followed by the variable
+ * in a comment
+ */
+static const char * varRef ( Arena & arena, const char * frametmp, unsigned addr, const AstVariable * var )
+{
+  bool const local = !frametmp;
+  if (local)
+    frametmp = "loc_";
+
+  char abuf[24], lbuf[24];
+  char * const aend = abuf + sizeof(abuf);
+  char * const lend = lbuf + sizeof(lbuf);
+  const char * const a = formatDecimal( aend, addr );
+  int const level = var->frame->level;
+  char * l = formatDecimal( lend, level < 0 ? -(long long)level : level );
+  if (level < 0)
+    *--l = '-';
+
+  size_t const flen = std::strlen( frametmp );
+  size_t const nlen = std::strlen( var->name );
+  size_t const alen = aend - a, llen = lend - l;
+  char * const res = static_cast<char *>(arena.alloc( flen + alen + nlen + llen + 8 ));
+  char * p = res;
+  std::memcpy( p, frametmp, flen ); p += flen;
+  if (local)
+  {
+    std::memcpy( p, a, alen ); p += alen;
+  }
+  else
+  {
+    *p++ = '[';
+    std::memcpy( p, a, alen ); p += alen;
+    *p++ = ']';
+  }
+  std::memcpy( p, "/*", 2 ); p += 2;
+  std::memcpy( p, var->name, nlen ); p += nlen;
+  *p++ = ':';
+  std::memcpy( p, l, llen ); p += llen;
+  std::memcpy( p, "*/", 3 );
+  return res;
+}
+
+static const char * join ( Arena & arena, const char * a, const char * b )
+{
+  size_t const alen = std::strlen( a ), blen = std::strlen( b );
+  char * const res = static_cast<char *>(arena.alloc( alen + blen + 1 ));
+  std::memcpy( res, a, alen );
+  std::memcpy( res + alen, b, blen + 1 );
+  return res;
+}
+
+const unsigned SimpleCodeGen::NO_ADDR;
+
 SimpleCodeGen::SimpleCodeGen ()
+  : m_addrs( NO_ADDR )
 {
   m_tmpIndex = 0;
   m_optLineInfo = false;
+  m_sysCtx = NULL;
+  m_streamFrame = NULL;
+  m_streamVarsDone = 0;
+  m_streamVarsAdded = NULL;
+  m_streamVarsBounded = false;
+  m_funcPrefix = "func_";
+  m_topCount = 0;
+  m_streamCount = 0;
+  m_out = NULL;
+  m_flushNext = 0;
+  pthread_mutex_init( &m_flushLock, NULL );
+  m_pool = NULL;
+  m_nextJob = 0;
+  m_jobFailed = 0;
+}
+
+void SimpleCodeGen::generate ( FastOutput & os, AstModule * module )
+{
+  genPrologue( os );
+  genTopLevel( os, module );
+  os << "int main ( void ) {\n"
+        "  return (int)module_init();\n"
+        "}\n\n";
 }
 
 void SimpleCodeGen::generate ( std::ostream & os, AstModule * module )
+{
+  OStreamOutput out( os );
+  generate( out, module );
+  out.flush();
+}
+
+void SimpleCodeGen::beginStream ( std::ostream & os, AstModule * module )
+{
+  OStreamOutput out( os );
+  beginStream( out, module );
+  out.flush();
+}
+
+void SimpleCodeGen::genStreamForm ( std::ostream & os, AstBody * form )
+{
+  OStreamOutput out( os );
+  genStreamForm( out, form );
+  out.flush();
+}
+
+void SimpleCodeGen::genStreamForm ( std::ostream & os, AstBody * form, unsigned id )
+{
+  OStreamOutput out( os );
+  genStreamForm( out, form, id );
+  out.flush();
+}
+
+void SimpleCodeGen::reuseStreamForm ( std::ostream & os, const gc_string & code, unsigned id )
+{
+  OStreamOutput out( os );
+  reuseStreamForm( out, code, id );
+  out.flush();
+}
+
+void SimpleCodeGen::endStream ( std::ostream & os )
+{
+  OStreamOutput out( os );
+  endStream( out );
+  out.flush();
+}
+
+void SimpleCodeGen::beginStream ( FastOutput & os, AstModule * module )
+{
+  genPrologue( os );
+  m_sysCtx = genSystem( os, module );
+  m_streamFrame = module->body()->frame();
+  m_streamVarsDone = 0;
+  m_streamVarsAdded = NULL;
+  m_streamVarsBounded = false;
+  m_streamIds.clear();
+  ++m_streamCount;
+  os << "static reg_t * g_topframe;\n";
+  os << "\n";
+}
+
+void SimpleCodeGen::genStreamForm ( FastOutput & os, AstBody * form )
+{
+  genStreamFunc( os, form, m_streamIds.size() );
+}
+
+void SimpleCodeGen::genStreamForm ( FastOutput & os, AstBody * form, unsigned id )
+{
+  // Number the functions of the form separately
+  unsigned const tmpIndex = m_tmpIndex;
+  m_tmpIndex = 0;
+  m_funcPrefix = join( m_names, concatDecimal( m_names, "func_", id ), "_" );
+
+  genStreamFunc( os, form, id );
+
+  m_tmpIndex = tmpIndex;
+  m_funcPrefix = "func_";
+}
+
+void SimpleCodeGen::reuseStreamForm ( FastOutput & os, const gc_string & code, unsigned id )
+{
+  assignStreamAddresses( id );
+  m_streamIds.push_back( id );
+  os << code;
+}
+
+/**
+ * Assign addresses to the top-level variables added since the last form, which were created by
+ * the form "id". A name keeps its address in all streams. Variables introduced by macros may share
+ * a name with others (and the forms defining them aren't reused), so theirs are kept by name and
+ * form instead, and the address of a name always belongs to its plain definition, wherever it is.
+ */
+void SimpleCodeGen::assignStreamAddresses ( unsigned id )
+{
+  if (m_streamVarsBounded)
+  {
+    // The frame may be growing on the parser's thread, so only its copy can be used
+    if (m_streamVarsAdded)
+    {
+      BOOST_FOREACH( AstVariable * var, *m_streamVarsAdded )
+        assignStreamAddress( var, id );
+      m_streamVarsDone += m_streamVarsAdded->size();
+      m_streamVarsAdded = NULL;
+    }
+    return;
+  }
+
+  for ( unsigned e = m_streamFrame->length(); m_streamVarsDone < e; ++m_streamVarsDone )
+    assignStreamAddress( m_streamFrame->var( m_streamVarsDone ), id );
+}
+
+void SimpleCodeGen::assignStreamAddress ( AstVariable * var, unsigned id )
+{
+  unsigned & addr = m_addrs[var];
+  assert( addr == NO_ADDR && "Variable already assigned an address" );
+  if (!var->introduced)
+  {
+    std::pair<TopAddrMap::iterator, bool> ins = m_topAddrs.insert(
+      TopAddrMap::value_type( gc_string( var->name ), 0 )
+    );
+    if (ins.second)
+      ins.first->second = ++m_topCount;
+    addr = ins.first->second;
+    return;
+  }
+
+  std::pair<FormAddrMap::iterator, bool> ins = m_formAddrs.insert(
+    FormAddrMap::value_type( FormAddrKey( gc_string( var->name ), id ), FormAddrs() )
+  );
+  FormAddrs & fa = ins.first->second;
+  if (ins.second || fa.stream != m_streamCount)
+  {
+    fa.stream = m_streamCount;
+    fa.used = 0;
+  }
+  if (fa.used == fa.addrs.size())
+    fa.addrs.push_back( ++m_topCount );
+  addr = fa.addrs[fa.used++];
+}
+
+void SimpleCodeGen::genStreamFunc ( FastOutput & os, AstBody * form, unsigned id )
+{
+  assert( form->frame() == m_streamFrame );
+
+  assignStreamAddresses( id );
+  m_streamIds.push_back( id );
+
+  Func * f = newFunc( form->coords, concatDecimal( m_names, "toplevel_", id ) );
+  Context * ctx = new Context( m_sysCtx, f, "g_topframe", m_streamFrame );
+  analyseClosures( form, m_varFlags );
+  prepareBody( ctx, form );
+  beginFuncs( os );
+
+  CodeBuffer & ss = f->contents;
+  const char * restmp = genBodyContents( ss, ctx, form );
+  if (!restmp)
+    restmp = "0";
+  ss << "  return (reg_t)"<<restmp<<";\n";
+  funcDone( f );
+
+  genClosureBodies();
+  endFuncs();
+}
+
+void SimpleCodeGen::endStream ( FastOutput & os )
+{
+  Func * f = newFunc( SourceCoords(), "module_init" );
+  beginFuncs( os );
+  CodeBuffer & ss = f->contents;
+  // Variables which were created after the last form, if any
+  m_streamVarsBounded = false;
+  assignStreamAddresses( ~0u );
+  ss << "  g_topframe = (reg_t *)ALLOC( sizeof(reg_t)*" << m_topCount+1 << " );\n";
+  if (!m_streamIds.empty())
+  {
+    for ( unsigned i = 0; i < m_streamIds.size() - 1; ++i )
+      ss << "  toplevel_"<<m_streamIds[i]<<"();\n";
+    ss << "  return toplevel_"<<m_streamIds.back()<<"();\n";
+  }
+  else
+    ss << "  return 0;\n";
+  funcDone( f );
+  endFuncs();
+
+  os << "int main ( void ) {\n"
+        "  return (int)module_init();\n"
+        "}\n\n";
+
+  m_sysCtx = NULL;
+  m_streamFrame = NULL;
+  m_streamVarsDone = 0;
+}
+
+void SimpleCodeGen::genPrologue ( FastOutput & os )
 {
   os << "#include <stdint.h>\n";
   os << "#include <stdlib.h>\n";
@@ -52,6 +377,28 @@ void SimpleCodeGen::generate ( std::ostream & os, AstModule * module )
         "  return 0;\n"
         "}\n";
   os << "\n";
+  // A variable which may change after a closure has captured it lives in a box
+  os << "static reg_t BOX ( reg_t v ) {\n"
+        "  reg_t * box = (reg_t *)ALLOC( sizeof(reg_t) );\n"
+        "  *box = v;\n"
+        "  return box;\n"
+        "}\n";
+  os << "\n";
+
+  // A function returns with g_tailfp set to make a call in tail position: CALL() makes it
+  // after the function has returned, so the stack doesn't grow
+  os << "static reg_t (*g_tailfp)(void);\n"
+        "\n"
+        "static reg_t CALL ( reg_t (*fp)(void) ) {\n"
+        "  reg_t res = fp();\n"
+        "  while (g_tailfp) {\n"
+        "    fp = g_tailfp;\n"
+        "    g_tailfp = 0;\n"
+        "    res = fp();\n"
+        "  }\n"
+        "  return res;\n"
+        "}\n";
+  os << "\n";
 
   os << "reg_t";
   for ( unsigned i = 0; i != PARAM_COUNT; ++i )
@@ -68,61 +415,131 @@ void SimpleCodeGen::generate ( std::ostream & os, AstModule * module )
   os << "\n";
   os << "#include \"smalls.inc\"\n";
   os << "\n";
+}
 
-  genTopLevel( os, module );
-
-  BOOST_FOREACH( Func & f, m_funcs )
+/**
+ * Start writing out the functions of a unit: declare them all, so each can be written out as
+ * soon as it is complete.
+ */
+void SimpleCodeGen::beginFuncs ( FastOutput & os )
+{
+  BOOST_FOREACH( Func * f, m_funcs )
   {
-    os << f.decl << ";\n";
+    os << "static reg_t " << f->name << " ( void );\n";
   }
   os << "\n\n";
-  BOOST_FOREACH( Func & f, m_funcs )
+  m_out = &os;
+  m_flushNext = 0;
+}
+
+/**
+ * Mark a function as complete and write out all complete functions which are next in order.
+ * May be called from any thread.
+ */
+void SimpleCodeGen::funcDone ( Func * f )
+{
+  pthread_mutex_lock( &m_flushLock );
+  ON_BLOCK_EXIT( pthread_mutex_unlock, &m_flushLock );
+
+  f->done = true;
+  while (m_flushNext < m_funcs.size() && m_funcs[m_flushNext]->done)
+    writeFunc( *m_out, m_funcs[m_flushNext++] );
+}
+
+void SimpleCodeGen::writeFunc ( FastOutput & os, Func * f )
+{
+  releaseWritten( os.flushCount() );
+
+  putLineInfo( os, coords(f->coords).coords );
+  os << "static reg_t " << f->name << " ( void ) {\n";
+  os.writeRefs( f->locals );
+  if (!f->locals.empty())
+    os << "\n";
+  os.writeRefs( f->contents );
+  os << "}\n\n";
+
+  if (os.keepsRefs())
+    m_written.push_back( std::make_pair( f, os.flushCount() ) );
+  else
+    f->arena.clear();
+}
+
+/**
+ * Release the text of the functions which the output no longer refers to
+ */
+void SimpleCodeGen::releaseWritten ( unsigned long flushCount )
+{
+  while (!m_written.empty() && m_written.front().second != flushCount)
   {
-    os << coords(f.coords) << f.decl << " {\n";
-    os << f.locals;
-    if (!f.locals.empty())
-      os << "\n";
-    os << f.contents;
-    os << "}\n\n";
+    m_written.front().first->arena.clear();
+    m_written.pop_front();
   }
-  os << "int main ( void ) {\n"
-        "  return (int)module_init();\n"
-        "}\n\n";
 }
 
-void SimpleCodeGen::genTopLevel ( std::ostream & os, AstModule * module )
+void SimpleCodeGen::endFuncs ()
+{
+  assert( m_flushNext == m_funcs.size() && "Not all functions were written out" );
+  if (!m_written.empty())
+  {
+    m_out->flush();
+    releaseWritten( m_out->flushCount() );
+  }
+  m_funcs.clear();
+  m_names.clear();
+  m_out = NULL;
+}
+
+void SimpleCodeGen::genTopLevel ( FastOutput & os, AstModule * module )
 {
   Context * sysctx = genSystem( os, module );
+  // All variables exist, so the table won't grow while closures are generated in parallel
+  m_addrs.reserve( module->body()->frame() );
+
+  AstFrame * const topfr = module->body()->frame();
+  assignAddresses( 1, topfr );
+  os << "static reg_t g_topframe[" << topfr->length()+1 << "];\n";
+  os << "\n";
 
   Func * f = newFunc( SourceCoords(), "module_init" );
-  std::stringstream ss;
-  const gc_char * restmp = genBody( ss, sysctx, f, module->body() );
+  Context * ctx = new Context( sysctx, f, "g_topframe", topfr );
+  analyseClosures( module->body(), m_varFlags );
+  prepareBody( ctx, module->body() );
+  beginFuncs( os );
+
+  CodeBuffer & ss = f->contents;
+  const char * restmp = genBodyContents( ss, ctx, module->body() );
   if (!restmp)
     restmp = "0";
   ss << "  return "<<restmp<<";\n";
-  f->setContents( ss.str() );
+  funcDone( f );
+
+  genClosureBodies();
+  endFuncs();
 }
 
-SimpleCodeGen::Context * SimpleCodeGen::genSystem ( std::ostream & os, AstModule * module )
+SimpleCodeGen::Context * SimpleCodeGen::genSystem ( FastOutput & os, AstModule * module )
 {
   AstFrame * const sysfr = module->systemFrame();
 
+  // Variable ids are per module, so the addresses of the previous one are meaningless
+  m_addrs.clear();
+  m_varFlags.clear();
+  m_knownCalls.clear();
+  m_addrs.reserve( sysfr );
   assignAddresses( 0, sysfr );
   os << "static reg_t g_sysframe[];\n";
   os << "\n";
-  for ( AstFrame::VariableList::iterator it = sysfr->vars().begin(), _e = sysfr->vars().end();
-        it != _e; ++it )
+  BOOST_FOREACH( AstVariable * var, sysfr->vars() )
   {
-    unsigned addr = varData( it.operator->() )->addr;
+    unsigned addr = varAddr( var );
     os << "static closure_t g_syscl"<<addr<<" = { "
        << "sysfunc"<<addr<<", sysfunc"<<addr<<"_pcount, sysfunc"<<addr<<"_plist, g_sysframe };\n";
   }
   os << "\n";
   os << "static reg_t g_sysframe[] = {\n";
-  for ( AstFrame::VariableList::iterator it = sysfr->vars().begin(), _e = sysfr->vars().end();
-        it != _e; ++it )
+  BOOST_FOREACH( AstVariable * var, sysfr->vars() )
   {
-    unsigned addr = varData( it.operator->() )->addr;
+    unsigned addr = varAddr( var );
     os << "  &g_syscl"<<addr<<",\n";
   }
   os << "};\n";
@@ -132,35 +549,222 @@ SimpleCodeGen::Context * SimpleCodeGen::genSystem ( std::ostream & os, AstModule
 }
 
 
-const gc_char * SimpleCodeGen::genBody ( std::ostream & os, Context * parentCtx, Func * func, AstBody * body )
+/**
+ * The context of a frame in a function. Its variables are C locals, numbered after the ones of
+ * the other frames of the function.
+ */
+SimpleCodeGen::Context * SimpleCodeGen::newFrameContext ( Context * parentCtx, Func * func, AstFrame * frame )
 {
-  Context * ctx = new Context( parentCtx, func, func->nextTmp("reg_t *", "frame_"), body->frame() );
+  Context * ctx = new Context( parentCtx, func, NULL, frame );
 
   // Assign addresses to all variables in the frame
-  assignAddresses( 1, ctx->frame );
+  assignAddresses( func->localCount, frame );
+  BOOST_FOREACH( AstVariable * var, frame->vars() )
+    func->locals << "  reg_t loc_" << varAddr( var ) << "; //" << *var << "\n";
+  func->localCount += frame->length();
+  return ctx;
+}
 
-  os << "  "<<ctx->frametmp<<" = (reg_t *)ALLOC( sizeof(reg_t)*" << ctx->frame->length()+1 << " );\n";
-  if (parentCtx)
-    os << "  "<<ctx->frametmp<<"[0] = (reg_t)"<<parentCtx->frametmp<<";\n";
-  else
-    os << "  "<<ctx->frametmp<<"[0] = (reg_t)0;\n";
+/**
+ * Create the functions and the contexts of all closures in an expression, in the order in which
+ * the generation of the expression reaches them, so the names and the addresses are the same as
+ * if they were generated recursively. Only the kinds of nodes gen() descends into are visited.
+ * The closures must have been analysed by analyseClosures().
+ * @param defVar the variable defined to ast, if any
+ */
+void SimpleCodeGen::prepare ( Context * ctx, Ast * ast, const AstVariable * defVar )
+{
+  if (AstClosure * cl = dyn_cast<AstClosure>(ast))
+  {
+    ClosureJob * job = new (GC) ClosureJob( cl, newFunc( cl->coords ) );
+
+    ListOfApply tailCalls;
+    markTailCalls( cl->body, &tailCalls );
+    if (defVar)
+    {
+      BOOST_FOREACH( AstApply * ap, tailCalls )
+      {
+        AstVar * v = dyn_cast<AstVar>(ap->target);
+        if (v && v->var == defVar)
+        {
+          job->func->selfVar = defVar;
+          break;
+        }
+      }
+    }
+
+    assert( cl->freeVars && "Closure wasn't analysed" );
+    job->func->baseLevel = cl->paramFrame->level;
+    job->func->freeVars = cl->freeVars;
+    if (!cl->freeVars->empty())
+      job->func->envtmp = job->func->nextTmp( "reg_t *", "env_" );
+    job->paramCtx = newFrameContext( ctx, job->func, cl->paramFrame );
+    job->bodyCtx = newFrameContext( job->paramCtx, job->func, cl->body->frame() );
+
+    m_jobs.push_back( job );
+    m_jobMap[cl] = job;
+    if (defVar && alwaysHolds( defVar ))
+      m_knownCalls[defVar] = job;
+
+    prepareBody( job->bodyCtx, cl->body );
+  }
+  else if (AstApply * ap = dyn_cast<AstApply>(ast))
+  {
+    prepare( ctx, ap->target );
+    BOOST_FOREACH( Ast * param, ap->params() )
+      prepare( ctx, param );
+  }
+  else if (AstIf * ia = dyn_cast<AstIf>(ast))
+  {
+    prepare( ctx, ia->cond );
+    prepare( ctx, ia->thenAst );
+    if (ia->elseAst)
+      prepare( ctx, ia->elseAst );
+  }
+  else if (AstSet * set = dyn_cast<AstSet>(ast))
+    prepare( ctx, set->rvalue );
+  else if (AstBody * body = dyn_cast<AstBody>(ast))
+    prepareBody( newFrameContext( ctx, ctx->func, body->frame() ), body );
+  else if (AstBegin * begin = dyn_cast<AstBegin>(ast))
+  {
+    BOOST_FOREACH( Ast * expr, begin->exprList() )
+      prepare( ctx, expr );
+  }
+  else if (ast->kind == AstKind::LET || ast->kind == AstKind::FIX)
+  {
+    AstLet * let = static_cast<AstLet *>(ast);
+    Context * letCtx = newFrameContext( ctx, ctx->func, let->paramFrame );
+    for ( unsigned i = 0, e = let->values->size(); i != e; ++i )
+      prepare( letCtx, (*let->values)[i], (*let->params)[i] );
+    prepareBody( newFrameContext( letCtx, ctx->func, let->body->frame() ), let->body );
+  }
+}
+
+void SimpleCodeGen::prepareBody ( Context * ctx, AstBody * body )
+{
   BOOST_FOREACH( AstBody::Definition & defn, body->defs() )
+    prepare( ctx, defn.second, defn.first );
+  BOOST_FOREACH( Ast * ast, body->exprList() )
+    prepare( ctx, ast );
+}
+
+/**
+ * Generate the bodies of all prepared closures. With a pool, every worker claims the closures
+ * in order, a few at a time, so only a few finished functions wait for the ones before them.
+ */
+void SimpleCodeGen::genClosureBodies ()
+{
+  if (!m_pool || m_jobs.size() < 2)
   {
-    const gc_char * tmp = gen( os, ctx, defn.second );
-    if (defn.first && tmp)
-      os << "  " << ctx->frametmp << "[" << varData(defn.first)->addr << "] = (reg_t)"<< tmp << "; //" << *defn.first << "\n";
+    BOOST_FOREACH( ClosureJob * job, m_jobs )
+      genClosureBody( job );
+  }
+  else
+  {
+    m_nextJob = 0;
+    m_jobFailed = 0;
+    std::vector<JobTask> tasks( std::min<size_t>( m_pool->size(), m_jobs.size() ), JobTask( this ) );
+    for ( unsigned i = 0; i < tasks.size(); ++i )
+      m_pool->submit( &tasks[i] );
+    m_pool->wait();
   }
 
-  const char * result = NULL;
-  for ( ListOfAst::iterator i = body->exprList().begin(), _e = body->exprList().end(); i != _e; ++i )
+  m_jobs.clear();
+  m_jobMap.clear();
+  if (m_jobFailed)
+    throw std::runtime_error( m_jobFailure );
+}
+
+void SimpleCodeGen::jobFailed ( const char * what )
+{
+  if (__sync_bool_compare_and_swap( &m_jobFailed, 0, 1 ))
+    m_jobFailure = what;
+}
+
+void SimpleCodeGen::genClosureBody ( ClosureJob * job )
+{
+  AstClosure * const cl = job->cl;
+  Context * const paramCtx = job->paramCtx;
+  CodeBuffer & ss = job->func->contents;
+
+  // FIXME: listParam handling
+
+  if (job->func->selfVar)
+    ss << "entry:\n";
+  if (job->func->envtmp)
+    ss << "  "<<job->func->envtmp<<" = (reg_t *)g_param0;\n";
+
+  // Extract all parameters
+  unsigned i = 1;
+  BOOST_FOREACH( AstVariable * param, cl->params() )
   {
-    Ast * ast = i.operator->();
-    result = gen( os, ctx, ast );
+    ss << "  " << varSlot( paramCtx, param ) << " = ";
+    if (isBoxed( param ))
+      ss << "(reg_t)BOX( g_param" << i << " );\n";
+    else
+      ss << "g_param" << i << ";\n";
+    ++i;
+  }
+  ss << "\n";
+
+  const char * rettmp = genBody( ss, job->bodyCtx, cl->body );
+  if (rettmp)
+    ss << "  return (reg_t)"<<rettmp<<";\n";
+  else
+    ss << "  return 0;\n";
+  funcDone( job->func );
+}
+
+const char * SimpleCodeGen::genBody ( CodeBuffer & os, Context * ctx, AstBody * body )
+{
+  genFrameBoxes( os, ctx, body->frame() );
+  return genBodyContents( os, ctx, body );
+}
+
+/**
+ * Allocate the boxes of the variables of a frame, which are filled in later. Nothing else in a
+ * frame needs memory of its own.
+ */
+void SimpleCodeGen::genFrameBoxes ( CodeBuffer & os, Context * ctx, AstFrame * frame )
+{
+  BOOST_FOREACH( AstVariable * var, frame->vars() )
+  {
+    if (isBoxed( var ))
+      os << "  "<<varSlot( ctx, var )<<" = (reg_t)BOX( 0 );\n";
+  }
+}
+
+const char * SimpleCodeGen::genBodyContents ( CodeBuffer & os, Context * ctx, AstBody * body )
+{
+  AstBody::DefinitionList & defs = body->defs();
+  for ( unsigned i = 0, e = defs.size(); i != e; )
+  {
+    if (!defs[i].first || !isa<AstClosure>(defs[i].second))
+    {
+      const char * tmp = gen( os, ctx, defs[i].second );
+      if (defs[i].first && tmp)
+        os << "  " << varValue( ctx, defs[i].first ) << " = (reg_t)"<< tmp << "; //" << *defs[i].first << "\n";
+      ++i;
+      continue;
+    }
+
+    SmallVector<AstVariable *, 8, std::allocator<AstVariable *> > vars;
+    SmallVector<Ast *, 8, std::allocator<Ast *> > values;
+    for ( ; i != e && defs[i].first && isa<AstClosure>(defs[i].second); ++i )
+    {
+      vars.push_back( defs[i].first );
+      values.push_back( defs[i].second );
+    }
+    genClosureGroup( os, ctx, vars.size(), vars.begin(), values.begin() );
   }
+
+  const char * result = NULL;
+  BOOST_FOREACH( Ast * ast, body->exprList() )
+    result = gen( os, ctx, ast );
   return result;
 }
 
-const gc_char * SimpleCodeGen::gen ( std::ostream & os, Context * ctx, Ast * ast )
+const char * SimpleCodeGen::gen ( CodeBuffer & os, Context * ctx, Ast * ast )
 {
   if (AstClosure * cl = dyn_cast<AstClosure>(ast))
     return genClosure( os, ctx, cl );
@@ -171,179 +775,327 @@ const gc_char * SimpleCodeGen::gen ( std::ostream & os, Context * ctx, Ast * ast
   else if (isa<AstUnspecified>(ast))
     return "0";
   else if (AstVar * v = dyn_cast<AstVar>(ast))
-  {
-    // Iteratively access parent frames
-    Context * curCtx = ctx;
-    const gc_char * frametmp = ctx->frametmp;
-    for ( ; curCtx->frame != v->var->frame; curCtx = curCtx->parent )
-    {
-      const gc_char * tmp = ctx->func->nextTmp( "reg_t *", "pframe_" );
-      os << coords(v) << "  "<<tmp<<" = (reg_t *)"<<frametmp<<"[0];\n";
-      frametmp = tmp;
-
-      assert( curCtx->parent );
-    }
-
-    std::stringstream sstmp;
-    sstmp << *v->var;
-    return formatGCStr( "%s[%u]/*%s*/", frametmp, varData(v->var)->addr, sstmp.str().c_str() );
-  }
+    return varValue( ctx, v->var );
   else if (AstIf * ia = dyn_cast<AstIf>(ast))
     return genIf( os, ctx, ia );
+  else if (AstSet * set = dyn_cast<AstSet>(ast))
+    return genSet( os, ctx, set );
+  else if (AstBody * body = dyn_cast<AstBody>(ast))
+  {
+    genFrameBoxes( os, ctx, body->frame() );
+    const char * result = genBodyContents( os, ctx, body );
+    return result ? result : "0";
+  }
+  else if (AstBegin * begin = dyn_cast<AstBegin>(ast))
+  {
+    const char * result = "0";
+    BOOST_FOREACH( Ast * expr, begin->exprList() )
+      result = gen( os, ctx, expr );
+    return result;
+  }
+  else if (ast->kind == AstKind::LET || ast->kind == AstKind::FIX)
+    return genLet( os, ctx, static_cast<AstLet *>(ast) );
 
-  return formatGCStr( "?%s", AstKind::name(ast->kind) );
+  return join( ctx->func->arena, "?", AstKind::name(ast->kind) );
 }
 
-const gc_char * SimpleCodeGen::genDatum ( std::ostream & os, Context * ctx, AstDatum * ast )
+const char * SimpleCodeGen::genDatum ( CodeBuffer & os, Context * ctx, AstDatum * ast )
 {
+  Arena & arena = ctx->func->arena;
   if (SyntaxValue * v = dyn_cast<SyntaxValue>(ast->datum))
   {
     switch (v->skind)
     {
     case SyntaxKind::REAL:
-      return formatGCStr("%f", v->u.real); // FIXME
+      {
+        char buf[512];
+        int len = std::snprintf( buf, sizeof(buf), "%f", v->u.real ); // FIXME
+        return arena.copy( buf, std::min<size_t>( len, sizeof(buf) - 1 ) );
+      }
 
     case SyntaxKind::INTEGER:
-      return formatGCStr("%lld", v->u.integer); // FIXME
+      {
+        char buf[24];
+        char * const end = buf + sizeof(buf);
+        long long const i = v->u.integer;
+        char * p = formatDecimal( end, i < 0 ? -(unsigned long long)i : i ); // FIXME
+        if (i < 0)
+          *--p = '-';
+        return arena.copy( p, end - p );
+      }
 
     case SyntaxKind::BOOL:
-      return formatGCStr("%d", v->u.vbool);
+      return v->u.vbool ? "1" : "0";
 
     default:
       // FIXME
-      return formatGCStr("??%s", SyntaxKind::name(ast->datum->skind)); // FIXME
+      return join( arena, "??", SyntaxKind::name(ast->datum->skind) ); // FIXME
     }
   }
   else
-    return formatGCStr("??%s", SyntaxKind::name(ast->datum->skind)); // FIXME
+    return join( arena, "??", SyntaxKind::name(ast->datum->skind) ); // FIXME
 }
 
-const gc_char * SimpleCodeGen::genClosure ( std::ostream & os, Context * ctx, AstClosure * cl )
+const char * SimpleCodeGen::genClosure ( CodeBuffer & os, Context * ctx, AstClosure * cl )
 {
-  std::stringstream ss;
-  Func * cf = newFunc( cl->coords );
-  Context * paramCtx = new Context(ctx,cf,cf->nextTmp("reg_t *", "params_"),cl->paramFrame);
+  const char * cltmp = genClosureAlloc( os, ctx, cl );
+  genClosureEnv( os, ctx, cl, cltmp );
+  return cltmp;
+}
 
-  // Assign addresses to all variables in the frame
-  assignAddresses( 1, paramCtx->frame );
+/**
+ * Allocate a closure together with its flat environment, which follows it in memory
+ */
+const char * SimpleCodeGen::genClosureAlloc ( CodeBuffer & os, Context * ctx, AstClosure * cl )
+{
+  JobMap::const_iterator it = m_jobMap.find( cl );
+  assert( it != m_jobMap.end() && "Closure wasn't prepared" );
+  Func * cf = it->second->func;
+  unsigned const envLen = cl->freeVars->size();
 
-  // FIXME: listParam handling
+  const char * cltmp = ctx->func->nextTmp( "closure_t *", "closure_" );
+  os << "  "<<cltmp<<" = (closure_t*)ALLOC( sizeof(closure_t)";
+  if (envLen)
+    os << "+sizeof(reg_t)*" << envLen;
+  os << " );\n";
+  os << "  "<<cltmp<<"->fp = "<<cf->name<<";\n";
+  os << "  "<<cltmp<<"->pcount = "<< cl->paramCount <<";\n";
+  os << "  "<<cltmp<<"->plist = "<< (cl->listParam != 0) <<";\n";
+  if (envLen)
+    os << "  "<<cltmp<<"->env = (reg_t *)("<<cltmp<<" + 1);\n";
+  else
+    os << "  "<<cltmp<<"->env = 0;\n";
 
-  // Allocate the parameter frame
-  ss << "  "<<paramCtx->frametmp<<" = (reg_t *)ALLOC( sizeof(reg_t)*" << paramCtx->frame->length()+1 << " );\n";
-  ss << "  "<<paramCtx->frametmp <<"[0] = g_param0;\n";
+  return cltmp;
+}
 
-  // Extract all parameters into the frame
-  if (cl->params)
+/**
+ * Create a group of closures which may capture each other: allocate them all and store them into
+ * their variables before filling in their environments
+ */
+void SimpleCodeGen::genClosureGroup ( CodeBuffer & os, Context * ctx, unsigned count,
+                                      AstVariable * const * vars, Ast * const * values )
+{
+  SmallVector<const char *, 8, std::allocator<const char *> > cltmps;
+  for ( unsigned i = 0; i != count; ++i )
+  {
+    const char * cltmp = genClosureAlloc( os, ctx, cast<AstClosure>(values[i]) );
+    cltmps.push_back( cltmp );
+    os << "  " << varValue( ctx, vars[i] ) << " = (reg_t)"<< cltmp << "; //" << *vars[i] << "\n";
+  }
+  for ( unsigned i = 0; i != count; ++i )
+    genClosureEnv( os, ctx, cast<AstClosure>(values[i]), cltmps[i] );
+}
+
+/**
+ * Copy the free variables of a closure into its environment: the value, or the box of a boxed
+ * variable
+ */
+void SimpleCodeGen::genClosureEnv ( CodeBuffer & os, Context * ctx, AstClosure * cl, const char * cltmp )
+{
+  unsigned i = 0;
+  BOOST_FOREACH( AstVariable * var, *cl->freeVars )
+  {
+    os << "  ((reg_t *)"<<cltmp<<"->env)["<<i<<"] = (reg_t)"<<varSlot( ctx, var )<<";\n";
+    ++i;
+  }
+}
+
+/**
+ * The variables of a let are initialized in place, in the current function. The closures of a
+ * fix are created together, like a group of closure definitions.
+ */
+const char * SimpleCodeGen::genLet ( CodeBuffer & os, Context * ctx, AstLet * let )
+{
+  VectorOfVariable & vars = *let->params;
+  VectorOfAst & values = *let->values;
+
+  if (let->kind == AstKind::FIX)
   {
-    BOOST_FOREACH( AstVariable * param, *cl->params )
+    genFrameBoxes( os, ctx, let->paramFrame );
+    if (!vars.empty())
+      genClosureGroup( os, ctx, vars.size(), &vars[0], &values[0] );
+  }
+  else
+  {
+    // The variables aren't visible to the values, so each can be set as soon as it's known
+    for ( unsigned i = 0, e = vars.size(); i != e; ++i )
     {
-      unsigned addr = varData(param)->addr;
-      ss << "  " << paramCtx->frametmp << "[" << addr << "] = g_param"<< addr << "; //" << *param << "\n";
+      const char * tmp = gen( os, ctx, values[i] );
+      if (!tmp)
+        tmp = "0";
+      os << coords(values[i]) << "  " << varSlot( ctx, vars[i] ) << " = ";
+      if (isBoxed( vars[i] ))
+        os << "(reg_t)BOX( (reg_t)" << tmp << " );\n";
+      else
+        os << "(reg_t)" << tmp << ";\n";
     }
   }
-  ss << "\n";
 
-  const gc_char * rettmp = genBody( ss, paramCtx, cf, cl->body );
-  if (rettmp)
-    ss << "  return (reg_t)"<<rettmp<<";\n";
-  else
-    ss << "  return 0;\n";
-  cf->setContents( ss.str() );
+  genFrameBoxes( os, ctx, let->body->frame() );
+  const char * result = genBodyContents( os, ctx, let->body );
+  return result ? result : "0";
+}
 
-  const gc_char * cltmp = ctx->func->nextTmp( "closure_t *", "closure_" );
-  os << "  "<<cltmp<<" = (closure_t*)ALLOC( sizeof(closure_t) );\n";
-  os << "  "<<cltmp<<"->fp = "<<cf->name<<";\n";
-  os << "  "<<cltmp<<"->pcount = "<< cl->params->size() <<";\n";
-  os << "  "<<cltmp<<"->plist = "<< (cl->listParam != 0) <<";\n";
-  os << "  "<<cltmp<<"->env = "<< ctx->frametmp <<";\n";
+const char * SimpleCodeGen::genSet ( CodeBuffer & os, Context * ctx, AstSet * set )
+{
+  const char * tmp = gen( os, ctx, set->rvalue );
+  os << coords(set) << "  " << varValue( ctx, set->target ) << " = (reg_t)" << (tmp ? tmp : "0") << ";\n";
+  return "0";
+}
 
-  return cltmp;
+/**
+ * Whether a variable defined to a closure holds that closure wherever it is read: it is never
+ * assigned nor captured before its definition. The top-level variables of a stream are never
+ * known, since a later form may assign them.
+ */
+bool SimpleCodeGen::alwaysHolds ( const AstVariable * var ) const
+{
+  if (m_varFlags.get( var ) & (VarFlags::ASSIGNED | VarFlags::EARLY))
+    return false;
+  return var->frame->level > 0 || (var->frame->level == 0 && !m_streamFrame);
 }
 
-const gc_char * SimpleCodeGen::genApply ( std::ostream & os, Context * ctx, AstApply * ap )
+/**
+ * A call to a closure which is known at compile time is made directly to its function. Its
+ * environment, if it has one, follows the closure.
+ */
+const char * SimpleCodeGen::genApply ( CodeBuffer & os, Context * ctx, AstApply * ap )
 {
-  const gc_char * targtmp = gen( os, ctx, ap->target );
-  const gc_char * cltmp = ctx->func->nextTmp( "closure_t *", "closure_" );
-  const gc_char * result = ctx->func->nextTmp( "reg_t", "result_" );
+  ClosureJob * known = NULL;
+  if (AstVar * v = dyn_cast<AstVar>(ap->target))
+  {
+    known = m_knownCalls.get( v->var );
+    if (known && (known->cl->listParam || known->cl->paramCount != ap->paramCount || ap->listParam))
+      known = NULL;
+  }
 
-  os << coords(ap->target) << "  "<<cltmp<<" = (closure_t *)"<<targtmp<<";\n";
+  const char * cltmp = NULL;
+  if (!known)
+  {
+    const char * targtmp = gen( os, ctx, ap->target );
+    cltmp = ctx->func->nextTmp( "closure_t *", "closure_" );
+    os << coords(ap->target) << "  "<<cltmp<<" = (closure_t *)"<<targtmp<<";\n";
+  }
+  const char * result = ctx->func->nextTmp( "reg_t", "result_" );
 
   // Store the parameter temporaries here
-  std::vector<const gc_char *,gc_allocator<const gc_char*> > paramTmps;
-  if (ap->params)
+  SmallVector<const char *, 8, std::allocator<const char *> > paramTmps;
+  BOOST_FOREACH( Ast * ast, ap->params() )
+    paramTmps.push_back( gen( os, ctx, ast ) );
+
+  if (!known)
+    os << coords(ap->target) << "  g_param0 = "<<cltmp<<"->env;\n";
+  else if (known->func->envtmp)
   {
-    BOOST_FOREACH( Ast * ast, *ap->params )
-      paramTmps.push_back( gen( os, ctx, ast ) );
+    os << coords(ap->target) << "  g_param0 = (closure_t *)"
+       << gen( os, ctx, ap->target ) << " + 1;\n";
   }
-
-  os << coords(ap->target) << "  g_param0 = "<<cltmp<<"->env;\n";
-  if (ap->params)
+  unsigned addr = 1;
+  unsigned i = 0;
+  BOOST_FOREACH( Ast * ast, ap->params() )
   {
-    unsigned addr = 1;
-    unsigned i = 0;
-    BOOST_FOREACH( Ast * ast, *ap->params )
-    {
-      const gc_char * tmp = paramTmps[i];
-      if (!tmp)
-        tmp = "0";
-      os<<coords(ast)<<"  g_param"<<addr<<" = (reg_t)"<<tmp<<";\n";
-      ++addr;
-      ++i;
-    }
+    const char * tmp = paramTmps[i];
+    if (!tmp)
+      tmp = "0";
+    os<<coords(ast)<<"  g_param"<<addr<<" = (reg_t)"<<tmp<<";\n";
+    ++addr;
+    ++i;
   }
 
+  const char * fp = known ? known->func->name : join( ctx->func->arena, cltmp, "->fp" );
+
   // FIXME: listParam handling
-  os <<coords(ap)<< "  "<<result<<" = (*"<<cltmp<<"->fp)();\n";
+  if (!ap->tail)
+    os <<coords(ap)<< "  "<<result<<" = CALL( "<<fp<<" );\n";
+  else if (known && known->func == ctx->func)
+  {
+    os <<coords(ap)<< "  goto entry;\n";
+    os << "  "<<result<<" = 0;\n";
+  }
+  else
+  {
+    // Return to the CALL() of our caller, which makes the call. The closure of a function is
+    // normally what its own variable holds, but the variable may have been assigned since.
+    const AstVariable * selfVar = ctx->func->selfVar;
+    AstVar * v = dyn_cast<AstVar>(ap->target);
+    if (!known && selfVar && v && v->var == selfVar)
+      os <<coords(ap)<< "  if ("<<cltmp<<"->fp == "<<ctx->func->name<<") goto entry;\n";
+    os <<coords(ap)<< "  g_tailfp = "<<fp<<";\n";
+    os << "  "<<result<<" = 0;\n";
+  }
 
   return result;
 }
 
-const gc_char * SimpleCodeGen::genIf ( std::ostream & os, Context * ctx, AstIf * ia )
+const char * SimpleCodeGen::genIf ( CodeBuffer & os, Context * ctx, AstIf * ia )
 {
-  const gc_char * cndtmp = gen( os, ctx, ia->cond );
-  const gc_char * exitlab = ctx->func->nextTmp(0,"lab_");
-  const gc_char * elselab = ia->elseAst ? ctx->func->nextTmp(0,"lab_") : exitlab;
+  const char * cndtmp = gen( os, ctx, ia->cond );
+  const char * exitlab = ctx->func->nextTmp(0,"lab_");
+  const char * elselab = ia->elseAst ? ctx->func->nextTmp(0,"lab_") : exitlab;
 
   os<<coords(ia)<<"  if (!"<<cndtmp<<") goto "<<elselab<<";\n";
-  const gc_char * thentmp = gen( os, ctx, ia->thenAst );
+  const char * thentmp = gen( os, ctx, ia->thenAst );
   if (!ia->elseAst)
   {
     os<<exitlab<<":\n";
     return thentmp;
   }
 
-  const gc_char * restmp = ctx->func->nextTmp( "reg_t", "tmp_" );
+  const char * restmp = ctx->func->nextTmp( "reg_t", "tmp_" );
   os<<"  "<<restmp<<" = (reg_t)"<<thentmp<<";\n";
   os << "  goto "<<exitlab<<";\n";
 
   os<<elselab<<":\n";
-  const gc_char * elsetmp = gen( os, ctx, ia->elseAst );
+  const char * elsetmp = gen( os, ctx, ia->elseAst );
   os<<"  "<<restmp<<" = (reg_t)"<<elsetmp<<";\n";
   os<<exitlab<<":\n";
   return restmp;
 }
 
-std::string SimpleCodeGen::coords ( const SourceCoords & coords )
+/**
+ * The slot holding a variable, as an lvalue: a C local of the current function, in the
+ * environment of its closure or in one of the global frames. The slot of a boxed variable holds
+ * its box.
+ */
+const char * SimpleCodeGen::varSlot ( Context * ctx, const AstVariable * var )
 {
-  if (m_optLineInfo && coords.full())
-  {
-    std::stringstream os;
-    os << "#line " << coords.line << " \"" << coords.fileName << "\" " << " // column:" << coords.column << '\n';
-    return os.str();
-  }
-  else
-    return "";
+  Arena & arena = ctx->func->arena;
+  int const level = var->frame->level;
+
+  if (level < 0)
+    return varRef( arena, "g_sysframe", varAddr( var ), var );
+  if (level == 0)
+    return varRef( arena, "g_topframe", varAddr( var ), var );
+  if (level >= ctx->func->baseLevel)
+    return varRef( arena, NULL, varAddr( var ), var );
+
+  // Free in the function
+  const VectorOfVariable * freeVars = ctx->func->freeVars;
+  assert( freeVars && "Variable isn't visible in the function" );
+  VectorOfVariable::const_iterator it = std::find( freeVars->begin(), freeVars->end(), var );
+  assert( it != freeVars->end() && "Free variable not in the environment" );
+  return varRef( arena, ctx->func->envtmp, it - freeVars->begin(), var );
+}
+
+/** The value of a variable, as an lvalue */
+const char * SimpleCodeGen::varValue ( Context * ctx, const AstVariable * var )
+{
+  const char * slot = varSlot( ctx, var );
+  if (!isBoxed( var ))
+    return slot;
+  Arena & arena = ctx->func->arena;
+  return join( arena, join( arena, "(*(reg_t *)", slot ), ")" );
 }
 
 void SimpleCodeGen::assignAddresses ( unsigned startAddr, AstFrame * frame )
 {
   // Assign addresses to all variables in the frame
-  for ( AstFrame::VariableList::iterator i = frame->vars().begin(), e = frame->vars().end();
-        i != e; ++i )
+  BOOST_FOREACH( AstVariable * var, frame->vars() )
   {
-    assert( i->data == NULL && "Variable already assigned an address" );
-    i->data = new (GC) VarData( startAddr++ );
+    unsigned & addr = m_addrs[var];
+    assert( addr == NO_ADDR && "Variable already assigned an address" );
+    addr = startAddr + var->index;
   }
 }
 
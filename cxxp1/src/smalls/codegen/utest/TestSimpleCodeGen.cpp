@@ -0,0 +1,241 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestSimpleCodeGen.hpp"
+#include "SimpleCodeGen.hpp"
+#include "p1/smalls/parser/SchemeParser.hpp"
+#include "p1/smalls/parser/SyntaxReader.hpp"
+#include "p1/util/ThreadPool.hpp"
+#include "ListBuilder.hpp"
+#include <sstream>
+#include <cstring>
+
+using namespace p1;
+using namespace p1::smalls;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestSimpleCodeGen );
+
+TestSimpleCodeGen::TestSimpleCodeGen ( )
+{
+}
+
+TestSimpleCodeGen::~TestSimpleCodeGen ( )
+{
+}
+
+void TestSimpleCodeGen::setUp ( )
+{
+}
+
+void TestSimpleCodeGen::tearDown ( )
+{
+}
+
+namespace
+{
+;
+
+class ErrorReporter : public AbstractErrorReporter
+{
+public:
+  int count;
+
+  ErrorReporter () : count( 0 ) {}
+  virtual void error ( const ErrorInfo & ei )
+  {
+    ++count;
+    std::cerr << "  " << ei.formatMessage() << std::endl;
+  }
+};
+
+/** Nested closures referring to the variables of the enclosing ones */
+std::string generateText ( unsigned count )
+{
+  std::stringstream text;
+  for ( unsigned i = 0; i < count; ++i )
+  {
+    text << "(define f" << i << " (lambda (a)"
+            " (lambda (b) (if a (lambda (c) (+ a b c)) (lambda (d) b)))))\n";
+    text << "((f" << i << " " << i << ") 1)\n";
+  }
+  return text.str();
+}
+
+std::string generate ( const std::string & text, ThreadPool * pool, bool stream )
+{
+  SymbolTable symTab;
+  ErrorReporter err;
+  CharBufInput in( text.c_str() );
+  Lexer lex( in, "input", symTab, err );
+  Keywords kw( symTab );
+  SyntaxReader reader( lex, kw );
+  SchemeParser parser( symTab, kw, err );
+
+  SimpleCodeGen * cg = new SimpleCodeGen();
+  cg->setThreadPool( pool );
+  std::stringstream out;
+  if (stream)
+  {
+    cg->beginStream( out, parser.beginStream() );
+    Syntax * d;
+    while ((d = reader.parseDatum()) != reader.DAT_EOF)
+      cg->genStreamForm( out, parser.compileTopLevelForm( d ) );
+    parser.endStream();
+    cg->endStream( out );
+  }
+  else
+  {
+    detail::ListBuilder lb;
+    Syntax * d;
+    while ((d = reader.parseDatum()) != reader.DAT_EOF)
+      lb << d;
+    cg->generate( out, parser.compileLibraryBody( lb ) );
+  }
+  CPPUNIT_ASSERT_EQUAL( 0, err.count );
+  return out.str();
+}
+
+};
+
+void TestSimpleCodeGen::testParallel ( )
+{
+  std::string text = generateText( 200 );
+  ThreadPool pool( 4 );
+
+  std::string expected = generate( text, NULL, false );
+  CPPUNIT_ASSERT( expected.find( "func_799" ) != std::string::npos );
+  CPPUNIT_ASSERT( generate( text, &pool, false ) == expected );
+
+  CPPUNIT_ASSERT( generate( text, &pool, true ) == generate( text, NULL, true ) );
+}
+
+static unsigned countOf ( const std::string & s, const char * what )
+{
+  unsigned n = 0;
+  for ( size_t pos = 0; (pos = s.find( what, pos )) != std::string::npos; pos += std::strlen( what ) )
+    ++n;
+  return n;
+}
+
+void TestSimpleCodeGen::testTailCalls ( )
+{
+  std::string code = generate(
+    "(define f (lambda (n)\n"
+    "  (define lp (lambda (i acc)\n"
+    "    (if (== i 0) acc (lp (- i 1) (+ acc 1)))))\n"
+    "  (lp n 0)))\n"
+    "(display (f 10))\n", NULL, false );
+
+  // lp jumps to itself, f returns to CALL() to call lp
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "entry:\n" ) );
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "  goto entry;" ) );
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "g_tailfp = func_" ) );
+  // ==, -, + and the two calls in the module body
+  CPPUNIT_ASSERT_EQUAL( 5u, countOf( code, " = CALL( " ) );
+
+  // Once lp may be assigned, it's only known at run time whether it still calls itself
+  code = generate(
+    "(define f (lambda (n)\n"
+    "  (define lp (lambda (i acc)\n"
+    "    (if (== i 0) acc (lp (- i 1) (+ acc 1)))))\n"
+    "  (set! lp lp)\n"
+    "  (lp n 0)))\n"
+    "(display (f 10))\n", NULL, false );
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "entry:\n" ) );
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, ") goto entry;" ) );
+  CPPUNIT_ASSERT_EQUAL( 2u, countOf( code, "g_tailfp = closure_" ) );
+
+  // Nothing is in tail position in the module body
+  code = generate( "(display 1)\n", NULL, false );
+  CPPUNIT_ASSERT_EQUAL( 0u, countOf( code, "g_tailfp = closure_" ) );
+}
+
+void TestSimpleCodeGen::testFlatClosures ( )
+{
+  std::string code = generate(
+    "(define mk (lambda (start)\n"
+    "  (define n start)\n"
+    "  (define ev (lambda (x) (if (== x 0) n (od (- x 1)))))\n"
+    "  (define od (lambda (x) (if (== x 0) 0 (ev (- x 1)))))\n"
+    "  (define inc (lambda (d) (set! n (+ n d)) n))\n"
+    "  (inc 1)\n"
+    "  (ev 4)))\n"
+    "(display (mk 10))\n", NULL, false );
+
+  // No frame links
+  CPPUNIT_ASSERT_EQUAL( 0u, countOf( code, "pframe_" ) );
+  // Only n is boxed, since inc assigns it; ev and od capture each other directly
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "BOX( 0 )" ) );
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "sizeof(closure_t)+sizeof(reg_t)*2 )" ) );
+  CPPUNIT_ASSERT_EQUAL( 4u, countOf( code, "->env)[" ) );
+  // Globals are never captured, so mk has no environment
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "->env = 0;" ) );
+}
+
+void TestSimpleCodeGen::testLocals ( )
+{
+  std::string code = generate(
+    "(define f (lambda (x) (define y (* x x)) (+ x y)))\n"
+    "(define g (lambda (n) (lambda (d) (set! n (+ n d)) n)))\n"
+    "(display (f 3))\n", NULL, false );
+
+  // No frames are allocated, only the box of n
+  CPPUNIT_ASSERT_EQUAL( 0u, countOf( code, "ALLOC( sizeof(reg_t)*" ) );
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "loc_0/*x:1*/ = g_param1;" ) );
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "loc_0/*n:1*/ = (reg_t)BOX( g_param1 );" ) );
+}
+
+void TestSimpleCodeGen::testLet ( )
+{
+  std::string code = generate(
+    "(define f (lambda (x)\n"
+    "  (let ((a (* x 2)))\n"
+    "    (letrec ((lp (lambda (i) (if (== i 0) a (lp (- i 1))))))\n"
+    "      (lp x)))))\n"
+    "(define g (lambda (k)\n"
+    "  (letrec* ((h (lambda (z) z)) (m (h k)))\n"
+    "    (set! h (lambda (z) k))\n"
+    "    (h m))))\n"
+    "(display (f 3))\n", NULL, false );
+
+  CPPUNIT_ASSERT( code.find( "?" ) == std::string::npos );
+  // a and lp are locals of f: only the closures are allocated
+  CPPUNIT_ASSERT_EQUAL( 0u, countOf( code, "ALLOC( sizeof(reg_t)*" ) );
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "loc_1/*a:3*/ = (reg_t)" ) );
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "goto entry;" ) );
+}
+
+void TestSimpleCodeGen::testKnownCalls ( )
+{
+  std::string text =
+    "(define sq (lambda (x) (* x x)))\n"
+    "(define f (lambda (k)\n"
+    "  (define add (lambda (x) (+ x k)))\n"
+    "  (add (sq k))))\n"
+    "(display (f 3))\n";
+
+  // f, sq and add (in tail position) are called directly; only add has an environment
+  std::string code = generate( text, NULL, false );
+  CPPUNIT_ASSERT_EQUAL( 2u, countOf( code, " = CALL( func_" ) );
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "g_tailfp = func_" ) );
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "  g_param0 = (closure_t *)" ) );
+
+  // In a stream, a later form may assign the top-level variables
+  code = generate( text, NULL, true );
+  CPPUNIT_ASSERT_EQUAL( 0u, countOf( code, " = CALL( func_" ) );
+  CPPUNIT_ASSERT_EQUAL( 1u, countOf( code, "g_tailfp = func_" ) );
+}
+
@@ -0,0 +1,47 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef TESTSIMPLECODEGEN_HPP
+#define	TESTSIMPLECODEGEN_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class TestSimpleCodeGen : public CPPUNIT_NS::TestFixture {
+  CPPUNIT_TEST_SUITE(TestSimpleCodeGen);
+  CPPUNIT_TEST(testParallel);
+  CPPUNIT_TEST(testTailCalls);
+  CPPUNIT_TEST(testFlatClosures);
+  CPPUNIT_TEST(testLocals);
+  CPPUNIT_TEST(testLet);
+  CPPUNIT_TEST(testKnownCalls);
+  CPPUNIT_TEST_SUITE_END();
+
+public:
+  TestSimpleCodeGen();
+  virtual ~TestSimpleCodeGen();
+  void setUp();
+  void tearDown();
+
+private:
+  void testParallel();
+  void testTailCalls();
+  void testFlatClosures();
+  void testLocals();
+  void testLet();
+  void testKnownCalls();
+};
+
+#endif	/* TESTSIMPLECODEGEN_HPP */
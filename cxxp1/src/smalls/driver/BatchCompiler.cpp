@@ -0,0 +1,178 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "BatchCompiler.hpp"
+#include "ModuleCompiler.hpp"
+#include "p1/util/FastStdioInput.hpp"
+#include "p1/util/clock.hpp"
+#include <boost/scoped_ptr.hpp>
+#include <algorithm>
+#include <sstream>
+#include <cstdio>
+
+namespace p1 {
+namespace smalls {
+
+class BatchCompiler::CompileTask : public ThreadPool::Task
+{
+public:
+  BatchCompiler * const owner;
+  FileResult result;
+  bool done; //< protected by BatchCompiler::m_lock
+
+  CompileTask ( BatchCompiler * owner_, const std::string & fileName )
+    : owner( owner_ ), done( false )
+  {
+    result.fileName = fileName;
+    result.status = 0;
+    result.sourceBytes = 0;
+    result.nanos = 0;
+  }
+
+  virtual void run ()
+  {
+    owner->compileFile( result );
+    owner->taskDone( this );
+  }
+};
+
+BatchCompiler::BatchCompiler ( const Options & options )
+  : m_options( options ), m_pool( options.threads )
+{
+  pthread_mutex_init( &m_lock, NULL );
+  pthread_cond_init( &m_taskDone, NULL );
+}
+
+BatchCompiler::~BatchCompiler ()
+{
+  m_pool.wait();
+  pthread_cond_destroy( &m_taskDone );
+  pthread_mutex_destroy( &m_lock );
+}
+
+/**
+ * Runs on a worker. Everything the compilation needs is created here.
+ */
+void BatchCompiler::compileFile ( FileResult & res ) const
+{
+  uint64_t const start = monotonicNanos();
+  std::stringstream out, diag;
+  StreamErrorReporter errors( &diag );
+
+  try
+  {
+    SymbolTable symTab;
+    FastStdioInput fi( res.fileName.c_str(), "rb" );
+    Lexer lex( fi, res.fileName.c_str(), symTab, errors );
+    Keywords kw( symTab );
+    SyntaxReader dp( lex, kw );
+
+    SyntaxList datums;
+    Syntax * d;
+    while ((d = dp.parseDatum()) != dp.DAT_EOF)
+      datums.push_back( d );
+    res.sourceBytes = fi.offset();
+
+    SchemeParser parser( symTab, kw, errors );
+    parser.setExpansionCache( m_options.expansionCache );
+    compileModule( parser, datums, m_options.stream, out );
+  }
+  catch (std::exception & e)
+  {
+    diag << e.what() << std::endl;
+    ++errors.count;
+  }
+
+  res.status = errors.count ? 1 : 0;
+  res.code = out.str();
+  res.diagnostics = diag.str();
+  res.nanos = monotonicNanos() - start;
+}
+
+void BatchCompiler::taskDone ( CompileTask * task )
+{
+  pthread_mutex_lock( &m_lock );
+  task->done = true;
+  pthread_cond_broadcast( &m_taskDone );
+  pthread_mutex_unlock( &m_lock );
+}
+
+BatchCompiler::Summary BatchCompiler::run ( const std::vector<std::string> & fileNames, Sink & sink )
+{
+  Summary sum;
+  uint64_t const start = monotonicNanos();
+
+  std::vector<CompileTask *> tasks;
+  tasks.reserve( fileNames.size() );
+  for ( size_t i = 0; i != fileNames.size(); ++i )
+    tasks.push_back( new CompileTask( this, fileNames[i] ) );
+  for ( size_t i = 0; i != tasks.size(); ++i )
+    m_pool.submit( tasks[i] );
+
+  // Deliver the results in order, while the rest are still compiling
+  for ( size_t i = 0; i != tasks.size(); ++i )
+  {
+    boost::scoped_ptr<CompileTask> task( tasks[i] );
+
+    pthread_mutex_lock( &m_lock );
+    while (!task->done)
+      pthread_cond_wait( &m_taskDone, &m_lock );
+    pthread_mutex_unlock( &m_lock );
+
+    const FileResult & res = task->result;
+    sink.done( res );
+
+    ++sum.files;
+    if (res.status)
+      ++sum.failed;
+    sum.sourceBytes += res.sourceBytes;
+    sum.nanos.push_back( res.nanos );
+  }
+
+  m_pool.wait();
+  sum.wallNanos = monotonicNanos() - start;
+  sum.pool = m_pool.stats();
+  std::sort( sum.nanos.begin(), sum.nanos.end() );
+  return sum;
+}
+
+void BatchCompiler::Summary::print ( std::ostream & os, unsigned threads ) const
+{
+  double const secs = wallNanos / 1e9;
+  char buf[256];
+
+  std::sprintf( buf, "%u files (%u failed), %.1f KiB on %u threads in %.3f s: %.1f files/s, %.1f KiB/s\n",
+                files, failed, sourceBytes / 1024.0, threads, secs,
+                secs > 0 ? files / secs : 0.0, secs > 0 ? sourceBytes / 1024.0 / secs : 0.0 );
+  os << buf;
+
+  if (!nanos.empty())
+  {
+    uint64_t total = 0;
+    for ( size_t i = 0; i != nanos.size(); ++i )
+      total += nanos[i];
+    std::sprintf( buf, "latency ms: min %.3f, median %.3f, p95 %.3f, max %.3f, mean %.3f\n",
+                  nanos.front() / 1e6, nanos[nanos.size() / 2] / 1e6,
+                  nanos[(nanos.size() - 1) * 95 / 100] / 1e6, nanos.back() / 1e6,
+                  total / 1e6 / nanos.size() );
+    os << buf;
+  }
+
+  std::sprintf( buf, "tasks stolen: %lu of %lu\n", pool.stolen, pool.executed );
+  os << buf;
+}
+
+}} // namespaces
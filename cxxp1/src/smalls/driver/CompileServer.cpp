@@ -0,0 +1,155 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "CompileServer.hpp"
+#include "p1/util/FastStdioInput.hpp"
+#include "p1/util/UnixSocket.hpp"
+#include "p1/util/format-str.hpp"
+#include "p1/util/scopeguard.hpp"
+#include <sstream>
+#include <cerrno>
+#include <sys/stat.h>
+
+namespace p1 {
+namespace smalls {
+
+CompileServer::CompileServer ()
+  : m_kw( m_symbolTable ),
+    m_parser( m_symbolTable, m_kw, m_errors )
+{
+}
+
+int CompileServer::compile ( const char * fileName, const char * path, unsigned flags,
+                             std::ostream & out, std::ostream & diag )
+{
+  ++m_stats.requests;
+  m_errors.os = &diag;
+  m_errors.count = 0;
+
+  int status;
+  try
+  {
+    SourceFile * src = readSource( fileName, path );
+    diag << src->diagnostics;
+    m_errors.count += src->errorCount;
+    compileModule( m_parser, src->datums, (flags & protocol::F_STREAM) != 0, out );
+    status = m_errors.count ? 1 : 0;
+  }
+  catch (std::exception & e)
+  {
+    diag << e.what() << std::endl;
+    status = 1;
+  }
+  m_errors.os = NULL;
+  return status;
+}
+
+/**
+ * Read the syntax of the file, or reuse it if the file hasn't changed since the last time.
+ */
+CompileServer::SourceFile * CompileServer::readSource ( const char * fileName, const char * path )
+{
+  // Before reading, so a modification while reading is noticed next time
+  struct stat st;
+  if (::stat( path, &st ))
+    throw io_error(formatStr("stat %s errno=%d", path, errno));
+
+  FileId const id( st.st_dev, st.st_ino );
+  SourceMap::iterator it = m_sources.find( id );
+  if (it != m_sources.end())
+  {
+    SourceFile * src = it->second;
+    if (src->mtime == st.st_mtim.tv_sec && src->mtimeNsec == st.st_mtim.tv_nsec &&
+        src->size == st.st_size && src->name == fileName)
+    {
+      ++m_stats.sourceHits;
+      return src;
+    }
+  }
+
+  SourceFile * src = new SourceFile();
+  src->dev = st.st_dev;
+  src->ino = st.st_ino;
+  src->mtime = st.st_mtim.tv_sec;
+  src->mtimeNsec = st.st_mtim.tv_nsec;
+  src->size = st.st_size;
+  src->name = fileName;
+
+  std::stringstream diag;
+  StreamErrorReporter errors( &diag );
+  FastStdioInput fi( path, "rb" );
+  Lexer lex( fi, src->name.c_str(), m_symbolTable, errors );
+  SyntaxReader dp( lex, m_kw );
+  Syntax * d;
+  while ((d = dp.parseDatum()) != dp.DAT_EOF)
+    src->datums.push_back( d );
+
+  std::string const text = diag.str();
+  src->diagnostics.assign( text.begin(), text.end() );
+  src->errorCount = errors.count;
+
+  m_sources[id] = src;
+  return src;
+}
+
+void CompileServer::serve ( const char * socketPath )
+{
+  UnixSocket listener( UnixSocket::listen( socketPath ) );
+  ON_BLOCK_EXIT( ::unlink, socketPath );
+
+  for(;;)
+  {
+    UnixSocket client( listener.accept() );
+    try
+    {
+      std::string msg;
+      if (!client.readMessage( msg ))
+        continue;
+      std::vector<std::string> const req = protocol::decode( msg );
+
+      int status;
+      std::stringstream out, diag;
+      if (req[0] == protocol::CMD_SHUTDOWN && req.size() == 1)
+        status = 0;
+      else if (req[0] == protocol::CMD_COMPILE && req.size() == 4)
+      {
+        const std::string & fileName = req[3];
+        std::string const path = fileName[0] == '/' ? fileName : req[2] + '/' + fileName;
+        status = compile( fileName.c_str(), path.c_str(), std::strtoul( req[1].c_str(), NULL, 10 ),
+                          out, diag );
+      }
+      else
+      {
+        status = 2;
+        diag << "Invalid request\n";
+      }
+
+      client.writeMessage( formatStr( "%d", status ) );
+      client.writeMessage( out.str() );
+      client.writeMessage( diag.str() );
+
+      if (req[0] == protocol::CMD_SHUTDOWN)
+        return;
+    }
+    catch (io_error & e)
+    {
+      // A client which went away doesn't stop the server
+      std::cerr << e.what() << std::endl;
+    }
+  }
+}
+
+}} // namespaces
@@ -0,0 +1,85 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "IncrementalCompiler.hpp"
+#include "p1/smalls/parser/Syntax.hpp"
+#include <boost/foreach.hpp>
+#include <sstream>
+
+namespace p1 {
+namespace smalls {
+
+IncrementalCompiler::IncrementalCompiler ( SymbolTable & symbolTable, const Keywords & kw,
+                                           AbstractErrorReporter & errors )
+  : m_parser( symbolTable, kw, errors )
+{
+  m_lineInfo = false;
+  m_nextId = 0;
+  m_parser.setAstCache( &m_astCache );
+}
+
+void IncrementalCompiler::setLineInfo ( bool on )
+{
+  m_lineInfo = on;
+  m_codeGen.setLineInfo( on );
+  m_code.clear();
+}
+
+void IncrementalCompiler::compile ( std::ostream & os, const SyntaxList & datums )
+{
+  CodeMap previous;
+  previous.swap( m_code );
+  m_stats = Stats();
+
+  m_codeGen.beginStream( os, m_parser.beginStream() );
+  BOOST_FOREACH( Syntax * datum, datums )
+  {
+    ++m_stats.forms;
+
+    uint64_t key;
+    bool const keyed = fingerprintSyntax( datum, &datum->coords, key );
+    if (keyed && m_lineInfo)
+      key ^= datum->coords.line * 1099511628211ULL;
+
+    if (keyed)
+    {
+      CodeMap::iterator it = previous.find( key );
+      if (it != previous.end() && m_parser.bindCachedForm( datum ))
+      {
+        FormCode * fc = it->second;
+        previous.erase( it );
+        m_codeGen.reuseStreamForm( os, fc->code, fc->id );
+        m_code.insert( CodeMap::value_type( key, fc ) );
+        ++m_stats.reused;
+        continue;
+      }
+    }
+
+    AstBody * body = m_parser.compileTopLevelForm( datum );
+    unsigned id = m_nextId++;
+    std::stringstream ss;
+    m_codeGen.genStreamForm( ss, body, id );
+    std::string code = ss.str();
+    os << code;
+    if (keyed)
+      m_code.insert( CodeMap::value_type( key, new FormCode( id, code ) ) );
+    ++m_stats.compiled;
+  }
+  m_parser.endStream();
+  m_codeGen.endStream( os );
+}
+
+}} // namespaces
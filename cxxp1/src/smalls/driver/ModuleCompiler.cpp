@@ -0,0 +1,69 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "ModuleCompiler.hpp"
+#include "p1/smalls/codegen/SimpleCodeGen.hpp"
+#include "ListBuilder.hpp"
+#include <boost/foreach.hpp>
+
+namespace p1 {
+namespace smalls {
+
+void StreamErrorReporter::error ( const ErrorInfo & ei )
+{
+  ++count;
+  if (os)
+    *os << ei.formatMessage() << std::endl;
+}
+
+void compileModule ( SchemeParser & parser, const SyntaxList & datums, bool stream, std::ostream & out )
+{
+  SimpleCodeGen cg;
+  cg.setLineInfo( false );
+
+  if (stream)
+  {
+    cg.beginStream( out, parser.beginStream() );
+    try
+    {
+      BOOST_FOREACH( Syntax * d, datums )
+      {
+        AstBody * form = parser.compileTopLevelForm( d );
+        out << "/*\n" << *form << "\n*/\n\n";
+        cg.genStreamForm( out, form );
+      }
+    }
+    catch (...)
+    {
+      parser.endStream();
+      throw;
+    }
+    parser.endStream();
+    cg.endStream( out );
+  }
+  else
+  {
+    detail::ListBuilder lb;
+    BOOST_FOREACH( Syntax * d, datums )
+      lb << d;
+
+    AstModule * mod = parser.compileLibraryBody( lb );
+    out << "/*\n" << *mod << "\n*/\n\n";
+    cg.generate( out, mod );
+  }
+}
+
+}} // namespaces
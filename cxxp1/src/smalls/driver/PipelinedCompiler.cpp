@@ -0,0 +1,278 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "PipelinedCompiler.hpp"
+#include "p1/util/clock.hpp"
+#include "p1/util/format-str.hpp"
+#include <boost/foreach.hpp>
+#include <stdexcept>
+#include <sched.h>
+#include <unistd.h>
+
+namespace p1 {
+namespace smalls {
+
+/**
+ * Collects the errors of the reader until the datum they belong to is queued.
+ */
+class PipelinedCompiler::ReaderErrors : public AbstractErrorReporter
+{
+public:
+  ErrorList * list;
+
+  ReaderErrors () : list( NULL ) {}
+
+  virtual void error ( const ErrorInfo & ei )
+  {
+    if (!list)
+      list = new (GC) ErrorList();
+    list->push_back( new ErrorInfo( ei ) );
+  }
+};
+
+PipelinedCompiler::PipelinedCompiler ( Lexer & lex, SyntaxReader & reader, SchemeParser & parser,
+                                       AbstractErrorReporter & errors, bool printForms,
+                                       unsigned queueSize )
+  : m_lex( lex ), m_reader( reader ), m_parser( parser ), m_errors( errors ),
+    m_printForms( printForms ),
+    m_readQueue( queueSize ), m_formQueue( queueSize )
+{
+  m_frame = NULL;
+  m_abort = 0;
+}
+
+/**
+ * Spin briefly, since the other stage is usually about to catch up, then give up the processor.
+ */
+static void backoff ( unsigned spins )
+{
+  if (spins < 64)
+    return;
+  else if (spins < 128)
+    sched_yield();
+  else
+    ::usleep( 50 );
+}
+
+template <typename Q, typename T>
+bool PipelinedCompiler::push ( Q & q, const T & x )
+{
+  for ( unsigned spins = 0; !q.tryPush( x ); ++spins )
+  {
+    if (__atomic_load_n( &m_abort, __ATOMIC_ACQUIRE ))
+      return false;
+    backoff( spins );
+  }
+  return true;
+}
+
+template <typename Q, typename T>
+bool PipelinedCompiler::pop ( Q & q, T & x )
+{
+  for ( unsigned spins = 0; !q.tryPop( x ); ++spins )
+  {
+    if (__atomic_load_n( &m_abort, __ATOMIC_ACQUIRE ))
+      return false;
+    backoff( spins );
+  }
+  return true;
+}
+
+void PipelinedCompiler::fail ( const char * what )
+{
+  if (__sync_bool_compare_and_swap( &m_abort, 0, 1 ))
+    m_failure = what;
+}
+
+void PipelinedCompiler::run ( std::ostream & out )
+{
+  uint64_t const start = monotonicNanos();
+
+  SimpleCodeGen cg;
+  cg.setLineInfo( false );
+  AstModule * mod = m_parser.beginStream();
+  m_frame = mod->body()->frame();
+  cg.beginStream( out, mod );
+
+  // The reader interns symbols while the parser is creating them
+  SymbolTable & symTab = m_lex.symbolTable();
+  symTab.setConcurrentInterning( true );
+
+  pthread_t reader, parser;
+  int err;
+  if ((err = pthread_create( &reader, NULL, readerMain, this )) != 0)
+  {
+    m_parser.endStream();
+    symTab.setConcurrentInterning( false );
+    throw std::runtime_error( formatStr( "pthread_create error=%d", err ) );
+  }
+  if ((err = pthread_create( &parser, NULL, parserMain, this )) != 0)
+  {
+    fail( formatStr( "pthread_create error=%d", err ).c_str() );
+    pthread_join( reader, NULL );
+    m_parser.endStream();
+    symTab.setConcurrentInterning( false );
+    throw std::runtime_error( m_failure );
+  }
+
+  try
+  {
+    emitStage( out, cg );
+  }
+  catch (std::exception & e)
+  {
+    fail( e.what() );
+  }
+
+  pthread_join( reader, NULL );
+  pthread_join( parser, NULL );
+  symTab.setConcurrentInterning( false );
+  m_stats.wallNanos = monotonicNanos() - start;
+
+  if (m_abort)
+    throw std::runtime_error( m_failure );
+}
+
+void * PipelinedCompiler::readerMain ( void * arg )
+{
+  static_cast<PipelinedCompiler *>(arg)->readStage();
+  return NULL;
+}
+
+void * PipelinedCompiler::parserMain ( void * arg )
+{
+  static_cast<PipelinedCompiler *>(arg)->compileStage();
+  return NULL;
+}
+
+void PipelinedCompiler::readStage ()
+{
+  ReaderErrors errors;
+  AbstractErrorReporter & saved = m_lex.errorReporter();
+  m_lex.setErrorReporter( errors );
+
+  try
+  {
+    for(;;)
+    {
+      uint64_t const t = monotonicNanos();
+      Syntax * d = m_reader.parseDatum();
+      m_stats.readNanos += monotonicNanos() - t;
+
+      ReadItem item;
+      item.datum = d != m_reader.DAT_EOF ? d : NULL;
+      item.errors = errors.list;
+      errors.list = NULL;
+      if (!push( m_readQueue, item ) || !item.datum)
+        break;
+    }
+  }
+  catch (std::exception & e)
+  {
+    fail( e.what() );
+  }
+
+  m_lex.setErrorReporter( saved );
+}
+
+void PipelinedCompiler::compileStage ()
+{
+  bool ended = false;
+  unsigned varsSent = 0; // as far as the code generator knows
+  try
+  {
+    for(;;)
+    {
+      ReadItem in;
+      if (!pop( m_readQueue, in ))
+        break;
+
+      uint64_t const t = monotonicNanos();
+      if (in.errors)
+      {
+        BOOST_FOREACH( ErrorInfo * ei, *in.errors )
+          m_errors.error( *ei );
+      }
+
+      FormItem res;
+      if (in.datum)
+      {
+        res.form = m_parser.compileTopLevelForm( in.datum );
+        unsigned const length = m_frame->length();
+        if (length != varsSent)
+        {
+          res.addedVars = new (GC) VectorOfVariable( m_frame->vars().begin() + varsSent,
+                                                     m_frame->vars().end() );
+          varsSent = length;
+        }
+        ++m_stats.forms;
+      }
+      else
+      {
+        // The frame must be complete before the code generator finishes
+        ended = true;
+        m_parser.endStream();
+      }
+      m_stats.compileNanos += monotonicNanos() - t;
+
+      if (!push( m_formQueue, res ) || !in.datum)
+        break;
+    }
+  }
+  catch (std::exception & e)
+  {
+    fail( e.what() );
+  }
+
+  // Leave the parser ready for the next module
+  if (!ended)
+  {
+    try
+    {
+      m_parser.endStream();
+    }
+    catch (std::exception & e)
+    {
+      fail( e.what() );
+    }
+  }
+}
+
+void PipelinedCompiler::emitStage ( std::ostream & out, SimpleCodeGen & cg )
+{
+  for(;;)
+  {
+    FormItem in;
+    if (!pop( m_formQueue, in ))
+      return;
+
+    uint64_t const t = monotonicNanos();
+    if (!in.form)
+    {
+      cg.endStream( out );
+      m_stats.emitNanos += monotonicNanos() - t;
+      return;
+    }
+
+    if (m_printForms)
+      out << "/*\n" << *in.form << "\n*/\n\n";
+    cg.setStreamVarsAdded( in.addedVars );
+    cg.genStreamForm( out, in.form );
+    m_stats.emitNanos += monotonicNanos() - t;
+  }
+}
+
+}} // namespaces
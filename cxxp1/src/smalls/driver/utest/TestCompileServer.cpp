@@ -0,0 +1,106 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestCompileServer.hpp"
+#include "CompileServer.hpp"
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace p1;
+using namespace p1::smalls;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestCompileServer );
+
+TestCompileServer::TestCompileServer ( )
+{
+}
+
+TestCompileServer::~TestCompileServer ( )
+{
+}
+
+static std::string tempFile ( )
+{
+  char name[] = "/tmp/TestCompileServerXXXXXX";
+  int fd = mkstemp( name );
+  CPPUNIT_ASSERT( fd != -1 );
+  ::close( fd );
+  return name;
+}
+
+void TestCompileServer::setUp ( )
+{
+  m_pathA = tempFile();
+  m_pathB = tempFile();
+}
+
+void TestCompileServer::tearDown ( )
+{
+  std::remove( m_pathA.c_str() );
+  std::remove( m_pathB.c_str() );
+}
+
+namespace
+{
+;
+
+void writeFile ( const std::string & path, const char * text )
+{
+  std::ofstream f( path.c_str() );
+  f << text;
+}
+
+int compile ( CompileServer * server, const std::string & path, std::string & out )
+{
+  std::stringstream os, diag;
+  int status = server->compile( path.c_str(), path.c_str(), 0, os, diag );
+  out = os.str();
+  return status;
+}
+
+};
+
+void TestCompileServer::testRequests ( )
+{
+  writeFile( m_pathA,
+    "(define-macro twice (syntax-rules () ((_ e) (begin e e))))\n"
+    "(define x 1)\n"
+    "(twice (display x))\n" );
+  writeFile( m_pathB, "(twice (display 2))\n" );
+
+  CompileServer * server = new CompileServer();
+  std::string first, out;
+  CPPUNIT_ASSERT_EQUAL( 0, compile( server, m_pathA, first ) );
+
+  // Nothing defined by a request is visible to the next one
+  CPPUNIT_ASSERT_EQUAL( 1, compile( server, m_pathB, out ) );
+  CPPUNIT_ASSERT_EQUAL( 0, compile( server, m_pathA, out ) );
+  CPPUNIT_ASSERT( out == first );
+  CPPUNIT_ASSERT_EQUAL( 1ul, server->stats().sourceHits );
+
+  // A modified file is read again
+  writeFile( m_pathA, "(define x 1)\n(display x)\n" );
+  CPPUNIT_ASSERT_EQUAL( 0, compile( server, m_pathA, out ) );
+  CPPUNIT_ASSERT( out != first );
+  CPPUNIT_ASSERT_EQUAL( 1ul, server->stats().sourceHits );
+  CPPUNIT_ASSERT_EQUAL( 4ul, server->stats().requests );
+
+  std::remove( m_pathB.c_str() );
+  CPPUNIT_ASSERT_EQUAL( 1, compile( server, m_pathB, out ) );
+}
@@ -0,0 +1,153 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestIncrementalCompiler.hpp"
+#include "IncrementalCompiler.hpp"
+#include "p1/smalls/parser/SyntaxReader.hpp"
+#include <sstream>
+
+using namespace p1;
+using namespace p1::smalls;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestIncrementalCompiler );
+
+TestIncrementalCompiler::TestIncrementalCompiler ( )
+{
+}
+
+TestIncrementalCompiler::~TestIncrementalCompiler ( )
+{
+}
+
+void TestIncrementalCompiler::setUp ( )
+{
+}
+
+void TestIncrementalCompiler::tearDown ( )
+{
+}
+
+namespace
+{
+;
+
+class ErrorReporter : public AbstractErrorReporter
+{
+public:
+  int count;
+
+  ErrorReporter () : count( 0 ) {}
+  virtual void error ( const ErrorInfo & ei )
+  {
+    ++count;
+    std::cerr << "  " << ei.formatMessage() << std::endl;
+  }
+};
+
+const char s_text[] =
+  "(define-macro twice (syntax-rules () ((_ e) (begin e e))))\n"
+  "(define x 1)\n"
+  "(define f (lambda (a) (twice (g a))))\n"
+  "(define g (lambda (n) (+ n x)))\n"
+  "(f 10)\n";
+
+std::string compile ( IncrementalCompiler & ic, SymbolTable & symTab, const Keywords & kw,
+                      ErrorReporter & err, const std::string & text )
+{
+  CharBufInput in( text.c_str() );
+  Lexer lex( in, "input", symTab, err );
+  SyntaxReader reader( lex, kw );
+
+  IncrementalCompiler::SyntaxList datums;
+  Syntax * d;
+  while ((d = reader.parseDatum()) != reader.DAT_EOF)
+    datums.push_back( d );
+
+  std::stringstream out;
+  ic.compile( out, datums );
+  CPPUNIT_ASSERT_EQUAL( 0, err.count );
+  return out.str();
+}
+
+};
+
+void TestIncrementalCompiler::testRecompile ( )
+{
+  SymbolTable symTab;
+  Keywords kw( symTab );
+  ErrorReporter err;
+  IncrementalCompiler * ic = new IncrementalCompiler( symTab, kw, err );
+
+  std::string first = compile( *ic, symTab, kw, err, s_text );
+  CPPUNIT_ASSERT_EQUAL( 5u, ic->stats().forms );
+  CPPUNIT_ASSERT_EQUAL( 5u, ic->stats().compiled );
+
+  // Nothing changed: everything except the macro definition is reused verbatim
+  std::string second = compile( *ic, symTab, kw, err, std::string( "\n" ) + s_text );
+  CPPUNIT_ASSERT_EQUAL( 4u, ic->stats().reused );
+  CPPUNIT_ASSERT_EQUAL( 1u, ic->stats().compiled );
+  // Only the id of the macro definition differs
+  CPPUNIT_ASSERT( second.size() == first.size() );
+
+  // Only the changed form is generated again
+  std::string edited = s_text;
+  edited.replace( edited.find( "(+ n x)" ), 7, "(- n x)" );
+  std::string third = compile( *ic, symTab, kw, err, edited );
+  CPPUNIT_ASSERT_EQUAL( 3u, ic->stats().reused );
+  CPPUNIT_ASSERT_EQUAL( 2u, ic->stats().compiled );
+  CPPUNIT_ASSERT( third != first );
+
+  // Changing the macro recompiles the forms using it
+  std::string macro = edited;
+  macro.replace( macro.find( "(begin e e)" ), 11, "(begin e)  " );
+  compile( *ic, symTab, kw, err, macro );
+  CPPUNIT_ASSERT_EQUAL( 3u, ic->stats().reused );
+  CPPUNIT_ASSERT_EQUAL( 2u, ic->stats().compiled );
+
+  // Shadowing a system binding recompiles its users
+  std::string shadowed = std::string( "(define - (lambda (a b) a))\n" ) + macro;
+  compile( *ic, symTab, kw, err, shadowed );
+  CPPUNIT_ASSERT_EQUAL( 3u, ic->stats().reused );
+  CPPUNIT_ASSERT_EQUAL( 3u, ic->stats().compiled );
+}
+
+void TestIncrementalCompiler::testDuplicateNames ( )
+{
+  SymbolTable symTab;
+  Keywords kw( symTab );
+  ErrorReporter err;
+  IncrementalCompiler * ic = new IncrementalCompiler( symTab, kw, err );
+
+  // Each use of the macro defines another top-level "tmp"
+  const char * const macro =
+    "(define-macro def-tmp (syntax-rules () ((_ get v) (begin (define tmp v) (define get (lambda (z) tmp))))))\n";
+  const char * const outer = "(define tmp 1)\n";
+  const char * const uses = "(def-tmp get-a 2)\n(def-tmp get-b 3)\n";
+  compile( *ic, symTab, kw, err, std::string( macro ) + outer + uses + "(define f (lambda (z) tmp))\n" );
+
+  // The reused definitions keep their addresses, so the regenerated form finds the outer "tmp"
+  std::string moved = compile( *ic, symTab, kw, err, std::string( macro ) + uses + outer + "(define f (lambda (z) (+ tmp 0)))\n" );
+  CPPUNIT_ASSERT_EQUAL( 1u, ic->stats().reused );
+  CPPUNIT_ASSERT_EQUAL( 4u, ic->stats().compiled );
+  std::string::size_type pos = moved.find( "= (reg_t)1;" );
+  CPPUNIT_ASSERT( pos != std::string::npos );
+  pos = moved.rfind( "g_topframe[", pos );
+  std::string outerAddr = moved.substr( pos, moved.find( ']', pos ) + 1 - pos );
+  // Nothing else is stored there
+  CPPUNIT_ASSERT( moved.find( outerAddr + "/*tmp:0*/ =" ) == pos );
+  CPPUNIT_ASSERT( moved.find( outerAddr + "/*tmp:0*/ =", pos + 1 ) == std::string::npos );
+  CPPUNIT_ASSERT( moved.find( "g_param1 = (reg_t)" + outerAddr ) != std::string::npos );
+}
@@ -0,0 +1,137 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestPipelinedCompiler.hpp"
+#include "PipelinedCompiler.hpp"
+#include "ModuleCompiler.hpp"
+#include "p1/smalls/codegen/SimpleCodeGen.hpp"
+#include "p1/smalls/parser/SyntaxReader.hpp"
+#include <sstream>
+
+using namespace p1;
+using namespace p1::smalls;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestPipelinedCompiler );
+
+TestPipelinedCompiler::TestPipelinedCompiler ( )
+{
+}
+
+TestPipelinedCompiler::~TestPipelinedCompiler ( )
+{
+}
+
+void TestPipelinedCompiler::setUp ( )
+{
+}
+
+void TestPipelinedCompiler::tearDown ( )
+{
+}
+
+namespace
+{
+;
+
+std::string generateText ( unsigned count )
+{
+  std::stringstream text;
+  text << "(define-macro twice (syntax-rules () ((_ e) (begin e e))))\n";
+  for ( unsigned i = 0; i < count; ++i )
+  {
+    text << "(define f" << i << " (lambda (a) (twice (+ a " << i << "))))\n";
+    text << "(f" << i << " " << i << ")\n";
+  }
+  return text.str();
+}
+
+std::string sequential ( const std::string & text, std::string & diag )
+{
+  SymbolTable symTab;
+  Keywords kw( symTab );
+  std::stringstream ds;
+  StreamErrorReporter errors( &ds );
+  CharBufInput in( text.c_str() );
+  Lexer lex( in, "input", symTab, errors );
+  SyntaxReader reader( lex, kw );
+  SchemeParser parser( symTab, kw, errors );
+
+  // Read one datum at a time, like "scheme-play -stream", so the diagnostics are interleaved
+  SimpleCodeGen cg;
+  cg.setLineInfo( false );
+  std::stringstream out;
+  cg.beginStream( out, parser.beginStream() );
+  Syntax * d;
+  while ((d = reader.parseDatum()) != reader.DAT_EOF)
+  {
+    AstBody * form = parser.compileTopLevelForm( d );
+    out << "/*\n" << *form << "\n*/\n\n";
+    cg.genStreamForm( out, form );
+  }
+  parser.endStream();
+  cg.endStream( out );
+  diag = ds.str();
+  return out.str();
+}
+
+std::string pipelined ( const std::string & text, unsigned queueSize, std::string & diag )
+{
+  SymbolTable symTab;
+  Keywords kw( symTab );
+  std::stringstream ds;
+  StreamErrorReporter errors( &ds );
+  CharBufInput in( text.c_str() );
+  Lexer lex( in, "input", symTab, errors );
+  SyntaxReader reader( lex, kw );
+  SchemeParser parser( symTab, kw, errors );
+
+  std::stringstream out;
+  PipelinedCompiler * pc = new PipelinedCompiler( lex, reader, parser, errors, true, queueSize );
+  pc->run( out );
+  diag = ds.str();
+  return out.str();
+}
+
+};
+
+void TestPipelinedCompiler::testSameAsSequential ( )
+{
+  std::string text = generateText( 300 );
+  std::string diag;
+  std::string expected = sequential( text, diag );
+  CPPUNIT_ASSERT( diag.empty() );
+
+  // A tiny queue makes the stages wait for each other all the time
+  CPPUNIT_ASSERT( pipelined( text, 2, diag ) == expected );
+  CPPUNIT_ASSERT( diag.empty() );
+  CPPUNIT_ASSERT( pipelined( text, 64, diag ) == expected );
+}
+
+void TestPipelinedCompiler::testErrors ( )
+{
+  const char text[] =
+    "(define x 1)\n"
+    "(define y #\\bogus)\n"
+    "(undefined-thing x)\n"
+    "(define z #\\bogus)\n"
+    "(define x 2)\n";
+
+  std::string expected, diag;
+  sequential( text, expected );
+  CPPUNIT_ASSERT( !expected.empty() );
+  pipelined( text, 2, diag );
+  CPPUNIT_ASSERT( diag == expected );
+}
@@ -0,0 +1,900 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "AstCache.hpp"
+#include "Syntax.hpp"
+#include "p1/util/FastMMapInput.hpp"
+#include "p1/util/format-str.hpp"
+#include <boost/scoped_ptr.hpp>
+#include <boost/foreach.hpp>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+
+namespace p1 {
+namespace smalls {
+
+#define _MK_ENUM(x) #x,
+const char * AstDependencyKind::s_names[] =
+{
+  _DEF_AST_DEPENDENCY_KINDS
+};
+#undef _MK_ENUM
+
+namespace
+{
+
+/*
+ * A form is a byte stream of unsigned LEB128 numbers, strings (length followed by the bytes) and
+ * raw doubles:
+ *   dependencies: count, { kind, system, name, detail, coords }...
+ *   AST: kind, coords, fields... in preorder; a NULL Ast is AstKind::NONE
+ *
+ * Coordinates:
+ *   0, line, column        -- relative to the start of the form
+ *   1, line, column        -- no file
+ *   2, name, line, column  -- a file name seen for the first time
+ *   3+k, line, column      -- the k-th file name seen
+ *
+ * Frames (an AstFrame *):
+ *   0                      -- the top-level frame
+ *   1, parent, count, { name, coords }... -- a frame seen for the first time, and its variables
+ *   2+k                    -- the k-th frame seen
+ *
+ * Variables (an AstVariable *):
+ *   0                      -- NULL
+ *   1, dep                 -- the variable of a dependency
+ *   2, frame, index        -- a variable of a frame created by the form
+ *
+ * The cache file is a header followed by the forms, each preceded by its key, length and hash.
+ */
+
+const char MAGIC[8] = { 's','m','a','l','l','s','a','c' };
+/** Bump whenever the encoding changes */
+const uint32_t VERSION = 1;
+
+struct FileHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t formCount;
+};
+
+struct FormHeader
+{
+  uint64_t key;
+  uint64_t hash; //< of the data
+  uint32_t length;
+  uint32_t astOffset;
+};
+
+uint64_t hashBytes ( const unsigned char * data, size_t len )
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for ( const unsigned char * end = data + len; data != end; ++data )
+  {
+    hash ^= *data;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+bool sameFile ( const gc_char * a, const gc_char * b )
+{
+  return a == b || (a && b && std::strcmp( a, b ) == 0);
+}
+
+/** Thrown when an AST can't be serialized or a form can't be decoded */
+struct BadForm {};
+
+class Writer
+{
+public:
+  AstCache::Bytes & out;
+
+  Writer ( AstCache::Bytes & out_, AstFrame * topFrame, const SourceCoords & base )
+    : out( out_ ), m_topFrame( topFrame ), m_base( base )
+  {}
+
+  void putNum ( uint64_t v )
+  {
+    while (v >= 0x80)
+    {
+      out.push_back( (unsigned char)(v | 0x80) );
+      v >>= 7;
+    }
+    out.push_back( (unsigned char)v );
+  }
+
+  void putString ( const gc_char * s )
+  {
+    size_t len = std::strlen( s );
+    putNum( len );
+    out.insert( out.end(), (const unsigned char *)s, (const unsigned char *)s + len );
+  }
+
+  void putCoords ( const SourceCoords & c );
+  void putDependencies ( const AstCache::DependencyList & deps );
+  void putFrame ( AstFrame * frame );
+  void putVar ( AstVariable * var );
+  void putAst ( Ast * ast );
+
+private:
+  AstFrame * const m_topFrame;
+  SourceCoords const m_base;
+
+  typedef boost::unordered_map<const gc_char *, unsigned, boost::hash<const gc_char *>,
+                               std::equal_to<const gc_char *>,
+                               gc_allocator<std::pair<const gc_char * const, unsigned> > > FileMap;
+  typedef boost::unordered_map<AstFrame *, unsigned, boost::hash<AstFrame *>,
+                               std::equal_to<AstFrame *>,
+                               gc_allocator<std::pair<AstFrame * const, unsigned> > > FrameMap;
+  typedef boost::unordered_map<AstVariable *, unsigned, boost::hash<AstVariable *>,
+                               std::equal_to<AstVariable *>,
+                               gc_allocator<std::pair<AstVariable * const, unsigned> > > VarMap;
+  FileMap m_files;
+  FrameMap m_frames;
+  VarMap m_depVars;   //< variable -> index of its dependency
+
+  template <class R>
+  void putAsts ( const R & r )
+  {
+    putNum( r.size() + 1 );
+    BOOST_FOREACH( Ast * ast, r )
+      putAst( ast );
+  }
+  template <class R>
+  void putVars ( const R & r )
+  {
+    putNum( r.size() + 1 );
+    BOOST_FOREACH( AstVariable * var, r )
+      putVar( var );
+  }
+  void putAstVector ( VectorOfAst * v );
+  void putVarVector ( VectorOfVariable * v );
+};
+
+void Writer::putCoords ( const SourceCoords & c )
+{
+  if (c.fileName && sameFile( c.fileName, m_base.fileName ) && c.line >= m_base.line)
+  {
+    putNum( 0 );
+    putNum( c.line - m_base.line );
+  }
+  else if (!c.fileName)
+  {
+    putNum( 1 );
+    putNum( c.line );
+  }
+  else
+  {
+    // File names are shared by all coordinates from the same file, so the pointer is enough
+    FileMap::iterator it = m_files.find( c.fileName );
+    if (it != m_files.end())
+      putNum( 3 + it->second );
+    else
+    {
+      unsigned index = m_files.size();
+      m_files[c.fileName] = index;
+      putNum( 2 );
+      putString( c.fileName );
+    }
+    putNum( c.line );
+  }
+  putNum( c.column );
+}
+
+void Writer::putDependencies ( const AstCache::DependencyList & deps )
+{
+  putNum( deps.size() );
+  unsigned index = 0;
+  BOOST_FOREACH( const AstDependency & dep, deps )
+  {
+    putNum( dep.kind );
+    putNum( dep.system );
+    putString( dep.name );
+    putNum( dep.detail );
+    putCoords( dep.coords );
+    if (dep.var)
+      m_depVars[dep.var] = index;
+    ++index;
+  }
+}
+
+void Writer::putFrame ( AstFrame * frame )
+{
+  if (frame == m_topFrame)
+  {
+    putNum( 0 );
+    return;
+  }
+  // Only frames nested in the top-level one can have been created by the form
+  if (!frame)
+    throw BadForm();
+
+  FrameMap::iterator it = m_frames.find( frame );
+  if (it != m_frames.end())
+  {
+    putNum( 2 + it->second );
+    return;
+  }
+
+  putNum( 1 );
+  putFrame( frame->parent );
+  unsigned id = m_frames.size();
+  m_frames[frame] = id;
+
+  putNum( frame->length() );
+  BOOST_FOREACH( AstVariable * var, frame->vars() )
+  {
+    putString( var->name );
+    putCoords( var->defCoords );
+  }
+}
+
+void Writer::putVar ( AstVariable * var )
+{
+  if (!var)
+  {
+    putNum( 0 );
+    return;
+  }
+
+  VarMap::iterator it = m_depVars.find( var );
+  if (it != m_depVars.end())
+  {
+    putNum( 1 );
+    putNum( it->second );
+    return;
+  }
+
+  if (var->frame == m_topFrame)
+    throw BadForm();
+  putNum( 2 );
+  putFrame( var->frame );
+  putNum( var->index );
+}
+
+void Writer::putAstVector ( VectorOfAst * v )
+{
+  if (v)
+    putAsts( *v );
+  else
+    putNum( 0 );
+}
+
+void Writer::putVarVector ( VectorOfVariable * v )
+{
+  if (v)
+    putVars( *v );
+  else
+    putNum( 0 );
+}
+
+void Writer::putAst ( Ast * ast )
+{
+  if (!ast)
+  {
+    putNum( AstKind::NONE );
+    return;
+  }
+
+  putNum( ast->kind );
+  putCoords( ast->coords );
+
+  switch (ast->kind)
+  {
+  case AstKind::UNSPECIFIED:
+    break;
+
+  case AstKind::VAR:
+    putVar( static_cast<AstVar *>(ast)->var );
+    break;
+
+  case AstKind::DATUM:
+    {
+      const SyntaxValue * sv = dyn_cast<SyntaxValue>(static_cast<AstDatum *>(ast)->datum);
+      if (!sv)
+        throw BadForm();
+      putNum( sv->skind );
+      putCoords( sv->coords );
+      switch (sv->skind)
+      {
+      case SyntaxKind::REAL:
+        out.insert( out.end(), (const unsigned char *)&sv->u.real, (const unsigned char *)(&sv->u.real + 1) );
+        break;
+      case SyntaxKind::INTEGER: putNum( (uint64_t)sv->u.integer ); break;
+      case SyntaxKind::BOOL: putNum( sv->u.vbool ); break;
+      case SyntaxKind::STR: putString( sv->u.str ); break;
+      default: throw BadForm();
+      }
+    }
+    break;
+
+  case AstKind::SET:
+    {
+      AstSet * set = static_cast<AstSet *>(ast);
+      putVar( set->target );
+      putAst( set->rvalue );
+    }
+    break;
+
+  case AstKind::APPLY:
+    {
+      AstApply * apply = static_cast<AstApply *>(ast);
+      putAst( apply->target );
+      putAsts( apply->params() );
+      putAst( apply->listParam );
+    }
+    break;
+
+  case AstKind::IF:
+    {
+      AstIf * aif = static_cast<AstIf *>(ast);
+      putAst( aif->cond );
+      putAst( aif->thenAst );
+      putAst( aif->elseAst );
+    }
+    break;
+
+  case AstKind::BODY:
+    {
+      AstBody * body = static_cast<AstBody *>(ast);
+      putFrame( body->frame() );
+      putNum( body->defs().size() );
+      BOOST_FOREACH( AstBody::Definition & defn, body->defs() )
+      {
+        putVar( defn.first );
+        putAst( defn.second );
+      }
+    }
+    // fall through to the expressions
+  case AstKind::BEGIN:
+    {
+      ListOfAst & exprs = static_cast<AstBegin *>(ast)->exprList();
+      putNum( exprs.size() );
+      BOOST_FOREACH( Ast * expr, exprs )
+        putAst( expr );
+    }
+    break;
+
+  case AstKind::CLOSURE:
+    {
+      AstClosure * closure = static_cast<AstClosure *>(ast);
+      putFrame( closure->paramFrame );
+      putVars( closure->params() );
+      putVar( closure->listParam );
+      putAst( closure->body );
+    }
+    break;
+
+  case AstKind::LET:
+  case AstKind::FIX:
+    {
+      AstLet * let = static_cast<AstLet *>(ast);
+      putFrame( let->paramFrame );
+      putVarVector( let->params );
+      putAstVector( let->values );
+      putAst( let->body );
+    }
+    break;
+
+  default:
+    throw BadForm();
+  }
+}
+
+class Reader
+{
+public:
+  Reader ( const unsigned char * p, const unsigned char * end, AstFrame * topFrame, const SourceCoords & base )
+    : m_p( p ), m_end( end ), m_topFrame( topFrame ), m_base( base ), m_deps( NULL )
+  {}
+
+  uint64_t getNum ()
+  {
+    uint64_t v = 0;
+    for ( unsigned shift = 0; shift < 64; shift += 7 )
+    {
+      if (m_p == m_end)
+        throw BadForm();
+      unsigned char b = *m_p++;
+      v |= (uint64_t)(b & 0x7F) << shift;
+      if (!(b & 0x80))
+        return v;
+    }
+    throw BadForm();
+  }
+
+  unsigned getIndex ( size_t limit )
+  {
+    uint64_t v = getNum();
+    if (v >= limit)
+      throw BadForm();
+    return (unsigned)v;
+  }
+
+  const gc_char * getString ()
+  {
+    uint64_t len = getNum();
+    if (len > (uint64_t)(m_end - m_p))
+      throw BadForm();
+    gc_char * s = new (PointerFreeGC) gc_char[len + 1];
+    std::memcpy( s, m_p, len );
+    s[len] = 0;
+    m_p += len;
+    return s;
+  }
+
+  SourceCoords getCoords ();
+  void getDependencies ( AstCache::DependencyList & deps );
+  int getFrameId ();
+  AstFrame * getFrame ();
+  AstVariable * getVar ();
+  Ast * getAst ();
+
+  void setDependencies ( const AstCache::DependencyList * deps ) { m_deps = deps; }
+  bool atEnd () const { return m_p == m_end; }
+
+private:
+  const unsigned char * m_p;
+  const unsigned char * const m_end;
+  AstFrame * const m_topFrame;
+  SourceCoords const m_base;
+  const AstCache::DependencyList * m_deps;
+
+  std::vector<const gc_char *, gc_allocator<const gc_char *> > m_files;
+  std::vector<AstFrame *, gc_allocator<AstFrame *> > m_frames;
+
+  AstBody * getBody ()
+  {
+    Ast * ast = getAst();
+    if (!ast || ast->kind != AstKind::BODY)
+      throw BadForm();
+    return static_cast<AstBody *>(ast);
+  }
+  template <class C>
+  bool getAsts ( C & c );
+  template <class C>
+  bool getVars ( C & c );
+  VectorOfAst * getAstVector ();
+  VectorOfVariable * getVarVector ();
+};
+
+SourceCoords Reader::getCoords ()
+{
+  uint64_t tag = getNum();
+  const gc_char * fileName;
+  unsigned line;
+  if (tag == 0)
+  {
+    fileName = m_base.fileName;
+    line = m_base.line + getNum();
+  }
+  else
+  {
+    if (tag == 1)
+      fileName = NULL;
+    else if (tag == 2)
+    {
+      fileName = getString();
+      m_files.push_back( fileName );
+    }
+    else if (tag - 3 < m_files.size())
+      fileName = m_files[tag - 3];
+    else
+      throw BadForm();
+    line = getNum();
+  }
+  unsigned column = getNum();
+  return SourceCoords( fileName, line, column );
+}
+
+void Reader::getDependencies ( AstCache::DependencyList & deps )
+{
+  uint64_t count = getNum();
+  while (count--)
+  {
+    unsigned kind = getIndex( AstDependencyKind::FORWARD + 1 );
+    bool system = getNum() != 0;
+    const gc_char * name = getString();
+    uint64_t detail = getNum();
+    SourceCoords coords = getCoords();
+    deps.push_back( AstDependency( (AstDependencyKind::Enum)kind, system, name, detail, coords, NULL ) );
+  }
+}
+
+/** @return the index of the frame in m_frames, or -1 for the top-level frame */
+int Reader::getFrameId ()
+{
+  uint64_t tag = getNum();
+  if (tag == 0)
+    return -1;
+  if (tag != 1)
+  {
+    if (tag - 2 >= m_frames.size())
+      throw BadForm();
+    return (int)(tag - 2);
+  }
+
+  AstFrame * frame = new AstFrame( getFrame() );
+  for ( uint64_t count = getNum(); count; --count )
+  {
+    const gc_char * name = getString();
+    frame->newVariable( name, getCoords() );
+  }
+  m_frames.push_back( frame );
+  return (int)m_frames.size() - 1;
+}
+
+AstFrame * Reader::getFrame ()
+{
+  int id = getFrameId();
+  return id < 0 ? m_topFrame : m_frames[id];
+}
+
+AstVariable * Reader::getVar ()
+{
+  switch (getNum())
+  {
+  case 0:
+    return NULL;
+  case 1:
+    {
+      AstVariable * var = (*m_deps)[getIndex( m_deps->size() )].var;
+      if (!var)
+        throw BadForm();
+      return var;
+    }
+  case 2:
+    {
+      int id = getFrameId();
+      if (id < 0)
+        throw BadForm();
+      AstFrame * frame = m_frames[id];
+      return frame->var( getIndex( frame->length() ) );
+    }
+  default:
+    throw BadForm();
+  }
+}
+
+/** @return false if the sequence was written as NULL */
+template <class C>
+bool Reader::getAsts ( C & c )
+{
+  uint64_t n = getNum();
+  if (!n)
+    return false;
+  while (--n)
+    c.push_back( getAst() );
+  return true;
+}
+
+/** @return false if the sequence was written as NULL */
+template <class C>
+bool Reader::getVars ( C & c )
+{
+  uint64_t n = getNum();
+  if (!n)
+    return false;
+  while (--n)
+    c.push_back( getVar() );
+  return true;
+}
+
+VectorOfAst * Reader::getAstVector ()
+{
+  VectorOfAst * v = new (GC) VectorOfAst();
+  return getAsts( *v ) ? v : NULL;
+}
+
+VectorOfVariable * Reader::getVarVector ()
+{
+  VectorOfVariable * v = new (GC) VectorOfVariable();
+  return getVars( *v ) ? v : NULL;
+}
+
+Ast * Reader::getAst ()
+{
+  AstKind::Enum kind = (AstKind::Enum)getIndex( AstKind::FIX + 1 );
+  if (kind == AstKind::NONE)
+    return NULL;
+
+  SourceCoords coords = getCoords();
+
+  switch (kind)
+  {
+  case AstKind::UNSPECIFIED:
+    return new AstUnspecified( coords );
+
+  case AstKind::VAR:
+    {
+      AstVariable * var = getVar();
+      if (!var)
+        throw BadForm();
+      return new AstVar( coords, var );
+    }
+
+  case AstKind::DATUM:
+    {
+      SyntaxKind::Enum skind = (SyntaxKind::Enum)getNum();
+      SourceCoords dcoords = getCoords();
+      SyntaxValue * sv;
+      switch (skind)
+      {
+      case SyntaxKind::REAL:
+        {
+          double real;
+          if ((size_t)(m_end - m_p) < sizeof(real))
+            throw BadForm();
+          std::memcpy( &real, m_p, sizeof(real) );
+          m_p += sizeof(real);
+          sv = new SyntaxValue( skind, dcoords, real );
+        }
+        break;
+      case SyntaxKind::INTEGER:
+        sv = new SyntaxValue( skind, dcoords, (int64_t)getNum() );
+        break;
+      case SyntaxKind::BOOL:
+        sv = new SyntaxValue( skind, dcoords, getNum() != 0 );
+        break;
+      case SyntaxKind::STR:
+        sv = new SyntaxValue( skind, dcoords, getString() );
+        break;
+      default:
+        throw BadForm();
+      }
+      return new AstDatum( coords, sv );
+    }
+
+  case AstKind::SET:
+    {
+      AstVariable * target = getVar();
+      if (!target)
+        throw BadForm();
+      return new AstSet( coords, target, getAst() );
+    }
+
+  case AstKind::APPLY:
+    {
+      Ast * target = getAst();
+      SmallVector<Ast *, 8> params;
+      getAsts( params );
+      return AstApply::create( coords, target, params.begin(), params.size(), getAst() );
+    }
+
+  case AstKind::IF:
+    {
+      Ast * cond = getAst();
+      Ast * thenAst = getAst();
+      return new AstIf( coords, cond, thenAst, getAst() );
+    }
+
+  case AstKind::BEGIN:
+  case AstKind::BODY:
+    {
+      AstBegin * begin;
+      if (kind == AstKind::BODY)
+      {
+        AstBody * body = new AstBody( coords, getFrame() );
+        for ( uint64_t count = getNum(); count; --count )
+        {
+          AstVariable * var = getVar();
+          body->defs().push_back( AstBody::Definition( var, getAst() ) );
+        }
+        begin = body;
+      }
+      else
+        begin = new AstBegin( coords );
+
+      for ( uint64_t count = getNum(); count; --count )
+      {
+        Ast * ast = getAst();
+        if (!ast)
+          throw BadForm();
+        begin->exprList() += ast;
+      }
+      return begin;
+    }
+
+  case AstKind::CLOSURE:
+    {
+      AstFrame * paramFrame = getFrame();
+      SmallVector<AstVariable *, 8> params;
+      getVars( params );
+      AstVariable * listParam = getVar();
+      return AstClosure::create( coords, paramFrame, params.begin(), params.size(), listParam,
+                                 getBody() );
+    }
+
+  case AstKind::LET:
+  case AstKind::FIX:
+    {
+      AstFrame * paramFrame = getFrame();
+      VectorOfVariable * params = getVarVector();
+      VectorOfAst * values = getAstVector();
+      AstBody * body = getBody();
+      if (kind == AstKind::FIX)
+        return new AstFix( coords, paramFrame, params, body, values );
+      else
+        return new AstLet( coords, paramFrame, params, body, values );
+    }
+
+  default:
+    throw BadForm();
+  }
+}
+
+} // anon namespace
+
+AstCache::AstCache ()
+{}
+
+const AstCache::Form * AstCache::find ( uint64_t key ) const
+{
+  FormMap::const_iterator it = m_forms.find( key );
+  return it != m_forms.end() ? it->second : NULL;
+}
+
+bool AstCache::store ( uint64_t key, const DependencyList & deps, AstBody * body, AstFrame * topFrame,
+                       const SourceCoords & base )
+{
+  Form * form = new Form();
+  form->key = key;
+  try
+  {
+    Writer w( form->data, topFrame, base );
+    w.putDependencies( deps );
+    form->astOffset = form->data.size();
+    w.putAst( body );
+  }
+  catch (BadForm &)
+  {
+    return false;
+  }
+  m_forms[key] = form;
+  return true;
+}
+
+bool AstCache::readDependencies ( const Form * form, const SourceCoords & base, DependencyList & deps ) const
+{
+  try
+  {
+    Reader r( &form->data[0], &form->data[0] + form->astOffset, NULL, base );
+    r.getDependencies( deps );
+    return r.atEnd();
+  }
+  catch (BadForm &)
+  {
+    return false;
+  }
+}
+
+AstBody * AstCache::instantiate ( const Form * form, const DependencyList & deps, AstFrame * topFrame,
+                                  const SourceCoords & base ) const
+{
+  try
+  {
+    Reader r( &form->data[0] + form->astOffset, &form->data[0] + form->data.size(), topFrame, base );
+    r.setDependencies( &deps );
+    Ast * ast = r.getAst();
+    if (!r.atEnd() || !ast || ast->kind != AstKind::BODY)
+      return NULL;
+    return static_cast<AstBody *>(ast);
+  }
+  catch (BadForm &)
+  {
+    return NULL;
+  }
+}
+
+void AstCache::save ( const char * path ) const
+{
+  FileHeader hdr;
+  std::memcpy( hdr.magic, MAGIC, sizeof(hdr.magic) );
+  hdr.version = VERSION;
+  hdr.formCount = m_forms.size();
+
+  // Write to a temporary and rename it, so a reader never sees a partial file
+  std::string tmpPath = formatStr( "%s.%lu.tmp", path, (unsigned long)::getpid() );
+  FILE * f;
+  if ( (f = std::fopen( tmpPath.c_str(), "wb" )) == NULL)
+    throw io_error(formatStr("open %s errno=%d", tmpPath.c_str(), errno));
+
+  std::fwrite( &hdr, sizeof(hdr), 1, f );
+  for ( FormMap::const_iterator it = m_forms.begin(), e = m_forms.end(); it != e; ++it )
+  {
+    const Form * form = it->second;
+    FormHeader fh;
+    fh.key = form->key;
+    fh.hash = hashBytes( &form->data[0], form->data.size() );
+    fh.length = form->data.size();
+    fh.astOffset = form->astOffset;
+    std::fwrite( &fh, sizeof(fh), 1, f );
+    std::fwrite( &form->data[0], 1, form->data.size(), f );
+  }
+
+  bool failed = std::ferror( f ) != 0;
+  if (std::fclose( f ) != 0 || failed)
+  {
+    int err = errno;
+    std::remove( tmpPath.c_str() );
+    throw io_error(formatStr("write %s errno=%d", tmpPath.c_str(), err));
+  }
+  if (std::rename( tmpPath.c_str(), path ) != 0)
+  {
+    int err = errno;
+    std::remove( tmpPath.c_str() );
+    throw io_error(formatStr("rename %s errno=%d", path, err));
+  }
+}
+
+bool AstCache::load ( const char * path )
+{
+  boost::scoped_ptr<FastMMapInput> map;
+  try
+  {
+    map.reset( new FastMMapInput( path ) );
+  }
+  catch (io_error &)
+  {
+    return false;
+  }
+
+  const unsigned char * p = map->head();
+  const unsigned char * const end = p + map->available();
+
+  if ((size_t)(end - p) < sizeof(FileHeader))
+    return false;
+  FileHeader hdr;
+  std::memcpy( &hdr, p, sizeof(hdr) );
+  p += sizeof(hdr);
+  if (std::memcmp( hdr.magic, MAGIC, sizeof(hdr.magic) ) != 0 || hdr.version != VERSION)
+    return false;
+
+  // Validate everything before adding anything
+  std::vector<Form *, gc_allocator<Form *> > forms;
+  for ( uint32_t i = 0; i != hdr.formCount; ++i )
+  {
+    FormHeader fh;
+    if ((size_t)(end - p) < sizeof(fh))
+      return false;
+    std::memcpy( &fh, p, sizeof(fh) );
+    p += sizeof(fh);
+    if (fh.length > (size_t)(end - p) || fh.astOffset > fh.length || !fh.length ||
+        hashBytes( p, fh.length ) != fh.hash)
+    {
+      return false;
+    }
+
+    Form * form = new Form();
+    form->key = fh.key;
+    form->astOffset = fh.astOffset;
+    form->data.assign( p, p + fh.length );
+    forms.push_back( form );
+    p += fh.length;
+  }
+  if (p != end)
+    return false;
+
+  BOOST_FOREACH( Form * form, forms )
+    m_forms[form->key] = form;
+  return true;
+}
+
+}} // namespaces
@@ -0,0 +1,135 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "Datum.hpp"
+#include "SymbolTable.hpp"
+#include <cstring>
+
+namespace p1 {
+namespace smalls {
+
+#define _MK_ENUM(x) #x,
+const char * DatumKind::s_names[] =
+{
+  _DEF_DATUM_KINDS
+};
+#undef _MK_ENUM
+
+Datum Datum::s_nil( DatumKind::NIL );
+
+const gc_char * Datum::symbolName () const
+{
+  if (kind == DatumKind::SYMBOL)
+    return u.symbol->name;
+  assert( kind == DatumKind::NAME );
+  return u.name;
+}
+
+bool Datum::equal ( const Datum * x ) const
+{
+  const Datum * d = this;
+  // Iterate along the cdr, so long lists don't exhaust the stack
+  for(;;)
+  {
+    if (d == x)
+      return true;
+    if (d->isSymbol())
+      return x->isSymbol() && std::strcmp( d->symbolName(), x->symbolName() ) == 0;
+    if (d->kind != x->kind)
+      return false;
+
+    switch (d->kind)
+    {
+    case DatumKind::BOOL:    return d->u.vbool == x->u.vbool;
+    case DatumKind::INTEGER: return d->u.integer == x->u.integer;
+    case DatumKind::REAL:    return d->u.real == x->u.real;
+    case DatumKind::STR:     return std::strcmp( d->u.str, x->u.str ) == 0;
+
+    case DatumKind::VECTOR:
+      if (d->u.vec.len != x->u.vec.len)
+        return false;
+      for ( unsigned i = 0; i != d->u.vec.len; ++i )
+        if (!d->u.vec.elems[i]->equal( x->u.vec.elems[i] ))
+          return false;
+      return true;
+
+    case DatumKind::PAIR:
+      if (!d->u.pair.car->equal( x->u.pair.car ))
+        return false;
+      d = d->u.pair.cdr;
+      x = x->u.pair.cdr;
+      break;
+
+    default: // NIL, DEOF, COMMENT
+      return true;
+    }
+  }
+}
+
+void Datum::toStream ( std::ostream & os ) const
+{
+  switch (kind)
+  {
+  case DatumKind::NIL:     os << "()"; break;
+  case DatumKind::BOOL:    os << (u.vbool ? "#t" : "#f"); break;
+  case DatumKind::INTEGER: os << u.integer; break;
+  case DatumKind::REAL:    os << u.real; break;
+  case DatumKind::STR:     os << "\"" << u.str << "\""; break; // FIXME: utf-8 decoding & escaping!
+  case DatumKind::SYMBOL:
+  case DatumKind::NAME:    os << symbolName(); break;
+
+  case DatumKind::PAIR:
+    {
+      os << '(';
+      const Datum * p = this;
+      for(;;)
+      {
+        p->u.pair.car->toStream( os );
+        if (p->u.pair.cdr->isNil())
+          break;
+        else if (p->u.pair.cdr->isPair())
+        {
+          p = p->u.pair.cdr;
+          os << " ";
+        }
+        else
+        {
+          os << " . " << *p->u.pair.cdr;
+          break;
+        }
+      }
+      os << ')';
+    }
+    break;
+
+  case DatumKind::VECTOR:
+    os << "#(";
+    for ( unsigned i = 0; i != u.vec.len; ++i )
+    {
+      if (i != 0)
+        os << " ";
+      os << *u.vec.elems[i];
+    }
+    os << ")";
+    break;
+
+  default:
+    os << DatumKind::name(kind);
+    break;
+  }
+}
+
+}} // namespaces
@@ -0,0 +1,286 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "DatumReader.hpp"
+#include "SymbolTable.hpp"
+#include "p1/util/format-str.hpp"
+#include <algorithm>
+
+using namespace p1;
+using namespace p1::smalls;
+
+static inline bool setContains ( unsigned set, TokenKind::Enum tok )
+{
+  return (set & (1 << tok)) != 0;
+}
+
+static inline unsigned setAdd ( unsigned set, TokenKind::Enum tok )
+{
+  return set | (1 << tok);
+}
+
+DatumReader::DatumReader ( Lexer & lex )
+  : DAT_EOF( new Datum(DatumKind::DEOF) ),
+    DAT_COM( new Datum(DatumKind::COMMENT) ),
+    m_lex( lex )
+{
+  m_abbrevQuote = newSymbol( "quote" );
+  m_abbrevQuasiquote = newSymbol( "quasiquote" );
+  m_abbrevUnquote = newSymbol( "unquote" );
+  m_abbrevUnquoteSplicing = newSymbol( "unquote-splicing" );
+  m_abbrevSyntax = newSymbol( "syntax" );
+  m_abbrevQuasisyntax = newSymbol( "quasisyntax" );
+  m_abbrevUnsyntax = newSymbol( "unsyntax" );
+  m_abbrevUnsyntaxSplicing = newSymbol( "unsyntax-splicing" );
+  next();
+}
+
+void DatumReader::error ( const gc_char * msg, ... )
+{
+  std::va_list ap;
+  va_start( ap, msg );
+  m_lex.errorReporter().error( m_tok.coords(), vformatGCStr( msg, ap ) );
+  va_end( ap );
+}
+
+Datum * DatumReader::newSymbol ( const char * name )
+{
+  Datum * res;
+  if (m_lex.internSymbols())
+  {
+    res = new Datum( DatumKind::SYMBOL );
+    res->u.symbol = m_lex.symbolTable().newSymbol( name );
+  }
+  else
+  {
+    res = new Datum( DatumKind::NAME );
+    res->u.name = name;
+  }
+  return res;
+}
+
+Datum * DatumReader::parseDatum ()
+{
+  return readSkipDatCom( setAdd(0, TokenKind::EOFTOK) );
+}
+
+Datum * DatumReader::readSkipDatCom ( unsigned termSet )
+{
+  // Ignore DATUM_COMMENT-s
+  Datum * res;
+  while ( (res = read(termSet)) == DAT_COM)
+    {}
+  return res;
+}
+
+Datum * DatumReader::read ( unsigned termSet )
+{
+  bool inError = false;
+
+  for(;;)
+  {
+    Datum * res;
+    switch (m_tok.kind())
+    {
+    case TokenKind::EOFTOK: return DAT_EOF;
+
+    // Atoms without pointers don't need to be scanned by the collector
+    case TokenKind::BOOL:
+      res = new (PointerFreeGC) Datum( DatumKind::BOOL );
+      res->u.vbool = m_tok.vbool();
+      next();
+      return res;
+    case TokenKind::INTEGER:
+      res = new (PointerFreeGC) Datum( DatumKind::INTEGER );
+      res->u.integer = m_tok.integer();
+      next();
+      return res;
+    case TokenKind::REAL:
+      res = new (PointerFreeGC) Datum( DatumKind::REAL );
+      res->u.real = m_tok.real();
+      next();
+      return res;
+    case TokenKind::STR:
+      res = new Datum( DatumKind::STR );
+      res->u.str = m_tok.string();
+      next();
+      return res;
+    case TokenKind::SYMBOL:
+      res = new Datum( DatumKind::SYMBOL );
+      res->u.symbol = m_tok.symbol();
+      next();
+      return res;
+    case TokenKind::NAME:
+      res = new Datum( DatumKind::NAME );
+      res->u.name = m_tok.name();
+      next();
+      return res;
+
+    case TokenKind::LPAR:    next(); return list( TokenKind::RPAR, termSet );
+    case TokenKind::LSQUARE: next(); return list( TokenKind::RSQUARE, termSet );
+    case TokenKind::HASH_LPAR: next(); return vector( TokenKind::RPAR, termSet );
+
+    case TokenKind::APOSTR:         return abbrev( m_abbrevQuote, termSet );
+    case TokenKind::ACCENT:         return abbrev( m_abbrevQuasiquote, termSet );
+    case TokenKind::COMMA:          return abbrev( m_abbrevUnquote, termSet );
+    case TokenKind::COMMA_AT:       return abbrev( m_abbrevUnquoteSplicing, termSet );
+    case TokenKind::HASH_APOSTR:    return abbrev( m_abbrevSyntax, termSet );
+    case TokenKind::HASH_ACCENT:    return abbrev( m_abbrevQuasisyntax, termSet );
+    case TokenKind::HASH_COMMA:     return abbrev( m_abbrevUnsyntax, termSet );
+    case TokenKind::HASH_COMMA_AT:  return abbrev( m_abbrevUnsyntaxSplicing, termSet );
+
+    case TokenKind::DATUM_COMMENT:
+      next();
+      read( termSet ); // Ignore the next datum
+      return DAT_COM;
+
+    case TokenKind::NESTED_COMMENT_END:
+    case TokenKind::NESTED_COMMENT_START:
+      assert(false);
+    case TokenKind::DOT:
+    case TokenKind::RPAR:
+    case TokenKind::RSQUARE:
+    case TokenKind::NONE:
+      // Skip invalid tokens, reporting only the first one
+      if (!inError)
+      {
+        error( "'%s' isn't allowed here", TokenKind::repr(m_tok.kind()) );
+        inError = true;
+      }
+      if (setContains(termSet,m_tok.kind()))
+        return Datum::nil();
+      next();
+      break;
+    }
+  }
+}
+
+Datum * DatumReader::list ( TokenKind::Enum terminator, unsigned termSet )
+{
+  Datum * head = Datum::nil();
+  Datum * tail = NULL;
+  termSet = setAdd(termSet,terminator);
+  unsigned carTermSet = setAdd(termSet, TokenKind::DOT);
+
+  for(;;)
+  {
+    Datum * car;
+
+    // Check for end of list. It is complicated by having to skip DATUM_COMMENT-s
+    do
+    {
+      if (m_tok.kind() == terminator)
+      {
+        next();
+        return head;
+      }
+    }
+    while ( (car = read( carTermSet )) == DAT_COM);
+
+    if (car == DAT_EOF)
+    {
+      error( "Unterminated list" );
+      return head;
+    }
+
+    Datum * pair = newPair( car, Datum::nil() );
+    if (tail)
+      tail->u.pair.cdr = pair;
+    else
+      head = pair;
+    tail = pair;
+
+    if (m_tok.kind() == TokenKind::DOT)
+    {
+      Datum * cdr;
+
+      next();
+      if ( (cdr = readSkipDatCom(termSet)) == DAT_EOF)
+      {
+        error( "Unterminated list" );
+        return head;
+      }
+
+      if (m_tok.kind() == terminator)
+        next();
+      else
+      {
+        error( "Expected %s", TokenKind::repr(terminator) );
+        // skip until terminator
+        assert( setContains(termSet, TokenKind::EOFTOK) ); // all sets should include EOF
+        for(;;)
+        {
+          if (m_tok.kind() == terminator)
+          {
+            next();
+            break;
+          }
+          if (setContains(termSet, m_tok.kind()))
+            break;
+          next();
+        }
+      }
+
+      tail->u.pair.cdr = cdr;
+      return head;
+    }
+  }
+}
+
+Datum * DatumReader::vector ( TokenKind::Enum terminator, unsigned termSet )
+{
+  // Collect the elements on the shared stack, so the vector can be allocated with its exact size
+  std::size_t const base = m_vecStack.size();
+  termSet = setAdd(termSet,terminator);
+
+  while (m_tok.kind() != terminator)
+  {
+    Datum * elem;
+    if ( (elem = read( termSet )) == DAT_COM) // skip DATUM_COMMENT-s
+      continue;
+    if (elem == DAT_EOF)
+    {
+      error( "Unterminated vector" );
+      break;
+    }
+    m_vecStack.push_back( elem );
+  }
+  if (m_tok.kind() == terminator)
+    next(); // skip the closing parren
+
+  Datum * res = new Datum( DatumKind::VECTOR );
+  res->u.vec.len = m_vecStack.size() - base;
+  if (res->u.vec.len)
+  {
+    res->u.vec.elems = new (GC) Datum*[res->u.vec.len];
+    std::copy( m_vecStack.begin() + base, m_vecStack.end(), res->u.vec.elems );
+  }
+  else
+    res->u.vec.elems = NULL;
+  m_vecStack.resize( base );
+  return res;
+}
+
+Datum * DatumReader::abbrev ( Datum * sym, unsigned termSet )
+{
+  next();
+
+  Datum * datum;
+  if ( (datum = readSkipDatCom( termSet )) == DAT_EOF)
+    error( "Unterminated abbreviation" );
+
+  return newPair( sym, newPair( datum, Datum::nil() ) );
+}
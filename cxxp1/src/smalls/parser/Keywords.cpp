@@ -44,7 +44,10 @@ Keywords::Keywords ( SymbolTable & symbolTable_ ) :
   sym_define_macro      ( symbolTable.newSymbol( "define-macro" ) ),
   sym_define_identifier_macro ( symbolTable.newSymbol( "define-identifier-macro" ) ),
   sym_define_set_macro  ( symbolTable.newSymbol( "define-set-macro" ) ),
-  sym_macro_env         ( symbolTable.newSymbol( "macro-env" ) )
+  sym_macro_env         ( symbolTable.newSymbol( "macro-env" ) ),
+  sym_syntax_rules      ( symbolTable.newSymbol( "syntax-rules" ) ),
+  sym_ellipsis          ( symbolTable.newSymbol( "..." ) ),
+  sym_underscore        ( symbolTable.newSymbol( "_" ) )
 {}
 
 }} // namespaces
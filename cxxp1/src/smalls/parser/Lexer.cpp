@@ -27,6 +27,7 @@ Lexer::Lexer ( FastCharInput & in, const gc_char * fileName, SymbolTable & symbo
     m_tokCoords( fileName, 0, 0 ), m_streamErrors( *this ), m_decoder( in, m_streamErrors )
 {
   m_curChar = 0;
+  m_internSymbols = true;
   m_inNestedComment = false;
 
   m_lineOffset = 0;
@@ -841,7 +842,10 @@ exitLoop:
 
 void Lexer::identifier ( Token & tok, const gc_char * name )
 {
-  tok.symbol( m_symbolTable.newSymbol( name ) );
+  if (m_internSymbols)
+    tok.symbol( m_symbolTable.newSymbol( name ) );
+  else
+    tok.name( name );
 }
 
 void Lexer::scanNumber ( Token & tok, unsigned state )
@@ -18,9 +18,18 @@
 #include "ListBuilder.hpp"
 #include "SystemBindings.hpp"
 #include "Keywords.hpp"
+#include "SyntaxRules.hpp"
+#include "p1/smalls/ast/AstRewriter.hpp"
 #include "p1/util/scopeguard.hpp"
+#include "p1/util/compiler.h"
+#include "p1/util/clock.hpp"
+#include "p1/util/format-str.hpp"
 #include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
 #include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <gc/gc.h>
 
 namespace p1 {
 namespace smalls {
@@ -35,10 +44,12 @@ class MacroOr : public Macro
 
 public:
   MacroOr ( Scope * scope_, SymbolTable & symbolTable )
-   : Macro( scope_ ), m_symbolTable( symbolTable )
+   : Macro( scope_, symbolTable.newSymbol( "or" ) ), m_symbolTable( symbolTable )
   {}
 
   virtual Syntax * expand ( Syntax * datum );
+  virtual bool isPure () const { return true; }
+  virtual uint64_t fingerprint () const { return 1; }
 };
 
 #if 0
@@ -48,7 +59,7 @@ class MacroTest : public Macro
 
 public:
   MacroTest ( Scope * scope_, SymbolTable & symbolTable )
-   : Macro( scope_ ), m_symbolTable( symbolTable )
+   : Macro( scope_, symbolTable.newSymbol( "test" ) ), m_symbolTable( symbolTable )
   {}
 
   virtual Syntax * expand ( Syntax * datum );
@@ -59,12 +70,25 @@ public:
 
 SchemeParser::SchemeParser ( SymbolTable & symbolTable, const Keywords & kw, AbstractErrorReporter & errors )
   : m_symbolTable( symbolTable ),
+    m_kw( kw ),
     m_systemScope( m_symbolTable.newScope() ),
     m_errors( errors ),
-    m_antiMark( new Mark( -1, NULL, NULL ) )
+    m_antiMark( m_symbolTable.newMark( -1, m_systemScope, NULL ) )
 {
   assert( &symbolTable == &kw.symbolTable );
 
+  // An epoch of 0 never matches, since creating the system scope has already advanced it
+  std::memset( m_resolveCache, 0, sizeof(m_resolveCache) );
+  m_expansionCacheHits = 0;
+  m_macroProfiling = false;
+  m_streamCtx = NULL;
+  m_forwardRefSeq = 0;
+  m_astCache = NULL;
+  m_astCacheHits = 0;
+  m_errorCount = 0;
+  m_formDeps = NULL;
+  m_formCacheable = false;
+
   // Generate the reserved bindings
   SystemBindings sysb( m_symbolTable, kw, m_systemScope );
 
@@ -81,6 +105,8 @@ SchemeParser::SchemeParser ( SymbolTable & symbolTable, const Keywords & kw, Abs
   Binding * orb;
   m_systemScope->bind( orb, m_symbolTable.newSymbol("or"), SourceCoords() );
   orb->bindMacro( new MacroOr( m_systemScope, m_symbolTable ) );
+  m_macros.push_back( orb->macro() );
+  m_systemMacroCount = m_macros.size();
 #if 0
   m_systemScope->bind( orb, m_symbolTable.newSymbol("test"), BindingKind::MACRO, SourceCoords() );
   orb->m_u.macro = new MacroTest( m_systemScope, m_symbolTable );
@@ -91,17 +117,295 @@ SchemeParser::~SchemeParser ()
 {
 }
 
+void SchemeParser::setExpansionCache ( bool enable )
+{
+  m_expansionCache.clear();
+  if (enable)
+    m_expansionCache.resize( EXPANSION_CACHE_SIZE );
+}
+
 AstModule * SchemeParser::compileLibraryBody ( Syntax * datum )
 {
+  // Release everything the compilation unit created, so the parser can be reused for the next one
+  m_macros.resize( m_systemMacroCount );
+  MarkGenerationScope markGeneration( m_symbolTable );
   Context * ctx = new Context( m_symbolTable.newScope(), new AstFrame(m_systemFrame) );
+  ON_BLOCK_EXIT_OBJ( m_symbolTable, &SymbolTable::popThisScope, ctx->scope );
+
   return new AstModule( m_systemFrame, compileBody( ctx, datum ) );
 }
 
+AstModule * SchemeParser::beginStream ()
+{
+  assert( !m_streamCtx && "Already streaming" );
+  m_macros.resize( m_systemMacroCount );
+  m_streamCtx = new Context( m_symbolTable.newScope(), new AstFrame(m_systemFrame) );
+  return new AstModule( m_systemFrame, new AstBody( SourceCoords(), m_streamCtx->frame ) );
+}
+
+AstBody * SchemeParser::compileTopLevelForm ( Syntax * datum )
+{
+  Context * ctx = m_streamCtx;
+  assert( ctx && "beginStream() not called" );
+
+  uint64_t key;
+  bool const caching = m_astCache && fingerprintSyntax( datum, &datum->coords, key );
+  if (caching)
+    if (AstBody * body = reuseCachedForm( key, datum->coords ))
+      return body;
+
+  AstCache::DependencyList deps;
+  unsigned long const errorCount = m_errorCount;
+  if (caching)
+  {
+    m_formDeps = &deps;
+    m_formCacheable = true;
+  }
+
+  AstBody * body;
+  {
+    // Nothing created by the expansion of this form is visible to the next one, except bindings
+    MarkGenerationScope markGeneration( m_symbolTable );
+
+    processBodyForm( ctx, datum );
+    body = compileDeferred( ctx, datum->coords );
+  }
+
+  ctx->defnList.clear();
+  ctx->exprList.clear();
+
+  if (caching)
+  {
+    m_formDeps = NULL;
+    m_formDepIndex.clear();
+    if (m_formCacheable && m_errorCount == errorCount)
+      m_astCache->store( key, deps, body, ctx->frame, datum->coords );
+  }
+  return body;
+}
+
+bool SchemeParser::bindCachedForm ( Syntax * datum )
+{
+  assert( m_streamCtx && "beginStream() not called" );
+
+  uint64_t key;
+  AstCache::DependencyList deps;
+  if (!m_astCache || !fingerprintSyntax( datum, &datum->coords, key ) || !bindCachedForm( key, datum->coords, deps ))
+    return false;
+  ++m_astCacheHits;
+  return true;
+}
+
+/**
+ * Reuse the cached compilation of a top-level form, if everything it depends on still resolves
+ * the same way.
+ */
+AstBody * SchemeParser::reuseCachedForm ( uint64_t key, const SourceCoords & coords )
+{
+  AstCache::DependencyList deps;
+  const AstCache::Form * form = bindCachedForm( key, coords, deps );
+  if (!form)
+    return NULL;
+
+  AstBody * body = m_astCache->instantiate( form, deps, m_streamCtx->frame, coords );
+  if (!body)
+  {
+    // The dependencies were readable, so this can only be a bug in the cache
+    m_errors.error( coords, "Invalid AST cache entry" );
+    ++m_errorCount;
+    body = new AstBody( coords, m_streamCtx->frame );
+  }
+  ++m_astCacheHits;
+  return body;
+}
+
+/**
+ * Check that everything a cached top-level form depends on still resolves the same way, and
+ * create the variables it defines.
+ * @param deps receives the dependencies, with their variables
+ * @return NULL if the form can't be reused
+ */
+const AstCache::Form * SchemeParser::bindCachedForm ( uint64_t key, const SourceCoords & coords,
+                                                     AstCache::DependencyList & deps )
+{
+  const AstCache::Form * form = m_astCache->find( key );
+  if (!form || !m_astCache->readDependencies( form, coords, deps ))
+    return NULL;
+
+  Scope * const topScope = m_streamCtx->scope;
+  std::vector<Symbol *, gc_allocator<Symbol *> > symbols;
+  std::vector<Binding *, gc_allocator<Binding *> > bindings;
+
+  // Check everything before changing anything. Only the system and top-level scopes are active,
+  // so a plain lookup resolves a name like an unmarked reference in the form would. (A reference
+  // introduced by a system macro to a system binding shadowed at the top level is just a miss.)
+  BOOST_FOREACH( const AstDependency & dep, deps )
+  {
+    Symbol * sym = m_symbolTable.newSymbol( dep.name );
+    Binding * bnd = m_symbolTable.lookup( sym );
+    symbols.push_back( sym );
+    bindings.push_back( bnd );
+
+    switch (dep.kind)
+    {
+    case AstDependencyKind::RESWORD:
+      if (!bnd || bnd->scope != (dep.system ? m_systemScope : topScope) ||
+          bnd->kind() != BindingKind::RESWORD || bnd->resWord() != dep.detail)
+        return NULL;
+      break;
+    case AstDependencyKind::MACRO:
+      if (!bnd || bnd->scope != (dep.system ? m_systemScope : topScope) ||
+          bnd->kind() != BindingKind::MACRO || bnd->macro()->fingerprint() != dep.detail)
+        return NULL;
+      break;
+    case AstDependencyKind::VAR:
+      if (!bnd || bnd->scope != (dep.system ? m_systemScope : topScope) || bnd->kind() != BindingKind::VAR)
+        return NULL;
+      break;
+    case AstDependencyKind::DEFINE:
+      // Either a new name, or the definition of a placeholder
+      if (bnd && bnd->scope == topScope && !m_forwardRefs.count( bnd ))
+        return NULL;
+      break;
+    case AstDependencyKind::FORWARD:
+      // Still undefined, or defined in the meantime
+      if (bnd && (bnd->scope != topScope || bnd->kind() != BindingKind::VAR))
+        return NULL;
+      break;
+    }
+  }
+
+  for ( unsigned i = 0, e = deps.size(); i != e; ++i )
+  {
+    AstDependency & dep = deps[i];
+    Binding * bnd = bindings[i];
+
+    switch (dep.kind)
+    {
+    case AstDependencyKind::RESWORD:
+    case AstDependencyKind::MACRO:
+      break;
+    case AstDependencyKind::VAR:
+      dep.var = bnd->var();
+      break;
+    case AstDependencyKind::DEFINE:
+      if (bnd && bnd->scope == topScope)
+      {
+        m_forwardRefs.erase( bnd );
+        bnd->setDefCoords( dep.coords );
+        bnd->var()->defCoords = dep.coords;
+      }
+      else
+      {
+        topScope->bind( bnd, symbols[i], dep.coords );
+        bnd->bindVar( m_streamCtx->frame->newVariable( bnd->sym->name, dep.coords ) );
+      }
+      dep.var = bnd->var();
+      break;
+    case AstDependencyKind::FORWARD:
+      if (!bnd)
+        bnd = forwardReference( new SyntaxSymbol( dep.coords, symbols[i] ) );
+      dep.var = bnd->var();
+      break;
+    }
+  }
+
+  return form;
+}
+
+/** Record a lookup which resolved to a system or top-level binding while caching a form */
+void SchemeParser::recordDependency ( Binding * bnd )
+{
+  bool const system = bnd->scope == m_systemScope;
+  if (!system && bnd->scope != m_streamCtx->scope)
+    return;
+  if (m_formDepIndex.count( bnd ))
+    return;
+  // Marked symbols can't be looked up by name
+  if (bnd->sym->markStamp)
+  {
+    m_formCacheable = false;
+    return;
+  }
+
+  AstDependency dep( AstDependencyKind::VAR, system, bnd->sym->name, 0, SourceCoords(), NULL );
+  switch (bnd->kind())
+  {
+  case BindingKind::RESWORD:
+    dep.kind = AstDependencyKind::RESWORD;
+    dep.detail = bnd->resWord();
+    break;
+  case BindingKind::MACRO:
+    dep.kind = AstDependencyKind::MACRO;
+    if ( (dep.detail = bnd->macro()->fingerprint()) == 0)
+      m_formCacheable = false;
+    break;
+  case BindingKind::VAR:
+    dep.var = bnd->var();
+    break;
+  default:
+    m_formCacheable = false;
+    return;
+  }
+
+  m_formDepIndex[bnd] = m_formDeps->size();
+  m_formDeps->push_back( dep );
+}
+
+/** Record a top-level definition, or a placeholder if coords are those of a reference */
+void SchemeParser::recordDefinition ( Binding * bnd, const SourceCoords & coords )
+{
+  if (bnd->sym->markStamp)
+  {
+    m_formCacheable = false;
+    return;
+  }
+
+  DependencyIndexMap::iterator it = m_formDepIndex.find( bnd );
+  if (it != m_formDepIndex.end())
+  {
+    // A placeholder created by this form
+    AstDependency & dep = (*m_formDeps)[it->second];
+    dep.kind = AstDependencyKind::DEFINE;
+    dep.coords = coords;
+    return;
+  }
+
+  m_formDepIndex[bnd] = m_formDeps->size();
+  m_formDeps->push_back( AstDependency( AstDependencyKind::DEFINE, false, bnd->sym->name, 0, coords, bnd->var() ) );
+}
+
+void SchemeParser::endStream ()
+{
+  assert( m_streamCtx && "beginStream() not called" );
+
+  // Report in order of appearance
+  std::vector<ForwardRef, gc_allocator<ForwardRef> > undefined;
+  undefined.resize( m_forwardRefSeq );
+  for ( ForwardRefMap::const_iterator it = m_forwardRefs.begin(), e = m_forwardRefs.end(); it != e; ++it )
+    undefined[it->second.seq] = it->second;
+  BOOST_FOREACH( ForwardRef & fr, undefined )
+    if (fr.ref)
+      error( fr.ref, "Undefined variable '%s'", fr.ref->symbol->name );
+  m_forwardRefs.clear();
+  m_forwardRefSeq = 0;
+
+  m_symbolTable.popThisScope( m_streamCtx->scope );
+  m_streamCtx = NULL;
+}
+
 AstBody * SchemeParser::compileBody ( SchemeParser::Context * ctx, Syntax * datum )
 {
   parseBody( ctx, datum );
+  return compileDeferred( ctx, datum->coords );
+}
 
-  AstBody * body = new AstBody( datum->coords, ctx->frame );
+/**
+ * Compile the definitions and expressions collected in the context
+ */
+AstBody * SchemeParser::compileDeferred ( SchemeParser::Context * ctx, const SourceCoords & coords )
+{
+  AstBody * body = new AstBody( coords, ctx->frame );
 
   BOOST_FOREACH( DeferredDefine & defn, ctx->defnList )
   {
@@ -187,6 +491,7 @@ void SchemeParser::parseBody ( SchemeParser::Context * ctx, Syntax * datum )
 
 void SchemeParser::processBodyForm ( SchemeParser::Context * ctx, Syntax * datum )
 {
+  unsigned depth = 0;
 tail_recursion:
   if (isa<SyntaxNil>(datum))
   {
@@ -201,7 +506,7 @@ tail_recursion:
     {
       if (binding->kind() == BindingKind::MACRO)
       {
-        datum = expandMacro( ctx, binding->macro(), pair );
+        datum = expandMacro( ctx, binding->macro(), pair, ++depth );
         if (!datum) // error?
           return;
         goto tail_recursion;
@@ -217,6 +522,9 @@ tail_recursion:
         case ResWord::DEFINE:
           recordDefine( ctx, pair );
           return;
+        case ResWord::DEFINE_MACRO:
+          defineMacro( ctx, pair );
+          return;
         default:
           break;
         }
@@ -263,6 +571,17 @@ void SchemeParser::recordDefine ( SchemeParser::Context * ctx, SyntaxPair * form
     if (bindSyntaxSymbol( bnd, ctx->scope, ss ))
     {
       bnd->bindVar( ctx->frame->newVariable( bnd->sym->name, ss->coords ) );
+      bnd->var()->introduced = bnd->sym->markStamp != 0;
+      if (m_formDeps && ctx == m_streamCtx)
+        recordDefinition( bnd, ss->coords );
+    }
+    else if (ctx == m_streamCtx && m_forwardRefs.erase( bnd ))
+    {
+      // This is the definition of a placeholder
+      bnd->setDefCoords( ss->coords );
+      bnd->var()->defCoords = ss->coords;
+      if (m_formDeps)
+        recordDefinition( bnd, ss->coords );
     }
     else
     {
@@ -290,8 +609,133 @@ void SchemeParser::recordDefine ( SchemeParser::Context * ctx, SyntaxPair * form
   ctx->defnList.push_back( DeferredDefine(bnd,value) );
 }
 
-Syntax * SchemeParser::expandMacro ( Context * ctx, Macro * macro, SyntaxPair * pair )
+/*
+  (define-macro <name> (syntax-rules ...))
+ */
+void SchemeParser::defineMacro ( SchemeParser::Context * ctx, SyntaxPair * form )
 {
+  Syntax * ps[2];
+
+  // A macro can't be cached, so neither can the form defining it at the top level
+  if (ctx == m_streamCtx)
+    m_formCacheable = false;
+
+  if (!needParams( "define-macro", form->cdr(), 2, ps, NULL ))
+    return;
+
+  SyntaxSymbol * ss = dyn_cast<SyntaxSymbol>(ps[0]);
+  if (!ss)
+  {
+    error( ps[0], "symbol required after \"define-macro\"" );
+    return;
+  }
+
+  SyntaxPair * spec = dyn_cast<SyntaxPair>(ps[1]);
+  Binding * bnd;
+  if (!spec || !(bnd = isBinding(spec->car())) ||
+      bnd->kind() != BindingKind::RESWORD || bnd->resWord() != ResWord::SYNTAX_RULES)
+  {
+    error( ps[1], "define-macro: syntax-rules expected" );
+    return;
+  }
+
+  Macro * macro;
+  try
+  {
+    macro = SyntaxRules::compile( ctx->scope, m_kw, ss->symbol, spec );
+  }
+  catch (ErrorInfo & ei)
+  {
+    m_errors.error( ei );
+    ++m_errorCount;
+    return;
+  }
+
+  if (bindSyntaxSymbol( bnd, ctx->scope, ss ))
+  {
+    bnd->bindMacro( macro );
+    if (m_macroProfiling)
+      m_macros.push_back( macro );
+  }
+  else
+    error( ps[0], "'%s' already defined at %s", ss->symbol->name, bnd->defCoords().toString().c_str() );
+}
+
+/**
+ * @param depth the number of expansions of the same form so far, including this one
+ */
+Syntax * SchemeParser::expandMacro ( Context * ctx, Macro * macro, SyntaxPair * pair, unsigned depth )
+{
+  if (likely(!m_macroProfiling))
+    return doExpandMacro( ctx, macro, pair );
+
+  MacroStats & st = macro->stats;
+  unsigned long const hits = m_expansionCacheHits;
+  size_t const bytes = GC_get_total_bytes();
+  uint64_t const start = monotonicNanos();
+
+  Syntax * result = doExpandMacro( ctx, macro, pair );
+
+  st.nanos += monotonicNanos() - start;
+  st.allocBytes += GC_get_total_bytes() - bytes;
+  ++st.count;
+  st.cacheHits += m_expansionCacheHits - hits;
+  st.inNodes += syntaxSize( pair, MacroStats::MAX_COUNTED_NODES );
+  if (result)
+    st.outNodes += syntaxSize( result, MacroStats::MAX_COUNTED_NODES );
+  if (depth > st.maxDepth)
+    st.maxDepth = depth;
+
+  return result;
+}
+
+namespace
+{
+  struct SlowerMacro
+  {
+    bool operator() ( const Macro * a, const Macro * b ) const
+    {
+      return a->stats.nanos > b->stats.nanos;
+    }
+  };
+}
+
+void SchemeParser::printMacroProfile ( std::ostream & os ) const
+{
+  MacroList sorted;
+  BOOST_FOREACH( Macro * macro, m_macros )
+    if (macro->stats.count)
+      sorted.push_back( macro );
+  std::stable_sort( sorted.begin(), sorted.end(), SlowerMacro() );
+
+  os << formatStr( "%-24s %8s %8s %10s %9s %10s %10s %12s %5s\n",
+                   "macro", "count", "hits", "total ms", "avg us", "in nodes", "out nodes", "bytes", "depth" );
+  BOOST_FOREACH( Macro * macro, sorted )
+  {
+    const MacroStats & st = macro->stats;
+    os << formatStr( "%-24s %8lu %8lu %10.3f %9.3f %10llu %10llu %12llu %5u\n",
+                     macro->name->name, st.count, st.cacheHits,
+                     st.nanos / 1e6, st.nanos / 1e3 / st.count,
+                     (unsigned long long)st.inNodes, (unsigned long long)st.outNodes,
+                     (unsigned long long)st.allocBytes, st.maxDepth );
+  }
+}
+
+Syntax * SchemeParser::doExpandMacro ( Context * ctx, Macro * macro, SyntaxPair * pair )
+{
+  ExpansionCacheEntry * ce = NULL;
+  std::size_t hash;
+  if (!m_expansionCache.empty() && macro->isPure() && hashSyntax( pair, hash, MAX_CACHED_EXPANSION_NODES ))
+  {
+    boost::hash_combine( hash, macro );
+    ce = &m_expansionCache[hash & (EXPANSION_CACHE_SIZE - 1)];
+    if (ce->macro == macro && ce->hash == hash && equalSyntax( ce->input, pair ))
+    {
+      ++m_expansionCacheHits;
+      return ce->expanded->wrap( m_symbolTable.newMark(m_symbolTable.nextMarkStamp(), macro->scope, NULL) );
+    }
+  }
+
   Syntax * wrapped = pair->wrap( m_antiMark );
 #if 0
   std::cout << "\nWrapped:\n" << *wrapped << "\n";
@@ -308,9 +752,17 @@ Syntax * SchemeParser::expandMacro ( Context * ctx, Macro * macro, SyntaxPair *
   catch (ErrorInfo & ei)
   {
     m_errors.error( ei );
+    ++m_errorCount;
     return NULL;
   }
-  Syntax * result = expanded->wrap( new Mark(m_symbolTable.nextMarkStamp(), macro->scope, NULL) );
+  if (ce)
+  {
+    ce->macro = macro;
+    ce->hash = hash;
+    ce->input = pair;
+    ce->expanded = expanded;
+  }
+  Syntax * result = expanded->wrap( m_symbolTable.newMark(m_symbolTable.nextMarkStamp(), macro->scope, NULL) );
 #if 0
   std::cout << "\nResult:\n" << *result << "\n";
   std::cout << "\nExpanded-Result:\n" << *unwrapCompletely(result) << "\n\n\n";
@@ -381,6 +833,7 @@ Syntax * MacroOr::expand ( Syntax * datum )
 
 Ast * SchemeParser::compileExpression ( SchemeParser::Context * ctx, Syntax * expr )
 {
+  unsigned depth = 0;
 tail_recursion:
   if (SyntaxValue * sv = dyn_cast<SyntaxValue>(expr))
   {
@@ -396,6 +849,8 @@ tail_recursion:
   {
     if (Binding * bnd = lookupSyntaxSymbol(ss))
       return compileBinding( ctx, bnd, expr );
+    else if (Binding * bnd = forwardReference(ss))
+      return compileBinding( ctx, bnd, expr );
     else
       error( expr, "Undefined variable '%s'", ss->symbol->name );
   }
@@ -410,7 +865,7 @@ tail_recursion:
     {
       if (bnd->kind() == BindingKind::MACRO)
       {
-        expr = expandMacro( ctx, bnd->macro(), pair );
+        expr = expandMacro( ctx, bnd->macro(), pair, ++depth );
         if (!expr) // error?
           goto unspec;
         goto tail_recursion;
@@ -443,21 +898,48 @@ Ast * SchemeParser::compileBinding ( Context * ctx, Binding * bnd, Syntax * expr
 }
 
 
+/**
+ * When streaming, a reference to an unknown variable may be to a top-level definition which
+ * hasn't been seen yet. Bind a placeholder variable in the top-level scope for it.
+ * Only plain symbols are handled: a macro-introduced identifier can't refer to a later definition.
+ */
+Binding * SchemeParser::forwardReference ( SyntaxSymbol * ss )
+{
+  if (!m_streamCtx || ss->mark)
+    return NULL;
+
+  Binding * bnd;
+  if (!m_streamCtx->scope->bind( bnd, ss->symbol, ss->coords ))
+    return NULL;
+  bnd->bindVar( m_streamCtx->frame->newVariable( ss->symbol->name, ss->coords ) );
+  ForwardRef & fr = m_forwardRefs[bnd];
+  fr.seq = m_forwardRefSeq++;
+  fr.ref = ss;
+
+  if (m_formDeps)
+  {
+    m_formDepIndex[bnd] = m_formDeps->size();
+    m_formDeps->push_back( AstDependency( AstDependencyKind::FORWARD, false, ss->symbol->name, 0, ss->coords,
+                                          bnd->var() ) );
+  }
+  return bnd;
+}
+
 Ast * SchemeParser::compileCall ( SchemeParser::Context * ctx, SyntaxPair * pair )
 {
   Ast * target = compileExpression( ctx, pair->car() );
-  VectorOfAst * params = new VectorOfAst();
+  SmallVector<Ast *, 8> params;
   Syntax * n = pair->cdr();
   while (!isa<SyntaxNil>(n))
   {
     SyntaxPair * expr = needPair( "", n );
     if (!expr)
       break;
-    params->push_back( compileExpression( ctx, expr->car() ) );
+    params.push_back( compileExpression( ctx, expr->car() ) );
     n = expr->cdr();
   }
 
-  return new AstApply( pair->coords, target, params, NULL );
+  return AstApply::create( pair->coords, target, params.begin(), params.size(), NULL );
 }
 
 
@@ -475,7 +957,7 @@ Ast * SchemeParser::compileResForm ( SchemeParser::Context * ctx, SyntaxPair * p
 
   case ResWord::LET: return compileLet( ctx, pair );
   case ResWord::LETREC:
-  case ResWord::LETREC_STAR:
+  case ResWord::LETREC_STAR: return compileLetRec( ctx, pair );
 
   // case ResWord::QUOTE: // FIXME
 
@@ -574,7 +1056,10 @@ Ast * SchemeParser::compileLambda ( SchemeParser::Context * ctx, SyntaxPair * la
   if (!needParams( "lambda", lambdaPair->cdr(), 1, &p0, &restp ))
     return makeUnspecified(lambdaPair);
 
-  VectorOfVariable * vars = new (GC) VectorOfVariable();
+  // The lambda is fully compiled when we exit, so the marked symbols it created can be released
+  MarkGenerationScope markGeneration( m_symbolTable );
+
+  SmallVector<AstVariable *, 8> vars;
   AstVariable * listParam = NULL;
 
   Scope * paramScope = m_symbolTable.newScope();
@@ -599,12 +1084,12 @@ Ast * SchemeParser::compileLambda ( SchemeParser::Context * ctx, SyntaxPair * la
         if (bindSyntaxSymbol( bnd, paramScope, ss ))
         {
           bnd->bindVar( paramFrame->newVariable( bnd->sym->name, ss->coords ) );
-          vars->push_back( bnd->var() );
+          vars.push_back( bnd->var() );
         }
         else
         {
           error( curParam, "Duplicated lambda parameter '%s'", ss->symbol->name );
-          vars->push_back( paramFrame->newAnonymous( ss->symbol->name, ss->coords ) );
+          vars.push_back( paramFrame->newAnonymous( ss->symbol->name, ss->coords ) );
         }
       }
       else
@@ -656,10 +1141,11 @@ Ast * SchemeParser::compileLambda ( SchemeParser::Context * ctx, SyntaxPair * la
     body = new AstBody( restp->coords, bodyCtx->frame );
   }
 
-  return new AstClosure(
+  return AstClosure::create(
     lambdaPair->car()->coords,
     paramFrame,
-    vars,
+    vars.begin(),
+    vars.size(),
     listParam,
     body
   );
@@ -777,6 +1263,123 @@ Ast * SchemeParser::compileBasicLet ( SchemeParser::Context * ctx, SyntaxPair *
   );
 }
 
+namespace {
+
+/** Finds whether any variable of a frame is the target of a set! */
+class FindAssigned : public AstRewriter
+{
+public:
+  explicit FindAssigned ( AstFrame * frame )
+    : m_frame( frame ), m_found( false )
+  {}
+
+  bool found () const { return m_found; }
+
+protected:
+  virtual Ast * visitSet ( AstSet * ast )
+  {
+    if (ast->target->frame == m_frame)
+      m_found = true;
+    return AstRewriter::visitSet( ast );
+  }
+
+private:
+  AstFrame * const m_frame;
+  bool m_found;
+};
+
+} // anonymous namespace
+
+/**
+ * Compile "letrec" and "letrec*". Both are evaluated like "letrec*": a body whose definitions
+ * are the initializations. The common case, where all inits are lambdas and the variables are
+ * never assigned, becomes an AstFix instead.
+ */
+Ast * SchemeParser::compileLetRec ( SchemeParser::Context * ctx, SyntaxPair * letPair )
+{
+  Syntax * p0;
+  SyntaxPair * restp;
+
+  if (!needParams( "letrec", letPair->cdr(), 1, &p0, &restp) )
+    return makeUnspecified(letPair);
+
+  DatumList varDatums;
+  DatumList valueDatums;
+
+  if (!splitLetParams( p0, varDatums, valueDatums ))
+    return makeUnspecified(letPair);
+
+  // The variables are visible in the initialization expressions
+  //
+  VectorOfVariable * vars = new (GC) VectorOfVariable();
+
+  Context * initCtx = new Context( m_symbolTable.newScope(), new AstFrame( ctx->frame ) );
+  ON_BLOCK_EXIT_OBJ( m_symbolTable, &SymbolTable::popThisScope, initCtx->scope );
+
+  BOOST_FOREACH( Syntax * curParam, varDatums )
+  {
+    if (SyntaxSymbol * ss = dyn_cast<SyntaxSymbol>(curParam))
+    {
+      Binding * bnd;
+      if (bindSyntaxSymbol( bnd, initCtx->scope, ss ))
+      {
+        bnd->bindVar( initCtx->frame->newVariable( bnd->sym->name, ss->coords ) );
+        vars->push_back( bnd->var() );
+      }
+      else
+      {
+        error( curParam, "letrec: duplicated variable '%s'", ss->symbol->name );
+        vars->push_back( initCtx->frame->newAnonymous( ss->symbol->name, ss->coords ) );
+      }
+    }
+    else
+    {
+      error( curParam, "letrec: init variable must be an identifier" );
+      vars->push_back( initCtx->frame->newAnonymous( "letrec", curParam->coords ) );
+    }
+  }
+
+  VectorOfAst * values = new (GC) VectorOfAst();
+  bool allClosures = true;
+  BOOST_FOREACH( Syntax * expr, valueDatums )
+  {
+    Ast * value = compileExpression( initCtx, expr );
+    values->push_back( value );
+    if (value->kind != AstKind::CLOSURE)
+      allClosures = false;
+  }
+
+  // Parse the body
+  //
+  Context * bodyCtx = new Context( m_symbolTable.newScope(), new AstFrame(initCtx->frame) );
+  ON_BLOCK_EXIT_OBJ( m_symbolTable, &SymbolTable::popThisScope, bodyCtx->scope );
+
+  AstBody * body;
+  if (!isa<SyntaxNil>(restp))
+    body = compileBody( bodyCtx, restp );
+  else
+  {
+    error( restp, "letrec requires a body" );
+    body = new AstBody( restp->coords, bodyCtx->frame );
+  }
+
+  if (allClosures)
+  {
+    FindAssigned fa( initCtx->frame );
+    BOOST_FOREACH( Ast * value, *values )
+      fa.rewrite( value );
+    fa.rewriteBody( body );
+    if (!fa.found())
+      return new AstFix( letPair->car()->coords, initCtx->frame, vars, body, values );
+  }
+
+  AstBody * res = new AstBody( letPair->car()->coords, initCtx->frame );
+  for ( unsigned i = 0; i != vars->size(); ++i )
+    res->defs().push_back( AstBody::Definition( (*vars)[i], (*values)[i] ) );
+  res->exprList() += body;
+  return res;
+}
+
 // FIXME
 Ast * SchemeParser::compileNamedLet ( SchemeParser::Context * ctx, SyntaxPair * letPair )
 {
@@ -898,27 +1501,52 @@ bool SchemeParser::bindSyntaxSymbol (
 }
 
 Binding * SchemeParser::lookupSyntaxSymbol ( SyntaxSymbol * ss )
+{
+  Binding * bnd = resolveSyntaxSymbol( ss );
+  if (unlikely(m_formDeps != NULL) && bnd)
+    recordDependency( bnd );
+  return bnd;
+}
+
+Binding * SchemeParser::resolveSyntaxSymbol ( SyntaxSymbol * ss )
+{
+  // Unmarked symbols are resolved with a single load anyway
+  if (!ss->mark)
+    return m_symbolTable.lookup(ss->symbol);
+
+  uintptr_t h = ((uintptr_t)ss->symbol >> 4) ^ ((uintptr_t)ss->mark >> 3) * 31;
+  ResolveCacheEntry & e = m_resolveCache[(h ^ (h >> 10)) & (RESOLVE_CACHE_SIZE - 1)];
+  uint64_t const epoch = m_symbolTable.epoch();
+
+  if (likely(e.epoch == epoch && e.symbol == ss->symbol && e.mark == ss->mark))
+    return e.bnd;
+
+  // Note that we cache negative results as well
+  e.bnd = resolveMarkedSymbol( ss->symbol, ss->mark );
+  e.symbol = ss->symbol;
+  e.mark = ss->mark;
+  e.epoch = epoch;
+  return e.bnd;
+}
+
+Binding * SchemeParser::resolveMarkedSymbol ( Symbol * symbol, Mark * mark )
 {
   Binding * bnd;
 
-  if ( (bnd = m_symbolTable.lookup(ss->symbol)) != NULL)
+  if ( (bnd = m_symbolTable.lookup(symbol)) != NULL)
     return bnd;
 
   // Check for the parent symbol in the mark's scope and go up the mark chain
-  if (Mark * mark = ss->mark)
+  do
   {
-    Symbol * symbol = ss->symbol;
-    do
+    if (mark->isMark())
     {
-      if (mark->isMark())
-      {
-        symbol = symbol->parentSymbol;
-        if ( (bnd = mark->scope->lookupHereAndUp( symbol )) != NULL)
-          return bnd;
-      }
+      symbol = symbol->parentSymbol;
+      if ( (bnd = mark->scope->lookupHereAndUp( symbol )) != NULL)
+        return bnd;
     }
-    while ( (mark = mark->next) != NULL);
   }
+  while ( (mark = mark->next) != NULL);
 
   return NULL;
 }
@@ -957,6 +1585,7 @@ void SchemeParser::error ( Syntax * where, const char * msg, ... )
   va_start( ap, msg );
   m_errors.verrorFormat( where->coords, msg, ap );
   va_end( ap );
+  ++m_errorCount;
 }
 
 }} // namespaces
\ No newline at end of file
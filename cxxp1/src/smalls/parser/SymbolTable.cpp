@@ -15,7 +15,12 @@
    limitations under the License.
 */
 #include "SymbolTable.hpp"
+#include "Syntax.hpp"
+#include "p1/util/scopeguard.hpp"
+#include "p1/util/compiler.h"
 #include <boost/foreach.hpp>
+#include <stdexcept>
+#include <limits>
 
 using namespace p1::smalls;
 
@@ -46,6 +51,7 @@ bool Scope::bind ( Binding * & res, Symbol * sym, const SourceCoords & defCoords
   bnd = new Binding( sym, this, defCoords );
   addToBindingList( bnd );
   sym->push( bnd );
+  ++symbolTable->m_epoch;
   res = bnd;
   return true;
 }
@@ -97,19 +103,35 @@ void Scope::popBindings()
 SymbolTable::SymbolTable ()
 {
   m_uid = 0;
+  m_concurrentInterning = false;
+  pthread_mutex_init( &m_internLock, NULL );
   m_topScope = NULL;
   m_markStamp = 0;
+  m_epoch = 0;
 }
 
 SymbolTable::~SymbolTable ( )
 {
+  pthread_mutex_destroy( &m_internLock );
 }
 
 Symbol * SymbolTable::newSymbol ( const gc_char * name )
+{
+  if (!m_concurrentInterning)
+    return internSymbol( name );
+
+  pthread_mutex_lock( &m_internLock );
+  ON_BLOCK_EXIT( pthread_mutex_unlock, &m_internLock );
+  return internSymbol( name );
+}
+
+Symbol * SymbolTable::internSymbol ( const gc_char * name )
 {
   Map::iterator it;
   if ( (it = m_map.find( name )) != m_map.end())
     return it->second;
+  if (m_uid == MARKED_UID)
+    throw std::runtime_error( "Symbol table overflow" );
   Symbol * sym = new Symbol( name, m_uid );
   m_map[name] = sym;
   ++m_uid;
@@ -127,17 +149,72 @@ Symbol * SymbolTable::newSymbol ( Symbol * parentSymbol, uint32_t markStamp )
   if ( (it = m_markMap.find( mk )) != m_markMap.end())
     return it->second;
 
-  Symbol * sym = new Symbol( parentSymbol->name, m_uid, parentSymbol, markStamp );
+  // Marked symbols are numbered by their position in the log, so released uids get reused
+  if (m_markLog.size() == MARKED_UID)
+    throw std::runtime_error( "Symbol table overflow" );
+
+  Symbol * sym = new Symbol( parentSymbol->name, MARKED_UID | m_markLog.size(), parentSymbol, markStamp );
   m_markMap[mk] = sym;
-  ++m_uid;
+  m_markLog.push_back( sym );
   return sym;
 }
 
+uint32_t SymbolTable::nextMarkStamp ()
+{
+  // Mark::value is signed and negative values are reserved for anti-marks
+  if (m_markStamp == (uint32_t)std::numeric_limits<int32_t>::max())
+    throw std::runtime_error( "Too many nested macro expansions" );
+  return ++m_markStamp;
+}
+
+Mark * SymbolTable::newMark ( int32_t value, Scope * scope, Mark * next )
+{
+  InternKey ik( value, scope, next );
+  InternMap::iterator it;
+  if ( (it = m_internMap.find( ik )) != m_internMap.end())
+    return it->second;
+
+  Mark * mark = new Mark( value, scope, next );
+  m_internMap[ik] = mark;
+  m_internLog.push_back( mark );
+  return mark;
+}
+
+void SymbolTable::beginMarkGeneration ()
+{
+  m_markGenerations.push_back( MarkGeneration( m_markStamp, m_markLog.size(), m_internLog.size() ) );
+}
+
+void SymbolTable::endMarkGeneration ()
+{
+  assert( !m_markGenerations.empty() );
+  const MarkGeneration & gen = m_markGenerations.back();
+
+  // Release the symbols in reverse order of creation, so a child is always erased before its parent
+  while (m_markLog.size() > gen.logSize)
+  {
+    Symbol * sym = m_markLog.back();
+    m_markMap.erase( MarkKey( sym->markStamp, sym->parentSymbol->uid ) );
+    m_markLog.pop_back();
+  }
+  while (m_internLog.size() > gen.internLogSize)
+  {
+    Mark * mark = m_internLog.back();
+    m_internMap.erase( InternKey( mark->value, mark->scope, mark->next ) );
+    m_internLog.pop_back();
+  }
+  m_markStamp = gen.markStamp;
+  ++m_epoch;
+
+  m_markGenerations.pop_back();
+}
+
 Scope * SymbolTable::newScope ()
 {
   Scope * scope = new Scope( this, m_topScope );
   scope->m_active = true;
   m_topScope = scope;
+  ++m_epoch;
   return scope;
 }
 
@@ -147,5 +224,6 @@ void SymbolTable::popScope ()
   assert( m_topScope->m_active );
   m_topScope->m_active = false;
   m_topScope = m_topScope->parent;
+  ++m_epoch;
 }
 
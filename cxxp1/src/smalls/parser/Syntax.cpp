@@ -17,6 +17,7 @@
 #include "Syntax.hpp"
 #include "SymbolTable.hpp"
 #include <boost/smart_ptr/scoped_array.hpp>
+#include <boost/functional/hash.hpp>
 
 namespace p1 {
 namespace smalls {
@@ -51,10 +52,10 @@ Mark * concat ( Mark * first, Mark * second )
 
   Mark * next = concat( first->next, second );
 
-  if (first->isMark() && next->isAntiMark()) // mark before anti-mark cancel each other
+  if (next && first->isMark() && next->isAntiMark()) // mark before anti-mark cancel each other
     return next->next;
   if (next != first->next)                 // did we change?
-    return new Mark( first->value, first->scope, next );
+    return first->scope->symbolTable->newMark( first->value, first->scope, next );
   else
     return first;
 }
@@ -113,6 +114,226 @@ Syntax * unwrapCompletely ( Syntax * d, Mark * mark )
   return d;
 }
 
+static bool hashSyntax ( const Syntax * d, Mark * mark, std::size_t & seed, unsigned & budget )
+{
+  if (!budget--)
+    return false;
+
+  boost::hash_combine( seed, (int)d->skind );
+  switch (d->skind)
+  {
+  case SyntaxKind::SYMBOL:
+    {
+      const SyntaxSymbol * ss = static_cast<const SyntaxSymbol *>(d);
+      boost::hash_combine( seed, ss->symbol );
+      boost::hash_combine( seed, concat( mark, ss->mark ) );
+      return true;
+    }
+  case SyntaxKind::PAIR:
+    {
+      const SyntaxPair * p = static_cast<const SyntaxPair *>(d);
+      Mark * newMark = concat( mark, p->mark );
+      return hashSyntax( p->m_car, newMark, seed, budget ) && hashSyntax( p->m_cdr, newMark, seed, budget );
+    }
+  case SyntaxKind::VECTOR:
+    {
+      const SyntaxVector * v = static_cast<const SyntaxVector *>(d);
+      Mark * newMark = concat( mark, v->mark );
+      boost::hash_combine( seed, v->len );
+      for ( unsigned i = 0; i != v->len; ++i )
+        if (!hashSyntax( v->m_data[i], newMark, seed, budget ))
+          return false;
+      return true;
+    }
+  case SyntaxKind::BINDING:
+    boost::hash_combine( seed, static_cast<const SyntaxBinding *>(d)->bnd );
+    return true;
+  case SyntaxKind::INTEGER:
+    boost::hash_combine( seed, static_cast<const SyntaxValue *>(d)->u.integer );
+    return true;
+  case SyntaxKind::REAL:
+    boost::hash_combine( seed, static_cast<const SyntaxValue *>(d)->u.real );
+    return true;
+  case SyntaxKind::BOOL:
+    boost::hash_combine( seed, static_cast<const SyntaxValue *>(d)->u.vbool );
+    return true;
+  case SyntaxKind::STR:
+    for ( const gc_char * s = static_cast<const SyntaxValue *>(d)->u.str; *s; ++s )
+      boost::hash_combine( seed, *s );
+    return true;
+  default:
+    return true;
+  }
+}
+
+bool hashSyntax ( const Syntax * syntax, std::size_t & hash, unsigned maxNodes )
+{
+  hash = 0;
+  return hashSyntax( syntax, NULL, hash, maxNodes );
+}
+
+static bool equalSyntax ( const Syntax * a, Mark * markA, const Syntax * b, Mark * markB )
+{
+  if (a->skind != b->skind)
+    return false;
+
+  switch (a->skind)
+  {
+  case SyntaxKind::SYMBOL:
+    {
+      const SyntaxSymbol * sa = static_cast<const SyntaxSymbol *>(a);
+      const SyntaxSymbol * sb = static_cast<const SyntaxSymbol *>(b);
+      return sa->symbol == sb->symbol && concat( markA, sa->mark ) == concat( markB, sb->mark );
+    }
+  case SyntaxKind::PAIR:
+    {
+      const SyntaxPair * pa = static_cast<const SyntaxPair *>(a);
+      const SyntaxPair * pb = static_cast<const SyntaxPair *>(b);
+      Mark * newA = concat( markA, pa->mark );
+      Mark * newB = concat( markB, pb->mark );
+      return equalSyntax( pa->m_car, newA, pb->m_car, newB ) && equalSyntax( pa->m_cdr, newA, pb->m_cdr, newB );
+    }
+  case SyntaxKind::VECTOR:
+    {
+      const SyntaxVector * va = static_cast<const SyntaxVector *>(a);
+      const SyntaxVector * vb = static_cast<const SyntaxVector *>(b);
+      if (va->len != vb->len)
+        return false;
+      Mark * newA = concat( markA, va->mark );
+      Mark * newB = concat( markB, vb->mark );
+      for ( unsigned i = 0; i != va->len; ++i )
+        if (!equalSyntax( va->m_data[i], newA, vb->m_data[i], newB ))
+          return false;
+      return true;
+    }
+  default:
+    return a->equal( b );
+  }
+}
+
+bool equalSyntax ( const Syntax * a, const Syntax * b )
+{
+  return equalSyntax( a, NULL, b, NULL );
+}
+
+static inline void fnv ( uint64_t & hash, const void * data, size_t len )
+{
+  for ( const unsigned char * p = (const unsigned char *)data, * e = p + len; p != e; ++p )
+  {
+    hash ^= *p;
+    hash *= 1099511628211ULL;
+  }
+}
+
+template <typename T>
+static inline void fnv ( uint64_t & hash, const T & v )
+{
+  fnv( hash, &v, sizeof(v) );
+}
+
+static bool fingerprintNode ( const Syntax * d, const SourceCoords * base, uint64_t & hash )
+{
+  // Iterate along the cdr-s, so long lists don't recurse deeply
+  for(;;)
+  {
+    fnv( hash, (uint8_t)d->skind );
+    if (base)
+    {
+      fnv( hash, (uint16_t)(d->coords.line - base->line) );
+      fnv( hash, d->coords.column );
+    }
+
+    switch (d->skind)
+    {
+    case SyntaxKind::SYMBOL:
+      {
+        const SyntaxSymbol * ss = static_cast<const SyntaxSymbol *>(d);
+        if (ss->mark)
+          return false;
+        // Include the terminating 0
+        fnv( hash, ss->symbol->name, std::strlen( ss->symbol->name ) + 1 );
+        return true;
+      }
+    case SyntaxKind::PAIR:
+      {
+        const SyntaxPair * p = static_cast<const SyntaxPair *>(d);
+        if (p->mark || !fingerprintNode( p->m_car, base, hash ))
+          return false;
+        d = p->m_cdr;
+        break;
+      }
+    case SyntaxKind::VECTOR:
+      {
+        const SyntaxVector * v = static_cast<const SyntaxVector *>(d);
+        if (v->mark)
+          return false;
+        fnv( hash, v->len );
+        for ( unsigned i = 0; i != v->len; ++i )
+          if (!fingerprintNode( v->m_data[i], base, hash ))
+            return false;
+        return true;
+      }
+    case SyntaxKind::BINDING:
+      return false;
+    case SyntaxKind::INTEGER:
+      fnv( hash, static_cast<const SyntaxValue *>(d)->u.integer );
+      return true;
+    case SyntaxKind::REAL:
+      fnv( hash, static_cast<const SyntaxValue *>(d)->u.real );
+      return true;
+    case SyntaxKind::BOOL:
+      fnv( hash, (uint8_t)static_cast<const SyntaxValue *>(d)->u.vbool );
+      return true;
+    case SyntaxKind::STR:
+      {
+        const gc_char * str = static_cast<const SyntaxValue *>(d)->u.str;
+        fnv( hash, str, std::strlen( str ) + 1 );
+        return true;
+      }
+    default:
+      return true;
+    }
+  }
+}
+
+bool fingerprintSyntax ( const Syntax * syntax, const SourceCoords * base, uint64_t & hash )
+{
+  hash = 14695981039346656037ULL;
+  return fingerprintNode( syntax, base, hash );
+}
+
+static void syntaxSize ( const Syntax * d, unsigned & count, unsigned limit )
+{
+  // Iterate along the cdr-s, so long lists don't recurse deeply
+  for(;;)
+  {
+    if (++count >= limit)
+      return;
+
+    if (const SyntaxPair * p = dyn_cast<SyntaxPair>(d))
+    {
+      if (isa<SyntaxNil>(p))
+        return;
+      syntaxSize( p->m_car, count, limit );
+      d = p->m_cdr;
+    }
+    else if (const SyntaxVector * v = dyn_cast<SyntaxVector>(d))
+    {
+      for ( unsigned i = 0; i != v->len && count < limit; ++i )
+        syntaxSize( v->m_data[i], count, limit );
+      return;
+    }
+    else
+      return;
+  }
+}
+
+unsigned syntaxSize ( const Syntax * syntax, unsigned limit )
+{
+  unsigned count = 0;
+  syntaxSize( syntax, count, limit );
+  return count < limit ? count : limit;
+}
 
 void Syntax::toStream ( std::ostream & os ) const
 {
@@ -170,16 +391,20 @@ Syntax * SyntaxSymbol::wrap ( Mark * mark )
 {
   if (!mark)
     return this;
+  // this->symbol already carries the marks of this->mark; start again from the unmarked one
+  Symbol * root = this->symbol;
+  for ( Mark * m = this->mark; m; m = m->next )
+    if (m->isMark())
+      root = root->parentSymbol;
   Mark * newMark = concat( mark, this->mark );
-  return
-    new SyntaxSymbol( this->coords, newMark ? wrapSymbol(newMark, this->symbol) : this->symbol, newMark );
+  return new SyntaxSymbol( this->coords, newMark ? wrapSymbol(newMark, root) : root, newMark );
 }
 
 void SyntaxSymbol::toStream ( std::ostream & os ) const
 {
   os << this->symbol->name;
   if (this->symbol->markStamp)
-    os << '@' << this->symbol->uid;
+    os << '@' << (this->symbol->uid & ~SymbolTable::MARKED_UID);
   if (this->mark)
     os << "{" << *this->mark << '}';
 }
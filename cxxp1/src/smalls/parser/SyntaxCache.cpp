@@ -0,0 +1,530 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "SyntaxCache.hpp"
+#include "SyntaxReader.hpp"
+#include "SymbolTable.hpp"
+#include "Keywords.hpp"
+#include "p1/util/FastMMapInput.hpp"
+#include "p1/util/format-str.hpp"
+#include <boost/unordered_map.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/foreach.hpp>
+#include <cstdio>
+#include <cerrno>
+#include <unistd.h>
+
+namespace p1 {
+namespace smalls {
+
+namespace
+{
+
+/*
+ * The layout of a cache file, in host byte order:
+ *   Header
+ *   Node     nodes[nodeCount]      -- in postorder
+ *   uint32_t symNames[symCount]    -- offsets of the symbol names in the string table
+ *   uint32_t elems[elemCount]      -- the elements of lists and vectors
+ *   uint32_t roots[rootCount]      -- the top-level datums
+ *   char     strings[stringBytes]  -- zero-terminated
+ */
+
+const char MAGIC[8] = { 's','m','a','l','l','s','x','c' };
+/** Bump whenever the layout changes */
+const uint32_t VERSION = 1;
+
+struct Header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t nodeCount;
+  uint64_t sourceHash;
+  uint32_t symCount;
+  uint32_t elemCount;
+  uint32_t rootCount;
+  uint32_t stringBytes;
+};
+
+struct NodeKind
+{
+  enum Enum
+  {
+    REAL,
+    INTEGER,
+    BOOL,
+    STR,
+    SYMBOL,
+    NIL,
+    /**
+     * A chain of pairs: "len" cars in elems[first...], followed by the final cdr. Only the first
+     * pair has the coordinates of the node; the rest have the coordinates of their car, which is
+     * always the case in lists read by SyntaxReader. That makes a list element 4 bytes.
+     */
+    LIST,
+    VECTOR //< "len" elements in elems[first...]
+  };
+};
+
+struct Node
+{
+  uint8_t kind; //< NodeKind
+  uint8_t reserved;
+  uint16_t line;
+  uint16_t column;
+  uint16_t reserved2;
+  union
+  {
+    int64_t integer;
+    double real;
+    uint32_t vbool;
+    uint32_t str; //< offset in the string table
+    uint32_t sym; //< index in symNames
+    struct
+    {
+      uint32_t first, len; //< index in elems
+    } seq;
+  } u;
+};
+
+typedef char HeaderSizeCheck[sizeof(Header) == 40 ? 1 : -1];
+typedef char NodeSizeCheck[sizeof(Node) == 16 ? 1 : -1];
+
+inline bool sameCoords ( const SourceCoords & a, const SourceCoords & b )
+{
+  return a.line == b.line && a.column == b.column;
+}
+
+class Writer
+{
+public:
+  std::vector<Node> nodes;
+  std::vector<uint32_t> symNames;
+  std::vector<uint32_t> elems;
+  std::vector<uint32_t> roots;
+  std::string strings;
+
+  uint32_t add ( const Syntax * d );
+
+private:
+  typedef boost::unordered_map<std::string, uint32_t> StringMap;
+  typedef boost::unordered_map<const Symbol *, uint32_t> SymbolMap;
+  StringMap m_strings;
+  SymbolMap m_symbols;
+
+  uint32_t addString ( const char * str );
+  uint32_t addSymbol ( const Symbol * sym );
+  uint32_t addNode ( NodeKind::Enum kind, const Syntax * d, Node & node );
+};
+
+uint32_t Writer::addString ( const char * str )
+{
+  std::pair<StringMap::iterator, bool> ins = m_strings.insert( std::make_pair( str, strings.size() ) );
+  if (ins.second)
+    strings.append( str, std::strlen(str) + 1 );
+  return ins.first->second;
+}
+
+uint32_t Writer::addSymbol ( const Symbol * sym )
+{
+  assert( !sym->markStamp && "Marked symbols can't be cached" );
+  std::pair<SymbolMap::iterator, bool> ins = m_symbols.insert( std::make_pair( sym, symNames.size() ) );
+  if (ins.second)
+    symNames.push_back( addString( sym->name ) );
+  return ins.first->second;
+}
+
+uint32_t Writer::addNode ( NodeKind::Enum kind, const Syntax * d, Node & node )
+{
+  node.kind = kind;
+  node.reserved = 0;
+  node.line = d->coords.line;
+  node.column = d->coords.column;
+  node.reserved2 = 0;
+  nodes.push_back( node );
+  return nodes.size() - 1;
+}
+
+uint32_t Writer::add ( const Syntax * d )
+{
+  Node node;
+  std::memset( &node, 0, sizeof(node) );
+
+  switch (d->skind)
+  {
+  case SyntaxKind::REAL:
+    node.u.real = cast<SyntaxValue>(d)->u.real;
+    return addNode( NodeKind::REAL, d, node );
+  case SyntaxKind::INTEGER:
+    node.u.integer = cast<SyntaxValue>(d)->u.integer;
+    return addNode( NodeKind::INTEGER, d, node );
+  case SyntaxKind::BOOL:
+    node.u.vbool = cast<SyntaxValue>(d)->u.vbool;
+    return addNode( NodeKind::BOOL, d, node );
+  case SyntaxKind::STR:
+    node.u.str = addString( cast<SyntaxValue>(d)->u.str );
+    return addNode( NodeKind::STR, d, node );
+  case SyntaxKind::NIL:
+    return addNode( NodeKind::NIL, d, node );
+
+  case SyntaxKind::SYMBOL:
+    assert( !cast<SyntaxSymbol>(d)->mark && "Marked syntax can't be cached" );
+    node.u.sym = addSymbol( cast<SyntaxSymbol>(d)->symbol );
+    return addNode( NodeKind::SYMBOL, d, node );
+
+  case SyntaxKind::VECTOR:
+    {
+      const SyntaxVector * vec = cast<SyntaxVector>(d);
+      assert( !vec->mark && "Marked syntax can't be cached" );
+      std::vector<uint32_t> tmp( vec->len );
+      for ( unsigned i = 0; i != vec->len; ++i )
+        tmp[i] = add( vec->m_data[i] );
+      node.u.seq.first = elems.size();
+      node.u.seq.len = vec->len;
+      elems.insert( elems.end(), tmp.begin(), tmp.end() );
+      return addNode( NodeKind::VECTOR, d, node );
+    }
+
+  case SyntaxKind::PAIR:
+    {
+      // Iterate along the cdr, so long lists don't exhaust the stack. A pair whose coordinates
+      // can't be recreated from its car starts a new LIST.
+      std::vector<uint32_t> tmp;
+      const Syntax * p = d;
+      do
+      {
+        const SyntaxPair * pair = cast<SyntaxPair>(p);
+        assert( !pair->mark && "Marked syntax can't be cached" );
+        tmp.push_back( add( pair->m_car ) );
+        p = pair->m_cdr;
+      }
+      while (isa<SyntaxPair>(p) && sameCoords( p->coords, cast<SyntaxPair>(p)->m_car->coords ));
+      tmp.push_back( add( p ) );
+
+      node.u.seq.first = elems.size();
+      node.u.seq.len = tmp.size() - 1;
+      elems.insert( elems.end(), tmp.begin(), tmp.end() );
+      return addNode( NodeKind::LIST, d, node );
+    }
+
+  default:
+    assert( false && "Syntax kind can't be cached" );
+    return addNode( NodeKind::NIL, d, node );
+  }
+}
+
+template <typename T>
+void writeVector ( FILE * f, const std::vector<T> & v )
+{
+  if (!v.empty())
+    std::fwrite( &v[0], sizeof(T), v.size(), f );
+}
+
+} // anon namespace
+
+std::string SyntaxCache::cachePath ( const char * sourcePath )
+{
+  return std::string( sourcePath ) + ".sxc";
+}
+
+uint64_t SyntaxCache::hashSource ( const unsigned char * data, size_t len )
+{
+  uint64_t hash = 14695981039346656037ULL;
+  for ( const unsigned char * end = data + len; data != end; ++data )
+  {
+    hash ^= *data;
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+void SyntaxCache::save ( const char * cachePath, uint64_t sourceHash, const SyntaxList & datums )
+{
+  Writer w;
+  BOOST_FOREACH( Syntax * d, datums )
+    w.roots.push_back( w.add( d ) );
+
+  Header hdr;
+  std::memcpy( hdr.magic, MAGIC, sizeof(hdr.magic) );
+  hdr.version = VERSION;
+  hdr.nodeCount = w.nodes.size();
+  hdr.sourceHash = sourceHash;
+  hdr.symCount = w.symNames.size();
+  hdr.elemCount = w.elems.size();
+  hdr.rootCount = w.roots.size();
+  hdr.stringBytes = w.strings.size();
+
+  // Write to a temporary and rename it, so a reader never sees a partial file
+  std::string tmpPath = formatStr( "%s.%lu.tmp", cachePath, (unsigned long)::getpid() );
+  FILE * f;
+  if ( (f = std::fopen( tmpPath.c_str(), "wb" )) == NULL)
+    throw io_error(formatStr("open %s errno=%d", tmpPath.c_str(), errno));
+
+  std::fwrite( &hdr, sizeof(hdr), 1, f );
+  writeVector( f, w.nodes );
+  writeVector( f, w.symNames );
+  writeVector( f, w.elems );
+  writeVector( f, w.roots );
+  std::fwrite( w.strings.data(), 1, w.strings.size(), f );
+
+  bool failed = std::ferror( f ) != 0;
+  if (std::fclose( f ) != 0 || failed)
+  {
+    int err = errno;
+    std::remove( tmpPath.c_str() );
+    throw io_error(formatStr("write %s errno=%d", tmpPath.c_str(), err));
+  }
+  if (std::rename( tmpPath.c_str(), cachePath ) != 0)
+  {
+    int err = errno;
+    std::remove( tmpPath.c_str() );
+    throw io_error(formatStr("rename %s errno=%d", cachePath, err));
+  }
+}
+
+bool SyntaxCache::load ( const char * cachePath, uint64_t sourceHash, SymbolTable & symbolTable,
+                         const gc_char * fileName, SyntaxList & datums )
+{
+  boost::scoped_ptr<FastMMapInput> map;
+  try
+  {
+    map.reset( new FastMMapInput( cachePath ) );
+  }
+  catch (io_error &)
+  {
+    return false;
+  }
+
+  const unsigned char * const base = map->head();
+  size_t const length = map->available();
+
+  // Validate everything before creating anything
+  if (length < sizeof(Header))
+    return false;
+  const Header * hdr = (const Header *)base;
+  if (std::memcmp( hdr->magic, MAGIC, sizeof(hdr->magic) ) != 0 || hdr->version != VERSION ||
+      hdr->sourceHash != sourceHash)
+  {
+    return false;
+  }
+  uint64_t const expected = sizeof(Header) + (uint64_t)hdr->nodeCount*sizeof(Node) +
+    ((uint64_t)hdr->symCount + hdr->elemCount + hdr->rootCount)*sizeof(uint32_t) + hdr->stringBytes;
+  if (length != expected)
+    return false;
+
+  const Node * const nodes = (const Node *)(hdr + 1);
+  const uint32_t * const symNames = (const uint32_t *)(nodes + hdr->nodeCount);
+  const uint32_t * const elems = symNames + hdr->symCount;
+  const uint32_t * const roots = elems + hdr->elemCount;
+  const char * const strings = (const char *)(roots + hdr->rootCount);
+
+  if (hdr->stringBytes && strings[hdr->stringBytes - 1] != 0)
+    return false;
+  for ( uint32_t i = 0; i != hdr->symCount; ++i )
+    if (symNames[i] >= hdr->stringBytes)
+      return false;
+  for ( uint32_t i = 0; i != hdr->elemCount; ++i )
+    if (elems[i] >= hdr->nodeCount)
+      return false;
+  for ( uint32_t i = 0; i != hdr->rootCount; ++i )
+    if (roots[i] >= hdr->nodeCount)
+      return false;
+  // Children must precede their parents. Calculate the size of all objects as well.
+  size_t heapSize = 0;
+  for ( uint32_t i = 0; i != hdr->nodeCount; ++i )
+  {
+    const Node & n = nodes[i];
+    switch (n.kind)
+    {
+    case NodeKind::REAL: case NodeKind::INTEGER: case NodeKind::BOOL:
+      heapSize += sizeof(SyntaxValue);
+      break;
+    case NodeKind::NIL:
+      heapSize += sizeof(SyntaxNil);
+      break;
+    case NodeKind::STR:
+      if (n.u.str >= hdr->stringBytes)
+        return false;
+      heapSize += sizeof(SyntaxValue);
+      break;
+    case NodeKind::SYMBOL:
+      if (n.u.sym >= hdr->symCount)
+        return false;
+      heapSize += sizeof(SyntaxSymbol);
+      break;
+    case NodeKind::LIST:
+    case NodeKind::VECTOR:
+      {
+        // A list also has its final cdr
+        uint32_t count = n.u.seq.len + (n.kind == NodeKind::LIST);
+        if (n.kind == NodeKind::LIST && !n.u.seq.len)
+          return false;
+        if (n.u.seq.first > hdr->elemCount || count > hdr->elemCount - n.u.seq.first)
+          return false;
+        for ( uint32_t j = 0; j != count; ++j )
+          if (elems[n.u.seq.first + j] >= i)
+            return false;
+        if (n.kind == NodeKind::LIST)
+          heapSize += n.u.seq.len * sizeof(SyntaxPair);
+        else
+          heapSize += sizeof(SyntaxVector) + n.u.seq.len * sizeof(Syntax *);
+      }
+      break;
+    default:
+      return false;
+    }
+  }
+
+  // The string values and symbol names point into a single copy of the string table
+  gc_char * const heapStrings = new (PointerFreeGC) gc_char[hdr->stringBytes ? hdr->stringBytes : 1];
+  std::memcpy( heapStrings, strings, hdr->stringBytes );
+
+  std::vector<Symbol *, gc_allocator<Symbol *> > syms( hdr->symCount );
+  for ( uint32_t i = 0; i != hdr->symCount; ++i )
+    syms[i] = symbolTable.newSymbol( heapStrings + symNames[i] );
+
+  // All objects are created in a single block, which means that it stays alive as long as any
+  // of them is referenced
+  char * heap = static_cast<char *>(::operator new( heapSize ? heapSize : 1, GC ));
+  char * const heapEnd = heap + heapSize;
+
+  std::vector<Syntax *, gc_allocator<Syntax *> > objs( hdr->nodeCount );
+  for ( uint32_t i = 0; i != hdr->nodeCount; ++i )
+  {
+    const Node & n = nodes[i];
+    SourceCoords coords( fileName, n.line, n.column );
+    Syntax * res;
+    switch (n.kind)
+    {
+    case NodeKind::REAL:
+      res = new (heap) SyntaxValue( SyntaxKind::REAL, coords, n.u.real );
+      heap += sizeof(SyntaxValue);
+      break;
+    case NodeKind::INTEGER:
+      res = new (heap) SyntaxValue( SyntaxKind::INTEGER, coords, (int64_t)n.u.integer );
+      heap += sizeof(SyntaxValue);
+      break;
+    case NodeKind::BOOL:
+      res = new (heap) SyntaxValue( SyntaxKind::BOOL, coords, n.u.vbool != 0 );
+      heap += sizeof(SyntaxValue);
+      break;
+    case NodeKind::STR:
+      res = new (heap) SyntaxValue( SyntaxKind::STR, coords, (const gc_char *)heapStrings + n.u.str );
+      heap += sizeof(SyntaxValue);
+      break;
+    case NodeKind::NIL:
+      res = new (heap) SyntaxNil( coords );
+      heap += sizeof(SyntaxNil);
+      break;
+    case NodeKind::SYMBOL:
+      res = new (heap) SyntaxSymbol( coords, syms[n.u.sym] );
+      heap += sizeof(SyntaxSymbol);
+      break;
+    case NodeKind::LIST:
+      {
+        const uint32_t * e = elems + n.u.seq.first;
+        SyntaxPair * pairs = reinterpret_cast<SyntaxPair *>(heap);
+        heap += n.u.seq.len * sizeof(SyntaxPair);
+        res = objs[e[n.u.seq.len]];
+        for ( uint32_t j = n.u.seq.len; j-- != 0; )
+        {
+          Syntax * car = objs[e[j]];
+          res = new (pairs + j) SyntaxPair( j ? car->coords : coords, car, res );
+        }
+      }
+      break;
+    case NodeKind::VECTOR:
+      {
+        Syntax ** data = NULL;
+        if (n.u.seq.len)
+        {
+          data = reinterpret_cast<Syntax **>(heap);
+          heap += n.u.seq.len * sizeof(Syntax *);
+          for ( uint32_t j = 0; j != n.u.seq.len; ++j )
+            data[j] = objs[elems[n.u.seq.first + j]];
+        }
+        res = new (heap) SyntaxVector( coords, data, n.u.seq.len );
+        heap += sizeof(SyntaxVector);
+      }
+      break;
+    default:
+      assert( false );
+      res = NULL;
+      break;
+    }
+    objs[i] = res;
+  }
+  assert( heap == heapEnd );
+  (void)heapEnd;
+
+  for ( uint32_t i = 0; i != hdr->rootCount; ++i )
+    datums.push_back( objs[roots[i]] );
+  return true;
+}
+
+namespace
+{
+
+class CountingErrorReporter : public AbstractErrorReporter
+{
+  AbstractErrorReporter & m_target;
+public:
+  unsigned count;
+
+  CountingErrorReporter ( AbstractErrorReporter & target ) : m_target( target ), count( 0 ) {}
+
+  virtual void error ( const ErrorInfo & ei )
+  {
+    ++count;
+    m_target.error( ei );
+  }
+};
+
+} // anon namespace
+
+bool SyntaxCache::readFile ( const char * sourcePath, const Keywords & kw, AbstractErrorReporter & errors,
+                             SyntaxList & datums )
+{
+  FastMMapInput src( sourcePath );
+  uint64_t const hash = hashSource( src.head(), src.available() );
+  std::string const path = cachePath( sourcePath );
+
+  if (load( path.c_str(), hash, kw.symbolTable, sourcePath, datums ))
+    return true;
+
+  CountingErrorReporter counter( errors );
+  Lexer lex( src, sourcePath, kw.symbolTable, counter );
+  SyntaxReader reader( lex, kw );
+  size_t const start = datums.size();
+  Syntax * d;
+  while ((d = reader.parseDatum()) != reader.DAT_EOF)
+    datums.push_back( d );
+
+  if (!counter.count)
+  {
+    try
+    {
+      save( path.c_str(), hash, SyntaxList( datums.begin() + start, datums.end() ) );
+    }
+    catch (io_error &)
+    {
+      // The cache is only an optimization
+    }
+  }
+  return false;
+}
+
+}} // namespaces
@@ -41,6 +41,7 @@ SyntaxReader::SyntaxReader ( Lexer & lex, const Keywords & kw )
     m_kw( kw )
 {
   assert( &m_kw.symbolTable == &m_lex.symbolTable() );
+  assert( m_lex.internSymbols() );
   next();
 }
 
@@ -106,6 +107,7 @@ Syntax * SyntaxReader::read ( unsigned termSet )
 
     case TokenKind::NESTED_COMMENT_END:
     case TokenKind::NESTED_COMMENT_START:
+    case TokenKind::NAME: // the Lexer must intern symbols
       assert(false);
     case TokenKind::DOT:
     case TokenKind::RPAR:
@@ -241,7 +243,7 @@ SyntaxVector * SyntaxReader::vector ( const SourceCoords & coords, TokenKind::En
 
 SyntaxPair * SyntaxReader::abbrev ( Symbol * sym, unsigned termSet )
 {
-  SyntaxValue * symdat = new SyntaxValue( SyntaxKind::SYMBOL, m_tok.coords(), sym );
+  SyntaxSymbol * symdat = new SyntaxSymbol( m_tok.coords(), sym );
 
   next();
 
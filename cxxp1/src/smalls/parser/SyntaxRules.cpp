@@ -0,0 +1,694 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "SyntaxRules.hpp"
+#include "Keywords.hpp"
+#include "p1/smalls/common/AbstractErrorReporter.hpp"
+#include "p1/util/format-str.hpp"
+#include <boost/foreach.hpp>
+#include <algorithm>
+
+namespace p1 {
+namespace smalls {
+namespace detail {
+
+typedef std::vector<unsigned, gc_allocator<unsigned> > SlotVec;
+
+/** The value of a pattern variable: a datum at depth 0, or a sequence of values */
+struct SyntaxRules::MValue
+{
+  Syntax * datum;
+  MSeq * seq;
+
+  MValue () : datum( NULL ), seq( NULL ) {}
+  explicit MValue ( Syntax * datum_ ) : datum( datum_ ), seq( NULL ) {}
+  explicit MValue ( MSeq * seq_ ) : datum( NULL ), seq( seq_ ) {}
+};
+
+struct SyntaxRules::MSeq : public gc
+{
+  MValueVec items;
+};
+
+/**
+ * LIST and VECTOR patterns have the shape "(<before>... [<ellipsis> ...] <after>... [. <tail>])".
+ */
+struct SyntaxRules::PatNode : public gc
+{
+  enum Kind { ANY, VAR, LITERAL, DATUM, NIL, LIST, VECTOR };
+  typedef std::vector<PatNode *, gc_allocator<PatNode *> > Vec;
+
+  Kind const kind;
+  unsigned slot;      //< VAR
+  Symbol * literal;   //< LITERAL: the unmarked symbol
+  Syntax * datum;     //< DATUM
+
+  Vec before;
+  PatNode * ellipsis; //< NULL if there is no ellipsis
+  SlotVec ellipsisVars; //< all slots bound inside the ellipsis
+  Vec after;
+  PatNode * tail;     //< NULL means that the list must be proper
+
+  PatNode ( Kind kind_ )
+    : kind( kind_ ), slot( 0 ), literal( NULL ), datum( NULL ), ellipsis( NULL ), tail( NULL )
+  {}
+};
+
+struct SyntaxRules::TmplNode : public gc
+{
+  enum Kind { CONST, VAR, LIST, VECTOR, ELLIPSIS };
+  typedef std::vector<TmplNode *, gc_allocator<TmplNode *> > Vec;
+
+  Kind const kind;
+  Syntax * datum;   //< CONST
+  unsigned slot;    //< VAR
+  Vec elems;        //< LIST, VECTOR. The results of ELLIPSIS elements are spliced
+  TmplNode * tail;  //< LIST: NULL means '()
+  TmplNode * sub;   //< ELLIPSIS
+  SlotVec drivers;  //< ELLIPSIS: the slots holding the sequences we iterate over
+
+  TmplNode ( Kind kind_ )
+    : kind( kind_ ), datum( NULL ), slot( 0 ), tail( NULL ), sub( NULL )
+  {}
+};
+
+struct SyntaxRules::Rule : public gc
+{
+  PatNode * pattern; //< matches the form after the keyword
+  TmplNode * tmpl;
+  unsigned numSlots;
+  unsigned minLen;   //< the minimal number of elements after the keyword
+  bool variadic;     //< whether more than minLen elements can match
+
+  Rule () : pattern( NULL ), tmpl( NULL ), numSlots( 0 ), minLen( 0 ), variadic( false ) {}
+};
+
+static Symbol * unmarkedSymbol ( Symbol * sym )
+{
+  while (sym->parentSymbol)
+    sym = sym->parentSymbol;
+  return sym;
+}
+
+class SyntaxRules::Compiler
+{
+public:
+  Compiler ( const Keywords & kw, Symbol * ellipsis, SyntaxVec & literals )
+    : m_kw( kw ), m_ellipsis( ellipsis ), m_literals( literals )
+  {}
+
+  Rule * compileRule ( Syntax * ruleDatum );
+
+private:
+  struct PatVar
+  {
+    Symbol * sym;
+    unsigned depth;
+
+    PatVar ( Symbol * sym_, unsigned depth_ ) : sym( sym_ ), depth( depth_ ) {}
+  };
+
+  const Keywords & m_kw;
+  Symbol * const m_ellipsis;
+  SyntaxVec & m_literals;
+
+  /** The variables of the current rule; the index is the slot */
+  std::vector<PatVar, gc_allocator<PatVar> > m_vars;
+
+  bool isEllipsis ( Syntax * s ) const
+  {
+    SyntaxSymbol * ss = dyn_cast<SyntaxSymbol>(s);
+    return ss && unmarkedSymbol( ss->symbol ) == m_ellipsis && !isLiteral( ss );
+  }
+
+  bool isLiteral ( SyntaxSymbol * ss ) const
+  {
+    Symbol * sym = unmarkedSymbol( ss->symbol );
+    BOOST_FOREACH( Syntax * lit, m_literals )
+      if (unmarkedSymbol( cast<SyntaxSymbol>(lit)->symbol ) == sym)
+        return true;
+    return false;
+  }
+
+  int findVar ( Symbol * sym ) const
+  {
+    for ( unsigned i = 0, e = m_vars.size(); i != e; ++i )
+      if (m_vars[i].sym == sym)
+        return i;
+    return -1;
+  }
+
+  PatNode * compilePattern ( Syntax * s, unsigned depth );
+  PatNode * compileSequencePattern ( PatNode * node, Syntax * s, unsigned depth );
+
+  TmplNode * compileTemplate ( Syntax * s, unsigned depth, bool escaped );
+  TmplNode * makeEllipsis ( TmplNode * sub, unsigned level, Syntax * where );
+  void collectVars ( TmplNode * t, SlotVec & vars );
+};
+
+SyntaxRules::Rule * SyntaxRules::Compiler::compileRule ( Syntax * ruleDatum )
+{
+  SyntaxPair * p;
+  SyntaxPair * pt;
+  if (!(p = dyn_cast<SyntaxPair>(ruleDatum)) ||
+      !(pt = dyn_cast<SyntaxPair>(p->cdr())) ||
+      !isa<SyntaxNil>(pt->cdr()))
+  {
+    throw ErrorInfo( ruleDatum->coords, "syntax-rules: a rule must be (<pattern> <template>)" );
+  }
+
+  // The keyword position of the pattern is ignored
+  SyntaxPair * pattern = dyn_cast<SyntaxPair>(p->car());
+  if (!pattern)
+    throw ErrorInfo( p->car()->coords, "syntax-rules: a pattern must be a list" );
+
+  m_vars.clear();
+
+  Rule * rule = new Rule();
+  rule->pattern = compilePattern( pattern->cdr(), 0 );
+  rule->numSlots = m_vars.size();
+
+  switch (rule->pattern->kind)
+  {
+  case PatNode::NIL:
+    rule->minLen = 0;
+    rule->variadic = false;
+    break;
+  case PatNode::LIST:
+    rule->minLen = rule->pattern->before.size() + rule->pattern->after.size();
+    rule->variadic = rule->pattern->ellipsis || rule->pattern->tail;
+    break;
+  default: // "(_ . args)"
+    rule->minLen = 0;
+    rule->variadic = true;
+    break;
+  }
+
+  rule->tmpl = compileTemplate( pt->car(), 0, false );
+  return rule;
+}
+
+SyntaxRules::PatNode * SyntaxRules::Compiler::compilePattern ( Syntax * s, unsigned depth )
+{
+  if (SyntaxSymbol * ss = dyn_cast<SyntaxSymbol>(s))
+  {
+    if (isLiteral( ss ))
+    {
+      PatNode * node = new PatNode( PatNode::LITERAL );
+      node->literal = unmarkedSymbol( ss->symbol );
+      return node;
+    }
+    if (isEllipsis( ss ))
+      throw ErrorInfo( s->coords, "syntax-rules: misplaced ellipsis in pattern" );
+    if (unmarkedSymbol( ss->symbol ) == m_kw.sym_underscore)
+      return new PatNode( PatNode::ANY );
+
+    if (findVar( ss->symbol ) >= 0)
+      throw ErrorInfo( s->coords, formatGCStr( "syntax-rules: duplicate pattern variable '%s'", ss->symbol->name ) );
+
+    PatNode * node = new PatNode( PatNode::VAR );
+    node->slot = m_vars.size();
+    m_vars.push_back( PatVar( ss->symbol, depth ) );
+    return node;
+  }
+  else if (isa<SyntaxNil>(s))
+    return new PatNode( PatNode::NIL );
+  else if (isa<SyntaxPair>(s))
+    return compileSequencePattern( new PatNode( PatNode::LIST ), s, depth );
+  else if (SyntaxVector * vec = dyn_cast<SyntaxVector>(s))
+  {
+    // Convert the vector to a list, so we can share the logic
+    Syntax * lst = new SyntaxNil( s->coords );
+    for ( unsigned i = vec->len; i > 0; --i )
+      lst = new SyntaxPair( s->coords, vec->getElement( i - 1 ), lst );
+    return compileSequencePattern( new PatNode( PatNode::VECTOR ), lst, depth );
+  }
+  else if (isa<SyntaxValue>(s))
+  {
+    PatNode * node = new PatNode( PatNode::DATUM );
+    node->datum = s;
+    return node;
+  }
+  else
+    throw ErrorInfo( s->coords, "syntax-rules: invalid pattern" );
+}
+
+SyntaxRules::PatNode * SyntaxRules::Compiler::compileSequencePattern (
+    PatNode * node, Syntax * s, unsigned depth
+  )
+{
+  while (SyntaxPair * p = dyn_cast<SyntaxPair>(s))
+  {
+    Syntax * elem = p->car();
+    if (isEllipsis( elem ))
+      throw ErrorInfo( elem->coords, "syntax-rules: misplaced ellipsis in pattern" );
+
+    s = p->cdr();
+    SyntaxPair * np = dyn_cast<SyntaxPair>(s);
+    if (np && isEllipsis( np->car() ))
+    {
+      if (node->ellipsis)
+        throw ErrorInfo( np->car()->coords, "syntax-rules: more than one ellipsis in the same list" );
+
+      unsigned firstSlot = m_vars.size();
+      node->ellipsis = compilePattern( elem, depth + 1 );
+      for ( unsigned i = firstSlot, e = m_vars.size(); i != e; ++i )
+        node->ellipsisVars.push_back( i );
+      s = np->cdr();
+    }
+    else
+      (node->ellipsis ? node->after : node->before).push_back( compilePattern( elem, depth ) );
+  }
+
+  if (!isa<SyntaxNil>(s))
+    node->tail = compilePattern( s, depth );
+
+  return node;
+}
+
+SyntaxRules::TmplNode * SyntaxRules::Compiler::compileTemplate ( Syntax * s, unsigned depth, bool escaped )
+{
+  if (SyntaxSymbol * ss = dyn_cast<SyntaxSymbol>(s))
+  {
+    int slot = findVar( ss->symbol );
+    if (slot >= 0)
+    {
+      if (m_vars[slot].depth > depth)
+        throw ErrorInfo( s->coords,
+                         formatGCStr( "syntax-rules: pattern variable '%s' needs more ellipses", ss->symbol->name ) );
+
+      TmplNode * node = new TmplNode( TmplNode::VAR );
+      node->slot = slot;
+      return node;
+    }
+    if (!escaped && isEllipsis( ss ))
+      throw ErrorInfo( s->coords, "syntax-rules: misplaced ellipsis in template" );
+  }
+  else if (SyntaxPair * p = dyn_cast<SyntaxPair>(s))
+  {
+    // (... <template>) escapes the ellipsis
+    if (!escaped && isEllipsis( p->car() ))
+    {
+      SyntaxPair * np = dyn_cast<SyntaxPair>(p->cdr());
+      if (!np || !isa<SyntaxNil>(np->cdr()))
+        throw ErrorInfo( s->coords, "syntax-rules: invalid ellipsis escape" );
+      return compileTemplate( np->car(), depth, true );
+    }
+
+    TmplNode * node = new TmplNode( TmplNode::LIST );
+    node->datum = s;
+    Syntax * t = s;
+    while ( (p = dyn_cast<SyntaxPair>(t)) != NULL)
+    {
+      Syntax * elem = p->car();
+      if (!escaped && isEllipsis( elem ))
+        throw ErrorInfo( elem->coords, "syntax-rules: misplaced ellipsis in template" );
+
+      // Count the ellipses following the element
+      unsigned k = 0;
+      t = p->cdr();
+      SyntaxPair * np;
+      while (!escaped && (np = dyn_cast<SyntaxPair>(t)) != NULL && isEllipsis( np->car() ))
+      {
+        ++k;
+        t = np->cdr();
+      }
+
+      TmplNode * elemNode = compileTemplate( elem, depth + k, escaped );
+      for ( ; k > 0; --k )
+        elemNode = makeEllipsis( elemNode, depth + k - 1, elem );
+      node->elems.push_back( elemNode );
+    }
+    if (!isa<SyntaxNil>(t))
+      node->tail = compileTemplate( t, depth, escaped );
+    return node;
+  }
+  else if (SyntaxVector * vec = dyn_cast<SyntaxVector>(s))
+  {
+    Syntax * lst = new SyntaxNil( s->coords );
+    for ( unsigned i = vec->len; i > 0; --i )
+      lst = new SyntaxPair( s->coords, vec->getElement( i - 1 ), lst );
+
+    TmplNode * node = compileTemplate( lst, depth, escaped );
+    if (node->kind != TmplNode::LIST) // empty vector
+    {
+      node = new TmplNode( TmplNode::VECTOR );
+      node->datum = s;
+      return node;
+    }
+    TmplNode * vnode = new TmplNode( TmplNode::VECTOR );
+    vnode->datum = s;
+    vnode->elems.swap( node->elems );
+    return vnode;
+  }
+
+  TmplNode * node = new TmplNode( TmplNode::CONST );
+  node->datum = s;
+  return node;
+}
+
+SyntaxRules::TmplNode * SyntaxRules::Compiler::makeEllipsis ( TmplNode * sub, unsigned level, Syntax * where )
+{
+  TmplNode * node = new TmplNode( TmplNode::ELLIPSIS );
+  node->sub = sub;
+
+  // We iterate over all variables which have more levels of ellipses than enclose us
+  SlotVec vars;
+  collectVars( sub, vars );
+  BOOST_FOREACH( unsigned slot, vars )
+    if (m_vars[slot].depth > level)
+      node->drivers.push_back( slot );
+
+  if (node->drivers.empty())
+    throw ErrorInfo( where->coords, "syntax-rules: no pattern variables to iterate over before ellipsis" );
+  return node;
+}
+
+void SyntaxRules::Compiler::collectVars ( TmplNode * t, SlotVec & vars )
+{
+  switch (t->kind)
+  {
+  case TmplNode::VAR:
+    if (std::find( vars.begin(), vars.end(), t->slot ) == vars.end())
+      vars.push_back( t->slot );
+    break;
+  case TmplNode::LIST:
+  case TmplNode::VECTOR:
+    BOOST_FOREACH( TmplNode * e, t->elems )
+      collectVars( e, vars );
+    if (t->tail)
+      collectVars( t->tail, vars );
+    break;
+  case TmplNode::ELLIPSIS:
+    collectVars( t->sub, vars );
+    break;
+  case TmplNode::CONST:
+    break;
+  }
+}
+
+SyntaxRules::SyntaxRules ( Scope * scope_, Symbol * name )
+  : Macro( scope_, name ), m_fingerprint( 0 )
+{}
+
+SyntaxRules * SyntaxRules::compile ( Scope * scope, const Keywords & kw, Symbol * name, SyntaxPair * spec )
+{
+  Syntax * s = spec->cdr();
+  SyntaxPair * p;
+
+  // Optional custom ellipsis
+  Symbol * ellipsis = kw.sym_ellipsis;
+  if ( (p = dyn_cast<SyntaxPair>(s)) != NULL)
+    if (SyntaxSymbol * ss = dyn_cast<SyntaxSymbol>(p->car()))
+    {
+      ellipsis = unmarkedSymbol( ss->symbol );
+      s = p->cdr();
+    }
+
+  if (!(p = dyn_cast<SyntaxPair>(s)))
+    throw ErrorInfo( s->coords, "syntax-rules: missing list of literals" );
+
+  SyntaxVec literals;
+  Syntax * l;
+  for ( l = p->car(); SyntaxPair * lp = dyn_cast<SyntaxPair>(l); l = lp->cdr() )
+  {
+    if (!isa<SyntaxSymbol>(lp->car()))
+      throw ErrorInfo( lp->car()->coords, "syntax-rules: literals must be identifiers" );
+    literals.push_back( lp->car() );
+  }
+  if (!isa<SyntaxNil>(l))
+    throw ErrorInfo( l->coords, "syntax-rules: the literals must be a proper list" );
+
+  SyntaxRules * macro = new SyntaxRules( scope, name );
+  Compiler comp( kw, ellipsis, literals );
+
+  for ( s = p->cdr(); (p = dyn_cast<SyntaxPair>(s)) != NULL; s = p->cdr() )
+    macro->m_rules.push_back( comp.compileRule( p->car() ) );
+  if (!isa<SyntaxNil>(s))
+    throw ErrorInfo( s->coords, "syntax-rules: the rules must be a proper list" );
+
+  // Build the dispatch table, preserving the order of the rules
+  for ( unsigned len = 0; len != DISPATCH_SIZE; ++len )
+    BOOST_FOREACH( Rule * rule, macro->m_rules )
+      if (len == rule->minLen || (len > rule->minLen && rule->variadic))
+        macro->m_byLength[len].push_back( rule );
+
+  if (!fingerprintSyntax( spec, NULL, macro->m_fingerprint ))
+    macro->m_fingerprint = 0;
+
+  return macro;
+}
+
+Syntax * SyntaxRules::expand ( Syntax * datum )
+{
+  SyntaxPair * form = cast<SyntaxPair>(datum);
+  Syntax * args = form->cdr();
+
+  // Measure the form once to select the candidate rules
+  unsigned len = 0;
+  Syntax * s;
+  for ( s = args; SyntaxPair * p = dyn_cast<SyntaxPair>(s); s = p->cdr() )
+    ++len;
+  bool const direct = len < DISPATCH_SIZE && isa<SyntaxNil>(s);
+
+  m_out.clear();
+  BOOST_FOREACH( Rule * rule, direct ? m_byLength[len] : m_rules )
+  {
+    if (!direct && (len < rule->minLen || (len != rule->minLen && !rule->variadic)))
+      continue;
+
+    m_env.assign( rule->numSlots, MValue() );
+    if (match( rule->pattern, args ))
+    {
+      Syntax * res = instantiate( rule->tmpl, datum->coords );
+      m_env.clear();
+      return res;
+    }
+  }
+
+  m_env.clear();
+  throw ErrorInfo( datum->coords, formatGCStr( "no syntax rule matches this use of '%s'", this->name->name ) );
+}
+
+bool SyntaxRules::match ( PatNode * p, Syntax * in )
+{
+  switch (p->kind)
+  {
+  case PatNode::ANY:
+    return true;
+  case PatNode::VAR:
+    m_env[p->slot] = MValue( in );
+    return true;
+  case PatNode::LITERAL:
+    if (SyntaxSymbol * ss = dyn_cast<SyntaxSymbol>(in))
+      return unmarkedSymbol( ss->symbol ) == p->literal;
+    return false;
+  case PatNode::DATUM:
+    return p->datum->equal( in );
+  case PatNode::NIL:
+    return isa<SyntaxNil>(in);
+  case PatNode::LIST:
+    return matchList( p, in );
+  case PatNode::VECTOR:
+    if (SyntaxVector * vec = dyn_cast<SyntaxVector>(in))
+      return matchVector( p, vec );
+    return false;
+  }
+  assert( false );
+  return false;
+}
+
+bool SyntaxRules::matchList ( PatNode * p, Syntax * in )
+{
+  SyntaxPair * pair;
+
+  BOOST_FOREACH( PatNode * e, p->before )
+  {
+    if (!(pair = dyn_cast<SyntaxPair>(in)) || !match( e, pair->car() ))
+      return false;
+    in = pair->cdr();
+  }
+
+  if (p->ellipsis)
+  {
+    // Run a lead pointer ahead by the number of trailing elements. The ellipsis consumes elements
+    // until the lead runs out, so the input is traversed only once.
+    Syntax * lead = in;
+    for ( unsigned i = 0, e = p->after.size(); i != e; ++i )
+    {
+      if (!(pair = dyn_cast<SyntaxPair>(lead)))
+        return false;
+      lead = pair->cdr();
+    }
+
+    unsigned const nvars = p->ellipsisVars.size();
+    MSeq ** seqs = new (GC) MSeq*[nvars ? nvars : 1];
+    for ( unsigned i = 0; i != nvars; ++i )
+      seqs[i] = new MSeq();
+
+    while (SyntaxPair * leadPair = dyn_cast<SyntaxPair>(lead))
+    {
+      pair = cast<SyntaxPair>(in);
+      if (!match( p->ellipsis, pair->car() ))
+        return false;
+      for ( unsigned i = 0; i != nvars; ++i )
+        seqs[i]->items.push_back( m_env[p->ellipsisVars[i]] );
+      in = pair->cdr();
+      lead = leadPair->cdr();
+    }
+
+    for ( unsigned i = 0; i != nvars; ++i )
+      m_env[p->ellipsisVars[i]] = MValue( seqs[i] );
+  }
+
+  BOOST_FOREACH( PatNode * e, p->after )
+  {
+    if (!(pair = dyn_cast<SyntaxPair>(in)) || !match( e, pair->car() ))
+      return false;
+    in = pair->cdr();
+  }
+
+  return p->tail ? match( p->tail, in ) : isa<SyntaxNil>(in);
+}
+
+bool SyntaxRules::matchVector ( PatNode * p, SyntaxVector * in )
+{
+  unsigned const fixed = p->before.size() + p->after.size();
+  if (p->ellipsis ? in->len < fixed : in->len != fixed)
+    return false;
+
+  unsigned idx = 0;
+  BOOST_FOREACH( PatNode * e, p->before )
+    if (!match( e, in->getElement( idx++ ) ))
+      return false;
+
+  if (p->ellipsis)
+  {
+    unsigned const nvars = p->ellipsisVars.size();
+    MSeq ** seqs = new (GC) MSeq*[nvars ? nvars : 1];
+    for ( unsigned i = 0; i != nvars; ++i )
+      seqs[i] = new MSeq();
+
+    for ( unsigned end = in->len - p->after.size(); idx != end; ++idx )
+    {
+      if (!match( p->ellipsis, in->getElement( idx ) ))
+        return false;
+      for ( unsigned i = 0; i != nvars; ++i )
+        seqs[i]->items.push_back( m_env[p->ellipsisVars[i]] );
+    }
+
+    for ( unsigned i = 0; i != nvars; ++i )
+      m_env[p->ellipsisVars[i]] = MValue( seqs[i] );
+  }
+
+  BOOST_FOREACH( PatNode * e, p->after )
+    if (!match( e, in->getElement( idx++ ) ))
+      return false;
+
+  return true;
+}
+
+Syntax * SyntaxRules::instantiate ( TmplNode * t, const SourceCoords & coords )
+{
+  switch (t->kind)
+  {
+  case TmplNode::CONST:
+    return t->datum;
+
+  case TmplNode::VAR:
+    assert( m_env[t->slot].datum );
+    return m_env[t->slot].datum;
+
+  case TmplNode::LIST:
+    {
+      size_t const start = m_out.size();
+      BOOST_FOREACH( TmplNode * e, t->elems )
+        instantiateInto( e, coords );
+      Syntax * res = t->tail ? instantiate( t->tail, coords ) : new SyntaxNil( coords );
+
+      // The length is known now, so allocate all pairs of the list in one block. The collector
+      // recognizes interior pointers, so the block lives as long as any of its pairs.
+      if (size_t const n = m_out.size() - start)
+      {
+        SyntaxPair * pairs = static_cast<SyntaxPair *>(::operator new( n * sizeof(SyntaxPair), GC ));
+        for ( size_t i = 0; i != n; ++i )
+          new (pairs + i) SyntaxPair( coords, m_out[start + i], i + 1 != n ? pairs + i + 1 : res );
+        res = pairs;
+      }
+
+      m_out.resize( start );
+      return res;
+    }
+
+  case TmplNode::VECTOR:
+    {
+      size_t const start = m_out.size();
+      BOOST_FOREACH( TmplNode * e, t->elems )
+        instantiateInto( e, coords );
+
+      unsigned const n = m_out.size() - start;
+      Syntax ** data = NULL;
+      if (n)
+      {
+        data = new (GC) Syntax*[n];
+        std::copy( m_out.begin() + start, m_out.end(), data );
+      }
+
+      m_out.resize( start );
+      return new SyntaxVector( coords, data, n );
+    }
+
+  case TmplNode::ELLIPSIS:
+    break;
+  }
+
+  assert( false && "ELLIPSIS must be spliced" );
+  return NULL;
+}
+
+void SyntaxRules::instantiateInto ( TmplNode * t, const SourceCoords & coords )
+{
+  if (t->kind != TmplNode::ELLIPSIS)
+  {
+    m_out.push_back( instantiate( t, coords ) );
+    return;
+  }
+
+  unsigned const ndrivers = t->drivers.size();
+  size_t const count = m_env[t->drivers[0]].seq->items.size();
+
+  // Save the sequences, since the slots are overwritten with their elements while we iterate
+  MSeq ** seqs = new (GC) MSeq*[ndrivers];
+  for ( unsigned d = 0; d != ndrivers; ++d )
+  {
+    seqs[d] = m_env[t->drivers[d]].seq;
+    assert( seqs[d] );
+    if (seqs[d]->items.size() != count)
+      throw ErrorInfo( coords, formatGCStr( "'%s': mismatched ellipsis lengths", this->name->name ) );
+  }
+
+  for ( size_t i = 0; i != count; ++i )
+  {
+    for ( unsigned d = 0; d != ndrivers; ++d )
+      m_env[t->drivers[d]] = seqs[d]->items[i];
+    instantiateInto( t->sub, coords );
+  }
+
+  for ( unsigned d = 0; d != ndrivers; ++d )
+    m_env[t->drivers[d]] = MValue( seqs[d] );
+}
+
+}}} // namespaces
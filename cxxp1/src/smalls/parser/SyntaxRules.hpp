@@ -0,0 +1,93 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef P1_SMALLS_PARSER_SYNTAXRULES_HPP
+#define	P1_SMALLS_PARSER_SYNTAXRULES_HPP
+
+#include "SymbolTable.hpp"
+#include "Syntax.hpp"
+#include <vector>
+
+namespace p1 {
+namespace smalls {
+  class Keywords;
+}}
+
+namespace p1 {
+namespace smalls {
+namespace detail {
+
+/**
+ * A "syntax-rules" macro.
+ *
+ * The rule set is compiled once, when the macro is defined. Patterns become match trees with
+ * pre-assigned variable slots, and templates become instantiation trees which know in advance
+ * which variables drive each ellipsis. The rules are also pre-sorted by the input lengths they
+ * can accept, so an expansion only tries the rules which could possibly match.
+ *
+ * Literals are compared by name, ignoring marks.
+ */
+class SyntaxRules : public Macro
+{
+public:
+  /**
+   * Compile "(syntax-rules [<ellipsis>] (<literal>...) (<pattern> <template>)...)".
+   * @throws ErrorInfo if the specification is invalid
+   */
+  static SyntaxRules * compile ( Scope * scope, const Keywords & kw, Symbol * name, SyntaxPair * spec );
+
+  virtual Syntax * expand ( Syntax * datum );
+  virtual bool isPure () const { return true; }
+  virtual uint64_t fingerprint () const { return m_fingerprint; }
+
+private:
+  struct MValue;
+  struct MSeq;
+  struct PatNode;
+  struct TmplNode;
+  struct Rule;
+  class Compiler;
+
+  typedef std::vector<Rule *, gc_allocator<Rule *> > RuleVec;
+  typedef std::vector<MValue, gc_allocator<MValue> > MValueVec;
+  typedef std::vector<Syntax *, gc_allocator<Syntax *> > SyntaxVec;
+
+  /** Inputs shorter than this are dispatched directly to the rules accepting their length */
+  static const unsigned DISPATCH_SIZE = 8;
+
+  RuleVec m_rules;
+  RuleVec m_byLength[DISPATCH_SIZE];
+  /** Of the specification, or 0 if it contains marks */
+  uint64_t m_fingerprint;
+
+  /** The pattern variable values of the current expansion */
+  MValueVec m_env;
+  /** Stack of instantiated list and vector elements, waiting for their container */
+  SyntaxVec m_out;
+
+  SyntaxRules ( Scope * scope_, Symbol * name );
+
+  bool match ( PatNode * p, Syntax * in );
+  bool matchList ( PatNode * p, Syntax * in );
+  bool matchVector ( PatNode * p, SyntaxVector * in );
+
+  Syntax * instantiate ( TmplNode * t, const SourceCoords & coords );
+  void instantiateInto ( TmplNode * t, const SourceCoords & coords );
+};
+
+}}} // namespaces
+
+#endif	/* P1_SMALLS_PARSER_SYNTAXRULES_HPP */
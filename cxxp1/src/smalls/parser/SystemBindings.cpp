@@ -47,7 +47,8 @@ SystemBindings::SystemBindings ( SymbolTable & symTab, const Keywords & kw, Scop
   bind_define_macro      ( bindKw( scope, kw.sym_define_macro, ResWord::DEFINE_MACRO ) ),
   bind_define_identifier_macro ( bindKw( scope, kw.sym_define_identifier_macro, ResWord::DEFINE_IDENTIFIER_MACRO ) ),
   bind_define_set_macro  ( bindKw( scope, kw.sym_define_set_macro, ResWord::DEFINE_SET_MACRO ) ),
-  bind_macro_env         ( bindKw( scope, kw.sym_macro_env, ResWord::MACRO_ENV ) )
+  bind_macro_env         ( bindKw( scope, kw.sym_macro_env, ResWord::MACRO_ENV ) ),
+  bind_syntax_rules      ( bindKw( scope, kw.sym_syntax_rules, ResWord::SYNTAX_RULES ) )
 {
   assert( &symTab == &kw.symbolTable );
 
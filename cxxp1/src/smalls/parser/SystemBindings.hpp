@@ -60,6 +60,7 @@ public:
   Binding * const bind_define_identifier_macro;
   Binding * const bind_define_set_macro;
   Binding * const bind_macro_env;
+  Binding * const bind_syntax_rules;
 
   SystemBindings ( SymbolTable & symTab, const Keywords & kw, Scope * scope );
 
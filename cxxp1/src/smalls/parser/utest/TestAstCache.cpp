@@ -0,0 +1,164 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestAstCache.hpp"
+#include "AstCache.hpp"
+#include "SchemeParser.hpp"
+#include "SyntaxReader.hpp"
+#include <boost/foreach.hpp>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace p1;
+using namespace p1::smalls;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestAstCache );
+
+TestAstCache::TestAstCache ( )
+{
+}
+
+TestAstCache::~TestAstCache ( )
+{
+}
+
+void TestAstCache::setUp ( )
+{
+  char name[] = "/tmp/TestAstCacheXXXXXX";
+  int fd = mkstemp( name );
+  CPPUNIT_ASSERT( fd != -1 );
+  ::close( fd );
+  m_path = name;
+}
+
+void TestAstCache::tearDown ( )
+{
+  std::remove( m_path.c_str() );
+}
+
+namespace
+{
+;
+
+class ErrorReporter : public AbstractErrorReporter
+{
+public:
+  int count;
+
+  ErrorReporter () : count( 0 ) {}
+  virtual void error ( const ErrorInfo & ei )
+  {
+    ++count;
+    std::cerr << "  " << ei.formatMessage() << std::endl;
+  }
+};
+
+const char s_text[] =
+  "(define-macro swap! (syntax-rules () ((_ a b) (let ((tmp a)) (set! a b) (set! b tmp)))))\n"
+  "(define x 1)\n"
+  "(define y 2)\n"
+  "(define f (lambda (a b . rest)\n"
+  "            (if a (g b) (or a b 3.5 \"s\"))))\n"
+  "(define g (lambda (n) (swap! x y) n))\n";
+
+/**
+ * Stream the text through a new parser, optionally with a cache.
+ * @return the printed forms, with the coordinates of their bodies and definitions
+ */
+std::string compile ( const std::string & text, AstCache * cache, unsigned long & hits )
+{
+  SymbolTable symTab;
+  ErrorReporter err;
+  CharBufInput in( text.c_str() );
+  Lexer lex( in, "input", symTab, err );
+  Keywords kw( symTab );
+  SyntaxReader reader( lex, kw );
+  SchemeParser parser( symTab, kw, err );
+  parser.setAstCache( cache );
+
+  std::stringstream out;
+  parser.beginStream();
+  Syntax * d;
+  while ((d = reader.parseDatum()) != reader.DAT_EOF)
+  {
+    AstBody * body = parser.compileTopLevelForm( d );
+    out << body->coords.line << ':' << body->coords.column;
+    BOOST_FOREACH( AstBody::Definition & defn, body->defs() )
+      out << ' ' << *defn.first << '@' << defn.first->defCoords.line << ':' << defn.first->defCoords.column;
+    out << '\n' << *body << '\n';
+  }
+  parser.endStream();
+
+  CPPUNIT_ASSERT_EQUAL( 0, err.count );
+  hits = parser.astCacheHits();
+  return out.str();
+}
+
+};
+
+void TestAstCache::testReuse ( )
+{
+  unsigned long hits;
+  AstCache * cache = new AstCache();
+  compile( s_text, cache, hits );
+  CPPUNIT_ASSERT_EQUAL( 0ul, hits );
+  // Everything except the macro definition
+  CPPUNIT_ASSERT_EQUAL( 4u, cache->size() );
+  cache->save( m_path.c_str() );
+
+  // Move all forms down in a new session
+  std::string moved = std::string( "\n\n" ) + s_text;
+  AstCache * loaded = new AstCache();
+  CPPUNIT_ASSERT( loaded->load( m_path.c_str() ) );
+  CPPUNIT_ASSERT_EQUAL( 4u, loaded->size() );
+
+  std::string expected = compile( moved, NULL, hits );
+  CPPUNIT_ASSERT( compile( moved, loaded, hits ) == expected );
+  CPPUNIT_ASSERT_EQUAL( 4ul, hits );
+
+  // A corrupted file is rejected as a whole
+  FILE * f = std::fopen( m_path.c_str(), "r+b" );
+  CPPUNIT_ASSERT( f );
+  std::fseek( f, -1, SEEK_END );
+  std::fputc( 0xFF, f );
+  std::fclose( f );
+  CPPUNIT_ASSERT( !(new AstCache())->load( m_path.c_str() ) );
+}
+
+void TestAstCache::testDependencies ( )
+{
+  unsigned long hits;
+  AstCache * cache = new AstCache();
+  compile( s_text, cache, hits );
+
+  // A different macro invalidates only the form using it
+  std::string changed = s_text;
+  changed.replace( changed.find( "(set! b tmp)" ), 12, "(set! b a)  " );
+  std::string expected = compile( changed, NULL, hits );
+  CPPUNIT_ASSERT( compile( changed, cache, hits ) == expected );
+  CPPUNIT_ASSERT_EQUAL( 3ul, hits );
+
+  // Shadowing a reserved word invalidates the forms using it
+  cache = new AstCache();
+  compile( s_text, cache, hits );
+  std::string shadowed = std::string( "(define if 0)\n" ) + s_text;
+  expected = compile( shadowed, NULL, hits );
+  CPPUNIT_ASSERT( compile( shadowed, cache, hits ) == expected );
+  // x, y and the new g (the macro introduces "let" and "set!", but not "if")
+  CPPUNIT_ASSERT_EQUAL( 3ul, hits );
+}
@@ -0,0 +1,172 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestDatumReader.hpp"
+#include "DatumReader.hpp"
+#include <sstream>
+
+using namespace p1;
+using namespace p1::smalls;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestDatumReader );
+
+TestDatumReader::TestDatumReader ( )
+{
+}
+
+TestDatumReader::~TestDatumReader ( )
+{
+}
+
+void TestDatumReader::setUp ( )
+{
+}
+
+void TestDatumReader::tearDown ( )
+{
+}
+
+namespace
+{
+;
+
+class ErrorReporter : public AbstractErrorReporter
+{
+public:
+  int count;
+
+  ErrorReporter () : count( 0 ) {}
+  virtual void error ( const ErrorInfo & ei )
+  {
+    ++count;
+    std::cerr << "  " << ei.formatMessage() << std::endl;
+  }
+};
+
+std::string toString ( const Datum * d )
+{
+  std::stringstream ss;
+  ss << *d;
+  return ss.str();
+}
+
+};
+
+void TestDatumReader::testRead ( )
+{
+  SymbolTable symTab;
+  ErrorReporter err;
+  CharBufInput in(
+    "1000 \"str\" #t 1.5\n"
+    "(this list (has 1 nested list))\n"
+    "(a . (b . (c . ())))\n"
+    "(a . #;(datum comment) b)\n"
+    "#(1 #(2 3) () #())\n"
+    "'x `(a ,b ,@c)\n"
+    "[square brackets]\n"
+  );
+  Lexer lex( in, "input", symTab, err );
+  DatumReader reader( lex );
+
+  Datum * d = reader.parseDatum();
+  CPPUNIT_ASSERT( DatumKind::INTEGER == d->kind && 1000 == d->u.integer );
+  d = reader.parseDatum();
+  CPPUNIT_ASSERT( DatumKind::STR == d->kind );
+  CPPUNIT_ASSERT_EQUAL( std::string("str"), std::string(d->u.str) );
+  d = reader.parseDatum();
+  CPPUNIT_ASSERT( DatumKind::BOOL == d->kind && d->u.vbool );
+  d = reader.parseDatum();
+  CPPUNIT_ASSERT( DatumKind::REAL == d->kind && 1.5 == d->u.real );
+
+  CPPUNIT_ASSERT_EQUAL( std::string("(this list (has 1 nested list))"), toString(reader.parseDatum()) );
+  CPPUNIT_ASSERT_EQUAL( std::string("(a b c)"), toString(reader.parseDatum()) );
+  CPPUNIT_ASSERT_EQUAL( std::string("(a . b)"), toString(reader.parseDatum()) );
+
+  d = reader.parseDatum();
+  CPPUNIT_ASSERT( DatumKind::VECTOR == d->kind && 4 == d->u.vec.len );
+  CPPUNIT_ASSERT_EQUAL( std::string("#(1 #(2 3) () #())"), toString(d) );
+
+  CPPUNIT_ASSERT_EQUAL( std::string("(quote x)"), toString(reader.parseDatum()) );
+  CPPUNIT_ASSERT_EQUAL( std::string("(quasiquote (a (unquote b) (unquote-splicing c)))"),
+                        toString(reader.parseDatum()) );
+  CPPUNIT_ASSERT_EQUAL( std::string("(square brackets)"), toString(reader.parseDatum()) );
+
+  CPPUNIT_ASSERT( reader.DAT_EOF == reader.parseDatum() );
+  CPPUNIT_ASSERT_EQUAL( 0, err.count );
+}
+
+void TestDatumReader::testSymbols ( )
+{
+  static const char text[] = "(foo bar foo)";
+  ErrorReporter err;
+
+  // Interned
+  {
+    SymbolTable symTab;
+    CharBufInput in( text );
+    Lexer lex( in, "input", symTab, err );
+    DatumReader reader( lex );
+    Datum * d = reader.parseDatum();
+    CPPUNIT_ASSERT( DatumKind::SYMBOL == d->car()->kind );
+    CPPUNIT_ASSERT( d->car()->u.symbol == d->cdr()->cdr()->car()->u.symbol );
+    CPPUNIT_ASSERT( d->car()->u.symbol == symTab.newSymbol("foo") );
+  }
+
+  // Not interned
+  Datum * names;
+  {
+    SymbolTable symTab;
+    CharBufInput in( text );
+    Lexer lex( in, "input", symTab, err );
+    lex.setInternSymbols( false );
+    DatumReader reader( lex );
+    names = reader.parseDatum();
+    CPPUNIT_ASSERT( DatumKind::NAME == names->car()->kind );
+    CPPUNIT_ASSERT_EQUAL( std::string("foo"), std::string(names->car()->symbolName()) );
+    CPPUNIT_ASSERT_EQUAL( std::string("(foo bar foo)"), toString(names) );
+  }
+
+  // A separate symbol table; the compiler's one is untouched
+  {
+    SymbolTable compilerSymTab, dataSymTab;
+    Symbol * foo = compilerSymTab.newSymbol( "foo" );
+    CharBufInput in( text );
+    Lexer lex( in, "input", dataSymTab, err );
+    DatumReader reader( lex );
+    Datum * d = reader.parseDatum();
+    CPPUNIT_ASSERT( d->car()->u.symbol != foo );
+    CPPUNIT_ASSERT( d->car()->u.symbol == dataSymTab.newSymbol("foo") );
+    // Symbols compare by name
+    CPPUNIT_ASSERT( d->equal( names ) );
+  }
+
+  CPPUNIT_ASSERT_EQUAL( 0, err.count );
+}
+
+void TestDatumReader::testErrors ( )
+{
+  SymbolTable symTab;
+  ErrorReporter err;
+  CharBufInput in( "(a . b c) (1 2" );
+  Lexer lex( in, "input", symTab, err );
+  DatumReader reader( lex );
+
+  CPPUNIT_ASSERT_EQUAL( std::string("(a . b)"), toString(reader.parseDatum()) );
+  CPPUNIT_ASSERT_EQUAL( 1, err.count );
+  CPPUNIT_ASSERT_EQUAL( std::string("(1 2)"), toString(reader.parseDatum()) );
+  CPPUNIT_ASSERT_EQUAL( 2, err.count );
+  CPPUNIT_ASSERT( reader.DAT_EOF == reader.parseDatum() );
+}
@@ -16,6 +16,7 @@
 */
 #include "TestSymbolTable.hpp"
 #include "Lexer.hpp"
+#include "Syntax.hpp"
 
 using namespace p1::smalls;
 
@@ -50,3 +51,62 @@ void TestSymbolTable::testMethod ( )
   CPPUNIT_ASSERT( t1 == t4 );
 }
 
+
+void TestSymbolTable::testMarkGenerations ( )
+{
+  SymbolTable sm;
+  Symbol * a = sm.newSymbol( "a" );
+
+  sm.beginMarkGeneration();
+  uint32_t s1 = sm.nextMarkStamp();
+  Symbol * a1 = sm.newSymbol( a, s1 );
+  CPPUNIT_ASSERT( a1 != a );
+  CPPUNIT_ASSERT( a1->parentSymbol == a );
+  CPPUNIT_ASSERT( a1 == sm.newSymbol( a, s1 ) );
+
+  // A nested generation only releases what it created
+  sm.beginMarkGeneration();
+  uint32_t s2 = sm.nextMarkStamp();
+  Symbol * a12 = sm.newSymbol( a1, s2 );
+  CPPUNIT_ASSERT( a12->parentSymbol == a1 );
+  sm.endMarkGeneration();
+
+  CPPUNIT_ASSERT( a1 == sm.newSymbol( a, s1 ) );
+  CPPUNIT_ASSERT_EQUAL( s2, sm.nextMarkStamp() );
+  Symbol * a12n = sm.newSymbol( a1, s2 );
+  CPPUNIT_ASSERT( a12n != a12 );
+  CPPUNIT_ASSERT_EQUAL( a12->uid, a12n->uid );
+  sm.endMarkGeneration();
+
+  // Everything was released and the counters start over
+  CPPUNIT_ASSERT_EQUAL( s1, sm.nextMarkStamp() );
+  CPPUNIT_ASSERT( a1 != sm.newSymbol( a, s1 ) );
+  CPPUNIT_ASSERT( a == sm.newSymbol( "a" ) );
+}
+
+void TestSymbolTable::testMarkInterning ( )
+{
+  SymbolTable sm;
+  Scope * scope = sm.newScope();
+  uint64_t epoch = sm.epoch();
+
+  Mark * anti = sm.newMark( -1, scope, NULL );
+  CPPUNIT_ASSERT( anti == sm.newMark( -1, scope, NULL ) );
+
+  sm.beginMarkGeneration();
+  Mark * m1 = sm.newMark( sm.nextMarkStamp(), scope, NULL );
+  Mark * m2 = sm.newMark( sm.nextMarkStamp(), scope, m1 );
+  CPPUNIT_ASSERT( m2 == sm.newMark( m2->value, scope, m1 ) );
+  CPPUNIT_ASSERT( m2 != sm.newMark( m2->value, scope, NULL ) );
+
+  // A mark followed by an anti-mark cancel out
+  CPPUNIT_ASSERT( concat( m1, anti ) == NULL );
+  CPPUNIT_ASSERT( concat( m2, anti ) == sm.newMark( m2->value, scope, NULL ) );
+  CPPUNIT_ASSERT( concat( m2, concat( anti, m1 ) ) == m2 );
+  sm.endMarkGeneration();
+
+  // Released marks are no longer interned, but the older ones are
+  CPPUNIT_ASSERT( m1 != sm.newMark( m1->value, scope, NULL ) );
+  CPPUNIT_ASSERT( anti == sm.newMark( -1, scope, NULL ) );
+  CPPUNIT_ASSERT( sm.epoch() != epoch );
+}
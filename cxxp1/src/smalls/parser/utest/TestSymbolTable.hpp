@@ -24,6 +24,8 @@
 class TestSymbolTable : public CPPUNIT_NS::TestFixture {
   CPPUNIT_TEST_SUITE(TestSymbolTable);
   CPPUNIT_TEST(testMethod);
+  CPPUNIT_TEST(testMarkGenerations);
+  CPPUNIT_TEST(testMarkInterning);
   CPPUNIT_TEST_SUITE_END();
 
 public:
@@ -34,6 +36,8 @@ public:
 
 private:
   void testMethod();
+  void testMarkGenerations();
+  void testMarkInterning();
 };
 
 #endif	/* TESTSYMBOLTABLE_HPP */
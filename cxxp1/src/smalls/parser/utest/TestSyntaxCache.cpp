@@ -0,0 +1,146 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestSyntaxCache.hpp"
+#include "SyntaxCache.hpp"
+#include "SyntaxReader.hpp"
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace p1;
+using namespace p1::smalls;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestSyntaxCache );
+
+TestSyntaxCache::TestSyntaxCache ( )
+{
+}
+
+TestSyntaxCache::~TestSyntaxCache ( )
+{
+}
+
+void TestSyntaxCache::setUp ( )
+{
+  char name[] = "/tmp/TestSyntaxCacheXXXXXX";
+  int fd = mkstemp( name );
+  CPPUNIT_ASSERT( fd != -1 );
+  ::close( fd );
+  m_path = name;
+}
+
+void TestSyntaxCache::tearDown ( )
+{
+  std::remove( m_path.c_str() );
+}
+
+namespace
+{
+;
+
+class ErrorReporter : public AbstractErrorReporter
+{
+public:
+  int count;
+
+  ErrorReporter () : count( 0 ) {}
+  virtual void error ( const ErrorInfo & ei )
+  {
+    ++count;
+    std::cerr << "  " << ei.formatMessage() << std::endl;
+  }
+};
+
+const char s_text[] =
+  "(define (fact x)\n"
+  "  (if (< x 2) 1 (* x (fact (- x 1)))))\n"
+  "\"a string\" 1.5 #t 'quoted\n"
+  "#(1 (2 . 3) #() ())\n"
+  "[a b . c]\n";
+
+void read ( SymbolTable & symTab, SyntaxCache::SyntaxList & datums )
+{
+  ErrorReporter err;
+  CharBufInput in( s_text );
+  Lexer lex( in, "input", symTab, err );
+  Keywords kw( symTab );
+  SyntaxReader reader( lex, kw );
+  Syntax * d;
+  while ((d = reader.parseDatum()) != reader.DAT_EOF)
+    datums.push_back( d );
+  CPPUNIT_ASSERT_EQUAL( 0, err.count );
+}
+
+/** Compare the structure, the symbols and the coordinates of every node */
+bool same ( const Syntax * a, const Syntax * b )
+{
+  if (a->skind != b->skind || a->coords.line != b->coords.line || a->coords.column != b->coords.column)
+    return false;
+  if (const SyntaxPair * pa = dyn_cast<SyntaxPair>(a))
+  {
+    const SyntaxPair * pb = cast<SyntaxPair>(b);
+    return same( pa->m_car, pb->m_car ) && same( pa->m_cdr, pb->m_cdr );
+  }
+  if (const SyntaxVector * va = dyn_cast<SyntaxVector>(a))
+  {
+    const SyntaxVector * vb = cast<SyntaxVector>(b);
+    if (va->len != vb->len)
+      return false;
+    for ( unsigned i = 0; i != va->len; ++i )
+      if (!same( va->m_data[i], vb->m_data[i] ))
+        return false;
+    return true;
+  }
+  return a->equal( b );
+}
+
+};
+
+void TestSyntaxCache::testRoundTrip ( )
+{
+  SymbolTable symTab;
+  SyntaxCache::SyntaxList original, loaded;
+  read( symTab, original );
+  CPPUNIT_ASSERT_EQUAL( (size_t)7, original.size() );
+
+  uint64_t hash = SyntaxCache::hashSource( (const unsigned char *)s_text, sizeof(s_text) - 1 );
+  SyntaxCache::save( m_path.c_str(), hash, original );
+  CPPUNIT_ASSERT( SyntaxCache::load( m_path.c_str(), hash, symTab, "input", loaded ) );
+
+  CPPUNIT_ASSERT_EQUAL( original.size(), loaded.size() );
+  for ( size_t i = 0; i != original.size(); ++i )
+    CPPUNIT_ASSERT( same( original[i], loaded[i] ) );
+}
+
+void TestSyntaxCache::testInvalid ( )
+{
+  SymbolTable symTab;
+  SyntaxCache::SyntaxList original, loaded;
+  read( symTab, original );
+  SyntaxCache::save( m_path.c_str(), 1, original );
+
+  // A different source
+  CPPUNIT_ASSERT( !SyntaxCache::load( m_path.c_str(), 2, symTab, "input", loaded ) );
+  // A missing file
+  CPPUNIT_ASSERT( !SyntaxCache::load( "/nonexistent/file.sxc", 1, symTab, "input", loaded ) );
+
+  // A truncated file
+  CPPUNIT_ASSERT( ::truncate( m_path.c_str(), 100 ) == 0 );
+  CPPUNIT_ASSERT( !SyntaxCache::load( m_path.c_str(), 1, symTab, "input", loaded ) );
+  CPPUNIT_ASSERT( loaded.empty() );
+}
@@ -0,0 +1,194 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestSyntaxRules.hpp"
+#include "SyntaxReader.hpp"
+#include "Keywords.hpp"
+#include "SyntaxRules.hpp"
+#include <sstream>
+
+using namespace p1;
+using namespace p1::smalls;
+using namespace p1::smalls::detail;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestSyntaxRules );
+
+TestSyntaxRules::TestSyntaxRules ( )
+{
+}
+
+TestSyntaxRules::~TestSyntaxRules ( )
+{
+}
+
+void TestSyntaxRules::setUp ( )
+{
+}
+
+void TestSyntaxRules::tearDown ( )
+{
+}
+
+namespace
+{
+;
+
+class ErrorReporter : public AbstractErrorReporter
+{
+public:
+  int count;
+
+  ErrorReporter () : count( 0 ) {}
+  virtual void error ( const ErrorInfo & ei )
+  {
+    ++count;
+    std::cerr << "  " << ei.formatMessage() << std::endl;
+  }
+};
+
+class Fixture
+{
+public:
+  SymbolTable symTab;
+  ErrorReporter err;
+  Keywords kw;
+  Scope * scope;
+
+  Fixture () : kw( symTab ), scope( symTab.newScope() ) {}
+
+  Syntax * read ( const char * str )
+  {
+    CharBufInput in( str );
+    Lexer lex( in, "input", symTab, err );
+    SyntaxReader reader( lex, kw );
+    Syntax * d = reader.parseDatum();
+    CPPUNIT_ASSERT_EQUAL( 0, err.count );
+    return d;
+  }
+
+  SyntaxRules * compile ( const char * spec )
+  {
+    return SyntaxRules::compile( scope, kw, symTab.newSymbol( "m" ), cast<SyntaxPair>(read( spec )) );
+  }
+
+  std::string expand ( SyntaxRules * macro, const char * form )
+  {
+    std::stringstream st;
+    st << *macro->expand( read( form ) );
+    return st.str();
+  }
+
+  /** Expand the way SchemeParser does: behind an anti-mark, with the result marked */
+  Syntax * expandMarked ( SyntaxRules * macro, Syntax * form )
+  {
+    Syntax * res = macro->expand( form->wrap( symTab.newMark( -1, scope, NULL ) ) );
+    return res->wrap( symTab.newMark( symTab.nextMarkStamp(), scope, NULL ) );
+  }
+};
+
+Syntax * nth ( Syntax * list, unsigned n )
+{
+  while (n--)
+    list = cast<SyntaxPair>(list)->cdr();
+  return cast<SyntaxPair>(list)->car();
+}
+
+/** The number of marks applied to a symbol */
+unsigned markDepth ( Symbol * sym )
+{
+  unsigned depth = 0;
+  for ( ; sym->parentSymbol; sym = sym->parentSymbol )
+    ++depth;
+  return depth;
+}
+
+}
+
+void TestSyntaxRules::testExpand ( )
+{
+  Fixture f;
+  SyntaxRules * m;
+
+  m = f.compile( "(syntax-rules () ((_) none) ((_ a) a) ((_ a b ...) (if a a (m b ...))))" );
+  CPPUNIT_ASSERT_EQUAL( std::string("none"), f.expand( m, "(m)" ) );
+  CPPUNIT_ASSERT_EQUAL( std::string("x"), f.expand( m, "(m x)" ) );
+  CPPUNIT_ASSERT_EQUAL( std::string("(if x x (m y z))"), f.expand( m, "(m x y z)" ) );
+
+  // Nested ellipses and depth-0 variables inside an ellipsis
+  m = f.compile( "(syntax-rules () ((_ k (a b ...) ...) (begin (k a) ... (k b ... ...) ((a b) ...) ...)))" );
+  CPPUNIT_ASSERT_EQUAL(
+    std::string("(begin (f 1) (f 4) (f 2 3 5) ((1 2) (1 3)) ((4 5)))"),
+    f.expand( m, "(m f (1 2 3) (4 5))" )
+  );
+
+  // Trailing patterns after the ellipsis and a dotted tail
+  m = f.compile( "(syntax-rules () ((_ a ... y z . r) (list (a ...) y z r)))" );
+  CPPUNIT_ASSERT_EQUAL( std::string("(list (1 2) 3 4 ())"), f.expand( m, "(m 1 2 3 4)" ) );
+  CPPUNIT_ASSERT_EQUAL( std::string("(list () 3 4 5)"), f.expand( m, "(m 3 4 . 5)" ) );
+
+  // Literals, "_" and constants
+  m = f.compile( "(syntax-rules (else) ((_ else e) (e)) ((_ 1 _) one) ((_ c e) (if c e)))" );
+  CPPUNIT_ASSERT_EQUAL( std::string("(x)"), f.expand( m, "(m else x)" ) );
+  CPPUNIT_ASSERT_EQUAL( std::string("one"), f.expand( m, "(m 1 x)" ) );
+  CPPUNIT_ASSERT_EQUAL( std::string("(if 2 x)"), f.expand( m, "(m 2 x)" ) );
+
+  // Vectors, a custom ellipsis and ellipsis escapes
+  m = f.compile( "(syntax-rules ::: () ((_ #(a ::: b)) #(b a :::)) ((_ x) (x ...)))" );
+  CPPUNIT_ASSERT_EQUAL( std::string("#(3 1 2)"), f.expand( m, "(m #(1 2 3))" ) );
+  CPPUNIT_ASSERT_EQUAL( std::string("(1 ...)"), f.expand( m, "(m 1)" ) );
+  m = f.compile( "(syntax-rules () ((_ a) (... (a ...))))" );
+  CPPUNIT_ASSERT_EQUAL( std::string("(1 ...)"), f.expand( m, "(m 1)" ) );
+
+  // Rules beyond the dispatch table
+  m = f.compile( "(syntax-rules () ((_ a ...) (+ a ...)))" );
+  CPPUNIT_ASSERT_EQUAL( std::string("(+ 1 2 3 4 5 6 7 8 9 10)"), f.expand( m, "(m 1 2 3 4 5 6 7 8 9 10)" ) );
+  m = f.compile( "(syntax-rules () ((_ a b c d e f g h i) (list a i)) ((_ a ...) (+ a ...)))" );
+  CPPUNIT_ASSERT_EQUAL( std::string("(list 1 9)"), f.expand( m, "(m 1 2 3 4 5 6 7 8 9)" ) );
+  CPPUNIT_ASSERT_EQUAL( std::string("(+ 1 2 3 4 5 6 7 8)"), f.expand( m, "(m 1 2 3 4 5 6 7 8)" ) );
+  CPPUNIT_ASSERT_EQUAL( std::string("(+ 1 2 3 4 5 6 7 8 9 10)"), f.expand( m, "(m 1 2 3 4 5 6 7 8 9 10)" ) );
+
+  // A macro expanding to another one: the identifier passed on still names its binding
+  SyntaxRules * m2 = f.compile( "(syntax-rules () ((_ e) (* e 2)))" );
+  SyntaxRules * m3 = f.compile( "(syntax-rules () ((_ x) (let ((t x)) (m2 t))))" );
+  Syntax * let = f.expandMarked( m3, f.read( "(m3 4)" ) );
+  SyntaxSymbol * bound = cast<SyntaxSymbol>(nth( nth( nth( let, 1 ), 0 ), 0 ));
+  SyntaxSymbol * used = cast<SyntaxSymbol>(nth( f.expandMarked( m2, nth( let, 2 ) ), 1 ));
+  CPPUNIT_ASSERT( used->symbol == bound->symbol );
+  CPPUNIT_ASSERT_EQUAL( 1u, markDepth( used->symbol ) );
+
+  // A macro defined by a macro: its template carries one mark per expansion
+  m = f.compile( "(syntax-rules () ((_ name) (define-macro name (syntax-rules () ((_ x) (+ x 1))))))" );
+  Syntax * def = f.expandMarked( m, f.read( "(defn n)" ) );
+  SyntaxRules * n = SyntaxRules::compile( f.scope, f.kw, f.symTab.newSymbol( "n" ), cast<SyntaxPair>(nth( def, 2 )) );
+  SyntaxSymbol * plus = cast<SyntaxSymbol>(nth( f.expandMarked( n, f.read( "(n 5)" ) ), 0 ));
+  CPPUNIT_ASSERT_EQUAL( 2u, markDepth( plus->symbol ) );
+  CPPUNIT_ASSERT( plus->symbol->parentSymbol->parentSymbol == f.symTab.newSymbol( "+" ) );
+}
+
+void TestSyntaxRules::testErrors ( )
+{
+  Fixture f;
+
+  CPPUNIT_ASSERT_THROW( f.compile( "(syntax-rules () ((_ a) (a ...)))" ), ErrorInfo );
+  CPPUNIT_ASSERT_THROW( f.compile( "(syntax-rules () ((_ a ...) a))" ), ErrorInfo );
+  CPPUNIT_ASSERT_THROW( f.compile( "(syntax-rules () ((_ a a) a))" ), ErrorInfo );
+  CPPUNIT_ASSERT_THROW( f.compile( "(syntax-rules () ((_ a ... b ...) a))" ), ErrorInfo );
+  CPPUNIT_ASSERT_THROW( f.compile( "(syntax-rules () (_ a))" ), ErrorInfo );
+
+  SyntaxRules * m = f.compile( "(syntax-rules () ((_ (a ...) (b ...)) ((a b) ...)))" );
+  CPPUNIT_ASSERT_THROW( f.expand( m, "(m (1 2) (3))" ), ErrorInfo );
+  CPPUNIT_ASSERT_THROW( f.expand( m, "(m 1 2)" ), ErrorInfo );
+}
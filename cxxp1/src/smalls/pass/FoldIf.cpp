@@ -0,0 +1,79 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "Passes.hpp"
+#include "p1/smalls/ast/AstRewriter.hpp"
+#include "p1/smalls/parser/Syntax.hpp"
+
+namespace p1 {
+namespace smalls {
+
+namespace {
+
+class FoldIf : public AstRewriter
+{
+public:
+  FoldIf () : AstRewriter( false ) {}
+
+protected:
+  virtual Ast * visitIf ( AstIf * ast )
+  {
+    AstRewriter::visitIf( ast );
+
+    AstDatum * dt = dyn_cast<AstDatum>(ast->cond);
+    if (!dt)
+      return ast;
+
+    // Everything except #f is true, but the generated code can't tell #f from 0 (or other
+    // literals it stores as 0), so only booleans are folded
+    SyntaxValue * v = dyn_cast<SyntaxValue>(dt->datum);
+    if (!v || v->skind != SyntaxKind::BOOL)
+      return ast;
+    if (v->u.vbool)
+      return ast->thenAst;
+    else if (ast->elseAst)
+      return ast->elseAst;
+    else
+      return new AstUnspecified( ast->coords );
+  }
+};
+
+class FoldIfPass : public AstFunctionPass
+{
+public:
+  FoldIfPass () : AstFunctionPass( "fold-if" ) {}
+
+  virtual unsigned runOnBody ( AstBody * body )
+  {
+    FoldIf fold;
+    fold.rewriteBody( body );
+    return fold.replaced();
+  }
+};
+
+} // anonymous namespace
+
+AstFunctionPass * createFoldIfPass ()
+{
+  return new FoldIfPass();
+}
+
+void addStandardPasses ( PassManager & pm )
+{
+  pm.add( createFoldIfPass() );
+}
+
+}} // namespaces
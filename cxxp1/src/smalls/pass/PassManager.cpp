@@ -0,0 +1,273 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "PassManager.hpp"
+#include "p1/smalls/ast/AstRewriter.hpp"
+#include "p1/util/ThreadPool.hpp"
+#include "p1/util/format-str.hpp"
+#include "p1/util/clock.hpp"
+#include <boost/foreach.hpp>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+namespace p1 {
+namespace smalls {
+
+/** Functions claimed by a FunctionTask at a time */
+static const unsigned BODY_CHUNK = 8;
+
+namespace {
+
+/** Collects the bodies of a module's functions, in source order */
+class FunctionCollector : public AstRewriter
+{
+public:
+  typedef std::vector<AstBody *, gc_allocator<AstBody *> > BodyList;
+
+  explicit FunctionCollector ( BodyList & bodies )
+    : m_bodies( bodies )
+  {}
+
+protected:
+  virtual Ast * visitClosure ( AstClosure * ast )
+  {
+    m_bodies.push_back( ast->body );
+    return AstRewriter::visitClosure( ast );
+  }
+
+private:
+  BodyList & m_bodies;
+};
+
+} // anonymous namespace
+
+/**
+ * Runs a function pass, claiming the functions in order a few at a time.
+ */
+class PassManager::FunctionTask : public ThreadPool::Task
+{
+public:
+  explicit FunctionTask ( PassManager * pm )
+    : m_pm( pm )
+  {}
+
+  virtual void run ()
+  {
+    try
+    {
+      unsigned const count = m_pm->m_bodies.size();
+      unsigned replaced = 0;
+      unsigned i;
+      while ((i = __sync_fetch_and_add( &m_pm->m_nextBody, BODY_CHUNK )) < count)
+      {
+        for ( unsigned e = std::min( i + BODY_CHUNK, count ); i != e; ++i )
+          replaced += m_pm->m_curPass->runOnBody( m_pm->m_bodies[i] );
+      }
+      __sync_fetch_and_add( &m_pm->m_replaced, replaced );
+    }
+    catch (std::exception & e)
+    {
+      m_pm->taskFailed( e.what() );
+    }
+  }
+
+private:
+  PassManager * m_pm;
+};
+
+unsigned AstFunctionPass::run ( PassManager & pm, AstModule * module )
+{
+  return pm.runOnFunctions( this, module );
+}
+
+PassManager::PassManager ()
+{
+  m_pool = NULL;
+  m_countNodes = false;
+  m_inputNodes = 0;
+  m_functions = 0;
+  m_curPass = NULL;
+  m_nextBody = 0;
+  m_replaced = 0;
+  m_taskFailed = 0;
+}
+
+PassManager::~PassManager ()
+{}
+
+void PassManager::add ( AstPass * pass )
+{
+  m_passes.push_back( pass );
+}
+
+/**
+ * Order the passes so that each follows its requirements, keeping the order they were added in
+ * otherwise: repeatedly take the first pass whose requirements have all been taken.
+ */
+PassManager::PassList PassManager::schedule () const
+{
+  PassList res;
+  PassList pending( m_passes );
+
+  BOOST_FOREACH( AstPass * pass, m_passes )
+  {
+    for ( const char * const * req = pass->requires; req && *req; ++req )
+    {
+      bool found = false;
+      BOOST_FOREACH( AstPass * p, m_passes )
+        if (std::strcmp( p->name, *req ) == 0)
+        {
+          found = true;
+          break;
+        }
+      if (!found)
+        throw std::runtime_error( formatStr( "Pass '%s' requires '%s', which wasn't added", pass->name, *req ) );
+    }
+  }
+
+  while (!pending.empty())
+  {
+    PassList::iterator it;
+    for ( it = pending.begin(); it != pending.end(); ++it )
+    {
+      bool ready = true;
+      for ( const char * const * req = (*it)->requires; req && *req && ready; ++req )
+      {
+        ready = false;
+        BOOST_FOREACH( AstPass * p, res )
+          if (std::strcmp( p->name, *req ) == 0)
+          {
+            ready = true;
+            break;
+          }
+      }
+      if (ready)
+        break;
+    }
+
+    if (it == pending.end())
+      throw std::runtime_error( formatStr( "Circular requirements of pass '%s'", pending.front()->name ) );
+
+    res.push_back( *it );
+    pending.erase( it );
+  }
+
+  return res;
+}
+
+void PassManager::run ( AstModule * module )
+{
+  PassList const passes = schedule();
+
+  m_stats.clear();
+  m_inputNodes = m_countNodes ? countNodes( module ) : 0;
+
+  BOOST_FOREACH( AstPass * pass, passes )
+  {
+    m_functions = 0;
+    uint64_t const start = monotonicNanos();
+    unsigned const replaced = pass->run( *this, module );
+
+    PassStats st;
+    st.name = pass->name;
+    st.nanos = monotonicNanos() - start;
+    st.functions = m_functions;
+    st.replaced = replaced;
+    st.nodes = m_countNodes ? countNodes( module ) : 0;
+    m_stats.push_back( st );
+  }
+}
+
+unsigned PassManager::runOnFunctions ( AstFunctionPass * pass, AstModule * module )
+{
+  // Passes may add or remove closures, so the functions are collected again every time
+  m_bodies.clear();
+  m_bodies.push_back( module->body() );
+  FunctionCollector( m_bodies ).rewriteBody( module->body() );
+  m_functions = m_bodies.size();
+
+  unsigned replaced = 0;
+  if (!m_pool || m_bodies.size() < 2)
+  {
+    BOOST_FOREACH( AstBody * body, m_bodies )
+      replaced += pass->runOnBody( body );
+  }
+  else
+  {
+    m_curPass = pass;
+    m_nextBody = 0;
+    m_replaced = 0;
+    m_taskFailed = 0;
+    std::vector<FunctionTask> tasks( std::min<size_t>( m_pool->size(), m_bodies.size() ), FunctionTask( this ) );
+    for ( unsigned i = 0; i < tasks.size(); ++i )
+      m_pool->submit( &tasks[i] );
+    m_pool->wait();
+    m_curPass = NULL;
+    replaced = m_replaced;
+  }
+
+  m_bodies.clear();
+  if (m_taskFailed)
+  {
+    m_taskFailed = 0;
+    throw std::runtime_error( m_taskFailure );
+  }
+  return replaced;
+}
+
+void PassManager::taskFailed ( const char * what )
+{
+  if (__sync_bool_compare_and_swap( &m_taskFailed, 0, 1 ))
+    m_taskFailure = what;
+}
+
+unsigned PassManager::countNodes ( AstModule * module )
+{
+  AstRewriter counter;
+  counter.rewriteBody( module->body() );
+  return counter.visited();
+}
+
+void PassManager::printStats ( std::ostream & os ) const
+{
+  char buf[256];
+  uint64_t total = 0;
+
+  if (m_countNodes)
+  {
+    std::sprintf( buf, "passes: %u nodes in\n", m_inputNodes );
+    os << buf;
+  }
+  BOOST_FOREACH( const PassStats & st, m_stats )
+  {
+    total += st.nanos;
+    std::sprintf( buf, "  %-20s %8.3f ms, %u functions, %u replaced", st.name, st.nanos / 1e6,
+                  st.functions, st.replaced );
+    os << buf;
+    if (m_countNodes)
+    {
+      std::sprintf( buf, ", %u nodes", st.nodes );
+      os << buf;
+    }
+    os << '\n';
+  }
+  std::sprintf( buf, "passes: %u run in %.3f ms\n", (unsigned)m_stats.size(), total / 1e6 );
+  os << buf;
+}
+
+}} // namespaces
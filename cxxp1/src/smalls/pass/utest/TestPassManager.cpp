@@ -0,0 +1,247 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestPassManager.hpp"
+#include "Passes.hpp"
+#include "p1/smalls/ast/AstRewriter.hpp"
+#include "p1/smalls/parser/SchemeParser.hpp"
+#include "p1/smalls/parser/SyntaxReader.hpp"
+#include "p1/util/ThreadPool.hpp"
+#include "ListBuilder.hpp"
+#include <stdexcept>
+#include <sstream>
+
+using namespace p1;
+using namespace p1::smalls;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestPassManager );
+
+TestPassManager::TestPassManager ( )
+{
+}
+
+TestPassManager::~TestPassManager ( )
+{
+}
+
+void TestPassManager::setUp ( )
+{
+}
+
+void TestPassManager::tearDown ( )
+{
+}
+
+namespace
+{
+;
+
+class ErrorReporter : public AbstractErrorReporter
+{
+public:
+  int count;
+
+  ErrorReporter () : count( 0 ) {}
+  virtual void error ( const ErrorInfo & ei )
+  {
+    ++count;
+    std::cerr << "  " << ei.formatMessage() << std::endl;
+  }
+};
+
+AstModule * compile ( const std::string & text )
+{
+  SymbolTable symTab;
+  ErrorReporter err;
+  CharBufInput in( text.c_str() );
+  Lexer lex( in, "input", symTab, err );
+  Keywords kw( symTab );
+  SyntaxReader reader( lex, kw );
+  SchemeParser parser( symTab, kw, err );
+
+  detail::ListBuilder lb;
+  Syntax * d;
+  while ((d = reader.parseDatum()) != reader.DAT_EOF)
+    lb << d;
+  AstModule * mod = parser.compileLibraryBody( lb );
+  CPPUNIT_ASSERT_EQUAL( 0, err.count );
+  return mod;
+}
+
+std::string toString ( AstModule * mod )
+{
+  std::stringstream ss;
+  ss << *mod;
+  return ss.str();
+}
+
+/** Appends its name to a log when it runs */
+class LogPass : public AstPass
+{
+public:
+  std::string & log;
+
+  LogPass ( std::string & log_, const char * name_, const char * const * requires_ = NULL )
+    : AstPass( name_, requires_ ), log( log_ )
+  {}
+
+  virtual unsigned run ( PassManager &, AstModule * )
+  {
+    log += name;
+    return 0;
+  }
+};
+
+/** Counts the closures in each function, and how many times each function was seen */
+class CountPass : public AstFunctionPass
+{
+public:
+  volatile unsigned bodies;
+  volatile unsigned closures;
+
+  CountPass () : AstFunctionPass( "count" ), bodies( 0 ), closures( 0 ) {}
+
+  virtual unsigned runOnBody ( AstBody * body )
+  {
+    class Counter : public AstRewriter
+    {
+    public:
+      unsigned closures;
+      Counter () : AstRewriter( false ), closures( 0 ) {}
+    protected:
+      virtual Ast * visitClosure ( AstClosure * ast )
+      {
+        ++closures;
+        return AstRewriter::visitClosure( ast );
+      }
+    } counter;
+
+    counter.rewriteBody( body );
+    __sync_fetch_and_add( &bodies, 1 );
+    __sync_fetch_and_add( &closures, counter.closures );
+    return 0;
+  }
+};
+
+};
+
+void TestPassManager::testFoldIf ( )
+{
+  AstModule * mod = compile( "(define x (if #f 1 2))\n"
+                             "(lambda (y) (if #t x (y x)))\n"
+                             "(if #f x)\n"
+                             "(if x 1 2)\n" );
+  PassManager pm;
+  pm.setNodeCounting( true );
+  addStandardPasses( pm );
+  pm.run( mod );
+
+  CPPUNIT_ASSERT_EQUAL( (size_t)1, pm.stats().size() );
+  const PassManager::PassStats & st = pm.stats()[0];
+  CPPUNIT_ASSERT( std::string( "fold-if" ) == st.name );
+  CPPUNIT_ASSERT_EQUAL( 2u, st.functions );
+  CPPUNIT_ASSERT_EQUAL( 3u, st.replaced );
+  CPPUNIT_ASSERT_EQUAL( pm.inputNodes() - 10, st.nodes );
+  CPPUNIT_ASSERT_EQUAL( st.nodes, PassManager::countNodes( mod ) );
+
+  std::string res = toString( mod );
+  CPPUNIT_ASSERT( res.find( "(DATUM 1)" ) != std::string::npos );
+  CPPUNIT_ASSERT( res.find( "(UNSPECIFIED)" ) != std::string::npos );
+  CPPUNIT_ASSERT( res.find( "APPLY" ) == std::string::npos );
+  // Only literal conditions are folded
+  CPPUNIT_ASSERT( res.find( "(IF" ) != std::string::npos );
+
+  // Nothing more to fold
+  pm.run( mod );
+  CPPUNIT_ASSERT_EQUAL( 0u, pm.stats()[0].replaced );
+
+  // 0 is true, but the generated code can't tell it from #f
+  mod = compile( "(if 0 1 2)\n" );
+  pm.run( mod );
+  CPPUNIT_ASSERT_EQUAL( 0u, pm.stats()[0].replaced );
+  CPPUNIT_ASSERT( toString( mod ).find( "(IF" ) != std::string::npos );
+}
+
+void TestPassManager::testSchedule ( )
+{
+  static const char * const needA[] = { "a", NULL };
+  static const char * const needAC[] = { "a", "c", NULL };
+  static const char * const needX[] = { "x", NULL };
+  static const char * const needD[] = { "d", NULL };
+  AstModule * mod = compile( "1" );
+  std::string log;
+
+  {
+    PassManager pm;
+    pm.add( new LogPass( log, "d", needAC ) );
+    pm.add( new LogPass( log, "b" ) );
+    pm.add( new LogPass( log, "c", needA ) );
+    pm.add( new LogPass( log, "a" ) );
+    pm.run( mod );
+    CPPUNIT_ASSERT_EQUAL( std::string( "bacd" ), log );
+    CPPUNIT_ASSERT_EQUAL( (size_t)4, pm.stats().size() );
+    CPPUNIT_ASSERT( std::string( "d" ) == pm.stats()[3].name );
+  }
+
+  log.clear();
+  {
+    PassManager pm;
+    pm.add( new LogPass( log, "a" ) );
+    pm.add( new LogPass( log, "b", needX ) );
+    CPPUNIT_ASSERT_THROW( pm.run( mod ), std::runtime_error );
+    CPPUNIT_ASSERT( log.empty() );
+  }
+  {
+    PassManager pm;
+    pm.add( new LogPass( log, "a", needD ) );
+    pm.add( new LogPass( log, "d", needA ) );
+    CPPUNIT_ASSERT_THROW( pm.run( mod ), std::runtime_error );
+    CPPUNIT_ASSERT( log.empty() );
+  }
+}
+
+void TestPassManager::testParallel ( )
+{
+  std::stringstream text;
+  for ( unsigned i = 0; i < 100; ++i )
+    text << "(define f" << i << " (lambda (a) (lambda (b) (if #t (lambda (c) (+ a b c)) b))))\n";
+  std::string const src = text.str();
+
+  AstModule * seqMod = compile( src );
+  PassManager seq;
+  CountPass * seqCount = new CountPass();
+  seq.add( seqCount );
+  addStandardPasses( seq );
+  seq.run( seqMod );
+  CPPUNIT_ASSERT_EQUAL( 301u, seqCount->bodies );
+  CPPUNIT_ASSERT_EQUAL( 300u, seqCount->closures );
+  CPPUNIT_ASSERT_EQUAL( 100u, seq.stats()[1].replaced );
+
+  ThreadPool pool( 4 );
+  AstModule * parMod = compile( src );
+  PassManager par;
+  par.setThreadPool( &pool );
+  CountPass * parCount = new CountPass();
+  par.add( parCount );
+  addStandardPasses( par );
+  par.run( parMod );
+  CPPUNIT_ASSERT_EQUAL( 301u, parCount->bodies );
+  CPPUNIT_ASSERT_EQUAL( 300u, parCount->closures );
+  CPPUNIT_ASSERT_EQUAL( 301u, par.stats()[1].functions );
+  CPPUNIT_ASSERT_EQUAL( 100u, par.stats()[1].replaced );
+
+  CPPUNIT_ASSERT( toString( parMod ) == toString( seqMod ) );
+}
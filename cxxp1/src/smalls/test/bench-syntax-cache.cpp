@@ -0,0 +1,138 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "p1/util/FastMMapInput.hpp"
+#include "p1/util/clock.hpp"
+#include "p1/smalls/parser/SyntaxReader.hpp"
+#include "p1/smalls/parser/SyntaxCache.hpp"
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+
+using namespace p1;
+using namespace p1::smalls;
+
+/*
+ * Compare reading a source file with SyntaxReader to loading its binary SyntaxCache.
+ */
+
+class ErrorReporter : public AbstractErrorReporter
+{
+public:
+  int count;
+
+  ErrorReporter () : count( 0 ) {}
+  virtual void error ( const ErrorInfo & ei )
+  {
+    ++count;
+    std::cerr << ei.formatMessage() << std::endl;
+  }
+};
+
+static uint64_t readSource ( const char * fileName, SyntaxCache::SyntaxList & datums )
+{
+  uint64_t start = monotonicNanos();
+  SymbolTable symTab;
+  ErrorReporter errors;
+  FastMMapInput fi( fileName );
+  Lexer lex( fi, fileName, symTab, errors );
+  Keywords kw( symTab );
+  SyntaxReader reader( lex, kw );
+  Syntax * d;
+  while ((d = reader.parseDatum()) != reader.DAT_EOF)
+    datums.push_back( d );
+  uint64_t res = monotonicNanos() - start;
+  if (errors.count)
+    std::exit( EXIT_FAILURE );
+  return res;
+}
+
+static uint64_t loadCache ( const char * fileName, const char * cachePath, uint64_t hash,
+                            SyntaxCache::SyntaxList & datums )
+{
+  uint64_t start = monotonicNanos();
+  SymbolTable symTab;
+  if (!SyntaxCache::load( cachePath, hash, symTab, fileName, datums ))
+  {
+    std::cerr << "**error: could not load " << cachePath << std::endl;
+    std::exit( EXIT_FAILURE );
+  }
+  return monotonicNanos() - start;
+}
+
+int main ( int argc, char ** argv )
+{
+  GC_INIT();
+
+  if (argc < 2 || argc > 3)
+  {
+    std::cerr << "syntax: bench-syntax-cache file [iterations]\n";
+    return EXIT_FAILURE;
+  }
+  const char * fileName = argv[1];
+  unsigned iterations = argc > 2 ? std::atoi( argv[2] ) : 10;
+  if (!iterations)
+    iterations = 1;
+
+  uint64_t hash;
+  {
+    FastMMapInput fi( fileName );
+    uint64_t start = monotonicNanos();
+    hash = SyntaxCache::hashSource( fi.head(), fi.available() );
+    std::printf( "hash:  %8.3f ms (%lu bytes)\n", (monotonicNanos() - start) / 1e6, (unsigned long)fi.available() );
+  }
+
+  SyntaxCache::SyntaxList original;
+  readSource( fileName, original );
+  std::string cachePath = SyntaxCache::cachePath( fileName );
+  {
+    uint64_t start = monotonicNanos();
+    SyntaxCache::save( cachePath.c_str(), hash, original );
+    std::printf( "save:  %8.3f ms\n", (monotonicNanos() - start) / 1e6 );
+  }
+
+  uint64_t bestRead = ~(uint64_t)0, bestLoad = ~(uint64_t)0;
+  for ( unsigned i = 0; i != iterations; ++i )
+  {
+    SyntaxCache::SyntaxList read, loaded;
+    bestRead = std::min( bestRead, readSource( fileName, read ) );
+    bestLoad = std::min( bestLoad, loadCache( fileName, cachePath.c_str(), hash, loaded ) );
+
+    if (i == 0)
+    {
+      // The symbol tables differ, so compare the printed forms and the coordinates
+      bool same = read.size() == loaded.size();
+      for ( std::size_t j = 0; same && j != read.size(); ++j )
+      {
+        std::stringstream a, b;
+        Syntax::toStreamIndented( a, 0, read[j] );
+        Syntax::toStreamIndented( b, 0, loaded[j] );
+        same = a.str() == b.str() && read[j]->coords == loaded[j]->coords;
+      }
+      if (!same)
+      {
+        std::cerr << "**error: the cache differs from the source\n";
+        return EXIT_FAILURE;
+      }
+    }
+  }
+
+  std::printf( "read:  %8.3f ms (best of %u)\n", bestRead / 1e6, iterations );
+  std::printf( "load:  %8.3f ms (best of %u)\n", bestLoad / 1e6, iterations );
+  std::printf( "speedup: %.2fx\n", (double)bestRead / bestLoad );
+  return 0;
+}
@@ -0,0 +1,200 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "p1/smalls/driver/BatchCompiler.hpp"
+#include "p1/util/gc-support.hpp"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <dirent.h>
+#include <sys/stat.h>
+
+using namespace p1;
+using namespace p1::smalls;
+
+/*
+ * Compile many files in parallel. Every "x.scm" produces "x.c", next to it or in the output
+ * directory.
+ */
+
+static void usage ()
+{
+  std::cerr << "syntax: scheme-batch [options] (file|dir)...\n"
+               "  -j n              compile on n threads (default: one per processor)\n"
+               "  -o dir            write the output files to dir instead of next to the sources\n"
+               "  -n                don't write the output files\n"
+               "  -list file        also compile the files listed in file, one per line ('-' is stdin)\n"
+               "  -stream           compile and emit each top-level form as soon as it is read\n"
+               "  -expansion-cache  reuse the expansions of pure macros\n";
+}
+
+static bool hasSuffix ( const std::string & s, const char * suffix )
+{
+  size_t len = std::strlen( suffix );
+  return s.size() >= len && s.compare( s.size() - len, len, suffix ) == 0;
+}
+
+/** Add the *.scm files in the directory and its subdirectories, sorted by name */
+static bool addDirectory ( const std::string & dir, std::vector<std::string> & files )
+{
+  DIR * d = ::opendir( dir.c_str() );
+  if (!d)
+  {
+    std::perror( dir.c_str() );
+    return false;
+  }
+  std::vector<std::string> names;
+  while (struct dirent * de = ::readdir( d ))
+    if (de->d_name[0] != '.')
+      names.push_back( de->d_name );
+  ::closedir( d );
+  std::sort( names.begin(), names.end() );
+
+  bool ok = true;
+  for ( size_t i = 0; i != names.size(); ++i )
+  {
+    std::string path = dir + '/' + names[i];
+    struct stat st;
+    if (::stat( path.c_str(), &st ) == 0 && S_ISDIR(st.st_mode))
+      ok &= addDirectory( path, files );
+    else if (hasSuffix( names[i], ".scm" ))
+      files.push_back( path );
+  }
+  return ok;
+}
+
+static bool addList ( const char * listName, std::vector<std::string> & files )
+{
+  std::ifstream f;
+  std::istream * is = &std::cin;
+  if (std::strcmp( listName, "-" ) != 0)
+  {
+    f.open( listName );
+    if (!f)
+    {
+      std::cerr << "**error: could not open " << listName << std::endl;
+      return false;
+    }
+    is = &f;
+  }
+  std::string line;
+  while (std::getline( *is, line ))
+    if (!line.empty())
+      files.push_back( line );
+  return true;
+}
+
+class OutputWriter : public BatchCompiler::Sink
+{
+public:
+  const char * outDir; //< NULL means next to the source
+  bool write;
+  unsigned failedWrites;
+
+  OutputWriter () : outDir( NULL ), write( true ), failedWrites( 0 ) {}
+
+  virtual void done ( const BatchCompiler::FileResult & res )
+  {
+    std::cerr << res.diagnostics;
+    if (!write)
+      return;
+
+    std::string name = res.fileName;
+    if (hasSuffix( name, ".scm" ))
+      name.erase( name.size() - 4 );
+    if (outDir)
+    {
+      size_t slash = name.rfind( '/' );
+      if (slash != std::string::npos)
+        name.erase( 0, slash + 1 );
+      name = std::string( outDir ) + '/' + name;
+    }
+    name += ".c";
+
+    std::ofstream f( name.c_str(), std::ios::out | std::ios::binary );
+    f << res.code;
+    if (!f.flush())
+    {
+      std::cerr << "**error: could not write " << name << std::endl;
+      ++failedWrites;
+    }
+  }
+};
+
+int main ( int argc, const char ** argv )
+{
+  GC_INIT();
+
+  BatchCompiler::Options options;
+  OutputWriter writer;
+  std::vector<std::string> files;
+
+  for ( int i = 1; i < argc; ++i )
+  {
+    if (std::strcmp( argv[i], "-j" ) == 0 && i + 1 < argc)
+    {
+      int threads = std::atoi( argv[++i] );
+      if (threads < 0)
+      {
+        usage();
+        return EXIT_FAILURE;
+      }
+      options.threads = threads;
+    }
+    else if (std::strcmp( argv[i], "-o" ) == 0 && i + 1 < argc)
+      writer.outDir = argv[++i];
+    else if (std::strcmp( argv[i], "-n" ) == 0)
+      writer.write = false;
+    else if (std::strcmp( argv[i], "-list" ) == 0 && i + 1 < argc)
+    {
+      if (!addList( argv[++i], files ))
+        return EXIT_FAILURE;
+    }
+    else if (std::strcmp( argv[i], "-stream" ) == 0)
+      options.stream = true;
+    else if (std::strcmp( argv[i], "-expansion-cache" ) == 0)
+      options.expansionCache = true;
+    else if (argv[i][0] == '-')
+    {
+      usage();
+      return EXIT_FAILURE;
+    }
+    else
+    {
+      struct stat st;
+      if (::stat( argv[i], &st ) == 0 && S_ISDIR(st.st_mode))
+      {
+        if (!addDirectory( argv[i], files ))
+          return EXIT_FAILURE;
+      }
+      else
+        files.push_back( argv[i] );
+    }
+  }
+  if (files.empty())
+  {
+    usage();
+    return EXIT_FAILURE;
+  }
+
+  BatchCompiler batch( options );
+  BatchCompiler::Summary sum = batch.run( files, writer );
+  sum.print( std::cerr, batch.threads() );
+
+  return sum.failed || writer.failedWrites ? EXIT_FAILURE : EXIT_SUCCESS;
+}
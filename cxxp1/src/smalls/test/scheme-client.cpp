@@ -0,0 +1,110 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "p1/util/UnixSocket.hpp"
+#include "p1/smalls/driver/CompileProtocol.hpp"
+#include <iostream>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <climits>
+#include <unistd.h>
+
+using namespace p1;
+using namespace p1::smalls;
+
+/*
+ * A drop-in replacement for "scheme-play", which has "scheme-server" do the work.
+ */
+
+static void usage ()
+{
+  std::cerr << "syntax: scheme-client [options] file\n"
+               "       scheme-client [-socket path] -shutdown\n"
+               "  -socket path      connect to path instead of $SMALLS_SOCKET or /tmp/smalls-<uid>.sock\n"
+               "  -stream           compile and emit each top-level form as soon as it is read\n"
+               "  -shutdown         stop the server\n";
+}
+
+int main ( int argc, const char ** argv )
+{
+  std::string socketPath = protocol::defaultSocketPath();
+  const char * fileName = NULL;
+  unsigned flags = 0;
+  bool shutdown = false;
+
+  for ( int i = 1; i < argc; ++i )
+  {
+    if (std::strcmp( argv[i], "-socket" ) == 0 && i + 1 < argc)
+      socketPath = argv[++i];
+    else if (std::strcmp( argv[i], "-stream" ) == 0)
+      flags |= protocol::F_STREAM;
+    else if (std::strcmp( argv[i], "-shutdown" ) == 0)
+      shutdown = true;
+    else if (argv[i][0] == '-' || fileName)
+    {
+      usage();
+      return 2;
+    }
+    else
+      fileName = argv[i];
+  }
+  if (!fileName == !shutdown)
+  {
+    usage();
+    return 2;
+  }
+
+  std::vector<std::string> req;
+  if (shutdown)
+    req.push_back( protocol::CMD_SHUTDOWN );
+  else
+  {
+    char cwd[PATH_MAX];
+    if (!::getcwd( cwd, sizeof(cwd) ))
+    {
+      std::perror( "getcwd" );
+      return 2;
+    }
+    char buf[16];
+    std::sprintf( buf, "%u", flags );
+
+    req.push_back( protocol::CMD_COMPILE );
+    req.push_back( buf );
+    req.push_back( cwd );
+    req.push_back( fileName );
+  }
+
+  std::string status, out, diag;
+  try
+  {
+    UnixSocket sock( UnixSocket::connect( socketPath.c_str() ) );
+    sock.writeMessage( protocol::encode( req ) );
+    if (!sock.readMessage( status ) || !sock.readMessage( out ) || !sock.readMessage( diag ))
+      throw io_error( "the server closed the connection" );
+  }
+  catch (io_error & e)
+  {
+    std::cerr << "**error: " << e.what() << std::endl;
+    return 2;
+  }
+
+  std::cerr << diag;
+  std::cout << out;
+  std::cout.flush();
+  return std::atoi( status.c_str() );
+}
@@ -18,8 +18,21 @@
 #include "p1/smalls/parser/SyntaxReader.hpp"
 #include "p1/smalls/parser/SchemeParser.hpp"
 #include "p1/smalls/codegen/SimpleCodeGen.hpp"
+#include "p1/smalls/pass/Passes.hpp"
+#include "p1/smalls/driver/PipelinedCompiler.hpp"
+#include "p1/util/ThreadPool.hpp"
+#include "p1/util/FastFileOutput.hpp"
+#include "p1/util/FastGatherOutput.hpp"
+#include "p1/util/FastMMapOutput.hpp"
 #include "ListBuilder.hpp"
+#include <boost/scoped_ptr.hpp>
+#include <boost/optional.hpp>
+#include <boost/utility/in_place_factory.hpp>
 #include <iostream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
 
 using namespace p1;
 using namespace p1::smalls;
@@ -57,15 +70,166 @@ public:
 };
 
 
+static int compileStream ( Lexer & lex, SyntaxReader & dp, SymbolTable & symTab, ErrorReporter & errors,
+                           bool profileMacros, bool expansionCache, const char * astCachePath,
+                           bool pipeline, ThreadPool * cgPool )
+{
+  SchemeParser par( symTab, dp.keywords(), errors );
+  par.setMacroProfiling( profileMacros );
+  par.setExpansionCache( expansionCache );
+  AstCache * astCache = NULL;
+  if (astCachePath)
+  {
+    astCache = new AstCache();
+    astCache->load( astCachePath );
+    par.setAstCache( astCache );
+  }
+  if (pipeline)
+  {
+    PipelinedCompiler pc( lex, dp, par, errors, true );
+    pc.run( std::cout );
+    const PipelinedCompiler::Stats & st = pc.stats();
+    std::fprintf( stderr, "pipeline: %u forms, read %.3f ms, compile %.3f ms, emit %.3f ms, wall %.3f ms\n",
+                  st.forms, st.readNanos / 1e6, st.compileNanos / 1e6, st.emitNanos / 1e6,
+                  st.wallNanos / 1e6 );
+  }
+  else
+  {
+    SimpleCodeGen cg;
+    cg.setLineInfo( false );
+    cg.setThreadPool( cgPool );
+
+    cg.beginStream( std::cout, par.beginStream() );
+    Syntax * d;
+    while ((d = dp.parseDatum()) != dp.DAT_EOF)
+    {
+      AstBody * form = par.compileTopLevelForm( d );
+      std::cout << "/*\n" << *form << "\n*/\n\n";
+      cg.genStreamForm( std::cout, form );
+    }
+    par.endStream();
+    cg.endStream( std::cout );
+  }
+
+  if (astCache)
+  {
+    std::cerr << "AST cache: " << par.astCacheHits() << " hits, " << astCache->size() << " forms\n";
+    try
+    {
+      astCache->save( astCachePath );
+    }
+    catch (std::exception & e)
+    {
+      std::cerr << e.what() << std::endl;
+    }
+  }
+
+  if (profileMacros)
+    par.printMacroProfile( std::cerr );
+  return 0;
+}
+
+static void usage ()
+{
+  std::cerr << "syntax: scheme-play [options] file\n"
+               "  -profile-macros   print macro expansion statistics to stderr\n"
+               "  -expansion-cache  reuse the expansions of pure macros\n"
+               "  -stream           compile and emit each top-level form as soon as it is read\n"
+               "  -ast-cache file   reuse the unchanged top-level forms compiled before (implies -stream)\n"
+               "  -pipeline         read, compile and generate on separate threads (implies -stream)\n"
+               "  -cg-threads n     run the passes and generate the closures on n threads (0 means one per processor)\n"
+               "  -O                run the standard passes (not with -stream)\n"
+               "  -pass-stats       print the time and node counts of the passes to stderr\n"
+               "  -o file           write the C code to a file (not with -stream)\n"
+               "  -sink kind        how to write the file: fd (default), writev or mmap\n";
+}
+
+static FastOutput * openOutput ( const char * fileName, const char * sink )
+{
+  if (std::strcmp( sink, "writev" ) == 0)
+    return new FastGatherOutput( fileName );
+  else if (std::strcmp( sink, "mmap" ) == 0)
+    return new FastMMapOutput( fileName );
+  else
+    return new FastFileOutput( fileName );
+}
+
 int main ( int argc, const char ** argv )
 {
-  const char * fileName = argv[1];
+  GC_INIT();
+
+  const char * fileName = NULL;
+  bool profileMacros = false;
+  bool expansionCache = false;
+  bool stream = false;
+  bool pipeline = false;
+  const char * astCachePath = NULL;
+  int cgThreads = -1;
+  const char * outFile = NULL;
+  const char * sink = "fd";
+  bool optimize = false;
+  bool passStats = false;
+
+  for ( int i = 1; i < argc; ++i )
+  {
+    if (std::strcmp( argv[i], "-profile-macros" ) == 0)
+      profileMacros = true;
+    else if (std::strcmp( argv[i], "-expansion-cache" ) == 0)
+      expansionCache = true;
+    else if (std::strcmp( argv[i], "-stream" ) == 0)
+      stream = true;
+    else if (std::strcmp( argv[i], "-pipeline" ) == 0)
+      pipeline = stream = true;
+    else if (std::strcmp( argv[i], "-ast-cache" ) == 0 && i + 1 < argc)
+    {
+      astCachePath = argv[++i];
+      stream = true;
+    }
+    else if (std::strcmp( argv[i], "-cg-threads" ) == 0 && i + 1 < argc)
+    {
+      cgThreads = std::atoi( argv[++i] );
+      if (cgThreads < 0)
+      {
+        usage();
+        return 1;
+      }
+    }
+    else if (std::strcmp( argv[i], "-o" ) == 0 && i + 1 < argc)
+      outFile = argv[++i];
+    else if (std::strcmp( argv[i], "-sink" ) == 0 && i + 1 < argc)
+      sink = argv[++i];
+    else if (std::strcmp( argv[i], "-O" ) == 0)
+      optimize = true;
+    else if (std::strcmp( argv[i], "-pass-stats" ) == 0)
+      passStats = true;
+    else if (argv[i][0] == '-' || fileName)
+    {
+      usage();
+      return 1;
+    }
+    else
+      fileName = argv[i];
+  }
+  if (!fileName || ((outFile || optimize) && stream))
+  {
+    usage();
+    return 1;
+  }
+
+  // On the stack, so the collector scans it while the workers run
+  boost::optional<ThreadPool> cgPool;
+  if (cgThreads >= 0)
+    cgPool = boost::in_place( (unsigned)cgThreads );
 
   SymbolTable symTab;
   ErrorReporter errors;
   FastStdioInput fi(fileName,"rb");
   Lexer lex( fi, fileName, symTab, errors );
-  SyntaxReader dp( lex, Keywords(lex.symbolTable()) );
+  Keywords kw( lex.symbolTable() );
+  SyntaxReader dp( lex, kw );
+
+  if (stream)
+    return compileStream( lex, dp, symTab, errors, profileMacros, expansionCache, astCachePath, pipeline, cgPool.get_ptr() );
 
   ListBuilder lb;
   Syntax * d;
@@ -82,12 +246,40 @@ int main ( int argc, const char ** argv )
   }
 
   SchemeParser par( symTab, dp.keywords(), errors );
+  par.setMacroProfiling( profileMacros );
+  par.setExpansionCache( expansionCache );
   AstModule * mod = par.compileLibraryBody( body );
-  if (true)
-    std::cout << "/*\n" << *mod << "\n*/\n\n";
+  if (profileMacros)
+    par.printMacroProfile( std::cerr );
+
+  if (optimize)
+  {
+    PassManager pm;
+    pm.setThreadPool( cgPool.get_ptr() );
+    pm.setNodeCounting( passStats );
+    addStandardPasses( pm );
+    pm.run( mod );
+    if (passStats)
+      pm.printStats( std::cerr );
+  }
 
   SimpleCodeGen cg;
   cg.setLineInfo( false );
+  cg.setThreadPool( cgPool.get_ptr() );
+
+  if (outFile)
+  {
+    boost::scoped_ptr<FastOutput> out( openOutput( outFile, sink ) );
+    std::stringstream ast;
+    ast << "/*\n" << *mod << "\n*/\n\n";
+    *out << ast.str();
+    cg.generate( *out, mod );
+    out->close();
+    return 0;
+  }
+
+  if (true)
+    std::cout << "/*\n" << *mod << "\n*/\n\n";
   cg.generate( std::cout, mod );
 
   return 0;
@@ -0,0 +1,71 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "p1/smalls/driver/CompileServer.hpp"
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+
+using namespace p1;
+using namespace p1::smalls;
+
+/*
+ * Serve compile requests from "scheme-client" until it asks for a shutdown.
+ */
+
+static void usage ()
+{
+  std::cerr << "syntax: scheme-server [options]\n"
+               "  -socket path      listen on path instead of $SMALLS_SOCKET or /tmp/smalls-<uid>.sock\n"
+               "  -expansion-cache  reuse the expansions of pure macros\n";
+}
+
+int main ( int argc, const char ** argv )
+{
+  GC_INIT();
+
+  std::string socketPath = protocol::defaultSocketPath();
+  bool expansionCache = false;
+
+  for ( int i = 1; i < argc; ++i )
+  {
+    if (std::strcmp( argv[i], "-socket" ) == 0 && i + 1 < argc)
+      socketPath = argv[++i];
+    else if (std::strcmp( argv[i], "-expansion-cache" ) == 0)
+      expansionCache = true;
+    else
+    {
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  CompileServer * server = new CompileServer();
+  server->setExpansionCache( expansionCache );
+  try
+  {
+    server->serve( socketPath.c_str() );
+  }
+  catch (std::exception & e)
+  {
+    std::cerr << "**error: " << e.what() << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  std::cerr << server->stats().requests << " requests, "
+            << server->stats().sourceHits << " unchanged sources\n";
+  return EXIT_SUCCESS;
+}
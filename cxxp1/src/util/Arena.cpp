@@ -0,0 +1,70 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "Arena.hpp"
+#include <cstdlib>
+#include <new>
+
+namespace p1 {
+
+Arena::Arena ( size_t blockSize )
+  : m_blockSize( blockSize )
+{
+  m_blocks = NULL;
+  m_cur = m_end = NULL;
+  m_allocated = 0;
+}
+
+void Arena::clear ()
+{
+  for ( Block * b = m_blocks, * next; b; b = next )
+  {
+    next = b->next;
+    std::free( b );
+  }
+  m_blocks = NULL;
+  m_cur = m_end = NULL;
+  m_allocated = 0;
+}
+
+void * Arena::allocSlow ( size_t size )
+{
+  size_t const header = (sizeof(Block) + ALIGN - 1) & ~(size_t)(ALIGN - 1);
+  // Large requests get a block of their own, so the rest of the current one isn't wasted
+  bool const own = size > m_blockSize / 4;
+  size_t const blockSize = header + (own ? size : m_blockSize);
+
+  Block * b = static_cast<Block *>(std::malloc( blockSize ));
+  if (!b)
+    throw std::bad_alloc();
+  m_allocated += blockSize;
+
+  char * const mem = reinterpret_cast<char *>(b) + header;
+  if (own && m_blocks)
+  {
+    b->next = m_blocks->next;
+    m_blocks->next = b;
+    return mem;
+  }
+
+  b->next = m_blocks;
+  m_blocks = b;
+  m_cur = mem + size;
+  m_end = mem + (own ? size : m_blockSize);
+  return mem;
+}
+
+} // namespaces
@@ -0,0 +1,100 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "CodeBuffer.hpp"
+#include <iostream>
+
+namespace p1 {
+
+const char * concatDecimal ( Arena & arena, const char * prefix, unsigned long long n )
+{
+  char buf[24];
+  char * const end = buf + sizeof(buf);
+  char * const digits = formatDecimal( end, n );
+  size_t const plen = std::strlen( prefix );
+  size_t const dlen = end - digits;
+
+  char * res = static_cast<char *>(arena.alloc( plen + dlen + 1 ));
+  std::memcpy( res, prefix, plen );
+  std::memcpy( res + plen, digits, dlen );
+  res[plen + dlen] = 0;
+  return res;
+}
+
+CodeBuffer & CodeBuffer::operator<< ( long long v )
+{
+  if (v >= 0)
+    return *this << (unsigned long long)v;
+  *this << '-';
+  return *this << (unsigned long long)-(v + 1) + 1;
+}
+
+CodeBuffer & CodeBuffer::operator<< ( const CodeBuffer & buf )
+{
+  for ( const Segment * seg = buf.m_first; seg; seg = seg->next )
+    append( seg->data(), seg->size );
+  return *this;
+}
+
+CodeBuffer & CodeBuffer::appendSlow ( const char * s, size_t len )
+{
+  // Fill the rest of the last segment first
+  if (m_last)
+  {
+    size_t const part = m_last->capacity - m_last->size;
+    std::memcpy( m_last->data() + m_last->size, s, part );
+    m_last->size += part;
+    m_size += part;
+    s += part;
+    len -= part;
+  }
+
+  size_t const capacity = len > SEGMENT_SIZE ? len : SEGMENT_SIZE;
+  Segment * seg = static_cast<Segment *>(m_arena.alloc( sizeof(Segment) + capacity ));
+  seg->next = NULL;
+  seg->size = len;
+  seg->capacity = capacity;
+  std::memcpy( seg->data(), s, len );
+
+  if (m_last)
+    m_last->next = seg;
+  else
+    m_first = seg;
+  m_last = seg;
+  m_size += len;
+  return *this;
+}
+
+const char * CodeBuffer::str () const
+{
+  char * res = static_cast<char *>(m_arena.alloc( m_size + 1 ));
+  char * p = res;
+  for ( const Segment * seg = m_first; seg; seg = seg->next )
+  {
+    std::memcpy( p, seg->data(), seg->size );
+    p += seg->size;
+  }
+  *p = 0;
+  return res;
+}
+
+void CodeBuffer::writeTo ( std::ostream & os ) const
+{
+  for ( const Segment * seg = m_first; seg; seg = seg->next )
+    os.write( seg->data(), seg->size );
+}
+
+} // namespaces
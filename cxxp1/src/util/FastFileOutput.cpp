@@ -0,0 +1,107 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "FastFileOutput.hpp"
+#include "format-str.hpp"
+#include <cerrno>
+#include <unistd.h>
+
+using namespace p1;
+
+FastFileOutput::FastFileOutput ( int handle, size_t bufSize )
+  : BufferedOutput<FastOutput>( bufSize ),
+    m_handle( handle ), m_own( false )
+{
+}
+
+FastFileOutput::FastFileOutput ( const char * fileName, int oflags, size_t bufSize )
+  : BufferedOutput<FastOutput>( bufSize ),
+    m_handle( -1 ), m_own( true )
+{
+  if ( (m_handle = ::open( fileName, oflags, 0666 )) == -1 )
+    throw io_error(formatStr("open %s errno=%d", fileName, errno));
+}
+
+FastFileOutput::~FastFileOutput ()
+{
+  try
+  {
+    close();
+  }
+  catch (...)
+  {
+  }
+}
+
+void FastFileOutput::close ()
+{
+  if (m_handle == -1)
+    return;
+  flush();
+  if (m_own)
+  {
+    int const handle = m_handle;
+    m_handle = -1;
+    if (::close( handle ) == -1)
+      throw io_error( formatStr("close errno=%d", errno) );
+  }
+  else
+    m_handle = -1;
+}
+
+void FastFileOutput::writeAll ( int handle, const char * s, size_t len )
+{
+  while (len)
+  {
+    ssize_t res = ::write( handle, s, len );
+    if (res == -1)
+    {
+      if (errno != EINTR)
+        throw io_error( formatStr("write errno=%d", errno) );
+    }
+    else
+    {
+      s += res;
+      len -= res;
+    }
+  }
+}
+
+void FastFileOutput::drain ()
+{
+  size_t const len = m_head - m_buf;
+  m_head = m_buf;
+  m_bufOffset += len;
+  writeAll( m_handle, m_buf, len );
+}
+
+void FastFileOutput::slowWrite ( const char * s, size_t len )
+{
+  if (len < m_bufSize)
+    FastOutput::slowWrite( s, len );
+  else
+  {
+    drain();
+    m_bufOffset += len;
+    writeAll( m_handle, s, len );
+  }
+}
+
+void FastFileOutput::flush ()
+{
+  drain();
+  ++m_flushCount;
+}
@@ -0,0 +1,150 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "FastGatherOutput.hpp"
+#include "format-str.hpp"
+#include <cerrno>
+#include <climits>
+#include <unistd.h>
+
+using namespace p1;
+
+#ifdef IOV_MAX
+static const size_t IOV_LIMIT = IOV_MAX < 1024 ? IOV_MAX : 1024;
+#else
+static const size_t IOV_LIMIT = 16;
+#endif
+
+FastGatherOutput::FastGatherOutput ( int handle, size_t bufSize )
+  : BufferedOutput<FastOutput>( bufSize ),
+    m_handle( handle ), m_own( false )
+{
+  init();
+}
+
+FastGatherOutput::FastGatherOutput ( const char * fileName, int oflags, size_t bufSize )
+  : BufferedOutput<FastOutput>( bufSize ),
+    m_handle( -1 ), m_own( true )
+{
+  init();
+  if ( (m_handle = ::open( fileName, oflags, 0666 )) == -1 )
+    throw io_error(formatStr("open %s errno=%d", fileName, errno));
+}
+
+void FastGatherOutput::init ()
+{
+  m_iov.reserve( IOV_LIMIT );
+  m_sliceStart = m_buf;
+}
+
+FastGatherOutput::~FastGatherOutput ()
+{
+  try
+  {
+    close();
+  }
+  catch (...)
+  {
+  }
+}
+
+void FastGatherOutput::close ()
+{
+  if (m_handle == -1)
+    return;
+  flush();
+  if (m_own)
+  {
+    int const handle = m_handle;
+    m_handle = -1;
+    if (::close( handle ) == -1)
+      throw io_error( formatStr("close errno=%d", errno) );
+  }
+  else
+    m_handle = -1;
+}
+
+void FastGatherOutput::closeSlice ()
+{
+  if (m_head != m_sliceStart)
+  {
+    struct iovec v;
+    v.iov_base = m_sliceStart;
+    v.iov_len = m_head - m_sliceStart;
+    m_iov.push_back( v );
+    m_sliceStart = m_head;
+  }
+}
+
+void FastGatherOutput::writeRef ( const char * s, size_t len )
+{
+  if (len < MIN_REF)
+  {
+    write( s, len );
+    return;
+  }
+
+  // Leave room for the slice after the block
+  if (m_iov.size() + 3 > IOV_LIMIT)
+    flush();
+  closeSlice();
+  struct iovec v;
+  v.iov_base = const_cast<char *>(s);
+  v.iov_len = len;
+  m_iov.push_back( v );
+  m_bufOffset += len;
+}
+
+void FastGatherOutput::drain ()
+{
+  flush();
+}
+
+void FastGatherOutput::flush ()
+{
+  closeSlice();
+
+  struct iovec * iov = m_iov.empty() ? NULL : &m_iov[0];
+  size_t count = m_iov.size();
+  while (count)
+  {
+    ssize_t res = ::writev( m_handle, iov, (int)count );
+    if (res == -1)
+    {
+      if (errno != EINTR)
+        throw io_error( formatStr("writev errno=%d", errno) );
+      continue;
+    }
+    // Skip what was written
+    size_t done = res;
+    while (count && done >= iov->iov_len)
+    {
+      done -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (count)
+    {
+      iov->iov_base = (char *)iov->iov_base + done;
+      iov->iov_len -= done;
+    }
+  }
+
+  m_iov.clear();
+  m_bufOffset += m_head - m_buf;
+  m_head = m_sliceStart = m_buf;
+  ++m_flushCount;
+}
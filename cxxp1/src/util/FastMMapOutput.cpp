@@ -0,0 +1,117 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "FastMMapOutput.hpp"
+#include "format-str.hpp"
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace p1;
+
+static size_t roundToPage ( size_t size )
+{
+  size_t const page = ::sysconf( _SC_PAGESIZE );
+  return size ? (size + page - 1) / page * page : page;
+}
+
+FastMMapOutput::FastMMapOutput ( const char * fileName, size_t window )
+  : FastOutput( NULL, 0 ),
+    m_handle( -1 ), m_window( roundToPage( window ) ), m_map( MAP_FAILED )
+{
+  if ( (m_handle = ::open( fileName, O_RDWR | O_CREAT | O_TRUNC, 0666 )) == -1)
+    throw io_error(formatStr("open %s errno=%d", fileName, errno));
+  try
+  {
+    map( 0 );
+  }
+  catch (...)
+  {
+    ::close( m_handle );
+    m_handle = -1;
+    throw;
+  }
+}
+
+FastMMapOutput::~FastMMapOutput ()
+{
+  try
+  {
+    close();
+  }
+  catch (...)
+  {
+  }
+}
+
+void FastMMapOutput::map ( off_t offset )
+{
+  if (::ftruncate( m_handle, offset + m_window ) == -1)
+    throw io_error(formatStr("ftruncate errno=%d", errno));
+  if ( (m_map = ::mmap( NULL, m_window, PROT_READ | PROT_WRITE, MAP_SHARED, m_handle, offset )) == MAP_FAILED)
+    throw io_error(formatStr("mmap errno=%d", errno));
+  ::madvise( m_map, m_window, MADV_SEQUENTIAL );
+
+  m_buf = m_head = static_cast<char *>(m_map);
+  m_end = m_buf + m_window;
+  m_bufOffset = offset;
+}
+
+void FastMMapOutput::unmap ()
+{
+  if (m_map != MAP_FAILED)
+  {
+    ::munmap( m_map, m_window );
+    m_map = MAP_FAILED;
+  }
+}
+
+void FastMMapOutput::drain ()
+{
+  off_t const next = m_bufOffset + m_window;
+  unmap();
+  map( next );
+}
+
+void FastMMapOutput::flush ()
+{
+  ++m_flushCount;
+}
+
+void FastMMapOutput::close ()
+{
+  if (m_handle == -1)
+    return;
+
+  off_t const length = offset();
+  unmap();
+  m_buf = m_head = m_end = NULL;
+  m_bufOffset = length;
+
+  int const handle = m_handle;
+  m_handle = -1;
+  if (::ftruncate( handle, length ) == -1)
+  {
+    int const err = errno;
+    ::close( handle );
+    throw io_error(formatStr("ftruncate errno=%d", err));
+  }
+  if (::close( handle ) == -1)
+    throw io_error(formatStr("close errno=%d", errno));
+}
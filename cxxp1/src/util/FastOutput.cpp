@@ -0,0 +1,70 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "FastOutput.hpp"
+#include <iostream>
+#include <algorithm>
+
+using namespace p1;
+
+FastOutput & FastOutput::operator<< ( long long v )
+{
+  if (v >= 0)
+    return *this << (unsigned long long)v;
+  put( '-' );
+  return *this << (unsigned long long)-(v + 1) + 1;
+}
+
+FastOutput & FastOutput::operator<< ( const CodeBuffer & buf )
+{
+  for ( const CodeBuffer::Segment * seg = buf.segments(); seg; seg = seg->next )
+    write( seg->data(), seg->size );
+  return *this;
+}
+
+void FastOutput::slowWrite ( const char * s, size_t len )
+{
+  for(;;)
+  {
+    size_t n = std::min( (size_t)(m_end - m_head), len );
+    std::memcpy( m_head, s, n );
+    m_head += n;
+    s += n;
+    len -= n;
+    if (!len)
+      break;
+    drain();
+  }
+}
+
+OStreamOutput::OStreamOutput ( std::ostream & os, size_t bufSize )
+  : BufferedOutput<FastOutput>( bufSize ), m_os( os )
+{}
+
+void OStreamOutput::drain ()
+{
+  size_t const len = m_head - m_buf;
+  if (!m_os.write( m_buf, len ))
+    throw io_error( "ostream write failed" );
+  m_bufOffset += len;
+  m_head = m_buf;
+}
+
+void OStreamOutput::flush ()
+{
+  drain();
+  ++m_flushCount;
+}
@@ -0,0 +1,251 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "ThreadPool.hpp"
+#include "format-str.hpp"
+#include <deque>
+#include <stdexcept>
+#include <cassert>
+#include <unistd.h>
+
+using namespace p1;
+
+static inline unsigned atomicLoad ( volatile unsigned & x )
+{
+  return __sync_fetch_and_add( &x, 0 );
+}
+
+struct ThreadPool::Worker : public gc
+{
+  ThreadPool * pool;
+  unsigned index;
+  pthread_t thread;
+
+  pthread_mutex_t lock; //< protects the deque
+  std::deque<Task *, gc_allocator<Task *> > tasks;
+
+  unsigned long executed, stolen;
+
+  Worker ( ThreadPool * pool_, unsigned index_ )
+    : pool( pool_ ), index( index_ ), executed( 0 ), stolen( 0 )
+  {
+    pthread_mutex_init( &lock, NULL );
+  }
+
+  ~Worker ()
+  {
+    pthread_mutex_destroy( &lock );
+  }
+
+  void push ( Task * task )
+  {
+    pthread_mutex_lock( &lock );
+    tasks.push_back( task );
+    pthread_mutex_unlock( &lock );
+  }
+
+  Task * popBack ()
+  {
+    Task * res = NULL;
+    pthread_mutex_lock( &lock );
+    if (!tasks.empty())
+    {
+      res = tasks.back();
+      tasks.pop_back();
+    }
+    pthread_mutex_unlock( &lock );
+    return res;
+  }
+
+  Task * popFront ()
+  {
+    Task * res = NULL;
+    pthread_mutex_lock( &lock );
+    if (!tasks.empty())
+    {
+      res = tasks.front();
+      tasks.pop_front();
+    }
+    pthread_mutex_unlock( &lock );
+    return res;
+  }
+};
+
+unsigned ThreadPool::processorCount ()
+{
+  long n = ::sysconf( _SC_NPROCESSORS_ONLN );
+  return n > 0 ? (unsigned)n : 1;
+}
+
+ThreadPool::ThreadPool ( unsigned threads )
+{
+  if (!threads)
+    threads = processorCount();
+
+  m_stop = false;
+  m_queued = 0;
+  m_pending = 0;
+  m_next = 0;
+  pthread_key_create( &m_self, NULL );
+  pthread_mutex_init( &m_lock, NULL );
+  pthread_cond_init( &m_workAvailable, NULL );
+  pthread_cond_init( &m_allDone, NULL );
+
+  // All workers must exist before any of them starts stealing
+  for ( unsigned i = 0; i != threads; ++i )
+    m_workers.push_back( new (NoGC) Worker( this, i ) );
+
+  for ( unsigned i = 0; i != threads; ++i )
+  {
+    // With GC_THREADS, gc.h redirects this to GC_pthread_create()
+    int err = pthread_create( &m_workers[i]->thread, NULL, threadMain, m_workers[i] );
+    if (err)
+    {
+      // Stop the ones which were started. The rest are uncollectable
+      for ( unsigned j = i; j != threads; ++j )
+        delete m_workers[j];
+      m_workers.resize( i );
+      shutdown();
+      throw std::runtime_error( formatStr( "pthread_create error=%d", err ) );
+    }
+  }
+}
+
+ThreadPool::~ThreadPool ()
+{
+  wait();
+  shutdown();
+}
+
+void ThreadPool::shutdown ()
+{
+  pthread_mutex_lock( &m_lock );
+  m_stop = true;
+  pthread_cond_broadcast( &m_workAvailable );
+  pthread_mutex_unlock( &m_lock );
+
+  // The ones still running may be stealing from the others
+  for ( WorkerList::iterator it = m_workers.begin(); it != m_workers.end(); ++it )
+    pthread_join( (*it)->thread, NULL );
+  for ( WorkerList::iterator it = m_workers.begin(); it != m_workers.end(); ++it )
+    delete *it;
+  m_workers.clear();
+
+  pthread_cond_destroy( &m_allDone );
+  pthread_cond_destroy( &m_workAvailable );
+  pthread_mutex_destroy( &m_lock );
+  pthread_key_delete( m_self );
+}
+
+int ThreadPool::currentWorker () const
+{
+  Worker * w = (Worker *)pthread_getspecific( m_self );
+  return w ? (int)w->index : -1;
+}
+
+void ThreadPool::submit ( Task * task )
+{
+  __sync_fetch_and_add( &m_pending, 1 );
+
+  Worker * w = (Worker *)pthread_getspecific( m_self );
+  if (!w)
+    w = m_workers[__sync_fetch_and_add( &m_next, 1 ) % m_workers.size()];
+  // Counted first, so it never goes below the number of tasks in the deques
+  __sync_fetch_and_add( &m_queued, 1 );
+  w->push( task );
+
+  // Taking the lock orders this with a worker which has just checked m_queued and is going to sleep
+  pthread_mutex_lock( &m_lock );
+  pthread_cond_signal( &m_workAvailable );
+  pthread_mutex_unlock( &m_lock );
+}
+
+void ThreadPool::wait ()
+{
+  assert( currentWorker() < 0 && "ThreadPool::wait() called from a worker" );
+
+  pthread_mutex_lock( &m_lock );
+  while (atomicLoad( m_pending ))
+    pthread_cond_wait( &m_allDone, &m_lock );
+  pthread_mutex_unlock( &m_lock );
+}
+
+ThreadPool::Stats ThreadPool::stats () const
+{
+  Stats res;
+  res.executed = res.stolen = 0;
+  for ( WorkerList::const_iterator it = m_workers.begin(); it != m_workers.end(); ++it )
+  {
+    res.executed += (*it)->executed;
+    res.stolen += (*it)->stolen;
+  }
+  return res;
+}
+
+void * ThreadPool::threadMain ( void * arg )
+{
+  Worker * self = (Worker *)arg;
+  pthread_setspecific( self->pool->m_self, self );
+  self->pool->workerLoop( self );
+  return NULL;
+}
+
+/**
+ * Take a task from the back of our own deque, or steal one from the front of another.
+ */
+ThreadPool::Task * ThreadPool::take ( Worker * self )
+{
+  Task * task = self->popBack();
+  if (!task)
+  {
+    unsigned const n = m_workers.size();
+    for ( unsigned i = 1; i != n && !task; ++i )
+      task = m_workers[(self->index + i) % n]->popFront();
+    if (task)
+      ++self->stolen;
+  }
+  if (task)
+    __sync_fetch_and_sub( &m_queued, 1 );
+  return task;
+}
+
+void ThreadPool::workerLoop ( Worker * self )
+{
+  for(;;)
+  {
+    if (Task * task = take( self ))
+    {
+      task->run();
+      ++self->executed;
+
+      if (__sync_sub_and_fetch( &m_pending, 1 ) == 0)
+      {
+        pthread_mutex_lock( &m_lock );
+        pthread_cond_broadcast( &m_allDone );
+        pthread_mutex_unlock( &m_lock );
+      }
+      continue;
+    }
+
+    pthread_mutex_lock( &m_lock );
+    while (!atomicLoad( m_queued ) && !m_stop)
+      pthread_cond_wait( &m_workAvailable, &m_lock );
+    bool const stop = m_stop && !atomicLoad( m_queued );
+    pthread_mutex_unlock( &m_lock );
+    if (stop)
+      return;
+  }
+}
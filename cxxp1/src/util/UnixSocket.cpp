@@ -0,0 +1,179 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "UnixSocket.hpp"
+#include "format-str.hpp"
+#include <cerrno>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+using namespace p1;
+
+static void makeAddress ( struct sockaddr_un & addr, const char * path )
+{
+  std::memset( &addr, 0, sizeof(addr) );
+  addr.sun_family = AF_UNIX;
+  if (std::strlen( path ) >= sizeof(addr.sun_path))
+    throw io_error(formatStr("socket path too long: %s", path));
+  std::strcpy( addr.sun_path, path );
+}
+
+UnixSocket::~UnixSocket ()
+{
+  if (m_fd != -1)
+    ::close( m_fd );
+}
+
+int UnixSocket::listen ( const char * path )
+{
+  struct sockaddr_un addr;
+  makeAddress( addr, path );
+
+  struct stat st;
+  if (::lstat( path, &st ) == 0 && S_ISSOCK(st.st_mode))
+  {
+    int probe = -1;
+    try
+    {
+      probe = connect( path );
+    }
+    catch (io_error &)
+    {
+      ::unlink( path ); // nobody is listening
+    }
+    if (probe != -1)
+    {
+      ::close( probe );
+      throw io_error(formatStr("%s is in use", path));
+    }
+  }
+
+  int fd;
+  if ((fd = ::socket( AF_UNIX, SOCK_STREAM, 0 )) == -1)
+    throw io_error(formatStr("socket errno=%d", errno));
+  if (::bind( fd, (struct sockaddr *)&addr, sizeof(addr) ) || ::listen( fd, 64 ))
+  {
+    int err = errno;
+    ::close( fd );
+    throw io_error(formatStr("listen %s errno=%d", path, err));
+  }
+  return fd;
+}
+
+int UnixSocket::connect ( const char * path )
+{
+  struct sockaddr_un addr;
+  makeAddress( addr, path );
+
+  int fd;
+  if ((fd = ::socket( AF_UNIX, SOCK_STREAM, 0 )) == -1)
+    throw io_error(formatStr("socket errno=%d", errno));
+  if (::connect( fd, (struct sockaddr *)&addr, sizeof(addr) ))
+  {
+    int err = errno;
+    ::close( fd );
+    throw io_error(formatStr("connect %s errno=%d", path, err));
+  }
+  return fd;
+}
+
+int UnixSocket::accept ()
+{
+  for(;;)
+  {
+    int fd = ::accept( m_fd, NULL, NULL );
+    if (fd != -1)
+      return fd;
+    if (errno != EINTR && errno != ECONNABORTED)
+      throw io_error(formatStr("accept errno=%d", errno));
+  }
+}
+
+void UnixSocket::writeMessage ( const std::string & msg )
+{
+  uint32_t len = msg.size();
+  unsigned char hdr[4] = { (unsigned char)len, (unsigned char)(len >> 8),
+                           (unsigned char)(len >> 16), (unsigned char)(len >> 24) };
+  writeAll( hdr, sizeof(hdr) );
+  writeAll( msg.data(), len );
+}
+
+bool UnixSocket::readMessage ( std::string & msg )
+{
+  unsigned char hdr[4];
+  if (!readAll( hdr, sizeof(hdr) ))
+    return false;
+  uint32_t len = hdr[0] | (hdr[1] << 8) | (hdr[2] << 16) | ((uint32_t)hdr[3] << 24);
+  if (len > MAX_MESSAGE)
+    throw io_error(formatStr("message too long: %u", (unsigned)len));
+
+  msg.resize( len );
+  if (len && !readAll( &msg[0], len ))
+    throw io_error("unexpected end of message");
+  return true;
+}
+
+void UnixSocket::writeAll ( const void * buf, size_t len )
+{
+  const char * p = (const char *)buf;
+  while (len)
+  {
+    // A client which went away must not kill the server with SIGPIPE
+    ssize_t n = ::send( m_fd, p, len, MSG_NOSIGNAL );
+    if (n == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      throw io_error(formatStr("send errno=%d", errno));
+    }
+    p += n;
+    len -= n;
+  }
+}
+
+/**
+ * @return false on end of stream before the first byte
+ */
+bool UnixSocket::readAll ( void * buf, size_t len )
+{
+  char * p = (char *)buf;
+  size_t done = 0;
+  while (done < len)
+  {
+    ssize_t n = ::recv( m_fd, p + done, len - done, 0 );
+    if (n == -1)
+    {
+      if (errno == EINTR)
+        continue;
+      throw io_error(formatStr("recv errno=%d", errno));
+    }
+    if (n == 0)
+    {
+      if (done == 0)
+        return false;
+      throw io_error("unexpected end of stream");
+    }
+    done += n;
+  }
+  return true;
+}
@@ -0,0 +1,100 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestCodeBuffer.hpp"
+#include "p1/util/CodeBuffer.hpp"
+#include <sstream>
+#include <climits>
+
+using namespace p1;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestCodeBuffer );
+
+TestCodeBuffer::TestCodeBuffer ( )
+{
+}
+
+TestCodeBuffer::~TestCodeBuffer ( )
+{
+}
+
+void TestCodeBuffer::setUp ( )
+{
+}
+
+void TestCodeBuffer::tearDown ( )
+{
+}
+
+void TestCodeBuffer::testArena ( )
+{
+  Arena arena( 256 );
+  CPPUNIT_ASSERT_EQUAL( (size_t)0, arena.allocated() );
+
+  char * a = static_cast<char *>(arena.alloc( 10 ));
+  char * b = static_cast<char *>(arena.alloc( 10 ));
+  CPPUNIT_ASSERT( b >= a + 10 );
+  CPPUNIT_ASSERT( ((size_t)b & (sizeof(void *) - 1)) == 0 );
+  size_t const oneBlock = arena.allocated();
+
+  // A large request doesn't replace the current block
+  arena.alloc( 1000 );
+  char * c = static_cast<char *>(arena.alloc( 10 ));
+  CPPUNIT_ASSERT( c > b && c < a + 256 );
+  CPPUNIT_ASSERT( arena.allocated() > oneBlock + 1000 );
+
+  CPPUNIT_ASSERT( std::strcmp( arena.copy( "abcdef", 3 ), "abc" ) == 0 );
+  CPPUNIT_ASSERT( std::strcmp( concatDecimal( arena, "tmp_", 0 ), "tmp_0" ) == 0 );
+  CPPUNIT_ASSERT( std::strcmp( concatDecimal( arena, "lab_", 4096 ), "lab_4096" ) == 0 );
+
+  arena.clear();
+  CPPUNIT_ASSERT_EQUAL( (size_t)0, arena.allocated() );
+}
+
+void TestCodeBuffer::testAppend ( )
+{
+  Arena arena;
+  CodeBuffer buf( arena );
+  CPPUNIT_ASSERT( buf.empty() );
+
+  buf << "x = " << 0 << ", " << -17 << ", " << 4000000000u << ", " << LLONG_MIN << ", " << true << '\n';
+  std::string expected = "x = 0, -17, 4000000000, -9223372036854775808, 1\n";
+  CPPUNIT_ASSERT( std::string( buf.str() ) == expected );
+
+  // Span many segments
+  std::ostringstream numbers;
+  for ( unsigned i = 0; i < 1000; ++i )
+  {
+    buf << i << ' ';
+    numbers << i << ' ';
+  }
+  std::string big( 5000, 'a' );
+  buf << big;
+  expected += numbers.str() + big;
+  CPPUNIT_ASSERT_EQUAL( expected.size(), buf.size() );
+
+  std::ostringstream os;
+  os << buf;
+  CPPUNIT_ASSERT( os.str() == expected );
+
+  CodeBuffer copy( arena );
+  copy << buf;
+  CPPUNIT_ASSERT( std::string( copy.str() ) == expected );
+
+  buf.clear();
+  CPPUNIT_ASSERT( buf.empty() );
+  CPPUNIT_ASSERT( std::string( buf.str() ).empty() );
+}
@@ -0,0 +1,125 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestFastOutput.hpp"
+#include "p1/util/FastFileOutput.hpp"
+#include "p1/util/FastGatherOutput.hpp"
+#include "p1/util/FastMMapOutput.hpp"
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+using namespace p1;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestFastOutput );
+
+TestFastOutput::TestFastOutput ( )
+{
+}
+
+TestFastOutput::~TestFastOutput ( )
+{
+}
+
+void TestFastOutput::setUp ( )
+{
+  char name[] = "/tmp/testfastoutput.XXXXXX";
+  int fd = mkstemp( name );
+  CPPUNIT_ASSERT( fd >= 0 );
+  ::close( fd );
+  m_fileName = name;
+}
+
+void TestFastOutput::tearDown ( )
+{
+  std::remove( m_fileName.c_str() );
+}
+
+/**
+ * Write a mix of small pieces, numbers, blocks larger than any buffer and references to
+ * the sink. Return what it should have produced.
+ */
+std::string TestFastOutput::writeSample ( FastOutput & out )
+{
+  std::ostringstream expected;
+
+  for ( int i = 0; i < 5000; ++i )
+  {
+    out << "line " << i << ' ' << -i << '\n';
+    expected << "line " << i << ' ' << -i << '\n';
+  }
+
+  std::string big( 300000, 'x' );
+  out << big;
+  expected << big;
+
+  Arena arena;
+  CodeBuffer buf( arena );
+  for ( unsigned i = 0; i < 2000; ++i )
+    buf << "ref " << i << '\n';
+  out.writeRefs( buf );
+  expected << buf;
+
+  out << "tail\n";
+  expected << "tail\n";
+
+  CPPUNIT_ASSERT_EQUAL( (off_t)expected.str().size(), out.offset() );
+  out.close();
+  return expected.str();
+}
+
+std::string TestFastOutput::readFile ( )
+{
+  std::ifstream in( m_fileName.c_str(), std::ios::in | std::ios::binary );
+  std::ostringstream res;
+  res << in.rdbuf();
+  return res.str();
+}
+
+void TestFastOutput::testFile ( )
+{
+  FastFileOutput out( m_fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 4096 );
+  std::string expected = writeSample( out );
+  CPPUNIT_ASSERT( readFile() == expected );
+}
+
+void TestFastOutput::testGather ( )
+{
+  FastGatherOutput out( m_fileName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 4096 );
+  CPPUNIT_ASSERT( out.keepsRefs() );
+  unsigned long before = out.flushCount();
+  std::string expected = writeSample( out );
+  CPPUNIT_ASSERT( out.flushCount() != before );
+  CPPUNIT_ASSERT( readFile() == expected );
+}
+
+void TestFastOutput::testMMap ( )
+{
+  // A window of one page, so the file is remapped many times
+  FastMMapOutput out( m_fileName.c_str(), 1 );
+  std::string expected = writeSample( out );
+  CPPUNIT_ASSERT( readFile() == expected );
+}
+
+void TestFastOutput::testOStream ( )
+{
+  std::ostringstream os;
+  OStreamOutput out( os, 256 );
+  std::string expected = writeSample( out );
+  CPPUNIT_ASSERT( os.str() == expected );
+}
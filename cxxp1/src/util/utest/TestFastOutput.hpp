@@ -0,0 +1,53 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#ifndef TESTFASTOUTPUT_HPP
+#define	TESTFASTOUTPUT_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+#include <string>
+
+namespace p1 {
+  class FastOutput;
+}
+
+class TestFastOutput : public CPPUNIT_NS::TestFixture {
+  CPPUNIT_TEST_SUITE(TestFastOutput);
+  CPPUNIT_TEST(testFile);
+  CPPUNIT_TEST(testGather);
+  CPPUNIT_TEST(testMMap);
+  CPPUNIT_TEST(testOStream);
+  CPPUNIT_TEST_SUITE_END();
+
+public:
+  TestFastOutput();
+  virtual ~TestFastOutput();
+  void setUp();
+  void tearDown();
+
+private:
+  std::string m_fileName;
+
+  std::string writeSample ( p1::FastOutput & out );
+  std::string readFile ();
+
+  void testFile();
+  void testGather();
+  void testMMap();
+  void testOStream();
+};
+
+#endif	/* TESTFASTOUTPUT_HPP */
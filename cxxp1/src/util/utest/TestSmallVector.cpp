@@ -0,0 +1,109 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestSmallVector.hpp"
+#include "p1/adt/SmallVector.hpp"
+#include <string>
+#include <memory>
+#include <algorithm>
+
+using namespace p1;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestSmallVector );
+
+TestSmallVector::TestSmallVector ( )
+{
+}
+
+TestSmallVector::~TestSmallVector ( )
+{
+}
+
+void TestSmallVector::setUp ( )
+{
+}
+
+void TestSmallVector::tearDown ( )
+{
+}
+
+void TestSmallVector::testGrow ( )
+{
+  SmallVector<int, 3> v;
+  CPPUNIT_ASSERT( v.empty() && v.isSmall() );
+  CPPUNIT_ASSERT_EQUAL( (size_t)3, v.capacity() );
+
+  v.push_back( 0 );
+  v += 1;
+  v += 2;
+  CPPUNIT_ASSERT( v.isSmall() );
+
+  // Pushing one of its own elements while moving out of the inline space
+  v.push_back( v[0] );
+  CPPUNIT_ASSERT( !v.isSmall() );
+  CPPUNIT_ASSERT_EQUAL( (size_t)4, v.size() );
+  CPPUNIT_ASSERT_EQUAL( 0, v.back() );
+
+  for ( int i = 4; i < 1000; ++i )
+    v.push_back( i );
+  CPPUNIT_ASSERT_EQUAL( (size_t)1000, v.size() );
+  for ( int i = 4; i < 1000; ++i )
+    CPPUNIT_ASSERT_EQUAL( i, v[i] );
+
+  v.pop_back();
+  CPPUNIT_ASSERT_EQUAL( 998, v.back() );
+
+  size_t const capacity = v.capacity();
+  v.clear();
+  CPPUNIT_ASSERT( v.empty() );
+  CPPUNIT_ASSERT_EQUAL( capacity, v.capacity() );
+}
+
+void TestSmallVector::testCopy ( )
+{
+  int const data[] = { 1, 2, 3, 4, 5 };
+  SmallVector<int, 2> big( data, data + 5 );
+  SmallVector<int, 2> small( data, data + 1 );
+  CPPUNIT_ASSERT( !big.isSmall() && small.isSmall() );
+
+  SmallVector<int, 2> copy( big );
+  CPPUNIT_ASSERT_EQUAL( (size_t)5, copy.size() );
+  CPPUNIT_ASSERT( copy.begin() != big.begin() );
+  CPPUNIT_ASSERT( std::equal( copy.begin(), copy.end(), data ) );
+
+  copy = small;
+  CPPUNIT_ASSERT_EQUAL( (size_t)1, copy.size() );
+  CPPUNIT_ASSERT_EQUAL( 1, copy.front() );
+
+  copy = copy;
+  CPPUNIT_ASSERT_EQUAL( (size_t)1, copy.size() );
+}
+
+void TestSmallVector::testObjects ( )
+{
+  SmallVector<std::string, 2, std::allocator<std::string> > v;
+  for ( unsigned i = 0; i < 100; ++i )
+    v.push_back( std::string( i, 'a' ) );
+  for ( unsigned i = 0; i < 100; ++i )
+    CPPUNIT_ASSERT( v[i] == std::string( i, 'a' ) );
+
+  const SmallVector<std::string, 2, std::allocator<std::string> > & cv = v;
+  size_t total = 0;
+  for ( SmallVector<std::string, 2, std::allocator<std::string> >::const_iterator it = cv.begin();
+        it != cv.end(); ++it )
+    total += it->size();
+  CPPUNIT_ASSERT_EQUAL( (size_t)(99 * 100 / 2), total );
+}
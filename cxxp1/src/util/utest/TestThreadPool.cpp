@@ -0,0 +1,126 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "TestThreadPool.hpp"
+#include "ThreadPool.hpp"
+#include <vector>
+#include <unistd.h>
+
+using namespace p1;
+
+CPPUNIT_TEST_SUITE_REGISTRATION ( TestThreadPool );
+
+TestThreadPool::TestThreadPool ( )
+{
+}
+
+TestThreadPool::~TestThreadPool ( )
+{
+}
+
+void TestThreadPool::setUp ( )
+{
+}
+
+void TestThreadPool::tearDown ( )
+{
+}
+
+namespace
+{
+;
+
+/** Counts itself and submits "fanout" children, down to "depth" levels */
+class TreeTask : public ThreadPool::Task
+{
+public:
+  ThreadPool & pool;
+  volatile unsigned & counter;
+  unsigned depth, fanout;
+  useconds_t sleep;
+  int worker; //< the worker which ran the task
+  std::vector<TreeTask *> children;
+
+  TreeTask ( ThreadPool & pool_, volatile unsigned & counter_, unsigned depth_, unsigned fanout_,
+             useconds_t sleep_ = 0 )
+    : pool( pool_ ), counter( counter_ ), depth( depth_ ), fanout( fanout_ ), sleep( sleep_ ), worker( -1 )
+  {}
+
+  ~TreeTask ()
+  {
+    for ( size_t i = 0; i != children.size(); ++i )
+      delete children[i];
+  }
+
+  virtual void run ()
+  {
+    worker = pool.currentWorker();
+    __sync_fetch_and_add( &counter, 1 );
+    if (sleep)
+      ::usleep( sleep );
+    if (depth)
+      for ( unsigned i = 0; i != fanout; ++i )
+      {
+        children.push_back( new TreeTask( pool, counter, depth - 1, fanout, sleep ) );
+        pool.submit( children.back() );
+      }
+  }
+};
+
+};
+
+void TestThreadPool::testTasks ( )
+{
+  ThreadPool pool( 4 );
+  CPPUNIT_ASSERT_EQUAL( 4u, pool.size() );
+  CPPUNIT_ASSERT_EQUAL( -1, pool.currentWorker() );
+
+  volatile unsigned counter = 0;
+  std::vector<TreeTask *> roots;
+  for ( unsigned i = 0; i != 10; ++i )
+  {
+    roots.push_back( new TreeTask( pool, counter, 3, 4 ) );
+    pool.submit( roots.back() );
+  }
+  pool.wait();
+  // 10 * (1 + 4 + 16 + 64)
+  CPPUNIT_ASSERT_EQUAL( 850u, (unsigned)counter );
+  CPPUNIT_ASSERT_EQUAL( 850ul, pool.stats().executed );
+  CPPUNIT_ASSERT( roots[0]->worker >= 0 && roots[0]->worker < 4 );
+
+  // The pool can be reused after waiting
+  TreeTask * again = new TreeTask( pool, counter, 0, 0 );
+  pool.submit( again );
+  pool.wait();
+  CPPUNIT_ASSERT_EQUAL( 851u, (unsigned)counter );
+
+  delete again;
+  for ( size_t i = 0; i != roots.size(); ++i )
+    delete roots[i];
+}
+
+void TestThreadPool::testStealing ( )
+{
+  ThreadPool pool( 4 );
+  volatile unsigned counter = 0;
+
+  // All children are queued on the worker running the root, which is busy sleeping
+  TreeTask root( pool, counter, 1, 32, 1000 );
+  pool.submit( &root );
+  pool.wait();
+  CPPUNIT_ASSERT_EQUAL( 33u, (unsigned)counter );
+  CPPUNIT_ASSERT( pool.stats().stolen > 0 );
+}
@@ -0,0 +1,42 @@
+/*
+   Copyright 2012 Tzvetan Mikov <tmikov@gmail.com>
+   All rights reserved.
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+
+
+#ifndef TESTTHREADPOOL_HPP
+#define	TESTTHREADPOOL_HPP
+
+#include <cppunit/extensions/HelperMacros.h>
+
+class TestThreadPool : public CPPUNIT_NS::TestFixture {
+  CPPUNIT_TEST_SUITE(TestThreadPool);
+  CPPUNIT_TEST(testTasks);
+  CPPUNIT_TEST(testStealing);
+  CPPUNIT_TEST_SUITE_END();
+
+public:
+  TestThreadPool();
+  virtual ~TestThreadPool();
+  void setUp();
+  void tearDown();
+
+private:
+  void testTasks();
+  void testStealing();
+};
+
+#endif	/* TESTTHREADPOOL_HPP */
+
@@ -0,0 +1,39 @@
+(define-macro my-or
+  (syntax-rules ()
+    ((_) #f)
+    ((_ e) e)
+    ((_ e r ...) (let ((t e)) (if t t (my-or r ...))))))
+
+(define-macro swap!
+  (syntax-rules ()
+    ((_ a b) (let ((tmp a)) (set! a b) (set! b tmp)))))
+
+(define-macro my-let*
+  (syntax-rules ()
+    ((_ () body ...) (let ((x 0)) body ...))
+    ((_ ((n v) rest ...) body ...) (let ((n v)) (my-let* (rest ...) body ...)))))
+
+(define t 5)
+(define tmp 1)
+(define y 2)
+(swap! tmp y)
+(display tmp)
+(display y)
+(display (my-or #f t))
+(display (my-let* ((a 1) (b (+ a 1))) (* a b)))
+
+(define-macro double
+  (syntax-rules ()
+    ((_ e) (* e 2))))
+
+(define-macro let-double
+  (syntax-rules ()
+    ((_ x) (let ((t x)) (double t)))))
+
+(define-macro define-inc
+  (syntax-rules ()
+    ((_ name) (define-macro name (syntax-rules () ((_ x) (+ x 1)))))))
+
+(define-inc inc)
+(display (let-double 4))
+(display (inc t))